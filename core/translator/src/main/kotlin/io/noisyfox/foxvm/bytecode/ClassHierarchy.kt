@@ -0,0 +1,153 @@
+package io.noisyfox.foxvm.bytecode
+
+import io.noisyfox.foxvm.bytecode.clazz.ClassInfo
+import io.noisyfox.foxvm.bytecode.clazz.Clazz
+import io.noisyfox.foxvm.bytecode.clazz.MethodInfo
+import io.noisyfox.foxvm.bytecode.visitor.ClassHandler
+import java.util.ArrayDeque
+
+/**
+ * Subtype relationship of all classes in a [ClassPool], used for class hierarchy analysis.
+ *
+ * The relationship is read from the class files directly, so it also covers classes that are not
+ * pre-resolved. Those classes are ignored when looking for method implementations, and any result
+ * that depends on them is treated as unknown.
+ *
+ * @property isClosedWorld whether the class pool contains every class that could ever be loaded,
+ * in which case a method that is not overridden by any known class can be called directly.
+ */
+class ClassHierarchy private constructor(
+    val isClosedWorld: Boolean,
+    /** Classes and interfaces that directly extend or implement each type, keyed by the type name */
+    private val subtypes: Map<String, List<Clazz>>
+) {
+
+    /** All subtypes of the given class or interface, including indirect ones, each listed once. */
+    fun allSubtypes(info: ClassInfo): List<Clazz> {
+        val visited = mutableSetOf(info.thisClass.className)
+        val result = mutableListOf<Clazz>()
+        val pending = ArrayDeque<Clazz>(subtypes[info.thisClass.className].orEmpty())
+        while (pending.isNotEmpty()) {
+            val c = pending.removeFirst()
+            if (visited.add(c.className)) {
+                result.add(c)
+                pending.addAll(subtypes[c.className].orEmpty())
+            }
+        }
+
+        return result
+    }
+
+    /**
+     * Find all distinct implementations that are reachable from the given vtable slot of [owner],
+     * by looking at the same slot of [owner] and all its pre-resolved non-abstract subclasses.
+     */
+    fun vtableTargets(owner: ClassInfo, vtableIndex: Int): List<MethodInfo> {
+        val targets = mutableListOf<MethodInfo>()
+
+        (sequenceOf(owner) + allSubtypes(owner).asSequence().mapNotNull { it.classInfo })
+            .filterNot { it.isAbstract || it.isInterface }
+            .forEach {
+                val m = it.vtable[vtableIndex]
+                if (!m.isAbstract && targets.none { t -> t === m }) {
+                    targets.add(m)
+                }
+            }
+
+        return targets
+    }
+
+    /**
+     * Find the only implementation that the given vtable slot of [owner] could ever dispatch to,
+     * or `null` if it can't be proved.
+     */
+    fun uniqueVtableTarget(owner: ClassInfo, vtableIndex: Int): MethodInfo? {
+        val m = owner.vtable[vtableIndex]
+
+        // Final methods and methods of final classes can never be overridden
+        if (!m.isAbstract && (m.isFinal || owner.isFinal)) {
+            return m
+        }
+
+        // Effectively final: not overridden by any class in the program.
+        // Arrays are implicit subclasses of java/lang/Object which are not in the class pool.
+        if (!isClosedWorld || owner.thisClass.className == Clazz.CLASS_JAVA_LANG_OBJECT) {
+            return null
+        }
+        if (!allSubtypes(owner).all { it.classInfo != null }) {
+            return null
+        }
+
+        return vtableTargets(owner, vtableIndex).singleOrNull()
+    }
+
+    /**
+     * Find the only implementation that the given interface method could ever dispatch to,
+     * or `null` if it can't be proved. Same as the runtime, the implementation must be public.
+     */
+    fun uniqueInterfaceTarget(interfaceMethod: MethodInfo): MethodInfo? {
+        if (!isClosedWorld) {
+            return null
+        }
+
+        val itf = interfaceMethod.declaringClass
+        val implementors = allSubtypes(itf)
+        if (!implementors.all { it.classInfo != null }) {
+            return null
+        }
+
+        val methodIndex = itf.methods.indexOf(interfaceMethod)
+        var target: MethodInfo? = null
+        implementors.forEach {
+            val info = it.requireClassInfo()
+            if (info.isAbstract || info.isInterface) {
+                return@forEach
+            }
+
+            // Any receiver that ends up with AbstractMethodError / IllegalAccessError needs the runtime lookup
+            val m = interfaceTarget(info, itf, methodIndex) ?: return null
+            if (m.isAbstract || !m.isPublic) {
+                return null
+            }
+            if (target != null && target !== m) {
+                return null
+            }
+            target = m
+        }
+
+        return target
+    }
+
+    /**
+     * Same as `bc_ivtable_lookup()` in .\native\runtime\vm_bytecode.c: search the ivtable of [receiver] and its
+     * superclasses, and fall back to the default method of the interface.
+     */
+    private fun interfaceTarget(receiver: ClassInfo, itf: ClassInfo, methodIndex: Int): MethodInfo? {
+        var c: ClassInfo? = receiver
+        while (c != null) {
+            c.ivtable.firstOrNull { it.declaringInterface === itf }?.let { item ->
+                item.methodIndexes.firstOrNull { it.methodIndex == methodIndex }?.let {
+                    return receiver.vtable[it.vtableIndex]
+                }
+            }
+            c = c.superClass?.requireClassInfo()
+        }
+
+        return itf.methods[methodIndex].takeUnless { it.isAbstract }
+    }
+
+    companion object {
+        fun build(classPool: ClassPool, isClosedWorld: Boolean): ClassHierarchy {
+            val subtypes = mutableMapOf<String, MutableList<Clazz>>()
+
+            classPool.accept(object : ClassHandler {
+                override fun handleAnyClass(clazz: Clazz) {
+                    clazz.superName?.let { subtypes.getOrPut(it) { mutableListOf() }.add(clazz) }
+                    clazz.interfaces.forEach { subtypes.getOrPut(it) { mutableListOf() }.add(clazz) }
+                }
+            })
+
+            return ClassHierarchy(isClosedWorld, subtypes)
+        }
+    }
+}
@@ -28,6 +28,8 @@ data class ClassInfo(
 
     val isAbstract: Boolean = (thisClass.access and Opcodes.ACC_ABSTRACT) == Opcodes.ACC_ABSTRACT
 
+    val isFinal: Boolean = (thisClass.access and Opcodes.ACC_FINAL) == Opcodes.ACC_FINAL
+
     val isInterface: Boolean = (thisClass.access and Opcodes.ACC_INTERFACE) == Opcodes.ACC_INTERFACE
 
     val packageName: String = thisClass.className.split('/').dropLast(1).joinToString(separator = ".")
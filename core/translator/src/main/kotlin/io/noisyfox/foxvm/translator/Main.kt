@@ -57,8 +57,17 @@ object TranslatorCommand : Callable<Int> {
     )
     lateinit var outputPath: File
 
+    @CommandLine.Option(
+        names = ["--promote-locals"],
+        description = [
+            "Keep primitive locals and operand stack values in C variables instead of the stack slots when possible."
+        ],
+        required = false
+    )
+    var promoteLocals: Boolean = false
+
     override fun call(): Int {
-        Translator(exclusive.isRt,exclusive.runtimeClasspath ?: emptyArray(), inClasspath, outputPath).execute()
+        Translator(exclusive.isRt,exclusive.runtimeClasspath ?: emptyArray(), inClasspath, outputPath, promoteLocals).execute()
 
         return 0
     }
@@ -1,5 +1,6 @@
 package io.noisyfox.foxvm.translator
 
+import io.noisyfox.foxvm.bytecode.ClassHierarchy
 import io.noisyfox.foxvm.bytecode.ClassPool
 import io.noisyfox.foxvm.bytecode.CombinedClassPool
 import io.noisyfox.foxvm.bytecode.SimpleClassPool
@@ -19,7 +20,8 @@ class Translator(
     private val isRt: Boolean,
     private val runtimeClasspath: Array<File>,
     private val inClasspath: Array<File>,
-    private val outputPath: File
+    private val outputPath: File,
+    private val promoteLocals: Boolean
 ) {
 
     private val runtimeClassPool: ClassPool = SimpleClassPool()
@@ -76,7 +78,15 @@ class Translator(
      */
     private fun writeClasses() {
         // Write each classes
-        ClassWriter(isRt = isRt, classPool = fullClassPool, constantPool = constantPool, outputDir = outputPath).also {
+        ClassWriter(
+            isRt = isRt,
+            classPool = fullClassPool,
+            // Application is compiled with all classes it could use, while runtime can be extended by any application
+            classHierarchy = ClassHierarchy.build(fullClassPool, isClosedWorld = !isRt),
+            constantPool = constantPool,
+            outputDir = outputPath,
+            promoteLocals = promoteLocals
+        ).also {
             applicationClassPool.accept(it)
 
             if (it.updatedClassNumber == 0) {
@@ -89,6 +99,8 @@ class Translator(
                     it.updatedClassNumber
                 )
             }
+            LOGGER.info("{} virtual call(s) devirtualized.", it.devirtualizedCallNumber)
+            LOGGER.info("{} null / bounds check(s) eliminated.", it.uncheckedAccessNumber)
         }
 
         // Write files contain ref to all classes
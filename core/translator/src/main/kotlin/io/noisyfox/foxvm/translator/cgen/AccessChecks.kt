@@ -0,0 +1,373 @@
+package io.noisyfox.foxvm.translator.cgen
+
+import io.noisyfox.foxvm.bytecode.clazz.MethodInfo
+import org.objectweb.asm.Opcodes
+import org.objectweb.asm.Type
+import org.objectweb.asm.tree.AbstractInsnNode
+import org.objectweb.asm.tree.IincInsnNode
+import org.objectweb.asm.tree.InsnList
+import org.objectweb.asm.tree.IntInsnNode
+import org.objectweb.asm.tree.JumpInsnNode
+import org.objectweb.asm.tree.LabelNode
+import org.objectweb.asm.tree.LdcInsnNode
+import org.objectweb.asm.tree.LookupSwitchInsnNode
+import org.objectweb.asm.tree.TableSwitchInsnNode
+import org.objectweb.asm.tree.VarInsnNode
+import org.objectweb.asm.tree.analysis.Analyzer
+import org.objectweb.asm.tree.analysis.AnalyzerException
+import org.objectweb.asm.tree.analysis.Frame
+import org.objectweb.asm.tree.analysis.SourceInterpreter
+import org.objectweb.asm.tree.analysis.SourceValue
+import org.slf4j.LoggerFactory
+
+/**
+ * Field and array instructions of a method that are proved to never throw, computed from the ASM frame analysis.
+ *
+ * The origins of each value are found by following the copies through local variables and `dup`s.
+ * A field access needs no null check if the receiver can only be `this` (and local 0 is never
+ * overwritten), a newly allocated object or a constant.
+ *
+ * An array load / store needs neither null check nor bounds check if:
+ * - the array can only be a newly allocated array with a constant length and the index is a constant
+ *   within that length, which covers array initializers; or
+ * - it's `a[i]` inside the loop that javac generates for iterating an array:
+ *   ```
+ *       ICONST_0 (or any non-negative constant)
+ *       ISTORE i
+ *   H:  ILOAD i
+ *       ALOAD a
+ *       ARRAYLENGTH
+ *       IF_ICMPGE X
+ *       ... a[i] ...
+ *       IINC i 1
+ *       GOTO H
+ *   X:
+ *   ```
+ *   where neither `i` nor `a` is written inside the loop, and the loop body can only be entered from
+ *   the loop condition.
+ *
+ * Every other check is kept and done by the runtime.
+ */
+class AccessChecks private constructor(
+    private val method: MethodInfo,
+    /** Indexes of the field and array instructions that don't need any check */
+    private val unchecked: Set<Int>
+) {
+
+    val size: Int
+        get() = unchecked.size
+
+    val isEmpty: Boolean
+        get() = unchecked.isEmpty()
+
+    /** Check if the null check and bounds check of the given instruction can be skipped. */
+    fun isUnchecked(inst: AbstractInsnNode): Boolean {
+        return method.methodNode.instructions.indexOf(inst) in unchecked
+    }
+
+    private class Analysis(
+        private val method: MethodInfo,
+        private val frames: Array<Frame<SourceValue>?>
+    ) {
+        private val instructions: InsnList = method.methodNode.instructions
+
+        /** Number of local slots that hold the arguments (including `this`) when the method is entered */
+        private val argumentSlots = (Type.getArgumentsAndReturnSizes(method.descriptor.descriptor) shr 2) -
+            (if (method.isStatic) 1 else 0)
+
+        /** Local slots that are written anywhere in the method */
+        private val writtenLocals: Set<Int> = instructions.asSequence().mapNotNull {
+            when (it) {
+                is VarInsnNode -> it.`var`.takeIf { _ -> it.opcode in Opcodes.ISTORE..Opcodes.ASTORE }
+                is IincInsnNode -> it.`var`
+                else -> null
+            }
+        }.toSet()
+
+        private fun frameOf(inst: AbstractInsnNode): Frame<SourceValue>? = frames[instructions.indexOf(inst)]
+
+        private fun Frame<SourceValue>.stackFromTop(i: Int): SourceValue = getStack(stackSize - 1 - i)
+
+        private fun isThis(inst: AbstractInsnNode): Boolean =
+            inst.opcode == Opcodes.ALOAD && (inst as VarInsnNode).`var` == 0 && !method.isStatic && 0 !in writtenLocals
+
+        /**
+         * Find the instructions that could have produced the given value, looking through the copies.
+         * Return `null` if the value might come from an argument.
+         */
+        fun origins(value: SourceValue): Set<AbstractInsnNode>? {
+            val result = mutableSetOf<AbstractInsnNode>()
+            val visited = mutableSetOf<AbstractInsnNode>()
+            val pending = ArrayList<AbstractInsnNode>(value.insns)
+            while (pending.isNotEmpty()) {
+                val inst = pending.removeAt(pending.size - 1)
+                if (!visited.add(inst)) {
+                    continue
+                }
+
+                when (inst.opcode) {
+                    Opcodes.ILOAD, Opcodes.ALOAD -> {
+                        if (isThis(inst)) {
+                            result.add(inst)
+                            continue
+                        }
+                        val local = (inst as VarInsnNode).`var`
+                        // The initial value of an argument slot is lost once it's merged with other stores
+                        if (local < argumentSlots) {
+                            return null
+                        }
+                        val stores = frameOf(inst)?.getLocal(local)?.insns
+                        if (stores.isNullOrEmpty()) {
+                            return null
+                        }
+                        pending.addAll(stores)
+                    }
+                    Opcodes.ISTORE, Opcodes.ASTORE,
+                    Opcodes.DUP, Opcodes.DUP_X1, Opcodes.DUP_X2,
+                    Opcodes.CHECKCAST -> {
+                        val frame = frameOf(inst) ?: return null
+                        pending.addAll(frame.stackFromTop(0).insns)
+                    }
+                    else -> result.add(inst)
+                }
+            }
+
+            return result
+        }
+
+        fun isNonNull(value: SourceValue): Boolean {
+            val o = origins(value) ?: return false
+            return o.isNotEmpty() && o.all {
+                when (it.opcode) {
+                    Opcodes.NEW,
+                    Opcodes.NEWARRAY,
+                    Opcodes.ANEWARRAY,
+                    Opcodes.MULTIANEWARRAY,
+                    Opcodes.LDC -> true
+                    else -> isThis(it)
+                }
+            }
+        }
+
+        private fun constantOf(inst: AbstractInsnNode): Int? = when (inst.opcode) {
+            in Opcodes.ICONST_M1..Opcodes.ICONST_5 -> inst.opcode - Opcodes.ICONST_0
+            Opcodes.BIPUSH, Opcodes.SIPUSH -> (inst as IntInsnNode).operand
+            Opcodes.LDC -> (inst as LdcInsnNode).cst as? Int
+            else -> null
+        }
+
+        /** The value of the given int if it's a constant. */
+        fun intConstant(value: SourceValue): Int? {
+            val o = origins(value)
+            if (o.isNullOrEmpty()) {
+                return null
+            }
+            val constants = o.map { constantOf(it) ?: return null }.distinct()
+            return constants.singleOrNull()
+        }
+
+        /** The smallest possible length of the given array, if it can only be a newly allocated array. */
+        fun arrayLength(value: SourceValue): Int? {
+            val o = origins(value)
+            if (o.isNullOrEmpty()) {
+                return null
+            }
+            return o.map {
+                if (it.opcode != Opcodes.NEWARRAY && it.opcode != Opcodes.ANEWARRAY) {
+                    return null
+                }
+                val frame = frameOf(it) ?: return null
+                intConstant(frame.stackFromTop(0)) ?: return null
+            }.min()
+        }
+
+        /** The smallest possible value of the given int, if it can only be one of the non-negative constants. */
+        private fun minConstant(values: Collection<AbstractInsnNode>): Int? {
+            return values.map {
+                if (it.opcode != Opcodes.ISTORE) {
+                    return null
+                }
+                val frame = frameOf(it) ?: return null
+                val o = origins(frame.stackFromTop(0))
+                if (o.isNullOrEmpty()) {
+                    return null
+                }
+                o.map { c -> constantOf(c) ?: return null }.min() ?: return null
+            }.min()
+        }
+
+        private fun AbstractInsnNode.previousReal(): AbstractInsnNode? {
+            var p = previous
+            while (p != null && p.opcode < 0) {
+                p = p.previous
+            }
+            return p
+        }
+
+        private fun AbstractInsnNode.nextReal(): AbstractInsnNode? {
+            var n = next
+            while (n != null && n.opcode < 0) {
+                n = n.next
+            }
+            return n
+        }
+
+        private fun jumpTargets(inst: AbstractInsnNode): List<LabelNode> = when (inst) {
+            is JumpInsnNode -> listOf(inst.label)
+            is TableSwitchInsnNode -> inst.labels + inst.dflt
+            is LookupSwitchInsnNode -> inst.labels + inst.dflt
+            else -> emptyList()
+        }
+
+        /**
+         * Find the array loads / stores that are in range in the loop that is exited by the given `if_icmpge`.
+         */
+        fun loopAccesses(exit: JumpInsnNode): List<AbstractInsnNode> {
+            // Loop condition
+            val arrayLength = exit.previousReal()?.takeIf { it.opcode == Opcodes.ARRAYLENGTH } ?: return emptyList()
+            val arrayLoad = arrayLength.previousReal()?.takeIf { it.opcode == Opcodes.ALOAD } as VarInsnNode? ?: return emptyList()
+            val indexLoad = arrayLoad.previousReal()?.takeIf { it.opcode == Opcodes.ILOAD } as VarInsnNode? ?: return emptyList()
+            val array = arrayLoad.`var`
+            val index = indexLoad.`var`
+
+            // Loop back edge right before the exit
+            val back = exit.label.previousReal()?.takeIf { it.opcode == Opcodes.GOTO } as JumpInsnNode? ?: return emptyList()
+            val increment = back.previousReal() as? IincInsnNode ?: return emptyList()
+            if (increment.`var` != index || increment.incr != 1 || back.label.nextReal() !== indexLoad) {
+                return emptyList()
+            }
+
+            val conditionStart = instructions.indexOf(indexLoad)
+            val bodyStart = instructions.indexOf(exit)
+            val bodyEnd = instructions.indexOf(increment)
+            val loopEnd = instructions.indexOf(back)
+            if (bodyEnd <= bodyStart || instructions.indexOf(exit.label) <= loopEnd) {
+                return emptyList()
+            }
+
+            // Neither the index nor the array can be changed inside the loop
+            for (i in conditionStart..loopEnd) {
+                val inst = instructions[i]
+                if (inst === increment) {
+                    continue
+                }
+                val written = when (inst) {
+                    is VarInsnNode -> if (inst.opcode in Opcodes.ISTORE..Opcodes.ASTORE) {
+                        val size = if (inst.opcode == Opcodes.LSTORE || inst.opcode == Opcodes.DSTORE) 2 else 1
+                        inst.`var` until inst.`var` + size
+                    } else {
+                        IntRange.EMPTY
+                    }
+                    is IincInsnNode -> inst.`var`..inst.`var`
+                    else -> IntRange.EMPTY
+                }
+                if (index in written || array in written) {
+                    return emptyList()
+                }
+            }
+
+            // Loop body can only be entered from the loop condition
+            val loopRange = conditionStart..loopEnd
+            for (i in 0 until instructions.size()) {
+                jumpTargets(instructions[i]).forEach {
+                    val target = instructions.indexOf(it)
+                    if (target in (conditionStart + 1)..bodyStart) {
+                        return emptyList()
+                    }
+                    if (i !in loopRange && target in (bodyStart + 1)..loopEnd) {
+                        return emptyList()
+                    }
+                }
+            }
+            if (method.methodNode.tryCatchBlocks.any { instructions.indexOf(it.handler) in (conditionStart + 1)..loopEnd }) {
+                return emptyList()
+            }
+
+            // The index must start from a non-negative constant
+            if (index < argumentSlots) {
+                return emptyList()
+            }
+            val entryValues = frameOf(indexLoad)?.getLocal(index)?.insns ?: return emptyList()
+            val initialValue = minConstant(entryValues.filter { it !== increment }) ?: return emptyList()
+            if (initialValue < 0) {
+                return emptyList()
+            }
+
+            // Then every a[i] in the body is in range
+            return ((bodyStart + 1) until bodyEnd).map { instructions[it] }.filter {
+                val indexDepth = when (it.opcode) {
+                    in Opcodes.IALOAD..Opcodes.SALOAD -> 0
+                    in Opcodes.IASTORE..Opcodes.SASTORE -> if (it.opcode == Opcodes.AASTORE) return@filter false else 1
+                    else -> return@filter false
+                }
+                val frame = frameOf(it) ?: return@filter false
+                val i = frame.stackFromTop(indexDepth).insns.singleOrNull() as? VarInsnNode ?: return@filter false
+                val a = frame.stackFromTop(indexDepth + 1).insns.singleOrNull() as? VarInsnNode ?: return@filter false
+                i.opcode == Opcodes.ILOAD && i.`var` == index && instructions.indexOf(i) in bodyStart..bodyEnd &&
+                    a.opcode == Opcodes.ALOAD && a.`var` == array && instructions.indexOf(a) in bodyStart..bodyEnd
+            }
+        }
+    }
+
+    companion object {
+        private val LOGGER = LoggerFactory.getLogger(AccessChecks::class.java)!!
+
+        /**
+         * Analyze the given method, or return `null` if the frames of the method can not be computed
+         * or the method contains subroutines, in which case all checks are kept.
+         */
+        fun analyze(method: MethodInfo): AccessChecks? {
+            if (!method.isConcrete) {
+                return null
+            }
+
+            val node = method.methodNode
+            // `ret` jumps to any caller of the subroutine, which is not followed by the loop analysis
+            if (node.instructions.any { it.opcode == Opcodes.JSR }) {
+                return null
+            }
+
+            val frames = try {
+                Analyzer(SourceInterpreter()).analyze(method.declaringClass.thisClass.className, node)
+            } catch (e: AnalyzerException) {
+                LOGGER.warn("Unable to analyze access checks of method {}.{}{}", method.declaringClass.thisClass.className, method.name, method.descriptor, e)
+                return null
+            }
+
+            val analysis = Analysis(method, frames)
+            val unchecked = mutableSetOf<Int>()
+            node.instructions.forEachIndexed { index, inst ->
+                // Unreachable code does not have a frame
+                val frame = frames[index] ?: return@forEachIndexed
+                when (inst.opcode) {
+                    Opcodes.GETFIELD -> if (analysis.isNonNull(frame.getStack(frame.stackSize - 1))) {
+                        unchecked.add(index)
+                    }
+                    Opcodes.PUTFIELD -> if (analysis.isNonNull(frame.getStack(frame.stackSize - 2))) {
+                        unchecked.add(index)
+                    }
+                    in Opcodes.IALOAD..Opcodes.SALOAD,
+                    in Opcodes.IASTORE..Opcodes.SASTORE -> {
+                        // aastore always needs the type check of the value
+                        if (inst.opcode == Opcodes.AASTORE) {
+                            return@forEachIndexed
+                        }
+                        val indexDepth = if (inst.opcode <= Opcodes.SALOAD) 1 else 2
+                        val length = analysis.arrayLength(frame.getStack(frame.stackSize - indexDepth - 1))
+                            ?: return@forEachIndexed
+                        val i = analysis.intConstant(frame.getStack(frame.stackSize - indexDepth))
+                            ?: return@forEachIndexed
+                        if (i in 0 until length) {
+                            unchecked.add(index)
+                        }
+                    }
+                    Opcodes.IF_ICMPGE -> analysis.loopAccesses(inst as JumpInsnNode).forEach {
+                        unchecked.add(node.instructions.indexOf(it))
+                    }
+                }
+            }
+
+            return AccessChecks(method, unchecked)
+        }
+    }
+}
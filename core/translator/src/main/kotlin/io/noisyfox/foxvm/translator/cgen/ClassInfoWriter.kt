@@ -1,12 +1,17 @@
 package io.noisyfox.foxvm.translator.cgen
 
+import io.noisyfox.foxvm.bytecode.clazz.ClassInfo
 import io.noisyfox.foxvm.bytecode.clazz.Clazz
+import io.noisyfox.foxvm.bytecode.toModifiedUtf8
 import io.noisyfox.foxvm.bytecode.visitor.ClassPoolVisitor
 import io.noisyfox.foxvm.translator.DiffFileWriter
 import java.io.File
 
 /**
  * Generate header and C file that contains decl of all application class infos.
+ *
+ * The class infos are ordered by a [PerfectHashTable] of the class names, so the runtime can
+ * find a class by name in constant time.
  */
 class ClassInfoWriter(
     private val isRt: Boolean,
@@ -14,6 +19,7 @@ class ClassInfoWriter(
 ) : ClassPoolVisitor {
     private val headerWriter = DiffFileWriter(File(outputDir, headerNameOf(isRt))).buffered()
     private val cWriter = DiffFileWriter(File(outputDir, cNameOf(isRt))).buffered()
+    private val classInfos = mutableListOf<ClassInfo>()
 
     override fun visitStart() {
         headerWriter.write(
@@ -24,17 +30,12 @@ class ClassInfoWriter(
                     |#include "vm_base.h"
                     |
                     |extern JavaClassInfo* ${classInfosNameOf(isRt)}[];
+                    |extern const uint32_t ${classInfosNameOf(isRt)}_count;
+                    |extern const int32_t ${classInfosNameOf(isRt)}_seeds[];
+                    |extern const uint64_t ${classInfosNameOf(isRt)}_hashes[];
                     |
                     |""".trimMargin()
         )
-
-        cWriter.write(
-            """
-                    |#include "${headerNameOf(isRt)}"
-                    |
-                    |JavaClassInfo* ${classInfosNameOf(isRt)}[] = {
-                    |""".trimMargin()
-        )
     }
 
     override fun handleApplicationClass(clazz: Clazz) {
@@ -45,11 +46,7 @@ class ClassInfoWriter(
                     |""".trimMargin()
         )
 
-        cWriter.write(
-            """
-                    |    &${info.cName},
-                    |""".trimMargin()
-        )
+        classInfos.add(info)
     }
 
     override fun visitEnd() {
@@ -61,9 +58,30 @@ class ClassInfoWriter(
         )
         headerWriter.close()
 
+        val table = PerfectHashTable.build(classInfos) { it.thisClass.className.toModifiedUtf8() }
+        // C does not allow empty arrays
+        val seeds = table.seeds.takeIf { it.isNotEmpty() }?.toList()?.chunked(16)?.joinToString(",\n    ") { it.joinToString(", ") } ?: "0"
+        val hashes = table.hashes.takeIf { it.isNotEmpty() }?.toList()?.chunked(4)?.joinToString(",\n    ") { line ->
+            line.joinToString(", ") { "UINT64_C(0x%016x)".format(it) }
+        } ?: "0"
+
         cWriter.write(
             """
-                    |    NULL
+                    |#include "${headerNameOf(isRt)}"
+                    |
+                    |// Ordered by the perfect hash of class names
+                    |JavaClassInfo* ${classInfosNameOf(isRt)}[] = {
+                    |${table.keys.joinToString("") { "    &${it.cName},\n" }}    NULL
+                    |};
+                    |
+                    |const uint32_t ${classInfosNameOf(isRt)}_count = ${table.size};
+                    |
+                    |const int32_t ${classInfosNameOf(isRt)}_seeds[] = {
+                    |    $seeds
+                    |};
+                    |
+                    |const uint64_t ${classInfosNameOf(isRt)}_hashes[] = {
+                    |    $hashes
                     |};
                     |""".trimMargin()
         )
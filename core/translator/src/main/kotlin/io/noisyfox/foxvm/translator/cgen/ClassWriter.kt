@@ -1,5 +1,6 @@
 package io.noisyfox.foxvm.translator.cgen
 
+import io.noisyfox.foxvm.bytecode.ClassHierarchy
 import io.noisyfox.foxvm.bytecode.ClassPool
 import io.noisyfox.foxvm.bytecode.asCString
 import io.noisyfox.foxvm.bytecode.clazz.ClassInfo
@@ -26,6 +27,7 @@ import org.objectweb.asm.tree.VarInsnNode
 import org.slf4j.LoggerFactory
 import java.io.File
 import java.io.Writer
+import java.util.IdentityHashMap
 
 /**
  * Must be synced with .\native\runtime\include\vm_base.h
@@ -33,8 +35,10 @@ import java.io.Writer
 class ClassWriter(
     private val isRt: Boolean,
     private val classPool: ClassPool,
+    private val classHierarchy: ClassHierarchy,
     private val constantPool: StringConstantPool,
-    private val outputDir: File
+    private val outputDir: File,
+    private val promoteLocals: Boolean = false
 ) : ClassHandler {
 
     var processedClassNumber: Int = 0
@@ -49,6 +53,18 @@ class ClassWriter(
     var processedInstructionNumber: Long = 0
         private set
 
+    var devirtualizedCallNumber: Long = 0
+        private set
+
+    var uncheckedAccessNumber: Long = 0
+        private set
+
+    /**
+     * GC stack maps of the methods of the class currently being written. Keyed by identity since
+     * [MethodInfo] and [ClassInfo] reference each other and can't be hashed by value.
+     */
+    private val stackMaps = IdentityHashMap<MethodInfo, StackMaps>()
+
     override fun handleApplicationClass(clazz: Clazz) {
         processedClassNumber++
 
@@ -353,6 +369,7 @@ class ClassWriter(
                     |""".trimMargin()
             )
 
+            stackMaps.clear()
             info.methods.forEach {
                 val codeRef = if (it.isAbstract) {
                     CNull
@@ -378,6 +395,14 @@ class ClassWriter(
                     |""".trimMargin()
                     )
                 } else {
+                    val methodStackMaps = StackMaps.analyze(it)?.takeUnless { m -> m.isEmpty }
+                    methodStackMaps?.let { m ->
+                        stackMaps[it] = m
+                        m.write(cWriter)
+                    }
+                    val stackMapCount = methodStackMaps?.size ?: 0
+                    val stackMapRef = if (methodStackMaps == null) CNull else it.cNameStackMaps
+
                     cWriter.write(
                         """
                     |static MethodInfo ${it.cName} = {
@@ -387,6 +412,8 @@ class ClassWriter(
                     |        .signature = ${it.signature.constantID()}, // ${it.signature.toCString()}
                     |        .declaringClass = &${info.cName},
                     |        .code = $codeRef,
+                    |        .stackMapCount = $stackMapCount,
+                    |        .stackMaps = $stackMapRef,
                     |};
                     |""".trimMargin()
                     )
@@ -477,6 +504,32 @@ class ClassWriter(
             )
         }
 
+        // Write reference field blocks
+        val referenceBlocks = info.referenceFieldBlocks
+        if (referenceBlocks.isNotEmpty()) {
+            cWriter.write(
+                """
+                    |// Reference field blocks of the instance, used by GC for tracing references
+                    |static ReferenceFieldBlock ${info.cNameReferenceBlocks}[] = {
+                    |""".trimMargin()
+            )
+
+            referenceBlocks.forEach {
+                cWriter.write(
+                    """
+                    |    {.offset = offsetof(${info.cObjectName}, ${it.first().cName}), .count = ${it.size}},
+                    |""".trimMargin()
+                )
+            }
+
+            cWriter.write(
+                """
+                    |};
+                    |
+                    |""".trimMargin()
+            )
+        }
+
         // Write vtable
         if (info.vtable.isNotEmpty()) {
             cWriter.write(
@@ -614,6 +667,9 @@ class ClassWriter(
                     |    .preResolvedInstanceFieldCount = ${info.preResolvedInstanceFields.size},
                     |    .preResolvedInstanceFields = ${info.cNameInstanceFields},
                     |
+                    |    .referenceBlockCount = ${referenceBlocks.size},
+                    |    .referenceBlocks = ${info.cNameReferenceBlocks},
+                    |
                     |    .vtableCount = ${info.vtable.size},
                     |    .vtable = ${info.cNameVTable},
                     |
@@ -780,70 +836,31 @@ class ClassWriter(
                     |""".trimMargin()
             )
         }
+        writeSynchronizedEnter(cWriter, method)
 
-        // Define exception handlers
-        if (node.tryCatchBlocks.isNotEmpty()) {
-            cWriter.write(
-                """
-                    |
-                    |    exception_frame_start();
-                    |""".trimMargin()
-            )
+        // Keep primitive locals in C variables if possible
+        val promoter = if (promoteLocals) LocalPromoter.create(method) else null
+        promoter?.writeDeclarations(cWriter)
 
-            val throwableClass = requireNotNull(classPool.getClass("java/lang/Throwable")) {
-                "cannot find class java/lang/Throwable"
-            }.requireClassInfo()
+        val methodStackMaps = stackMaps[method]
+        // Null checks and bounds checks that are proved to be redundant
+        val accessChecks = AccessChecks.analyze(method)?.takeUnless { it.isEmpty }
+        uncheckedAccessNumber += accessChecks?.size ?: 0
 
-            node.tryCatchBlocks.forEach {
-                if(it.type == null) {
-                    cWriter.write(
-                        """
-                    |        exception_new_block(${it.start.index(method)}, ${it.end.index(method)}, ${it.handler.cName(method)}, $CNull);
-                    |""".trimMargin()
-                    )
-                } else {
-                    val exceptionClass = requireNotNull(classPool.getClass(it.type)) {
-                        "cannot find class ${it.type}"
-                    }.requireClassInfo()
-
-                    require(exceptionClass instanceOf throwableClass) {
-                        "class $exceptionClass is not a subclass of $throwableClass"
-                    }
-
-                    // Add the class as dependency
-                    cWriter.addDependency(exceptionClass)
+        node.instructions.forEach { inst ->
+            processedInstructionNumber++
 
-                    cWriter.write(
-                        """
-                    |        exception_new_block(${it.start.index(method)}, ${it.end.index(method)}, ${it.handler.cName(method)}, &${exceptionClass.cName});
-                    |""".trimMargin()
-                    )
-                }
+            if (promoter != null && promoter.write(cWriter, inst)) {
+                return@forEach
             }
 
-            cWriter.write(
-                """
-                    |        exception_not_handled();
-                    |    exception_block_end();
-                    |""".trimMargin()
-            )
-        } else if(method.isSynchronized) {
-            // Need an empty try for releasing the lock before exception is thrown up
-            cWriter.write(
-                """
-                    |
-                    |    // Empty exception frame for freeing the lock of synchronized method
-                    |    exception_frame_start();
-                    |        exception_not_handled();
-                    |    exception_block_end();
+            if (methodStackMaps != null && methodStackMaps.isGcPoint(inst)) {
+                cWriter.write(
+                    """
+                    |    bc_gc_point(${node.instructions.indexOf(inst)});
                     |""".trimMargin()
-            )
-        }
-
-        // TODO: write instructions
-
-        node.instructions.forEach { inst ->
-            processedInstructionNumber++
+                )
+            }
 
             when (inst) {
                 is LabelNode -> {
@@ -914,7 +931,11 @@ class ClassWriter(
                 is InsnNode -> {
                     when (inst.opcode) {
                         in byteCodesInstInst -> {
-                            val functionName = byteCodesInstInst[inst.opcode]
+                            val functionName = if (accessChecks != null && accessChecks.isUnchecked(inst)) {
+                                "${byteCodesInstInst[inst.opcode]}_unchecked"
+                            } else {
+                                byteCodesInstInst[inst.opcode]
+                            }
                             cWriter.write(
                                 """
                     |    ${functionName}();
@@ -1111,10 +1132,11 @@ class ClassWriter(
                             cWriter.addDependency(resolvedField.declaringClass)
                             // Get the pre-resolved info
                             val preResolved = resolvedField.declaringClass.preResolvedInstanceFields.single { it.field == resolvedField }
+                            val fieldCheck = if (accessChecks != null && accessChecks.isUnchecked(inst)) "_unchecked" else ""
                             cWriter.write(
                                 """
                     |    // getfield ${inst.owner}.${inst.name}:${inst.desc}
-                    |    bc_getfield${resolvedField.typeSuffix}(&${resolvedField.declaringClass.cName}, ${preResolved.fieldIndex}, ${resolvedField.declaringClass.cObjectName}, ${preResolved.cName});
+                    |    bc_getfield${fieldCheck}${resolvedField.typeSuffix}(&${resolvedField.declaringClass.cName}, ${preResolved.fieldIndex}, ${resolvedField.declaringClass.cObjectName}, ${preResolved.cName});
                     |""".trimMargin()
                             )
                         }
@@ -1139,10 +1161,11 @@ class ClassWriter(
                             cWriter.addDependency(resolvedField.declaringClass)
                             // Get the pre-resolved info
                             val preResolved = resolvedField.declaringClass.preResolvedInstanceFields.single { it.field == resolvedField }
+                            val fieldCheck = if (accessChecks != null && accessChecks.isUnchecked(inst)) "_unchecked" else ""
                             cWriter.write(
                                 """
                     |    // putfield ${inst.owner}.${inst.name}:${inst.desc}
-                    |    bc_putfield${resolvedField.typeSuffix}(&${resolvedField.declaringClass.cName}, ${preResolved.fieldIndex}, ${resolvedField.declaringClass.cObjectName}, ${preResolved.cName});
+                    |    bc_putfield${fieldCheck}${resolvedField.typeSuffix}(&${resolvedField.declaringClass.cName}, ${preResolved.fieldIndex}, ${resolvedField.declaringClass.cObjectName}, ${preResolved.cName});
                     |""".trimMargin()
                             )
                         }
@@ -1218,12 +1241,50 @@ class ClassWriter(
 
                                 val targetMethodArgumentCount = lookupMethod.descriptor.argumentTypes.size + 1 // implicitly passed this
                                 cWriter.addDependency(ownerClass)
-                                cWriter.write(
-                                    """
+
+                                val uniqueTarget = classHierarchy.uniqueVtableTarget(ownerClass, vtableIndex)
+                                val knownTargets = classHierarchy.vtableTargets(ownerClass, vtableIndex)
+                                if (uniqueTarget != null) {
+                                    // Only one implementation could be reached, call it directly
+                                    devirtualizedCallNumber++
+                                    cWriter.addDependency(uniqueTarget.declaringClass)
+                                    cWriter.write(
+                                        """
+                    |    // invokevirtual ${inst.owner}.${inst.name}${inst.desc} (devirtualized)
+                    |    bc_check_receiver_virtual($targetMethodArgumentCount, &${ownerClass.cName}, $vtableIndex);
+                    |    bc_invoke_special${lookupMethod.invokeSuffix}(${uniqueTarget.cFunctionName});
+                    |""".trimMargin()
+                                    )
+                                } else if (knownTargets.isEmpty() || knownTargets.size > INLINE_CACHE_TARGETS_MAX) {
+                                    // Megamorphic, go through the vtable
+                                    cWriter.write(
+                                        """
                     |    // invokevirtual ${inst.owner}.${inst.name}${inst.desc}
                     |    bc_invoke_virtual${lookupMethod.invokeSuffix}($targetMethodArgumentCount, &${ownerClass.cName}, $vtableIndex);
                     |""".trimMargin()
-                                )
+                                    )
+                                } else {
+                                    // Inline cache: call the known implementations directly, and only
+                                    // fall back to the vtable target for receivers we haven't seen
+                                    knownTargets.forEach { cWriter.addDependency(it.declaringClass) }
+                                    val cases = knownTargets.joinToString("") {
+                                        """if (icTarget == (void *) ${it.cFunctionName}) {
+                    |            bc_invoke_special${lookupMethod.invokeSuffix}(${it.cFunctionName});
+                    |        } else """
+                                    }
+                                    cWriter.write(
+                                        """
+                    |    // invokevirtual ${inst.owner}.${inst.name}${inst.desc}
+                    |    bc_check_receiver_virtual($targetMethodArgumentCount, &${ownerClass.cName}, $vtableIndex);
+                    |    {
+                    |        void *icTarget = bc_vtable_code($targetMethodArgumentCount, &${ownerClass.cName}, $vtableIndex);
+                    |        ${cases}{
+                    |            bc_invoke_special${lookupMethod.invokeSuffix}(icTarget);
+                    |        }
+                    |    }
+                    |""".trimMargin()
+                                    )
+                                }
                             }
                             Opcodes.INVOKESPECIAL -> {
                                 // if the resolved method is an instance initialization
@@ -1288,12 +1349,26 @@ class ClassWriter(
                                     val methodIndex = resolvedMethod.declaringClass.methods.indexOf(resolvedMethod)
                                     require(methodIndex >= 0)
                                     val targetMethodArgumentCount = resolvedMethod.descriptor.argumentTypes.size + 1 // implicitly passed this
-                                    cWriter.write(
-                                        """
+                                    val uniqueTarget = classHierarchy.uniqueInterfaceTarget(resolvedMethod)
+                                    if (uniqueTarget != null) {
+                                        // Only one implementation could be reached, call it directly
+                                        devirtualizedCallNumber++
+                                        cWriter.addDependency(uniqueTarget.declaringClass)
+                                        cWriter.write(
+                                            """
+                    |    // invokeinterface ${inst.owner}.${inst.name}${inst.desc} (devirtualized)
+                    |    bc_check_receiver_interface($targetMethodArgumentCount, &${resolvedMethod.declaringClass.cName}, $methodIndex);
+                    |    bc_invoke_special${resolvedMethod.invokeSuffix}(${uniqueTarget.cFunctionName});
+                    |""".trimMargin()
+                                        )
+                                    } else {
+                                        cWriter.write(
+                                            """
                     |    // invokeinterface ${inst.owner}.${inst.name}${inst.desc}
                     |    bc_invoke_interface${resolvedMethod.invokeSuffix}($targetMethodArgumentCount, &${resolvedMethod.declaringClass.cName}, $methodIndex);
                     |""".trimMargin()
-                                    )
+                                        )
+                                    }
                                 }
                             }
                             else -> throw IllegalArgumentException("Unexpected opcode ${inst.opcode}")
@@ -1401,6 +1476,70 @@ class ClassWriter(
                     |
                     |    assert(!"Unexpected reach of the end of the method");
                     |    exit(-2);
+                    |""".trimMargin()
+        )
+
+        writeExceptionDispatcher(cWriter, method)
+    }
+
+    /**
+     * Write the exception dispatcher at the end of the method, which is jumped to when an exception
+     * is pending, then close the method.
+     *
+     * Must be synced with the exception dispatching macros in .\native\runtime\include\vm_exception.h
+     */
+    private fun writeExceptionDispatcher(cWriter: CWriter, method: MethodInfo) {
+        cWriter.write(
+            """
+                    |
+                    |    // Exception dispatcher
+                    |    exception_dispatch_start();
+                    |""".trimMargin()
+        )
+
+        val tryCatchBlocks = if (method.isNative) emptyList() else method.methodNode.tryCatchBlocks
+        if (tryCatchBlocks.isNotEmpty()) {
+            val throwableClass = requireNotNull(classPool.getClass("java/lang/Throwable")) {
+                "cannot find class java/lang/Throwable"
+            }.requireClassInfo()
+
+            tryCatchBlocks.forEach {
+                if(it.type == null) {
+                    cWriter.write(
+                        """
+                    |    exception_new_block(${it.start.index(method)}, ${it.end.index(method)}, ${it.handler.cName(method)}, $CNull);
+                    |""".trimMargin()
+                    )
+                } else {
+                    val exceptionClass = requireNotNull(classPool.getClass(it.type)) {
+                        "cannot find class ${it.type}"
+                    }.requireClassInfo()
+
+                    require(exceptionClass instanceOf throwableClass) {
+                        "class $exceptionClass is not a subclass of $throwableClass"
+                    }
+
+                    // Add the class as dependency
+                    cWriter.addDependency(exceptionClass)
+
+                    cWriter.write(
+                        """
+                    |    exception_new_block(${it.start.index(method)}, ${it.end.index(method)}, ${it.handler.cName(method)}, &${exceptionClass.cName});
+                    |""".trimMargin()
+                    )
+                }
+            }
+        }
+
+        // Not handled by this method, return with the exception still pending
+        val notHandled = if (method.descriptor.returnType.sort == Type.VOID) {
+            "exception_not_handled()"
+        } else {
+            "exception_not_handled_r(0)"
+        }
+        cWriter.write(
+            """
+                    |    $notHandled;
                     |}
                     |
                     |""".trimMargin()
@@ -1470,6 +1609,23 @@ class ClassWriter(
         }
     }
 
+    /**
+     * jvms8 §2.11.10 Synchronization: the monitor of a synchronized method is entered on invocation,
+     * and exited by the return instructions or [writeExceptionDispatcher] if the method completes abruptly.
+     */
+    private fun writeSynchronizedEnter(cWriter: CWriter, method: MethodInfo) {
+        if (!method.isSynchronized) {
+            return
+        }
+
+        val enterStatement = if (method.isStatic) "bc_synchronized_enter_static()" else "bc_synchronized_enter()"
+        cWriter.write(
+            """
+                    |    $enterStatement;
+                    |""".trimMargin()
+        )
+    }
+
     private fun writeNativeMethodBridge(cWriter: CWriter, clazzInfo: ClassInfo, method: MethodInfo) {
         val clazz = clazzInfo.thisClass
         val jniMethod = JNIMethod(method)
@@ -1497,19 +1653,7 @@ class ClassWriter(
                     |""".trimMargin()
             )
         }
-
-        if(method.isSynchronized) {
-            // Need an empty try for releasing the lock before exception is thrown up
-            cWriter.write(
-                """
-                    |
-                    |    // Empty exception frame for freeing the lock of synchronized method
-                    |    exception_frame_start();
-                    |        exception_not_handled();
-                    |    exception_block_end();
-                    |""".trimMargin()
-            )
-        }
+        writeSynchronizedEnter(cWriter, method)
 
         // Resolve the function pointer to the native method
         cWriter.write(
@@ -1517,7 +1661,7 @@ class ClassWriter(
                 |
                 |    // Resolve the function ptr
                 |    ${jniMethod.functionPtrDecl("ptr")};
-                |    ptr = bc_resolve_native(vmCurrentContext, &${method.cName});
+                |    bc_resolve_native(&${method.cName}, ptr);
                 |
                 |""".trimMargin()
         )
@@ -1586,10 +1730,10 @@ class ClassWriter(
             """
                     |
                     |    bc_${returnPrefix}return();
-                    |}
-                    |
                     |""".trimMargin()
         )
+
+        writeExceptionDispatcher(cWriter, method)
     }
 
     /** jvms8 §6.5 Instructions - invokespecial */
@@ -1711,6 +1855,9 @@ class ClassWriter(
     companion object {
         private val LOGGER = LoggerFactory.getLogger(ClassWriter::class.java)!!
 
+        /** Max number of implementations that an invokevirtual inline cache checks before using the vtable */
+        private const val INLINE_CACHE_TARGETS_MAX = 4
+
         private const val CNAME_BACKING_INTERFACES = "backingInterfaces"
         private const val CNAME_BACKING_STATIC_FIELDS = "backingStaticFields"
         private const val CNAME_BACKING_INSTANCE_FIELDS = "backingFields"
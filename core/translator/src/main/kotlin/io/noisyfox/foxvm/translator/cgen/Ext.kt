@@ -290,6 +290,39 @@ val ClassInfo.cNameInstanceFields: String
         "fieldsInstance${cIdentifier}"
     }
 
+/**
+ * Runs of contiguous reference fields in [ClassInfo.preResolvedInstanceFields].
+ *
+ * Since [io.noisyfox.foxvm.bytecode.resolver.FieldLayout] puts references at the end of the fields
+ * declared by each class, there is at most one run for each class in the hierarchy.
+ */
+val ClassInfo.referenceFieldBlocks: List<List<PreResolvedFieldInfo>>
+    get() {
+        val blocks = mutableListOf<MutableList<PreResolvedFieldInfo>>()
+        var previousIsReference = false
+        for (f in preResolvedInstanceFields) {
+            if (f.isReference) {
+                if (!previousIsReference) {
+                    blocks.add(mutableListOf())
+                }
+                blocks.last().add(f)
+            }
+            previousIsReference = f.isReference
+        }
+        return blocks
+    }
+
+/**
+ * The C reference name to the given [ClassInfo.referenceFieldBlocks],
+ * or [CNull] if instances of this class does not have any reference field
+ */
+val ClassInfo.cNameReferenceBlocks: String
+    get() = if (preResolvedInstanceFields.none { it.isReference }) {
+        CNull
+    } else {
+        "refBlocks${cIdentifier}"
+    }
+
 /**
  * The C reference name to the given [ClassInfo.vtable],
  * or [CNull] if this class does not have any virtual method
@@ -346,6 +379,22 @@ val MethodInfo.cName: String
         return "methodInfo_${declaringClass.cIdentifier}_${this.cIdentifier}${this.descriptor.toCMethodSignature()}"
     }
 
+/**
+ * The C stack map table name of the method.
+ */
+val MethodInfo.cNameStackMaps: String
+    get() {
+        return "stackMaps_${declaringClass.cIdentifier}_${this.cIdentifier}${this.descriptor.toCMethodSignature()}"
+    }
+
+/**
+ * The C stack map reference bitmap name of the method.
+ */
+val MethodInfo.cNameStackMapRefs: String
+    get() {
+        return "stackMapRefs_${declaringClass.cIdentifier}_${this.cIdentifier}${this.descriptor.toCMethodSignature()}"
+    }
+
 /**
  * The C function name of the method.
  */
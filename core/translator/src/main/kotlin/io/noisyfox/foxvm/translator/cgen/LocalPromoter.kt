@@ -0,0 +1,462 @@
+package io.noisyfox.foxvm.translator.cgen
+
+import io.noisyfox.foxvm.bytecode.clazz.MethodInfo
+import org.objectweb.asm.Opcodes
+import org.objectweb.asm.Type
+import org.objectweb.asm.tree.AbstractInsnNode
+import org.objectweb.asm.tree.FrameNode
+import org.objectweb.asm.tree.IincInsnNode
+import org.objectweb.asm.tree.InsnNode
+import org.objectweb.asm.tree.IntInsnNode
+import org.objectweb.asm.tree.JumpInsnNode
+import org.objectweb.asm.tree.LdcInsnNode
+import org.objectweb.asm.tree.LineNumberNode
+import org.objectweb.asm.tree.VarInsnNode
+
+/**
+ * Keeps primitive locals and operand stack values of a method in plain C variables.
+ *
+ * A local is promoted if it is only ever accessed as one primitive type. Operand stack values produced
+ * by supported primitive instructions are tracked symbolically and only pushed to the real operand
+ * stack (flushed) before an instruction that is not handled here, or at the end of a basic block.
+ * References are never promoted, so the GC still finds all of them in the stack slots.
+ *
+ * Exceptions are dispatched by jumping inside the same C function, so promoted locals keep their values in
+ * exception handlers as well. The symbolic operand stack is always flushed at a label, so no handler ever
+ * depends on a value that was only held symbolically.
+ *
+ * Must be synced with the register promotion macros in .\native\runtime\include\vm_bytecode.h
+ */
+class LocalPromoter private constructor(
+    private val method: MethodInfo,
+    private val promotedLocals: Map<Int, Kind>
+) {
+
+    enum class Kind(val cType: String, val suffix: String) {
+        INT("JAVA_INT", "i"),
+        LONG("JAVA_LONG", "l"),
+        FLOAT("JAVA_FLOAT", "f"),
+        DOUBLE("JAVA_DOUBLE", "d");
+
+        val isCategory2: Boolean
+            get() = this == LONG || this == DOUBLE
+    }
+
+    /**
+     * A value on the symbolic operand stack.
+     *
+     * Values are always side-effect free expressions: a constant, a promoted local or a temporary.
+     * [local] is set if the value reads a promoted local lazily, which has to be materialized
+     * before that local is overwritten.
+     */
+    private class Value(val kind: Kind, val expr: String, val local: Int? = null, val constant: Number? = null)
+
+    private val stack = mutableListOf<Value>()
+    private var tempCount = 0
+
+    private fun localName(index: Int) = "__l$index"
+
+    /**
+     * Declare promoted locals. Must be called after the arguments are transferred to the local slots.
+     */
+    fun writeDeclarations(cWriter: CWriter) {
+        if (promotedLocals.isEmpty()) {
+            return
+        }
+
+        val arguments = argumentLocals(method)
+        cWriter.write(
+            """
+                    |
+                    |    // Promoted locals
+                    |""".trimMargin()
+        )
+        promotedLocals.toSortedMap().forEach { (index, kind) ->
+            val initialValue = if (index in arguments) {
+                "bc_arg_${kind.suffix}($index)"
+            } else {
+                "0"
+            }
+            cWriter.write(
+                """
+                    |    ${kind.cType} ${localName(index)} = $initialValue;
+                    |""".trimMargin()
+            )
+        }
+    }
+
+    /**
+     * Try translating the given instruction using promoted values.
+     *
+     * @return `false` if the instruction is not handled, in which case the symbolic stack has been
+     * flushed to the real operand stack (unless the instruction does not touch the operand stack at all)
+     * so the caller can emit the normal `bc_*` instruction.
+     */
+    fun write(cWriter: CWriter, inst: AbstractInsnNode): Boolean {
+        val handled = when (inst) {
+            // Those do not touch the operand stack
+            is LineNumberNode, is FrameNode -> return false
+            is VarInsnNode -> writeVar(cWriter, inst)
+            is IincInsnNode -> writeIinc(cWriter, inst)
+            is IntInsnNode -> when (inst.opcode) {
+                Opcodes.BIPUSH, Opcodes.SIPUSH -> pushConstant(Kind.INT, inst.operand)
+                else -> false
+            }
+            is LdcInsnNode -> when (val v = inst.cst) {
+                is Int -> pushConstant(Kind.INT, v)
+                is Long -> pushConstant(Kind.LONG, v)
+                is Float -> pushConstant(Kind.FLOAT, v)
+                is Double -> pushConstant(Kind.DOUBLE, v)
+                else -> false
+            }
+            is InsnNode -> writeInsn(cWriter, inst)
+            is JumpInsnNode -> writeJump(cWriter, inst)
+            else -> false
+        }
+
+        if (!handled) {
+            flush(cWriter)
+        }
+
+        return handled
+    }
+
+    /**
+     * Push all symbolic values to the real operand stack.
+     */
+    fun flush(cWriter: CWriter) {
+        stack.forEach {
+            cWriter.write(
+                """
+                    |    bc_push_${it.kind.suffix}(${it.expr});
+                    |""".trimMargin()
+            )
+        }
+        stack.clear()
+    }
+
+    private fun String.constant() = "($this)"
+
+    private fun push(kind: Kind, expr: String, local: Int? = null): Boolean {
+        stack.add(Value(kind, expr, local))
+        return true
+    }
+
+    private fun pushConstant(kind: Kind, value: Number): Boolean {
+        stack.add(Value(kind, value.toCConst().constant(), constant = value))
+        return true
+    }
+
+    private fun pop(): Value = stack.removeAt(stack.lastIndex)
+
+    /** Whether the top [count] values are on the symbolic stack. */
+    private fun hasSymbolic(count: Int) = stack.size >= count
+
+    private fun newTemp(cWriter: CWriter, kind: Kind, expr: String): Value {
+        val name = "__t${tempCount++}"
+        cWriter.write(
+            """
+                    |    const ${kind.cType} $name = $expr;
+                    |""".trimMargin()
+        )
+        return Value(kind, name)
+    }
+
+    /** Make sure no symbolic value still depends on the current value of the given local. */
+    private fun materialize(cWriter: CWriter, local: Int) {
+        stack.forEachIndexed { i, v ->
+            if (v.local == local) {
+                stack[i] = newTemp(cWriter, v.kind, v.expr)
+            }
+        }
+    }
+
+    private fun writeVar(cWriter: CWriter, inst: VarInsnNode): Boolean {
+        val kind = promotedLocals[inst.`var`] ?: return false
+        val name = localName(inst.`var`)
+
+        return when (inst.opcode) {
+            Opcodes.ILOAD, Opcodes.LLOAD, Opcodes.FLOAD, Opcodes.DLOAD -> push(kind, name, inst.`var`)
+            Opcodes.ISTORE, Opcodes.LSTORE, Opcodes.FSTORE, Opcodes.DSTORE -> {
+                if (hasSymbolic(1)) {
+                    val v = pop()
+                    materialize(cWriter, inst.`var`)
+                    cWriter.write(
+                        """
+                    |    $name = ${v.expr};
+                    |""".trimMargin()
+                    )
+                } else {
+                    cWriter.write(
+                        """
+                    |    bc_pop_${kind.suffix}($name);
+                    |""".trimMargin()
+                    )
+                }
+                true
+            }
+            else -> false
+        }
+    }
+
+    private fun writeIinc(cWriter: CWriter, inst: IincInsnNode): Boolean {
+        if (promotedLocals[inst.`var`] != Kind.INT) {
+            return false
+        }
+
+        materialize(cWriter, inst.`var`)
+        cWriter.write(
+            """
+                    |    ${localName(inst.`var`)} = bc_value_iadd(${localName(inst.`var`)}, ${inst.incr});
+                    |""".trimMargin()
+        )
+        return true
+    }
+
+    private fun binary(cWriter: CWriter, kind: Kind, format: (String, String) -> String): Boolean {
+        if (!hasSymbolic(2)) {
+            return false
+        }
+        val value2 = pop()
+        val value1 = pop()
+        stack.add(newTemp(cWriter, kind, format(value1.expr, value2.expr)))
+        return true
+    }
+
+    private fun division(cWriter: CWriter, kind: Kind, name: String): Boolean {
+        val divisor = stack.lastOrNull()?.constant ?: return false
+        if (divisor.toLong() == 0L) {
+            return false
+        }
+        return binary(cWriter, kind) { a, b -> "bc_value_$name($a, $b)" }
+    }
+
+    private fun unary(cWriter: CWriter, kind: Kind, format: (String) -> String): Boolean {
+        if (!hasSymbolic(1)) {
+            return false
+        }
+        val value = pop()
+        stack.add(newTemp(cWriter, kind, format(value.expr)))
+        return true
+    }
+
+    private fun writeInsn(cWriter: CWriter, inst: InsnNode): Boolean = when (inst.opcode) {
+        Opcodes.ICONST_M1, Opcodes.ICONST_0, Opcodes.ICONST_1, Opcodes.ICONST_2,
+        Opcodes.ICONST_3, Opcodes.ICONST_4, Opcodes.ICONST_5 ->
+            pushConstant(Kind.INT, inst.opcode - Opcodes.ICONST_0)
+        Opcodes.LCONST_0, Opcodes.LCONST_1 ->
+            pushConstant(Kind.LONG, (inst.opcode - Opcodes.LCONST_0).toLong())
+        Opcodes.FCONST_0, Opcodes.FCONST_1, Opcodes.FCONST_2 ->
+            pushConstant(Kind.FLOAT, (inst.opcode - Opcodes.FCONST_0).toFloat())
+        Opcodes.DCONST_0, Opcodes.DCONST_1 ->
+            pushConstant(Kind.DOUBLE, (inst.opcode - Opcodes.DCONST_0).toDouble())
+
+        Opcodes.POP -> if (hasSymbolic(1) && !stack.last().kind.isCategory2) {
+            pop()
+            true
+        } else {
+            false
+        }
+        Opcodes.POP2 -> when {
+            hasSymbolic(1) && stack.last().kind.isCategory2 -> {
+                pop()
+                true
+            }
+            hasSymbolic(2) && !stack.last().kind.isCategory2 -> {
+                pop()
+                pop()
+                true
+            }
+            else -> false
+        }
+        Opcodes.DUP -> if (hasSymbolic(1)) {
+            stack.add(stack.last())
+            true
+        } else {
+            false
+        }
+
+        Opcodes.IADD -> binary(cWriter, Kind.INT) { a, b -> "bc_value_iadd($a, $b)" }
+        Opcodes.LADD -> binary(cWriter, Kind.LONG) { a, b -> "bc_value_ladd($a, $b)" }
+        Opcodes.FADD -> binary(cWriter, Kind.FLOAT) { a, b -> "bc_value_fadd($a, $b)" }
+        Opcodes.DADD -> binary(cWriter, Kind.DOUBLE) { a, b -> "bc_value_dadd($a, $b)" }
+
+        Opcodes.ISUB -> binary(cWriter, Kind.INT) { a, b -> "bc_value_isub($a, $b)" }
+        Opcodes.LSUB -> binary(cWriter, Kind.LONG) { a, b -> "bc_value_lsub($a, $b)" }
+        Opcodes.FSUB -> binary(cWriter, Kind.FLOAT) { a, b -> "bc_value_fsub($a, $b)" }
+        Opcodes.DSUB -> binary(cWriter, Kind.DOUBLE) { a, b -> "bc_value_dsub($a, $b)" }
+
+        Opcodes.IMUL -> binary(cWriter, Kind.INT) { a, b -> "bc_value_imul($a, $b)" }
+        Opcodes.LMUL -> binary(cWriter, Kind.LONG) { a, b -> "bc_value_lmul($a, $b)" }
+        Opcodes.FMUL -> binary(cWriter, Kind.FLOAT) { a, b -> "bc_value_fmul($a, $b)" }
+        Opcodes.DMUL -> binary(cWriter, Kind.DOUBLE) { a, b -> "bc_value_dmul($a, $b)" }
+
+        // Integer division is only done here if it can never throw, otherwise the operands have to be on the
+        // real operand stack when the exception is created
+        Opcodes.IDIV -> division(cWriter, Kind.INT, "idiv")
+        Opcodes.LDIV -> division(cWriter, Kind.LONG, "ldiv")
+        Opcodes.IREM -> division(cWriter, Kind.INT, "irem")
+        Opcodes.LREM -> division(cWriter, Kind.LONG, "lrem")
+        Opcodes.FDIV -> binary(cWriter, Kind.FLOAT) { a, b -> "bc_value_fdiv($a, $b)" }
+        Opcodes.DDIV -> binary(cWriter, Kind.DOUBLE) { a, b -> "bc_value_ddiv($a, $b)" }
+        Opcodes.FREM -> binary(cWriter, Kind.FLOAT) { a, b -> "bc_value_frem($a, $b)" }
+        Opcodes.DREM -> binary(cWriter, Kind.DOUBLE) { a, b -> "bc_value_drem($a, $b)" }
+
+        Opcodes.INEG -> unary(cWriter, Kind.INT) { "bc_value_ineg($it)" }
+        Opcodes.LNEG -> unary(cWriter, Kind.LONG) { "bc_value_lneg($it)" }
+        Opcodes.FNEG -> unary(cWriter, Kind.FLOAT) { "bc_value_fneg($it)" }
+        Opcodes.DNEG -> unary(cWriter, Kind.DOUBLE) { "bc_value_dneg($it)" }
+
+        Opcodes.ISHL -> binary(cWriter, Kind.INT) { a, b -> "bc_value_ishl($a, $b)" }
+        Opcodes.LSHL -> binary(cWriter, Kind.LONG) { a, b -> "bc_value_lshl($a, $b)" }
+        Opcodes.ISHR -> binary(cWriter, Kind.INT) { a, b -> "bc_value_ishr($a, $b)" }
+        Opcodes.LSHR -> binary(cWriter, Kind.LONG) { a, b -> "bc_value_lshr($a, $b)" }
+        Opcodes.IUSHR -> binary(cWriter, Kind.INT) { a, b -> "bc_value_iushr($a, $b)" }
+        Opcodes.LUSHR -> binary(cWriter, Kind.LONG) { a, b -> "bc_value_lushr($a, $b)" }
+
+        Opcodes.IAND -> binary(cWriter, Kind.INT) { a, b -> "bc_value_iand($a, $b)" }
+        Opcodes.LAND -> binary(cWriter, Kind.LONG) { a, b -> "bc_value_land($a, $b)" }
+        Opcodes.IOR -> binary(cWriter, Kind.INT) { a, b -> "bc_value_ior($a, $b)" }
+        Opcodes.LOR -> binary(cWriter, Kind.LONG) { a, b -> "bc_value_lor($a, $b)" }
+        Opcodes.IXOR -> binary(cWriter, Kind.INT) { a, b -> "bc_value_ixor($a, $b)" }
+        Opcodes.LXOR -> binary(cWriter, Kind.LONG) { a, b -> "bc_value_lxor($a, $b)" }
+
+        Opcodes.I2L -> unary(cWriter, Kind.LONG) { "bc_value_i2l($it)" }
+        Opcodes.I2F -> unary(cWriter, Kind.FLOAT) { "bc_value_i2f($it)" }
+        Opcodes.I2D -> unary(cWriter, Kind.DOUBLE) { "bc_value_i2d($it)" }
+        Opcodes.L2I -> unary(cWriter, Kind.INT) { "bc_value_l2i($it)" }
+        Opcodes.L2F -> unary(cWriter, Kind.FLOAT) { "bc_value_l2f($it)" }
+        Opcodes.L2D -> unary(cWriter, Kind.DOUBLE) { "bc_value_l2d($it)" }
+        Opcodes.F2I -> unary(cWriter, Kind.INT) { "bc_value_f2i($it)" }
+        Opcodes.F2L -> unary(cWriter, Kind.LONG) { "bc_value_f2l($it)" }
+        Opcodes.F2D -> unary(cWriter, Kind.DOUBLE) { "bc_value_f2d($it)" }
+        Opcodes.D2I -> unary(cWriter, Kind.INT) { "bc_value_d2i($it)" }
+        Opcodes.D2L -> unary(cWriter, Kind.LONG) { "bc_value_d2l($it)" }
+        Opcodes.D2F -> unary(cWriter, Kind.FLOAT) { "bc_value_d2f($it)" }
+        Opcodes.I2B -> unary(cWriter, Kind.INT) { "bc_value_i2b($it)" }
+        Opcodes.I2C -> unary(cWriter, Kind.INT) { "bc_value_i2c($it)" }
+        Opcodes.I2S -> unary(cWriter, Kind.INT) { "bc_value_i2s($it)" }
+
+        Opcodes.LCMP -> binary(cWriter, Kind.INT) { a, b -> "bc_value_lcmp($a, $b)" }
+        Opcodes.FCMPL -> binary(cWriter, Kind.INT) { a, b -> "bc_value_fcmpl($a, $b)" }
+        Opcodes.FCMPG -> binary(cWriter, Kind.INT) { a, b -> "bc_value_fcmpg($a, $b)" }
+        Opcodes.DCMPL -> binary(cWriter, Kind.INT) { a, b -> "bc_value_dcmpl($a, $b)" }
+        Opcodes.DCMPG -> binary(cWriter, Kind.INT) { a, b -> "bc_value_dcmpg($a, $b)" }
+
+        Opcodes.IRETURN -> writeReturn(cWriter, Type.INT)
+        Opcodes.LRETURN -> writeReturn(cWriter, Type.LONG)
+        Opcodes.FRETURN -> writeReturn(cWriter, Type.FLOAT)
+        Opcodes.DRETURN -> writeReturn(cWriter, Type.DOUBLE)
+
+        else -> false
+    }
+
+    private fun writeReturn(cWriter: CWriter, sort: Int): Boolean {
+        // Sub-int return types require the same conversion as bc_read_stack_top()
+        if (method.descriptor.returnType.sort != sort || !hasSymbolic(1)) {
+            return false
+        }
+
+        val value = pop()
+        flush(cWriter)
+        cWriter.write(
+            """
+                    |    bc_return_r(${value.expr});
+                    |""".trimMargin()
+        )
+        return true
+    }
+
+    private fun writeJump(cWriter: CWriter, inst: JumpInsnNode): Boolean {
+        val (operandCount, condition) = when (inst.opcode) {
+            Opcodes.IFEQ -> 1 to "=="
+            Opcodes.IFNE -> 1 to "!="
+            Opcodes.IFLT -> 1 to "<"
+            Opcodes.IFLE -> 1 to "<="
+            Opcodes.IFGT -> 1 to ">"
+            Opcodes.IFGE -> 1 to ">="
+            Opcodes.IF_ICMPEQ -> 2 to "=="
+            Opcodes.IF_ICMPNE -> 2 to "!="
+            Opcodes.IF_ICMPLT -> 2 to "<"
+            Opcodes.IF_ICMPLE -> 2 to "<="
+            Opcodes.IF_ICMPGT -> 2 to ">"
+            Opcodes.IF_ICMPGE -> 2 to ">="
+            else -> return false
+        }
+        if (!hasSymbolic(operandCount)) {
+            return false
+        }
+
+        val value2 = if (operandCount == 2) pop().expr else "0"
+        val value1 = pop().expr
+        // Values below the operands are expected on the real stack by the branch target
+        flush(cWriter)
+        cWriter.write(
+            """
+                    |    bc_if_r($value1 $condition $value2, ${inst.label.cName(method)});
+                    |""".trimMargin()
+        )
+        return true
+    }
+
+    companion object {
+
+        fun create(method: MethodInfo): LocalPromoter = LocalPromoter(method, findPromotableLocals(method))
+
+        /** Map the local index of each argument to its type. */
+        private fun argumentLocals(method: MethodInfo): Map<Int, Type> {
+            val result = mutableMapOf<Int, Type>()
+            var index = if (method.isStatic) 0 else 1 // implicitly passed this
+            method.descriptor.argumentTypes.forEach {
+                result[index] = it
+                index += it.localSlotCount
+            }
+            return result
+        }
+
+        private fun Type.toKind(): Kind? = when (sort) {
+            Type.BOOLEAN, Type.CHAR, Type.BYTE, Type.SHORT, Type.INT -> Kind.INT
+            Type.LONG -> Kind.LONG
+            Type.FLOAT -> Kind.FLOAT
+            Type.DOUBLE -> Kind.DOUBLE
+            else -> null
+        }
+
+        private fun findPromotableLocals(method: MethodInfo): Map<Int, Kind> {
+            val kinds = mutableMapOf<Int, Kind>()
+            val rejected = mutableSetOf<Int>()
+
+            fun access(index: Int, kind: Kind?) {
+                if (kind == null) {
+                    rejected.add(index)
+                } else if (kinds.getOrPut(index) { kind } != kind) {
+                    rejected.add(index)
+                }
+            }
+
+            method.methodNode.instructions.forEach { inst ->
+                when (inst) {
+                    is VarInsnNode -> access(
+                        inst.`var`, when (inst.opcode) {
+                            Opcodes.ILOAD, Opcodes.ISTORE -> Kind.INT
+                            Opcodes.LLOAD, Opcodes.LSTORE -> Kind.LONG
+                            Opcodes.FLOAD, Opcodes.FSTORE -> Kind.FLOAT
+                            Opcodes.DLOAD, Opcodes.DSTORE -> Kind.DOUBLE
+                            else -> null
+                        }
+                    )
+                    is IincInsnNode -> access(inst.`var`, Kind.INT)
+                }
+            }
+
+            // Arguments are passed in the local slots, so the type of the argument must match as well
+            argumentLocals(method).forEach { (index, type) ->
+                if (index in kinds) {
+                    access(index, type.toKind())
+                }
+            }
+
+            return kinds.filterKeys { it !in rejected }
+        }
+    }
+}
@@ -0,0 +1,104 @@
+package io.noisyfox.foxvm.translator.cgen
+
+/**
+ * A minimal perfect hash table built by hash and displace, so a key can be found by computing its hash once and
+ * checking exactly one slot.
+ *
+ * Keys are first distributed into [size] buckets by `hash % size`. Each bucket then records either a seed that
+ * moves all its keys to free slots by [slotOf], or for bucket with only one key, the slot itself (as `-slot - 1`).
+ *
+ * Must be synced with `cl_class_name_hash()` and `cl_bootstrap_class_info_lookup()` in
+ * .\native\runtime\classloader\vm_boot_classloader.c
+ *
+ * @property keys the keys in slot order.
+ * @property hashes the hash of each key, in slot order.
+ * @property seeds the seed of each bucket.
+ */
+class PerfectHashTable<T> private constructor(
+    val keys: List<T>,
+    val hashes: LongArray,
+    val seeds: IntArray
+) {
+
+    val size: Int
+        get() = keys.size
+
+    companion object {
+        private const val FNV_OFFSET_BASIS = -0x340d631b7bdddcdbL // 0xcbf29ce484222325
+        private const val FNV_PRIME = 0x100000001b3L
+        private const val GOLDEN_RATIO = -0x61c8864680b583ebL // 0x9e3779b97f4a7c15
+
+        private const val MAX_SEED = 1 shl 24
+
+        /** 64-bit FNV-1a hash of the given bytes. */
+        fun hash(bytes: ByteArray): Long {
+            var h = FNV_OFFSET_BASIS
+            bytes.forEach {
+                h = h xor (it.toLong() and 0xFF)
+                h *= FNV_PRIME
+            }
+            return h
+        }
+
+        /** Slot of the key with the given [hash] in a table of [size] when displaced by [seed]. */
+        fun slotOf(hash: Long, seed: Int, size: Int): Int {
+            // Finalizer of MurmurHash3
+            var h = hash xor (seed.toLong() * GOLDEN_RATIO)
+            h = h xor (h ushr 33)
+            h *= -0xae502812aa7333L // 0xff51afd7ed558ccd
+            h = h xor (h ushr 33)
+            h *= -0x3b314601e57a13adL // 0xc4ceb9fe1a85ec53
+            h = h xor (h ushr 33)
+            return java.lang.Long.remainderUnsigned(h, size.toLong()).toInt()
+        }
+
+        fun bucketOf(hash: Long, size: Int): Int = java.lang.Long.remainderUnsigned(hash, size.toLong()).toInt()
+
+        fun <T> build(keys: List<T>, keyBytes: (T) -> ByteArray): PerfectHashTable<T> {
+            val size = keys.size
+            val hashed = keys.map { it to hash(keyBytes(it)) }
+            hashed.groupBy { it.second }.values.firstOrNull { it.size > 1 }?.let {
+                throw IllegalStateException("Hash collision between keys ${it.map { k -> k.first }}")
+            }
+
+            val slots = arrayOfNulls<Pair<T, Long>>(size)
+            val seeds = IntArray(size)
+
+            // Place the biggest buckets first, while there are still plenty of free slots
+            val buckets = hashed.groupBy { bucketOf(it.second, size) }.entries.sortedByDescending { it.value.size }
+            buckets.filter { it.value.size > 1 }.forEach { (bucket, entries) ->
+                var seed = 1
+                while (true) {
+                    val candidates = entries.map { slotOf(it.second, seed, size) }
+                    if (candidates.distinct().size == candidates.size && candidates.all { slots[it] == null }) {
+                        candidates.forEachIndexed { i, slot -> slots[slot] = entries[i] }
+                        seeds[bucket] = seed
+                        break
+                    }
+
+                    seed++
+                    if (seed > MAX_SEED) {
+                        throw IllegalStateException("Unable to find a perfect hash seed for keys ${entries.map { it.first }}")
+                    }
+                }
+            }
+
+            // Then put single keys directly in the remaining slots
+            var freeSlot = 0
+            buckets.filter { it.value.size == 1 }.forEach { (bucket, entries) ->
+                while (slots[freeSlot] != null) {
+                    freeSlot++
+                }
+                slots[freeSlot] = entries.single()
+                seeds[bucket] = -freeSlot - 1
+            }
+
+            val placed = slots.map { requireNotNull(it) }
+            return PerfectHashTable(
+                keys = placed.map { it.first },
+                hashes = placed.map { it.second }.toLongArray(),
+                seeds = seeds
+            )
+        }
+    }
+}
@@ -0,0 +1,192 @@
+package io.noisyfox.foxvm.translator.cgen
+
+import io.noisyfox.foxvm.bytecode.clazz.MethodInfo
+import org.objectweb.asm.Opcodes
+import org.objectweb.asm.tree.AbstractInsnNode
+import org.objectweb.asm.tree.FieldInsnNode
+import org.objectweb.asm.tree.InsnNode
+import org.objectweb.asm.tree.IntInsnNode
+import org.objectweb.asm.tree.InvokeDynamicInsnNode
+import org.objectweb.asm.tree.LdcInsnNode
+import org.objectweb.asm.tree.MethodInsnNode
+import org.objectweb.asm.tree.MultiANewArrayInsnNode
+import org.objectweb.asm.tree.TypeInsnNode
+import org.objectweb.asm.tree.analysis.Analyzer
+import org.objectweb.asm.tree.analysis.AnalyzerException
+import org.objectweb.asm.tree.analysis.BasicInterpreter
+import org.slf4j.LoggerFactory
+import java.util.BitSet
+
+/**
+ * GC stack maps of a method, computed from the ASM frame analysis.
+ *
+ * A map is generated for every instruction that might trigger a GC (by allocating, calling other
+ * methods or throwing exceptions). Before such an instruction is executed, the generated code records
+ * its index in the frame by `bc_gc_point()`, so the GC knows exactly which slots hold references
+ * without checking the type of each slot.
+ *
+ * Must be synced with `StackMapEntry` in .\native\runtime\include\vm_base.h
+ */
+class StackMaps private constructor(
+    private val method: MethodInfo,
+    /** Reference bitmap of each GC point, keyed by the instruction index */
+    private val entries: Map<Int, Entry>
+) {
+
+    /**
+     * @property stackDepth depth of the operand stack before the instruction is executed.
+     * @property refs reference slots, locals first and then the operand stack.
+     */
+    private class Entry(val stackDepth: Int, val refs: BitSet)
+
+    val size: Int
+        get() = entries.size
+
+    val isEmpty: Boolean
+        get() = entries.isEmpty()
+
+    /** Check if the given instruction is a GC point of this method. */
+    fun isGcPoint(inst: AbstractInsnNode): Boolean {
+        return method.methodNode.instructions.indexOf(inst) in entries
+    }
+
+    /** Reference slots at the given GC point, locals first and then the operand stack, or `null` if it's not a GC point. */
+    fun refsAt(inst: AbstractInsnNode): BitSet? {
+        return entries[method.methodNode.instructions.indexOf(inst)]?.refs?.clone() as BitSet?
+    }
+
+    /** Write the stack map table of this method. */
+    fun write(cWriter: CWriter) {
+        if (isEmpty) {
+            return
+        }
+
+        val slotCount = method.methodNode.maxLocals
+        // Identical bitmaps are shared between entries
+        val bitmaps = mutableListOf<Int>()
+        val offsets = mutableMapOf<List<Int>, Int>()
+        val refsOffsets = entries.toSortedMap().mapValues { (_, entry) ->
+            val byteCount = (slotCount + entry.stackDepth + 7) / 8
+            if (byteCount == 0) {
+                null
+            } else {
+                val bytes = (0 until byteCount).map { b ->
+                    (0 until 8).fold(0) { acc, bit ->
+                        if (entry.refs[b * 8 + bit]) acc or (1 shl bit) else acc
+                    }
+                }
+                offsets.getOrPut(bytes) {
+                    val offset = bitmaps.size
+                    bitmaps.addAll(bytes)
+                    offset
+                }
+            }
+        }
+
+        if (bitmaps.isNotEmpty()) {
+            cWriter.write(
+                """
+                    |static const uint8_t ${method.cNameStackMapRefs}[] = {
+                    |${bitmaps.chunked(16).joinToString("\n") { line -> "    " + line.joinToString(" ") { "0x%02x,".format(it) } }}
+                    |};
+                    |""".trimMargin()
+            )
+        }
+
+        cWriter.write(
+            """
+                    |static StackMapEntry ${method.cNameStackMaps}[] = {
+                    |""".trimMargin()
+        )
+        refsOffsets.forEach { (index, offset) ->
+            val refs = if (offset == null) CNull else "&${method.cNameStackMapRefs}[$offset]"
+            cWriter.write(
+                """
+                    |    {.label = $index, .stackDepth = ${entries.getValue(index).stackDepth}, .refs = $refs},
+                    |""".trimMargin()
+            )
+        }
+        cWriter.write(
+            """
+                    |};
+                    |
+                    |""".trimMargin()
+        )
+    }
+
+    companion object {
+        private val LOGGER = LoggerFactory.getLogger(StackMaps::class.java)!!
+
+        /**
+         * Analyze the given method, or return `null` if the frames of the method can not be computed,
+         * in which case the GC falls back to checking the slot types.
+         */
+        fun analyze(method: MethodInfo): StackMaps? {
+            if (!method.isConcrete) {
+                return null
+            }
+
+            val node = method.methodNode
+            val frames = try {
+                Analyzer(BasicInterpreter()).analyze(method.declaringClass.thisClass.className, node)
+            } catch (e: AnalyzerException) {
+                LOGGER.warn("Unable to compute stack maps of method {}.{}{}", method.declaringClass.thisClass.className, method.name, method.descriptor, e)
+                return null
+            }
+
+            val entries = mutableMapOf<Int, Entry>()
+            node.instructions.forEachIndexed { index, inst ->
+                // Unreachable code does not have a frame
+                val frame = frames[index] ?: return@forEachIndexed
+                if (!mayTriggerGc(inst)) {
+                    return@forEachIndexed
+                }
+
+                val refs = BitSet()
+                for (i in 0 until frame.locals) {
+                    if (frame.getLocal(i).isReference) {
+                        refs.set(i)
+                    }
+                }
+                // Each operand stack value takes exactly one slot in the runtime
+                for (i in 0 until frame.stackSize) {
+                    if (frame.getStack(i).isReference) {
+                        refs.set(node.maxLocals + i)
+                    }
+                }
+                entries[index] = Entry(frame.stackSize, refs)
+            }
+
+            return StackMaps(method, entries)
+        }
+
+        /**
+         * Check if the given instruction might reach a safepoint, by allocating objects (including
+         * exceptions it might throw), initializing classes or calling other methods.
+         */
+        private fun mayTriggerGc(inst: AbstractInsnNode): Boolean = when (inst) {
+            is MethodInsnNode,
+            is InvokeDynamicInsnNode,
+            is FieldInsnNode,
+            is TypeInsnNode,
+            is MultiANewArrayInsnNode -> true
+            is IntInsnNode -> inst.opcode == Opcodes.NEWARRAY
+            is LdcInsnNode -> inst.cst !is Number
+            is InsnNode -> when (inst.opcode) {
+                in Opcodes.IALOAD..Opcodes.SALOAD,
+                in Opcodes.IASTORE..Opcodes.SASTORE,
+                Opcodes.ARRAYLENGTH,
+                Opcodes.ATHROW,
+                Opcodes.MONITORENTER,
+                Opcodes.MONITOREXIT,
+                Opcodes.IDIV,
+                Opcodes.LDIV,
+                Opcodes.IREM,
+                Opcodes.LREM,
+                in Opcodes.IRETURN..Opcodes.RETURN -> true
+                else -> false
+            }
+            else -> false
+        }
+    }
+}
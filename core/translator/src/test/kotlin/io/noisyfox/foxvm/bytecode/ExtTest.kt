@@ -1,7 +1,9 @@
 package io.noisyfox.foxvm.bytecode
 
+import java.io.ByteArrayOutputStream
 import kotlin.test.Test
 import kotlin.test.assertEquals
+import kotlin.test.fail
 
 class ExtTest {
 
@@ -10,4 +12,75 @@ class ExtTest {
         assertEquals("""abc""\xe6\xb5\x8b\xe8\xaf\x95\xe4\xb8\x80\xe4\xb8\x8b""abc\r\n\t\\\"""", "abc测试一下abc\r\n\t\\\"".asCString())
     }
 
-}
\ No newline at end of file
+    @Test
+    fun `test String#toModifiedUtf8()`() {
+        // The null code point is encoded in 2 bytes
+        assertEquals(bytes(0x61, 0xC0, 0x80, 0x62), "a\u0000b".toModifiedUtf8().toList())
+        assertEquals(bytes(0x7F, 0xC2, 0x80, 0xDF, 0xBF, 0xE0, 0xA0, 0x80, 0xEF, 0xBF, 0xBF), "\u007f\u0080\u07ff\u0800\uffff".toModifiedUtf8().toList())
+        // Supplementary characters are encoded as the surrogate pair, each in 3 bytes
+        assertEquals(bytes(0xED, 0xA0, 0xBD, 0xED, 0xB8, 0x80), "\ud83d\ude00".toModifiedUtf8().toList())
+    }
+
+    @Test
+    fun `test String#toModifiedUtf8() matches String#asCString()`() {
+        listOf(
+            "",
+            "java/lang/Object",
+            "abc测试一下abc\r\n\t\\\"",
+            "a\u0000b\u0000",
+            "\u0000",
+            "\u007f\u0080\u07ff\u0800\uffff",
+            "emoji\ud83d\ude00\ud83d\ude00end",
+            "\ud800\udc00abc"
+        ).forEach {
+            assertEquals(it.asCString().decodeCString().toList(), it.toModifiedUtf8().toList(), "Encoding of \"$it\"")
+        }
+    }
+
+    private fun bytes(vararg values: Int): List<Byte> = values.map { it.toByte() }
+
+    /**
+     * Decode the content of a C string literal generated by [asCString] to the bytes a C compiler would produce.
+     */
+    private fun String.decodeCString(): ByteArray {
+        val out = ByteArrayOutputStream()
+        var i = 0
+        while (i < length) {
+            val c = this[i]
+            when (c) {
+                '"' -> {
+                    // `""` that terminates a hex escape
+                    assertEquals('"', this[i + 1])
+                    i += 2
+                }
+                '\\' -> {
+                    when (val escape = this[i + 1]) {
+                        'x' -> {
+                            out.write(substring(i + 2, i + 4).toInt(16))
+                            i += 4
+                        }
+                        else -> {
+                            out.write(
+                                when (escape) {
+                                    'b' -> '\b'
+                                    'n' -> '\n'
+                                    'r' -> '\r'
+                                    't' -> '\t'
+                                    '\\' -> '\\'
+                                    '"' -> '"'
+                                    else -> fail("Unexpected escape \\$escape")
+                                }.toInt()
+                            )
+                            i += 2
+                        }
+                    }
+                }
+                else -> {
+                    out.write(c.toInt())
+                    i++
+                }
+            }
+        }
+        return out.toByteArray()
+    }
+}
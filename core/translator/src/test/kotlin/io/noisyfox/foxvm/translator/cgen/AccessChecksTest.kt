@@ -0,0 +1,228 @@
+package io.noisyfox.foxvm.translator.cgen
+
+import io.noisyfox.foxvm.bytecode.clazz.MethodInfo
+import org.objectweb.asm.Label
+import org.objectweb.asm.Opcodes
+import org.objectweb.asm.tree.AbstractInsnNode
+import org.objectweb.asm.tree.MethodNode
+import kotlin.test.Test
+import kotlin.test.assertFalse
+import kotlin.test.assertNotNull
+import kotlin.test.assertNull
+import kotlin.test.assertTrue
+
+class AccessChecksTest {
+
+    private fun MethodNode.newTest() {
+        visitTypeInsn(Opcodes.NEW, TEST_CLASS)
+        visitInsn(Opcodes.DUP)
+        visitMethodInsn(Opcodes.INVOKESPECIAL, TEST_CLASS, "<init>", "()V", false)
+    }
+
+    /**
+     * `static int test(int[] a) { int s = 0; for (int i = 0; i < a.length; i++) { body } return s; }`
+     * as compiled by javac.
+     */
+    private fun arrayLoop(body: MethodNode.() -> Unit): MethodInfo = testMethod("([I)I") {
+        val head = Label()
+        val exit = Label()
+
+        visitInsn(Opcodes.ICONST_0)
+        visitVarInsn(Opcodes.ISTORE, 1)
+        visitInsn(Opcodes.ICONST_0)
+        visitVarInsn(Opcodes.ISTORE, 2)
+        visitLabel(head)
+        visitVarInsn(Opcodes.ILOAD, 2)
+        visitVarInsn(Opcodes.ALOAD, 0)
+        visitInsn(Opcodes.ARRAYLENGTH)
+        visitJumpInsn(Opcodes.IF_ICMPGE, exit)
+        body(this)
+        visitIincInsn(2, 1)
+        visitJumpInsn(Opcodes.GOTO, head)
+        visitLabel(exit)
+        visitVarInsn(Opcodes.ILOAD, 1)
+        visitInsn(Opcodes.IRETURN)
+        visitMaxs(4, 3)
+    }
+
+    @Test
+    fun `test array loop`() {
+        lateinit var load: AbstractInsnNode
+        lateinit var loadNext: AbstractInsnNode
+        val method = arrayLoop {
+            // s += a[i]
+            visitVarInsn(Opcodes.ILOAD, 1)
+            visitVarInsn(Opcodes.ALOAD, 0)
+            visitVarInsn(Opcodes.ILOAD, 2)
+            visitInsn(Opcodes.IALOAD)
+            load = instructions.last
+            visitInsn(Opcodes.IADD)
+            visitVarInsn(Opcodes.ISTORE, 1)
+            // s += a[i + 1]
+            visitVarInsn(Opcodes.ILOAD, 1)
+            visitVarInsn(Opcodes.ALOAD, 0)
+            visitVarInsn(Opcodes.ILOAD, 2)
+            visitInsn(Opcodes.ICONST_1)
+            visitInsn(Opcodes.IADD)
+            visitInsn(Opcodes.IALOAD)
+            loadNext = instructions.last
+            visitInsn(Opcodes.IADD)
+            visitVarInsn(Opcodes.ISTORE, 1)
+        }
+
+        val checks = assertNotNull(AccessChecks.analyze(method))
+        assertTrue(checks.isUnchecked(load))
+        assertFalse(checks.isUnchecked(loadNext))
+    }
+
+    @Test
+    fun `test array loop with reassigned index`() {
+        lateinit var load: AbstractInsnNode
+        val method = arrayLoop {
+            visitIincInsn(2, 1)
+            // s += a[i]
+            visitVarInsn(Opcodes.ILOAD, 1)
+            visitVarInsn(Opcodes.ALOAD, 0)
+            visitVarInsn(Opcodes.ILOAD, 2)
+            visitInsn(Opcodes.IALOAD)
+            load = instructions.last
+            visitInsn(Opcodes.IADD)
+            visitVarInsn(Opcodes.ISTORE, 1)
+        }
+
+        val checks = assertNotNull(AccessChecks.analyze(method))
+        assertFalse(checks.isUnchecked(load))
+    }
+
+    @Test
+    fun `test this receiver`() {
+        lateinit var get: AbstractInsnNode
+        val code: MethodNode.() -> Unit = {
+            visitVarInsn(Opcodes.ALOAD, 0)
+            visitFieldInsn(Opcodes.GETFIELD, TEST_CLASS, "f", "I")
+            get = instructions.last
+            visitInsn(Opcodes.IRETURN)
+            visitMaxs(1, 2)
+        }
+
+        val instanceMethod = testMethod("()I", Opcodes.ACC_PUBLIC, code)
+        assertTrue(assertNotNull(AccessChecks.analyze(instanceMethod)).isUnchecked(get))
+
+        // Local 0 is just an argument of a static method
+        val staticMethod = testMethod("(L$TEST_CLASS;)I", Opcodes.ACC_PUBLIC or Opcodes.ACC_STATIC, code)
+        assertFalse(assertNotNull(AccessChecks.analyze(staticMethod)).isUnchecked(get))
+
+        // Local 0 is no longer `this` once it's overwritten
+        val overwritten = testMethod("(L$TEST_CLASS;)I", Opcodes.ACC_PUBLIC) {
+            visitVarInsn(Opcodes.ALOAD, 1)
+            visitVarInsn(Opcodes.ASTORE, 0)
+            code(this)
+        }
+        assertFalse(assertNotNull(AccessChecks.analyze(overwritten)).isUnchecked(get))
+    }
+
+    @Test
+    fun `test new receiver`() {
+        lateinit var put: AbstractInsnNode
+        lateinit var get: AbstractInsnNode
+        lateinit var getMaybeNull: AbstractInsnNode
+        val method = testMethod("(I)I") {
+            val isNull = Label()
+            val merge = Label()
+
+            newTest()
+            visitVarInsn(Opcodes.ASTORE, 1)
+            visitVarInsn(Opcodes.ALOAD, 1)
+            visitInsn(Opcodes.ICONST_1)
+            visitFieldInsn(Opcodes.PUTFIELD, TEST_CLASS, "f", "I")
+            put = instructions.last
+            visitVarInsn(Opcodes.ALOAD, 1)
+            visitFieldInsn(Opcodes.GETFIELD, TEST_CLASS, "f", "I")
+            get = instructions.last
+            visitInsn(Opcodes.POP)
+
+            // The receiver is either a new object or null
+            visitVarInsn(Opcodes.ILOAD, 0)
+            visitJumpInsn(Opcodes.IFEQ, isNull)
+            newTest()
+            visitVarInsn(Opcodes.ASTORE, 2)
+            visitJumpInsn(Opcodes.GOTO, merge)
+            visitLabel(isNull)
+            visitInsn(Opcodes.ACONST_NULL)
+            visitVarInsn(Opcodes.ASTORE, 2)
+            visitLabel(merge)
+            visitVarInsn(Opcodes.ALOAD, 2)
+            visitFieldInsn(Opcodes.GETFIELD, TEST_CLASS, "f", "I")
+            getMaybeNull = instructions.last
+            visitInsn(Opcodes.IRETURN)
+            visitMaxs(3, 3)
+        }
+
+        val checks = assertNotNull(AccessChecks.analyze(method))
+        assertTrue(checks.isUnchecked(put))
+        assertTrue(checks.isUnchecked(get))
+        assertFalse(checks.isUnchecked(getMaybeNull))
+    }
+
+    @Test
+    fun `test index divided by constant`() {
+        lateinit var loadInRange: AbstractInsnNode
+        lateinit var loadOutOfRange: AbstractInsnNode
+        lateinit var loadDivided: AbstractInsnNode
+        val method = testMethod("()I") {
+            visitInsn(Opcodes.ICONST_3)
+            visitIntInsn(Opcodes.NEWARRAY, Opcodes.T_INT)
+            visitVarInsn(Opcodes.ASTORE, 0)
+
+            visitVarInsn(Opcodes.ALOAD, 0)
+            visitInsn(Opcodes.ICONST_2)
+            visitInsn(Opcodes.IALOAD)
+            loadInRange = instructions.last
+            visitInsn(Opcodes.POP)
+
+            visitVarInsn(Opcodes.ALOAD, 0)
+            visitInsn(Opcodes.ICONST_3)
+            visitInsn(Opcodes.IALOAD)
+            loadOutOfRange = instructions.last
+            visitInsn(Opcodes.POP)
+
+            // Only constants are followed, 8 / 4 is not folded
+            visitVarInsn(Opcodes.ALOAD, 0)
+            visitIntInsn(Opcodes.BIPUSH, 8)
+            visitInsn(Opcodes.ICONST_4)
+            visitInsn(Opcodes.IDIV)
+            visitInsn(Opcodes.IALOAD)
+            loadDivided = instructions.last
+            visitInsn(Opcodes.IRETURN)
+            visitMaxs(3, 1)
+        }
+
+        val checks = assertNotNull(AccessChecks.analyze(method))
+        assertTrue(checks.isUnchecked(loadInRange))
+        assertFalse(checks.isUnchecked(loadOutOfRange))
+        assertFalse(checks.isUnchecked(loadDivided))
+    }
+
+    @Test
+    fun `test method with subroutine`() {
+        val method = testMethod("()I") {
+            val subroutine = Label()
+
+            visitInsn(Opcodes.ICONST_3)
+            visitIntInsn(Opcodes.NEWARRAY, Opcodes.T_INT)
+            visitVarInsn(Opcodes.ASTORE, 0)
+            visitJumpInsn(Opcodes.JSR, subroutine)
+            visitVarInsn(Opcodes.ALOAD, 0)
+            visitInsn(Opcodes.ICONST_0)
+            visitInsn(Opcodes.IALOAD)
+            visitInsn(Opcodes.IRETURN)
+
+            visitLabel(subroutine)
+            visitVarInsn(Opcodes.ASTORE, 1)
+            visitVarInsn(Opcodes.RET, 1)
+            visitMaxs(2, 2)
+        }
+
+        assertNull(AccessChecks.analyze(method))
+    }
+}
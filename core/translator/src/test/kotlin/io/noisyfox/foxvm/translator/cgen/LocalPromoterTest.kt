@@ -0,0 +1,157 @@
+package io.noisyfox.foxvm.translator.cgen
+
+import io.noisyfox.foxvm.bytecode.clazz.MethodInfo
+import org.objectweb.asm.Label
+import org.objectweb.asm.Opcodes
+import org.objectweb.asm.tree.AbstractInsnNode
+import java.io.StringWriter
+import kotlin.test.Test
+import kotlin.test.assertEquals
+import kotlin.test.assertFalse
+import kotlin.test.assertTrue
+
+class LocalPromoterTest {
+
+    /**
+     * @property code the code written by the promoter.
+     * @property unhandled the instructions that are left to the normal `bc_*` instructions.
+     */
+    private class Translation(val code: String, val unhandled: List<AbstractInsnNode>)
+
+    private fun translate(method: MethodInfo): Translation {
+        val out = StringWriter()
+        val cWriter = CWriter(out)
+        val unhandled = mutableListOf<AbstractInsnNode>()
+
+        val promoter = LocalPromoter.create(method)
+        promoter.writeDeclarations(cWriter)
+        method.methodNode.instructions.forEach {
+            if (!promoter.write(cWriter, it)) {
+                unhandled.add(it)
+            }
+        }
+        cWriter.finish()
+
+        return Translation(out.toString(), unhandled)
+    }
+
+    @Test
+    fun `test locals live across exception handler`() {
+        lateinit var invoke: AbstractInsnNode
+        lateinit var handlerPop: AbstractInsnNode
+        val method = testMethod("(I)I") {
+            val start = Label()
+            val end = Label()
+            val handler = Label()
+            visitTryCatchBlock(start, end, handler, "java/lang/Exception")
+
+            visitLabel(start)
+            visitVarInsn(Opcodes.ILOAD, 0)
+            visitInsn(Opcodes.ICONST_1)
+            visitInsn(Opcodes.IADD)
+            visitVarInsn(Opcodes.ISTORE, 1)
+            visitMethodInsn(Opcodes.INVOKESTATIC, TEST_CLASS, "foo", "()V", false)
+            invoke = instructions.last
+            visitLabel(end)
+            visitVarInsn(Opcodes.ILOAD, 1)
+            visitInsn(Opcodes.IRETURN)
+
+            visitLabel(handler)
+            visitInsn(Opcodes.POP)
+            handlerPop = instructions.last
+            visitVarInsn(Opcodes.ILOAD, 1)
+            visitInsn(Opcodes.IRETURN)
+            visitMaxs(2, 2)
+        }
+
+        val translation = translate(method)
+        assertTrue("JAVA_INT __l0 = bc_arg_i(0);" in translation.code)
+        assertTrue("JAVA_INT __l1 = 0;" in translation.code)
+        assertTrue("__l1 = __t0;" in translation.code)
+        // The handler reads the same C variable that was written inside the try block
+        assertEquals(2, translation.code.split("bc_return_r(__l1);").size - 1)
+
+        assertTrue(invoke in translation.unhandled)
+        // The exception is on the real operand stack when the handler is entered
+        assertTrue(handlerPop in translation.unhandled)
+    }
+
+    @Test
+    fun `test locals used in subroutine`() {
+        lateinit var jsr: AbstractInsnNode
+        lateinit var storeAddress: AbstractInsnNode
+        lateinit var ret: AbstractInsnNode
+        val method = testMethod("()I") {
+            val subroutine = Label()
+
+            visitInsn(Opcodes.ICONST_0)
+            visitVarInsn(Opcodes.ISTORE, 0)
+            visitJumpInsn(Opcodes.JSR, subroutine)
+            jsr = instructions.last
+            visitVarInsn(Opcodes.ILOAD, 0)
+            visitInsn(Opcodes.IRETURN)
+
+            visitLabel(subroutine)
+            visitVarInsn(Opcodes.ASTORE, 1)
+            storeAddress = instructions.last
+            visitIincInsn(0, 1)
+            visitVarInsn(Opcodes.RET, 1)
+            ret = instructions.last
+            visitMaxs(1, 2)
+        }
+
+        val translation = translate(method)
+        assertTrue("JAVA_INT __l0 = 0;" in translation.code)
+        assertTrue("__l0 = bc_value_iadd(__l0, 1);" in translation.code)
+        assertTrue("bc_return_r(__l0);" in translation.code)
+        // The return address is never promoted
+        assertFalse("__l1" in translation.code)
+
+        assertTrue(jsr in translation.unhandled)
+        assertTrue(storeAddress in translation.unhandled)
+        assertTrue(ret in translation.unhandled)
+    }
+
+    @Test
+    fun `test slot reused with different type`() {
+        lateinit var argumentStore: AbstractInsnNode
+        lateinit var intStore: AbstractInsnNode
+        val method = testMethod("(F)V") {
+            // The float argument is overwritten by an int
+            visitInsn(Opcodes.ICONST_1)
+            visitVarInsn(Opcodes.ISTORE, 0)
+            argumentStore = instructions.last
+
+            visitInsn(Opcodes.FCONST_1)
+            visitVarInsn(Opcodes.FSTORE, 1)
+            visitInsn(Opcodes.ICONST_2)
+            visitVarInsn(Opcodes.ISTORE, 1)
+            intStore = instructions.last
+
+            visitInsn(Opcodes.LCONST_1)
+            visitVarInsn(Opcodes.LSTORE, 2)
+
+            visitInsn(Opcodes.ICONST_2)
+            visitVarInsn(Opcodes.ISTORE, 4)
+            visitInsn(Opcodes.ACONST_NULL)
+            visitVarInsn(Opcodes.ASTORE, 4)
+
+            visitInsn(Opcodes.ICONST_3)
+            visitVarInsn(Opcodes.ISTORE, 5)
+            visitInsn(Opcodes.RETURN)
+            visitMaxs(2, 6)
+        }
+
+        val translation = translate(method)
+        assertFalse("__l0" in translation.code)
+        assertFalse("__l1" in translation.code)
+        assertFalse("__l4" in translation.code)
+        assertTrue("JAVA_LONG __l2 = 0;" in translation.code)
+        assertTrue("JAVA_INT __l5 = 0;" in translation.code)
+
+        // Stores to locals that are not promoted go through the real operand stack
+        assertTrue(argumentStore in translation.unhandled)
+        assertTrue(intStore in translation.unhandled)
+        assertTrue("bc_push_i((1l));" in translation.code)
+    }
+}
@@ -0,0 +1,97 @@
+package io.noisyfox.foxvm.translator.cgen
+
+import io.noisyfox.foxvm.bytecode.toModifiedUtf8
+import org.junit.jupiter.api.Assertions.assertTimeoutPreemptively
+import org.junit.jupiter.api.function.Executable
+import org.junit.jupiter.api.function.ThrowingSupplier
+import java.time.Duration
+import kotlin.test.Test
+import kotlin.test.assertEquals
+import kotlin.test.assertFailsWith
+
+/**
+ * The vectors must match the ones checked by `cl_bootstrap_init()` in
+ * .\native\runtime\classloader\vm_boot_classloader.c
+ */
+class PerfectHashTableTest {
+
+    @Test
+    fun `test hash()`() {
+        assertEquals(unsigned("cbf29ce484222325"), PerfectHashTable.hash(ByteArray(0)))
+        assertEquals(unsigned("af63dc4c8601ec8c"), PerfectHashTable.hash("a".toModifiedUtf8()))
+        assertEquals(unsigned("85944171f73967e8"), PerfectHashTable.hash("foobar".toModifiedUtf8()))
+        assertEquals(unsigned("ab7c168ed6969c44"), PerfectHashTable.hash("java/lang/Object".toModifiedUtf8()))
+        assertEquals(unsigned("9ba35cf574bbb092"), PerfectHashTable.hash("java/lang/String".toModifiedUtf8()))
+    }
+
+    @Test
+    fun `test slotOf()`() {
+        val objectHash = unsigned("ab7c168ed6969c44")
+        assertEquals(51, PerfectHashTable.slotOf(objectHash, 1, 97))
+        assertEquals(62, PerfectHashTable.slotOf(objectHash, 12345, 97))
+        assertEquals(94, PerfectHashTable.slotOf(objectHash, 7, 1000))
+
+        val stringHash = unsigned("9ba35cf574bbb092")
+        assertEquals(1, PerfectHashTable.slotOf(stringHash, 1, 97))
+        assertEquals(96, PerfectHashTable.slotOf(stringHash, 12345, 97))
+        assertEquals(528, PerfectHashTable.slotOf(stringHash, 7, 1000))
+
+        // Buckets are selected by the unsigned remainder
+        assertEquals(50, PerfectHashTable.bucketOf(objectHash, 97))
+        assertEquals(68, PerfectHashTable.bucketOf(stringHash, 97))
+    }
+
+    @Test
+    fun `test build()`() {
+        listOf(1, 2, 3, 10, 100, 4000).forEach { count ->
+            val keys = (0 until count).map { "io/noisyfox/test/Class$it" }
+            assertPlacedOnce(keys, PerfectHashTable.build(keys) { it.toModifiedUtf8() })
+        }
+    }
+
+    @Test
+    fun `test build() with keys in the same bucket`() {
+        val size = 8
+        val keys = generateSequence(0) { it + 1 }
+            .map { "Class$it" }
+            .filter { PerfectHashTable.bucketOf(PerfectHashTable.hash(it.toModifiedUtf8()), size) == 0 }
+            .take(size)
+            .toList()
+
+        val table = assertTimeoutPreemptively(Duration.ofSeconds(30), ThrowingSupplier {
+            PerfectHashTable.build(keys) { it.toModifiedUtf8() }
+        })
+        assertPlacedOnce(keys, table)
+    }
+
+    @Test
+    fun `test build() with hash collision`() {
+        assertTimeoutPreemptively(Duration.ofSeconds(30), Executable {
+            assertFailsWith<IllegalStateException> {
+                PerfectHashTable.build(listOf("a", "b", "c")) { "same".toModifiedUtf8() }
+            }
+        })
+    }
+
+    private fun unsigned(hex: String): Long = java.lang.Long.parseUnsignedLong(hex, 16)
+
+    /** Make sure every key is placed in exactly one slot, and can be found the same way as the C side does. */
+    private fun assertPlacedOnce(keys: List<String>, table: PerfectHashTable<String>) {
+        assertEquals(keys.size, table.size)
+        assertEquals(keys.sorted(), table.keys.sorted())
+        assertEquals(keys.size, table.seeds.size)
+
+        keys.forEach { key ->
+            val hash = PerfectHashTable.hash(key.toModifiedUtf8())
+            val seed = table.seeds[PerfectHashTable.bucketOf(hash, table.size)]
+            val slot = if (seed < 0) {
+                -seed - 1
+            } else {
+                PerfectHashTable.slotOf(hash, seed, table.size)
+            }
+
+            assertEquals(key, table.keys[slot], "Slot of $key")
+            assertEquals(hash, table.hashes[slot], "Hash of $key")
+        }
+    }
+}
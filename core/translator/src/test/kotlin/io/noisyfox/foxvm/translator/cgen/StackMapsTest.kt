@@ -0,0 +1,119 @@
+package io.noisyfox.foxvm.translator.cgen
+
+import org.objectweb.asm.Label
+import org.objectweb.asm.Opcodes
+import org.objectweb.asm.tree.AbstractInsnNode
+import org.objectweb.asm.tree.MethodNode
+import java.util.BitSet
+import kotlin.test.Test
+import kotlin.test.assertEquals
+import kotlin.test.assertFalse
+import kotlin.test.assertNotNull
+
+class StackMapsTest {
+
+    private fun bits(vararg indexes: Int): BitSet = BitSet().apply { indexes.forEach { set(it) } }
+
+    private fun MethodNode.newObject() {
+        visitTypeInsn(Opcodes.NEW, "java/lang/Object")
+        visitInsn(Opcodes.DUP)
+        visitMethodInsn(Opcodes.INVOKESPECIAL, "java/lang/Object", "<init>", "()V", false)
+    }
+
+    @Test
+    fun `test refs at invoke`() {
+        lateinit var init: AbstractInsnNode
+        lateinit var invoke: AbstractInsnNode
+        lateinit var add: AbstractInsnNode
+        val method = testMethod("(Ljava/lang/Object;I)V") {
+            newObject()
+            init = instructions.last
+            visitVarInsn(Opcodes.ASTORE, 2)
+            visitVarInsn(Opcodes.ALOAD, 2)
+            visitVarInsn(Opcodes.ILOAD, 1)
+            visitMethodInsn(Opcodes.INVOKESTATIC, TEST_CLASS, "foo", "(Ljava/lang/Object;I)V", false)
+            invoke = instructions.last
+            visitVarInsn(Opcodes.ILOAD, 1)
+            visitInsn(Opcodes.ICONST_1)
+            visitInsn(Opcodes.IADD)
+            add = instructions.last
+            visitInsn(Opcodes.POP)
+            visitInsn(Opcodes.RETURN)
+            visitMaxs(2, 3)
+        }
+
+        val stackMaps = assertNotNull(StackMaps.analyze(method))
+        // Local 2 is not assigned yet, and both the new object and its copy are on the stack
+        assertEquals(bits(0, 3, 4), stackMaps.refsAt(init))
+        // Operand stack starts right after the 3 locals
+        assertEquals(bits(0, 2, 3), stackMaps.refsAt(invoke))
+        assertFalse(stackMaps.isGcPoint(add))
+    }
+
+    @Test
+    fun `test refs at merge point`() {
+        lateinit var invoke: AbstractInsnNode
+        val method = testMethod("(I)V") {
+            val otherwise = Label()
+            val merge = Label()
+
+            visitVarInsn(Opcodes.ILOAD, 0)
+            visitJumpInsn(Opcodes.IFEQ, otherwise)
+            visitLdcInsn("ref")
+            visitVarInsn(Opcodes.ASTORE, 1)
+            visitLdcInsn("ref")
+            visitVarInsn(Opcodes.ASTORE, 2)
+            visitJumpInsn(Opcodes.GOTO, merge)
+
+            visitLabel(otherwise)
+            visitInsn(Opcodes.ICONST_0)
+            visitVarInsn(Opcodes.ISTORE, 1)
+            visitInsn(Opcodes.ACONST_NULL)
+            visitVarInsn(Opcodes.ASTORE, 2)
+
+            visitLabel(merge)
+            visitMethodInsn(Opcodes.INVOKESTATIC, TEST_CLASS, "foo", "()V", false)
+            invoke = instructions.last
+            visitInsn(Opcodes.RETURN)
+            visitMaxs(1, 3)
+        }
+
+        val stackMaps = assertNotNull(StackMaps.analyze(method))
+        // Local 1 is a reference on one path and an int on the other, so it must not be scanned
+        assertEquals(bits(2), stackMaps.refsAt(invoke))
+    }
+
+    @Test
+    fun `test refs at exception handler`() {
+        lateinit var invokeInTry: AbstractInsnNode
+        lateinit var invokeInHandler: AbstractInsnNode
+        val method = testMethod("()V") {
+            val start = Label()
+            val end = Label()
+            val handler = Label()
+            visitTryCatchBlock(start, end, handler, "java/lang/Throwable")
+
+            newObject()
+            visitVarInsn(Opcodes.ASTORE, 0)
+
+            visitLabel(start)
+            newObject()
+            visitVarInsn(Opcodes.ASTORE, 1)
+            visitMethodInsn(Opcodes.INVOKESTATIC, TEST_CLASS, "foo", "()V", false)
+            invokeInTry = instructions.last
+            visitLabel(end)
+            visitInsn(Opcodes.RETURN)
+
+            visitLabel(handler)
+            visitMethodInsn(Opcodes.INVOKEVIRTUAL, "java/lang/Throwable", "printStackTrace", "()V", false)
+            invokeInHandler = instructions.last
+            visitInsn(Opcodes.RETURN)
+            visitMaxs(2, 2)
+        }
+
+        val stackMaps = assertNotNull(StackMaps.analyze(method))
+        assertEquals(bits(0, 1), stackMaps.refsAt(invokeInTry))
+        // Local 1 might be unassigned when the exception is thrown, the exception itself is on the stack
+        assertEquals(bits(0, 2), stackMaps.refsAt(invokeInHandler))
+    }
+}
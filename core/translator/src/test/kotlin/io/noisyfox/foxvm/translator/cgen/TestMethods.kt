@@ -0,0 +1,53 @@
+package io.noisyfox.foxvm.translator.cgen
+
+import io.noisyfox.foxvm.bytecode.clazz.ClassInfo
+import io.noisyfox.foxvm.bytecode.clazz.Clazz
+import io.noisyfox.foxvm.bytecode.clazz.MethodInfo
+import org.objectweb.asm.ClassWriter
+import org.objectweb.asm.Opcodes
+import org.objectweb.asm.Type
+import org.objectweb.asm.tree.MethodNode
+import java.io.ByteArrayInputStream
+
+const val TEST_CLASS = "test/Test"
+
+/** The class that declares all methods created by [testMethod]. */
+private val testClass: ClassInfo by lazy {
+    val writer = ClassWriter(0)
+    writer.visit(Opcodes.V1_8, Opcodes.ACC_PUBLIC or Opcodes.ACC_SUPER, TEST_CLASS, null, "java/lang/Object", null)
+    writer.visitEnd()
+
+    ClassInfo(
+        thisClass = Clazz(false, "$TEST_CLASS.class", ByteArrayInputStream(writer.toByteArray())),
+        cIdentifier = "test_Test",
+        version = Opcodes.V1_8,
+        modifier = Opcodes.ACC_PUBLIC,
+        signature = null,
+        superClass = null,
+        interfaces = emptyList()
+    )
+}
+
+/**
+ * Create a method of [TEST_CLASS] with the code generated by [code], which must end with [MethodNode.visitMaxs].
+ */
+fun testMethod(
+    descriptor: String,
+    access: Int = Opcodes.ACC_PUBLIC or Opcodes.ACC_STATIC,
+    code: MethodNode.() -> Unit
+): MethodInfo {
+    val node = MethodNode(Opcodes.ASM8, access, "test", descriptor, null, null)
+    node.visitCode()
+    node.code()
+    node.visitEnd()
+
+    return MethodInfo(
+        declaringClass = testClass,
+        access = access,
+        name = "test",
+        cIdentifier = "test",
+        descriptor = Type.getMethodType(descriptor),
+        signature = null,
+        methodNode = node
+    )
+}
@@ -7,7 +7,7 @@
 #include "vm_thread.h"
 #include "vm_gc.h"
 #include <string.h>
-#include "uthash.h"
+#include "opa_primitives.h"
 #include <stdio.h>
 #include "vm_bytecode.h"
 #include "vm_array.h"
@@ -17,6 +17,9 @@
 #include "vm_primitive.h"
 
 extern JavaClassInfo *foxvm_class_infos_rt[];
+extern const uint32_t foxvm_class_infos_rt_count;
+extern const int32_t foxvm_class_infos_rt_seeds[];
+extern const uint64_t foxvm_class_infos_rt_hashes[];
 
 // A fake object for locking
 static JavaObjectBase g_bootstrapClassLockObj = {0};
@@ -60,11 +63,13 @@ cached_class(java_lang_UnsatisfiedLinkError);
 cached_class(java_lang_InstantiationError);
 cached_class(java_lang_IllegalAccessError);
 cached_class(java_lang_AbstractMethodError);
+cached_class(java_lang_ExceptionInInitializerError);
 
 // Exceptions
 cached_class(java_lang_Throwable);
 cached_class(java_lang_RuntimeException);
 cached_class(java_lang_NullPointerException);
+cached_class(java_lang_ArithmeticException);
 cached_class(java_lang_ArrayIndexOutOfBoundsException);
 cached_class(java_lang_ArrayStoreException);
 cached_class(java_lang_ClassNotFoundException);
@@ -82,19 +87,36 @@ cached_class(java_lang_reflect_Method);
 FieldInfo *g_field_java_lang_Class_fvmNativeType = NULL;
 static MethodInfo *java_lang_Class_init = NULL;
 
+/**
+ * Entry of loaded class tables. The key is the JavaClassInfo of non-array classes,
+ * or the descriptor string of array classes.
+ */
 typedef struct {
-    void *key;
+    const void *key;
+    uint32_t hash;
     JAVA_CLASS clazz;
-    UT_hash_handle hh;
 } LoadedClassEntry;
-static LoadedClassEntry *g_loadedClasses = NULL;
 
-typedef struct {
-    C_CSTR key;
-    JAVA_CLASS clazz;
-    UT_hash_handle hh;
-} LoadedArrayClassEntry;
-static LoadedArrayClassEntry *g_loadedArrayClasses = NULL;
+/**
+ * Open addressing hash table of LoadedClassEntry, with lock-free readers.
+ *
+ * Writers must hold the lock of the table. A new entry is fully initialized before being
+ * published to its slot, and entries are never removed, so readers can probe the slots without
+ * locking. When growing, a new table is filled and then published as a whole; the old one is
+ * retired instead of freed since readers might still be probing it.
+ */
+typedef struct _LoadedClassTable LoadedClassTable;
+struct _LoadedClassTable {
+    uint32_t capacity; // Always power of 2
+    uint32_t count;
+    LoadedClassTable *retired;
+    OPA_ptr_t slots[];
+};
+
+#define LOADED_CLASS_TABLE_INITIAL_CAPACITY 256
+
+static OPA_ptr_t g_loadedClasses = OPA_PTR_T_INITIALIZER(NULL);
+static OPA_ptr_t g_loadedArrayClasses = OPA_PTR_T_INITIALIZER(NULL);
 
 // Interfaces that implemented by all arrays:
 // java/lang/Cloneable and java/io/Serializable
@@ -190,23 +212,70 @@ static JavaClassInfo g_classInfo_array_prototype = {
         .finalizer = NULL,
 };
 
-/** Find class info by class name */
-static JavaClassInfo *cl_bootstrap_class_info_lookup(C_CSTR className) {
-    JavaClassInfo **cursor = foxvm_class_infos_rt;
-    JavaClassInfo *currentInfo = *cursor;
-    while (currentInfo != NULL) {
-        // Compare the class name
-        if (strcmp(className, currentInfo->thisClass) == 0) {
-            return currentInfo;
-        }
+/**
+ * 64-bit FNV-1a hash of the class name.
+ *
+ * Must be synced with `PerfectHashTable` in .\core\translator\src\main\kotlin\io\noisyfox\foxvm\translator\cgen\PerfectHashTable.kt
+ */
+static inline uint64_t cl_class_name_hash(C_CSTR name, size_t len) {
+    uint64_t h = UINT64_C(0xcbf29ce484222325);
+    for (size_t i = 0; i < len; i++) {
+        h ^= (uint8_t) name[i];
+        h *= UINT64_C(0x100000001b3);
+    }
+    return h;
+}
+
+/** Slot of the class name with the given hash when displaced by the seed of its bucket */
+static inline uint32_t cl_class_name_slot(uint64_t hash, int32_t seed, uint32_t size) {
+    if (seed < 0) {
+        // Bucket contains only this class
+        return (uint32_t) (-(int64_t) seed - 1);
+    }
+
+    // Finalizer of MurmurHash3
+    uint64_t h = hash ^ ((uint64_t) (uint32_t) seed * UINT64_C(0x9e3779b97f4a7c15));
+    h ^= h >> 33;
+    h *= UINT64_C(0xff51afd7ed558ccd);
+    h ^= h >> 33;
+    h *= UINT64_C(0xc4ceb9fe1a85ec53);
+    h ^= h >> 33;
+    return (uint32_t) (h % size);
+}
 
-        cursor++;
-        currentInfo = *cursor;
+/**
+ * Find class info by the first [len] bytes of class name, using the perfect hash table generated by the translator.
+ * The hash only leads to one candidate, which is then verified by comparing the name.
+ */
+static JavaClassInfo *cl_bootstrap_class_info_lookup_n(C_CSTR className, size_t len) {
+    uint32_t size = foxvm_class_infos_rt_count;
+    if (size == 0) {
+        return NULL;
+    }
+
+    uint64_t hash = cl_class_name_hash(className, len);
+    uint32_t slot = cl_class_name_slot(hash, foxvm_class_infos_rt_seeds[hash % size], size);
+    if (slot >= size || foxvm_class_infos_rt_hashes[slot] != hash) {
+        return NULL;
+    }
+
+    JavaClassInfo *info = foxvm_class_infos_rt[slot];
+    if (strncmp(className, info->thisClass, len) == 0
+        // Make sure the class name has the same length, since strncmp will match if
+        // [className] is the prefix of the actual name, for example,
+        //   strncmp("class1", "class12", 6) == 0
+        && info->thisClass[len] == '\0') {
+        return info;
     }
 
     return NULL;
 }
 
+/** Find class info by class name */
+static JavaClassInfo *cl_bootstrap_class_info_lookup(C_CSTR className) {
+    return cl_bootstrap_class_info_lookup_n(className, strlen(className));
+}
+
 static JavaClassInfo *cl_bootstrap_class_info_lookup_by_descriptor(C_CSTR desc) {
     assert(desc[0] == TYPE_DESC_REFERENCE);
     size_t len = strlen(desc);
@@ -215,23 +284,104 @@ static JavaClassInfo *cl_bootstrap_class_info_lookup_by_descriptor(C_CSTR desc)
     desc++; // Skip the first L
     len -= 2; // Then also remove the last ;
 
-    JavaClassInfo **cursor = foxvm_class_infos_rt;
-    JavaClassInfo *currentInfo = *cursor;
-    while (currentInfo != NULL) {
-        // Compare the class name
-        if (strncmp(desc, currentInfo->thisClass, len) == 0
-            // Make sure the class name has the same length, since strncmp will match if
-            // [desc] is the prefix of the actual name, for example,
-            //   strncmp("class1", "class12", 6) == 0
-            && currentInfo->thisClass[len] == '\0') {
-            return currentInfo;
+    return cl_bootstrap_class_info_lookup_n(desc, len);
+}
+
+static inline uint32_t cl_loaded_class_hash_info(JavaClassInfo *info) {
+    uint64_t h = ((uintptr_t) info >> 3) * UINT64_C(0x9e3779b97f4a7c15);
+    return (uint32_t) (h >> 32);
+}
+
+static inline uint32_t cl_loaded_class_hash_desc(C_CSTR desc) {
+    return (uint32_t) cl_class_name_hash(desc, strlen(desc));
+}
+
+static inline LoadedClassTable *cl_loaded_class_table_new(uint32_t capacity) {
+    LoadedClassTable *table = heap_alloc_uncollectable(sizeof(LoadedClassTable) + capacity * sizeof(OPA_ptr_t));
+    if (table) {
+        table->capacity = capacity;
+    }
+    return table;
+}
+
+#define cl_loaded_class_table_foreach(tableRef, entryVar)                                           \
+    for (LoadedClassTable *_table = OPA_load_ptr(tableRef); _table != NULL; _table = NULL)         \
+        for (uint32_t _i = 0; _i < _table->capacity; _i++)                                         \
+            for (LoadedClassEntry *entryVar = OPA_load_ptr(&_table->slots[_i]); entryVar != NULL; entryVar = NULL)
+
+/**
+ * Find the entry with the given key without locking.
+ *
+ * @param by_name if true, compare the keys as C strings, otherwise compare them as pointers.
+ */
+static inline LoadedClassEntry *cl_loaded_class_table_find(OPA_ptr_t *tableRef, const void *key, uint32_t hash, JAVA_BOOLEAN by_name) {
+    LoadedClassTable *table = OPA_load_acquire_ptr(tableRef);
+    if (!table) {
+        return NULL;
+    }
+
+    uint32_t mask = table->capacity - 1;
+    for (uint32_t i = hash & mask;; i = (i + 1) & mask) {
+        LoadedClassEntry *entry = OPA_load_acquire_ptr(&table->slots[i]);
+        if (!entry) {
+            return NULL;
         }
+        if (entry->hash == hash && (by_name ? strcmp(entry->key, key) == 0 : entry->key == key)) {
+            return entry;
+        }
+    }
+}
 
-        cursor++;
-        currentInfo = *cursor;
+static inline void cl_loaded_class_table_put(LoadedClassTable *table, LoadedClassEntry *entry) {
+    uint32_t mask = table->capacity - 1;
+    uint32_t i = entry->hash & mask;
+    while (OPA_load_ptr(&table->slots[i])) {
+        i = (i + 1) & mask;
     }
+    // Entry must be visible before it can be found
+    OPA_store_release_ptr(&table->slots[i], entry);
+    table->count++;
+}
 
-    return NULL;
+/**
+ * Add the entry to the table. Must be called with the lock of the table held.
+ */
+static JAVA_BOOLEAN cl_loaded_class_table_add(OPA_ptr_t *tableRef, LoadedClassEntry *entry) {
+    LoadedClassTable *table = OPA_load_ptr(tableRef);
+
+    // Keep the load factor under 3/4
+    if (!table || (table->count + 1) * 4 > table->capacity * 3) {
+        uint32_t capacity = table ? table->capacity * 2 : LOADED_CLASS_TABLE_INITIAL_CAPACITY;
+        LoadedClassTable *newTable = cl_loaded_class_table_new(capacity);
+        if (!newTable) {
+            return JAVA_FALSE;
+        }
+        if (table) {
+            for (uint32_t i = 0; i < table->capacity; i++) {
+                LoadedClassEntry *e = OPA_load_ptr(&table->slots[i]);
+                if (e) {
+                    cl_loaded_class_table_put(newTable, e);
+                }
+            }
+        }
+        newTable->retired = table;
+        OPA_store_release_ptr(tableRef, newTable);
+        table = newTable;
+    }
+
+    cl_loaded_class_table_put(table, entry);
+    return JAVA_TRUE;
+}
+
+/**
+ * Check if the class found without locking is ready to use, otherwise the caller
+ * needs to go through the locked path and wait for the loading thread.
+ */
+static inline JAVA_BOOLEAN cl_bootstrap_class_is_resolved(JAVA_CLASS clazz) {
+    JAVA_BOOLEAN resolved = clazz->state >= CLASS_STATE_RESOLVED;
+    // Pairs with the write barrier before marking the class as resolved
+    OPA_read_barrier();
+    return resolved;
 }
 
 #define load_class_info(var, className) do {                                                            \
@@ -273,6 +423,9 @@ static void cl_bootstrap_init_class_object(VM_PARAM_CURRENT_CONTEXT, JAVA_OBJECT
     bc_invoke_special(java_lang_Class_init->code);
 
     stack_frame_end();
+    return;
+
+    exception_suppressedv();
 }
 
 static JAVA_BOOLEAN cl_bootstrap_create_class(VM_PARAM_CURRENT_CONTEXT, JavaClassInfo *classInfo,
@@ -310,9 +463,16 @@ static JAVA_BOOLEAN cl_bootstrap_register_class(VM_PARAM_CURRENT_CONTEXT, JAVA_C
         return JAVA_FALSE;
     }
     entry->key = clazz->info;
+    entry->hash = cl_loaded_class_hash_info(clazz->info);
     entry->clazz = clazz;
-    HASH_ADD_PTR(g_loadedClasses, key, entry);
     clazz->state = CLASS_STATE_REGISTERED;
+    if (!cl_loaded_class_table_add(&g_loadedClasses, entry)) {
+        heap_free_uncollectable(entry);
+        fprintf(stderr, "Bootstrap Classloader: unable to grow loaded class table for class %s\n",
+                clazz->info->thisClass);
+        // TODO: throw OOM exception
+        return JAVA_FALSE;
+    }
 
     return JAVA_TRUE;
 }
@@ -368,6 +528,13 @@ static JAVA_CLASS cl_bootstrap_createPrimitiveClass(VM_PARAM_CURRENT_CONTEXT, Ja
 } while(0)
 
 JAVA_BOOLEAN cl_bootstrap_init(VM_PARAM_CURRENT_CONTEXT) {
+    // Must be synced with PerfectHashTableTest in the translator
+    assert(cl_class_name_hash("", 0) == UINT64_C(0xcbf29ce484222325));
+    assert(cl_class_name_hash("foobar", 6) == UINT64_C(0x85944171f73967e8));
+    assert(cl_class_name_hash("java/lang/Object", 16) == UINT64_C(0xab7c168ed6969c44));
+    assert(cl_class_name_slot(UINT64_C(0xab7c168ed6969c44), 12345, 97) == 62);
+    assert(cl_class_name_slot(UINT64_C(0x9ba35cf574bbb092), 7, 1000) == 528);
+
     g_bootstrapClassLock.data.o = &g_bootstrapClassLockObj;
     g_bootstrapClassLock.type = VM_SLOT_OBJECT;
     if (monitor_create(vmCurrentContext, &g_bootstrapClassLock) != thrd_success) {
@@ -455,19 +622,13 @@ JAVA_BOOLEAN cl_bootstrap_init(VM_PARAM_CURRENT_CONTEXT) {
         c->classInstance->clazz = g_class_java_lang_Class;                      \
         cl_bootstrap_init_class_object(vmCurrentContext, c->classInstance, c);  \
     } while(0)
-    {
-        LoadedClassEntry *cursor;
-        for (cursor = g_loadedClasses; cursor != NULL; cursor = cursor->hh.next) {
-            JAVA_CLASS c = cursor->clazz;
-            fix_class(c);
-        }
+    cl_loaded_class_table_foreach(&g_loadedClasses, cursor) {
+        JAVA_CLASS c = cursor->clazz;
+        fix_class(c);
     }
-    {
-        LoadedArrayClassEntry *cursor;
-        for (cursor = g_loadedArrayClasses; cursor != NULL; cursor = cursor->hh.next) {
-            JAVA_CLASS c = cursor->clazz;
-            fix_class(c);
-        }
+    cl_loaded_class_table_foreach(&g_loadedArrayClasses, cursor) {
+        JAVA_CLASS c = cursor->clazz;
+        fix_class(c);
     }
     fix_class(g_class_primitive_Z);
     fix_class(g_class_primitive_B);
@@ -503,10 +664,12 @@ JAVA_BOOLEAN cl_bootstrap_init(VM_PARAM_CURRENT_CONTEXT) {
     cache_class(java_lang_InstantiationError, "java/lang/InstantiationError");
     cache_class(java_lang_IllegalAccessError, "java/lang/IllegalAccessError");
     cache_class(java_lang_AbstractMethodError, "java/lang/AbstractMethodError");
+    cache_class(java_lang_ExceptionInInitializerError, "java/lang/ExceptionInInitializerError");
 
     cache_class(java_lang_Throwable, "java/lang/Throwable");
     cache_class(java_lang_RuntimeException, "java/lang/RuntimeException");
     cache_class(java_lang_NullPointerException, "java/lang/NullPointerException");
+    cache_class(java_lang_ArithmeticException, "java/lang/ArithmeticException");
     cache_class(java_lang_ArrayIndexOutOfBoundsException, "java/lang/ArrayIndexOutOfBoundsException");
     cache_class(java_lang_ArrayStoreException, "java/lang/ArrayStoreException");
     cache_class(java_lang_ClassNotFoundException, "java/lang/ClassNotFoundException");
@@ -524,14 +687,42 @@ JAVA_BOOLEAN cl_bootstrap_init(VM_PARAM_CURRENT_CONTEXT) {
     return JAVA_TRUE;
 }
 
+void cl_bootstrap_scan_classes(scan_func fn, void *scan_context) {
+    // Called with the world stopped, so no one is adding classes
+    cl_loaded_class_table_foreach(&g_loadedClasses, cursor) {
+        fn((JAVA_OBJECT *) &cursor->clazz, scan_context);
+    }
+    cl_loaded_class_table_foreach(&g_loadedArrayClasses, cursor) {
+        fn((JAVA_OBJECT *) &cursor->clazz, scan_context);
+    }
+
+    // Primitive classes are not registered in the class table
+    fn((JAVA_OBJECT *) &g_class_primitive_Z, scan_context);
+    fn((JAVA_OBJECT *) &g_class_primitive_B, scan_context);
+    fn((JAVA_OBJECT *) &g_class_primitive_C, scan_context);
+    fn((JAVA_OBJECT *) &g_class_primitive_S, scan_context);
+    fn((JAVA_OBJECT *) &g_class_primitive_I, scan_context);
+    fn((JAVA_OBJECT *) &g_class_primitive_J, scan_context);
+    fn((JAVA_OBJECT *) &g_class_primitive_F, scan_context);
+    fn((JAVA_OBJECT *) &g_class_primitive_D, scan_context);
+    fn((JAVA_OBJECT *) &g_class_primitive_V, scan_context);
+}
+
 JAVA_CLASS cl_bootstrap_get_loaded_class(JavaClassInfo *classInfo) {
-    LoadedClassEntry *entry;
-    HASH_FIND_PTR(g_loadedClasses, &classInfo, entry);
+    LoadedClassEntry *entry = cl_loaded_class_table_find(&g_loadedClasses, classInfo, cl_loaded_class_hash_info(classInfo), JAVA_FALSE);
 
     return entry ? entry->clazz : (JAVA_CLASS) JAVA_NULL;
 }
 
 JAVA_CLASS cl_bootstrap_find_class_by_info(VM_PARAM_CURRENT_CONTEXT, JavaClassInfo *classInfo) {
+    // Fast path: class is already loaded, no need to lock
+    {
+        JAVA_CLASS clazz = cl_bootstrap_get_loaded_class(classInfo);
+        if (clazz != (JAVA_CLASS) JAVA_NULL && cl_bootstrap_class_is_resolved(clazz)) {
+            return clazz;
+        }
+    }
+
     int ret = monitor_enter(vmCurrentContext, &g_bootstrapClassLock);
     if (ret != thrd_success) {
         return (JAVA_CLASS) JAVA_NULL;
@@ -615,12 +806,20 @@ JAVA_CLASS cl_bootstrap_find_class_by_info(VM_PARAM_CURRENT_CONTEXT, JavaClassIn
         return (JAVA_CLASS) JAVA_NULL;
     }
 
+    if(classloader_prepare_itable(vmCurrentContext, thisClass) != JAVA_TRUE) {
+        thisClass->state = CLASS_STATE_ERROR;
+        monitor_exit(vmCurrentContext, &g_bootstrapClassLock);
+        // TODO: throw OOM exception
+        return (JAVA_CLASS) JAVA_NULL;
+    }
+
     // Init the java/lang/Class instance
     if (java_lang_Class_init) {
         cl_bootstrap_init_class_object(vmCurrentContext, classObject, thisClass);
     }
 
-    // Mark current class as resolved
+    // Mark current class as resolved, after everything above is visible to the lock-free readers
+    OPA_write_barrier();
     thisClass->state = CLASS_STATE_RESOLVED;
 
     monitor_exit(vmCurrentContext, &g_bootstrapClassLock);
@@ -652,6 +851,16 @@ JAVA_CLASS cl_bootstrap_find_class_by_descriptor(VM_PARAM_CURRENT_CONTEXT, C_CST
 static JAVA_CLASS cl_bootstrap_find_array_class(VM_PARAM_CURRENT_CONTEXT, C_CSTR desc) {
     assert(desc[0] == TYPE_DESC_ARRAY);
 
+    uint32_t hash = cl_loaded_class_hash_desc(desc);
+
+    // Fast path: array class is already created, no need to lock
+    {
+        LoadedClassEntry *entry = cl_loaded_class_table_find(&g_loadedArrayClasses, desc, hash, JAVA_TRUE);
+        if (entry && cl_bootstrap_class_is_resolved(entry->clazz)) {
+            return entry->clazz;
+        }
+    }
+
     int ret = monitor_enter(vmCurrentContext, &g_bootstrapArrayClassLock);
     if (ret != thrd_success) {
         return (JAVA_CLASS) JAVA_NULL;
@@ -659,8 +868,7 @@ static JAVA_CLASS cl_bootstrap_find_array_class(VM_PARAM_CURRENT_CONTEXT, C_CSTR
 
     // Find class in dynamic created array cache
     {
-        LoadedArrayClassEntry *entry;
-        HASH_FIND_STR(g_loadedArrayClasses, desc, entry);
+        LoadedClassEntry *entry = cl_loaded_class_table_find(&g_loadedArrayClasses, desc, hash, JAVA_TRUE);
         if (entry) {
             JAVA_CLASS c = entry->clazz;
             monitor_exit(vmCurrentContext, &g_bootstrapArrayClassLock);
@@ -696,6 +904,9 @@ static JAVA_CLASS cl_bootstrap_find_array_class(VM_PARAM_CURRENT_CONTEXT, C_CSTR
 
     JavaArrayClass *arrayClass = (JavaArrayClass *) thisClass;
     arrayClass->componentType = componentType;
+    arrayClass->elementType = array_type_of(desc);
+    arrayClass->elementSize = type_size(arrayClass->elementType);
+    arrayClass->headerSize = array_header_size(arrayClass->elementType);
 
     // Make a copy of the class desc string
     C_CSTR desc_dup = strdup(desc);
@@ -708,18 +919,26 @@ static JAVA_CLASS cl_bootstrap_find_array_class(VM_PARAM_CURRENT_CONTEXT, C_CSTR
 
     {
         // We then register the class
-        LoadedArrayClassEntry *entry = heap_alloc_uncollectable(sizeof(LoadedArrayClassEntry));
+        LoadedClassEntry *entry = heap_alloc_uncollectable(sizeof(LoadedClassEntry));
         if (!entry) {
             monitor_exit(vmCurrentContext, &g_bootstrapArrayClassLock);
             free((void *) desc_dup);
-            fprintf(stderr, "Bootstrap Classloader: unable to alloc LoadedArrayClassEntry for array class %s\n", desc);
+            fprintf(stderr, "Bootstrap Classloader: unable to alloc LoadedClassEntry for array class %s\n", desc);
             // TODO: throw OOM exception
             return (JAVA_CLASS) JAVA_NULL;
         }
         entry->key = desc_dup; // <- here we keep the reference to the duplicated string, so it won't leak
+        entry->hash = hash;
         entry->clazz = thisClass;
-        HASH_ADD_STR(g_loadedArrayClasses, key, entry);
         thisClass->state = CLASS_STATE_REGISTERED;
+        if (!cl_loaded_class_table_add(&g_loadedArrayClasses, entry)) {
+            monitor_exit(vmCurrentContext, &g_bootstrapArrayClassLock);
+            heap_free_uncollectable(entry);
+            free((void *) desc_dup);
+            fprintf(stderr, "Bootstrap Classloader: unable to grow loaded class table for array class %s\n", desc);
+            // TODO: throw OOM exception
+            return (JAVA_CLASS) JAVA_NULL;
+        }
     }
 
     // Then we pre-init the class
@@ -742,7 +961,8 @@ static JAVA_CLASS cl_bootstrap_find_array_class(VM_PARAM_CURRENT_CONTEXT, C_CSTR
         cl_bootstrap_init_class_object(vmCurrentContext, classObject, thisClass);
     }
 
-    // Mark current class as resolved
+    // Mark current class as resolved, after everything above is visible to the lock-free readers
+    OPA_write_barrier();
     thisClass->state = CLASS_STATE_RESOLVED;
 
     monitor_exit(vmCurrentContext, &g_bootstrapArrayClassLock);
@@ -6,6 +6,7 @@
 #define FOXVM_VM_BOOT_CLASSLOADER_H
 
 #include "vm_base.h"
+#include "vm_gc.h"
 
 #define cached_class(var)                \
 extern JavaClassInfo *g_classInfo_##var; \
@@ -41,11 +42,13 @@ cached_class(java_lang_UnsatisfiedLinkError);
 cached_class(java_lang_InstantiationError);
 cached_class(java_lang_IllegalAccessError);
 cached_class(java_lang_AbstractMethodError);
+cached_class(java_lang_ExceptionInInitializerError);
 
 // Exceptions
 cached_class(java_lang_Throwable);
 cached_class(java_lang_RuntimeException);
 cached_class(java_lang_NullPointerException);
+cached_class(java_lang_ArithmeticException);
 cached_class(java_lang_ArrayIndexOutOfBoundsException);
 cached_class(java_lang_ArrayStoreException);
 cached_class(java_lang_ClassNotFoundException);
@@ -71,4 +74,10 @@ JAVA_CLASS cl_bootstrap_find_class(VM_PARAM_CURRENT_CONTEXT, C_CSTR className);
 
 JAVA_CLASS cl_bootstrap_find_class_by_descriptor(VM_PARAM_CURRENT_CONTEXT, C_CSTR desc);
 
+/**
+ * Scan all classes loaded by the bootstrap class loader. Classes are never unloaded so
+ * they are always GC roots. Must be called when the world is stopped.
+ */
+void cl_bootstrap_scan_classes(scan_func fn, void *scan_context);
+
 #endif //FOXVM_VM_BOOT_CLASSLOADER_H
@@ -9,6 +9,9 @@
 #include "vm_array.h"
 #include <string.h>
 #include "vm_string.h"
+#include "vm_method.h"
+#include "vm_gc.h"
+#include "vm_exception.h"
 
 JAVA_BOOLEAN classloader_init(VM_PARAM_CURRENT_CONTEXT) {
     if (!cl_bootstrap_init(vmCurrentContext)) {
@@ -31,6 +34,8 @@ JAVA_BOOLEAN classloader_init(VM_PARAM_CURRENT_CONTEXT) {
 
 JAVA_BOOLEAN classloader_init_class(VM_PARAM_CURRENT_CONTEXT, JAVA_CLASS clazz) {
     if (clazz->state == CLASS_STATE_INITIALIZED) {
+        // Make sure everything written by the initializing thread is visible to us
+        OPA_read_barrier();
         return JAVA_TRUE;
     }
 
@@ -108,6 +113,7 @@ JAVA_BOOLEAN classloader_init_class(VM_PARAM_CURRENT_CONTEXT, JAVA_CLASS clazz)
             JAVA_OBJECT str = string_get_constant(vmCurrentContext, index);
             JAVA_OBJECT *fieldPtr = ptr_inc(clazz, f->info.offset);
             *fieldPtr = str;
+            heap_write_barrier(fieldPtr, str);
         }
     }
 
@@ -171,8 +177,8 @@ JAVA_BOOLEAN classloader_init_class(VM_PARAM_CURRENT_CONTEXT, JAVA_CLASS clazz)
     vmCurrentContext->callingClass = clazz;
     // Call the function
     clinit(vmCurrentContext);
-    // TODO: handle error
-    JAVA_BOOLEAN clinit_success = JAVA_TRUE;
+    // Any exception thrown by the clinit is left pending
+    JAVA_BOOLEAN clinit_success = !exception_occurred(vmCurrentContext);
     // Pop the stack
     stack_frame_end();
 
@@ -183,7 +189,13 @@ JAVA_BOOLEAN classloader_init_class(VM_PARAM_CURRENT_CONTEXT, JAVA_CLASS clazz)
         class_init_completed(JAVA_TRUE);
         return JAVA_TRUE;
     } else {
-        // TODO: handle error
+        // 11. Otherwise, the class or interface initialization method must have completed
+        //     abruptly by throwing some exception E. If the class of E is not Error or one of its
+        //     subclasses, then create a new instance of the class ExceptionInInitializerError with E
+        //     as the argument, and use this object in place of E in the following step.
+        exception_wrap_ExceptionInInitializerError(vmCurrentContext);
+        // 12. Acquire LC, label the Class object for C as erroneous, notify all waiting threads,
+        //     release LC, and complete this procedure abruptly with reason E or its replacement.
         class_init_completed(JAVA_FALSE);
         return JAVA_FALSE;
     }
@@ -290,6 +302,104 @@ JAVA_BOOLEAN classloader_prepare_fields(VM_PARAM_CURRENT_CONTEXT, JAVA_CLASS thi
     return JAVA_TRUE;
 }
 
+// Count all interfaces that declare methods implemented by the given class, may contain duplicates
+static uint32_t classloader_count_interfaces(JavaClassInfo *classInfo) {
+    uint32_t count = classInfo->methodCount > 0 && (classInfo->accessFlags & CLASS_ACC_INTERFACE) ? 1 : 0;
+
+    for (uint16_t i = 0; i < classInfo->interfaceCount; i++) {
+        count += classloader_count_interfaces(classInfo->interfaces[i]);
+    }
+    if (classInfo->superClass) {
+        count += classloader_count_interfaces(classInfo->superClass);
+    }
+
+    return count;
+}
+
+static JAVA_BOOLEAN classloader_itable_add(JAVA_CLASS thisClass, JavaClassInfo *interface) {
+    if (interface->methodCount > 0) {
+        uint32_t mask = thisClass->itableMask;
+        uint32_t i = ((uint32_t) (((uintptr_t) interface) >> 3u)) & mask;
+        while (thisClass->itable[i].interface != NULL) {
+            if (thisClass->itable[i].interface == interface) {
+                // Already added through another path
+                return JAVA_TRUE;
+            }
+            i = (i + 1) & mask;
+        }
+
+        void **codes = heap_alloc_uncollectable(sizeof(void *) * interface->methodCount);
+        if (!codes) {
+            return JAVA_FALSE;
+        }
+
+        JavaClassInfo *classInfo = thisClass->info;
+        for (uint16_t m = 0; m < interface->methodCount; m++) {
+            int32_t vtableIndex = method_ivtable_find(classInfo, interface, m);
+            if (vtableIndex >= 0) {
+                // Illegal access is left to the slow path
+                if (method_is_public(method_vtable_get(classInfo, vtableIndex))) {
+                    codes[m] = classInfo->vtable[vtableIndex].code;
+                }
+            } else {
+                // Default method, or NULL if it's abstract
+                codes[m] = interface->methods[m]->code;
+            }
+        }
+
+        thisClass->itable[i].interface = interface;
+        thisClass->itable[i].codes = codes;
+    }
+
+    for (uint16_t i = 0; i < interface->interfaceCount; i++) {
+        if (classloader_itable_add(thisClass, interface->interfaces[i]) != JAVA_TRUE) {
+            return JAVA_FALSE;
+        }
+    }
+
+    return JAVA_TRUE;
+}
+
+JAVA_BOOLEAN classloader_prepare_itable(VM_PARAM_CURRENT_CONTEXT, JAVA_CLASS thisClass) {
+    JavaClassInfo *classInfo = thisClass->info;
+
+    thisClass->itableMask = 0;
+    thisClass->itable = NULL;
+
+    // Interfaces are never the runtime type of an object
+    if (classInfo->accessFlags & CLASS_ACC_INTERFACE) {
+        return JAVA_TRUE;
+    }
+
+    uint32_t count = classloader_count_interfaces(classInfo);
+    if (count == 0) {
+        return JAVA_TRUE;
+    }
+
+    // Keep the load factor below 0.5
+    uint32_t size = 4;
+    while (size < count * 2) {
+        size <<= 1u;
+    }
+    thisClass->itable = heap_alloc_uncollectable(sizeof(ITableEntry) * size);
+    if (!thisClass->itable) {
+        fprintf(stderr, "Classloader: unable to alloc itable for class %s\n", classInfo->thisClass);
+        return JAVA_FALSE;
+    }
+    thisClass->itableMask = size - 1;
+
+    for (JavaClassInfo *c = classInfo; c; c = c->superClass) {
+        for (uint16_t i = 0; i < c->interfaceCount; i++) {
+            if (classloader_itable_add(thisClass, c->interfaces[i]) != JAVA_TRUE) {
+                fprintf(stderr, "Classloader: unable to prepare itable for class %s\n", classInfo->thisClass);
+                return JAVA_FALSE;
+            }
+        }
+    }
+
+    return JAVA_TRUE;
+}
+
 JAVA_CLASS classloader_get_class_by_desc(VM_PARAM_CURRENT_CONTEXT, JAVA_OBJECT classloader, C_CSTR desc) {
     JAVA_CLASS c = NULL;
     if (classloader == NULL) {
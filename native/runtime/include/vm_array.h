@@ -6,6 +6,7 @@
 #define FOXVM_VM_ARRAYS_H
 
 #include "vm_base.h"
+#include "vm_memory.h"
 #include <assert.h>
 
 //*********************************************************************************************************
@@ -29,6 +30,11 @@ typedef struct _JavaArrayClass {
     // need to worry about memory memory management.
     JavaClassInfo classInfo;
     JAVA_CLASS componentType;
+
+    // Element info parsed from the descriptor when the class is created
+    BasicType elementType;
+    size_t elementSize;
+    size_t headerSize;
 } JavaArrayClass;
 
 struct _JavaArray {
@@ -37,14 +43,46 @@ struct _JavaArray {
     JAVA_INT length;
 };
 
-/** Returns the offset of the first element. */
-size_t array_header_size(BasicType t);
+static inline JavaArrayClass *array_class_of(JAVA_ARRAY a) {
+    return (JavaArrayClass *) obj_get_class(&a->baseObject);
+}
+
+/**
+ * Check whether the elements of the given array can be accessed by the load / store instruction of the given type.
+ * baload / bastore are also used by boolean arrays, and aaload / aastore by arrays of arrays.
+ */
+static inline JAVA_BOOLEAN array_element_type_matches(JAVA_ARRAY a, BasicType t) {
+    BasicType elementType = array_class_of(a)->elementType;
+    switch (t) {
+        case VM_TYPE_BYTE:
+            return elementType == VM_TYPE_BYTE || elementType == VM_TYPE_BOOLEAN;
+        case VM_TYPE_OBJECT:
+            return elementType == VM_TYPE_OBJECT || elementType == VM_TYPE_ARRAY;
+        default:
+            return elementType == t;
+    }
+}
+
+// Check whether an element of am array with the given type must be
+// aligned 0 mod 8.
+static inline size_t array_element_alignment(BasicType t) {
+    return (t == VM_TYPE_DOUBLE || t == VM_TYPE_LONG) ? 8 : ANY_ALIGNMENT;
+}
+
+/** Returns the offset of the first element. Inlined so it's folded into a constant for known types. */
+static inline size_t array_header_size(BasicType t) {
+    return align_size_up(sizeof(JavaArrayBase), array_element_alignment(t));
+}
 
 /** Returns the address of the first element. */
-void *array_base(JAVA_ARRAY a, BasicType t);
+static inline void *array_base(JAVA_ARRAY a, BasicType t) {
+    return ptr_inc(a, array_header_size(t));
+}
 
 /** Returns the address of the element at index. */
-void *array_element_at(JAVA_ARRAY a, BasicType t, size_t index);
+static inline void *array_element_at(JAVA_ARRAY a, BasicType t, size_t index) {
+    return ptr_inc(array_base(a, t), type_size(t) * index);
+}
 
 /** Return the maximum length of an array of BasicType. */
 size_t array_max_length(BasicType t);
@@ -52,6 +90,11 @@ size_t array_max_length(BasicType t);
 /** Return the size in byte of an array of BasicType of given length. */
 size_t array_size_of_type(BasicType t, size_t length);
 
+/** Return the size in byte of an array of given class and length, same as [array_size_of_type] of its element type. */
+static inline size_t array_class_size_of(JavaArrayClass *arrayClass, size_t length) {
+    return align_size_up(arrayClass->headerSize + arrayClass->elementSize * length, SIZE_ALIGNMENT);
+}
+
 /** Return the minimum size in byte of an array of BasicType. */
 static inline size_t array_min_size_of_type(BasicType t) {
     return array_size_of_type(t, 0);
@@ -76,6 +119,11 @@ static inline BasicType array_type_of(C_CSTR desc) {
  */
 JAVA_ARRAY array_new(VM_PARAM_CURRENT_CONTEXT, C_CSTR desc, JAVA_INT length);
 
+/**
+ * Create an array of given length of the given array class, without looking up the class by name.
+ */
+JAVA_ARRAY array_new_of_class(VM_PARAM_CURRENT_CONTEXT, JAVA_CLASS arrayClass, JAVA_INT length);
+
 JAVA_VOID array_set_object(VM_PARAM_CURRENT_CONTEXT, JAVA_ARRAY array, JAVA_INT index, JAVA_OBJECT obj);
 
 #endif //FOXVM_VM_ARRAYS_H
@@ -199,6 +199,12 @@ typedef struct {
     JAVA_BOOLEAN isReference;
 } PreResolvedFieldInfo;
 
+/** A run of contiguous reference fields of an instance, used by GC for tracing references */
+typedef struct {
+    ptrdiff_t offset; // Offset of the first reference field from the beginning of the [JavaObjectBase]
+    uint32_t count; // Number of reference fields in this run
+} ReferenceFieldBlock;
+
 typedef enum {
     METHOD_ACC_PUBLIC = 0x0001,
     METHOD_ACC_PRIVATE = 0x0002,
@@ -214,6 +220,18 @@ typedef enum {
     METHOD_ACC_SYNTHETIC = 0x1000,
 } MethodAccFlag;
 
+/**
+ * GC reference map of a translated method frame at a single instruction,
+ * generated by the translator from the bytecode frame analysis.
+ */
+typedef struct {
+    int32_t label; // Index of the instruction in the method this map applies to
+    uint16_t stackDepth; // Depth of the operand stack before the instruction is executed
+    // Bitmap of reference slots, 1 bit for each slot, locals first and then the operand stack,
+    // in the same layout as the slots of the [JavaStackFrame]
+    const uint8_t *refs;
+} StackMapEntry;
+
 /** Java .class method_info */
 typedef struct {
     uint16_t accessFlags;
@@ -224,6 +242,11 @@ typedef struct {
     JavaClassInfo *declaringClass; // The class that declares this method
 
     void *code; // Pointer to the function
+
+    // GC stack maps of this method, sorted by label. If there is no stack map at the current label of
+    // the frame then the GC falls back to checking the slot types.
+    uint16_t stackMapCount;
+    StackMapEntry *stackMaps;
 } MethodInfo;
 
 typedef struct {
@@ -253,6 +276,12 @@ typedef struct {
     IVTableMethodIndex* methodIndexes;
 } IVTableItem;
 
+// Flattened implementation of an interface in a class, built by class loader for fast interface method dispatch
+typedef struct {
+    JavaClassInfo *interface; // NULL means empty slot
+    void **codes; // Function ptr of each method in `interface->methods`, NULL if it must be handled by the slow path
+} ITableEntry;
+
 typedef enum {
     CLASS_ACC_PUBLIC = 0x0001,
     CLASS_ACC_PRIVATE = 0x0002,
@@ -300,6 +329,9 @@ struct _JavaClassInfo {
     uint32_t preResolvedInstanceFieldCount; // Include ALL instance fields from super classes
     PreResolvedFieldInfo *preResolvedInstanceFields;
 
+    uint16_t referenceBlockCount; // Include reference fields from super classes
+    ReferenceFieldBlock *referenceBlocks;
+
     uint16_t vtableCount;
     VTableItem *vtable;
 
@@ -355,6 +387,11 @@ struct _JavaClass {
     int interfaceCount;
     JAVA_CLASS *interfaces;
 
+    // Open addressing hash table of all interfaces implemented by this class, keyed by the interface info.
+    // NULL if this class doesn't implement any interface method.
+    uint32_t itableMask; // Size of the table - 1
+    ITableEntry *itable;
+
     // Static fields of this class, fields from super class / interfaces not included.
     uint16_t staticFieldCount; // Number of resolved static fields of this class
     ResolvedField *staticFields;
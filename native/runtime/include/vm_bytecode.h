@@ -7,7 +7,11 @@
 
 #include "vm_stack.h"
 #include "vm_exception.h"
+#include "vm_gc.h"
+#include "vm_array.h"
 #include "jni.h"
+#include "opa_primitives.h"
+#include <math.h>
 
 /**
  * Nop instruction
@@ -19,11 +23,11 @@
  *
  * Increment local variable by [amount]
  */
-#define bc_iinc(local, amount) do {                 \
-    local_check_index(local);                       \
-    assert(local_of(local).type == VM_SLOT_INT);    \
-                                                    \
-    local_of(local).data.i += amount;               \
+#define bc_iinc(local, amount) do {                                             \
+    local_check_index(local);                                                   \
+    assert(local_of(local).type == VM_SLOT_INT);                                \
+                                                                                \
+    local_of(local).data.i = bc_value_iadd(local_of(local).data.i, amount);     \
 } while(0)
 
 
@@ -132,176 +136,312 @@
 /** Swap the top two operand stack values */
 #define bc_swap() stack_swap(OP_STACK)
 
-// Variants of the arithmetic instructions
-#define decl_arithmetic_func(n) void bc_arithmetic_##n(VMOperandStack *stack)
-#define decl_arithmetic_func_prefix_all(n) \
-decl_arithmetic_func(i##n);\
-decl_arithmetic_func(l##n);\
-decl_arithmetic_func(f##n);\
-decl_arithmetic_func(d##n)
-
-decl_arithmetic_func_prefix_all(add);
-decl_arithmetic_func_prefix_all(sub);
-decl_arithmetic_func_prefix_all(mul);
-decl_arithmetic_func_prefix_all(div);
-decl_arithmetic_func_prefix_all(rem);
-decl_arithmetic_func_prefix_all(neg);
-
-#define bc_iadd() bc_arithmetic_iadd(OP_STACK)
-#define bc_ladd() bc_arithmetic_ladd(OP_STACK)
-#define bc_fadd() bc_arithmetic_fadd(OP_STACK)
-#define bc_dadd() bc_arithmetic_dadd(OP_STACK)
-
-#define bc_isub() bc_arithmetic_isub(OP_STACK)
-#define bc_lsub() bc_arithmetic_lsub(OP_STACK)
-#define bc_fsub() bc_arithmetic_fsub(OP_STACK)
-#define bc_dsub() bc_arithmetic_dsub(OP_STACK)
-
-#define bc_imul() bc_arithmetic_imul(OP_STACK)
-#define bc_lmul() bc_arithmetic_lmul(OP_STACK)
-#define bc_fmul() bc_arithmetic_fmul(OP_STACK)
-#define bc_dmul() bc_arithmetic_dmul(OP_STACK)
-
-#define bc_idiv() bc_arithmetic_idiv(OP_STACK)
-#define bc_ldiv() bc_arithmetic_ldiv(OP_STACK)
-#define bc_fdiv() bc_arithmetic_fdiv(OP_STACK)
-#define bc_ddiv() bc_arithmetic_ddiv(OP_STACK)
-
-#define bc_irem() bc_arithmetic_irem(OP_STACK)
-#define bc_lrem() bc_arithmetic_lrem(OP_STACK)
-#define bc_frem() bc_arithmetic_frem(OP_STACK)
-#define bc_drem() bc_arithmetic_drem(OP_STACK)
-
-#define bc_ineg() bc_arithmetic_ineg(OP_STACK)
-#define bc_lneg() bc_arithmetic_lneg(OP_STACK)
-#define bc_fneg() bc_arithmetic_fneg(OP_STACK)
-#define bc_dneg() bc_arithmetic_dneg(OP_STACK)
-
-// Variants of the bitwise instructions
-#define decl_bitwise_func_prefix_all(n) \
-decl_arithmetic_func(i##n);\
-decl_arithmetic_func(l##n)
-
-decl_bitwise_func_prefix_all(shl);
-decl_bitwise_func_prefix_all(shr);
-decl_bitwise_func_prefix_all(ushr);
-decl_bitwise_func_prefix_all(and);
-decl_bitwise_func_prefix_all(or);
-decl_bitwise_func_prefix_all(xor);
-
-#define bc_ishl() bc_arithmetic_ishl(OP_STACK)
-#define bc_lshl() bc_arithmetic_lshl(OP_STACK)
-
-#define bc_ishr() bc_arithmetic_ishr(OP_STACK)
-#define bc_lshr() bc_arithmetic_lshr(OP_STACK)
-
-#define bc_iushr() bc_arithmetic_iushr(OP_STACK)
-#define bc_lushr() bc_arithmetic_lushr(OP_STACK)
-
-#define bc_iand() bc_arithmetic_iand(OP_STACK)
-#define bc_land() bc_arithmetic_land(OP_STACK)
-
-#define bc_ior() bc_arithmetic_ior(OP_STACK)
-#define bc_lor() bc_arithmetic_lor(OP_STACK)
-
-#define bc_ixor() bc_arithmetic_ixor(OP_STACK)
-#define bc_lxor() bc_arithmetic_lxor(OP_STACK)
+// Arithmetic instructions.
+// The value of each instruction is computed by a bc_value_* function with the exact Java semantics, which C
+// does not guarantee: integer overflow wraps around, integer division by zero throws ArithmeticException,
+// and float to integer conversions saturate. Those functions are shared by the inlined stack instructions
+// below and the promoted locals, so both produce the same straight-line C code without any function call.
+static inline JAVA_INT bc_value_iadd(JAVA_INT a, JAVA_INT b) { return (JAVA_INT) ((JAVA_UINT) a + (JAVA_UINT) b); }
+static inline JAVA_LONG bc_value_ladd(JAVA_LONG a, JAVA_LONG b) { return (JAVA_LONG) ((JAVA_ULONG) a + (JAVA_ULONG) b); }
+static inline JAVA_FLOAT bc_value_fadd(JAVA_FLOAT a, JAVA_FLOAT b) { return a + b; }
+static inline JAVA_DOUBLE bc_value_dadd(JAVA_DOUBLE a, JAVA_DOUBLE b) { return a + b; }
+
+static inline JAVA_INT bc_value_isub(JAVA_INT a, JAVA_INT b) { return (JAVA_INT) ((JAVA_UINT) a - (JAVA_UINT) b); }
+static inline JAVA_LONG bc_value_lsub(JAVA_LONG a, JAVA_LONG b) { return (JAVA_LONG) ((JAVA_ULONG) a - (JAVA_ULONG) b); }
+static inline JAVA_FLOAT bc_value_fsub(JAVA_FLOAT a, JAVA_FLOAT b) { return a - b; }
+static inline JAVA_DOUBLE bc_value_dsub(JAVA_DOUBLE a, JAVA_DOUBLE b) { return a - b; }
+
+static inline JAVA_INT bc_value_imul(JAVA_INT a, JAVA_INT b) { return (JAVA_INT) ((JAVA_UINT) a * (JAVA_UINT) b); }
+static inline JAVA_LONG bc_value_lmul(JAVA_LONG a, JAVA_LONG b) { return (JAVA_LONG) ((JAVA_ULONG) a * (JAVA_ULONG) b); }
+static inline JAVA_FLOAT bc_value_fmul(JAVA_FLOAT a, JAVA_FLOAT b) { return a * b; }
+static inline JAVA_DOUBLE bc_value_dmul(JAVA_DOUBLE a, JAVA_DOUBLE b) { return a * b; }
+
+static inline JAVA_INT bc_value_ineg(JAVA_INT a) { return (JAVA_INT) (0u - (JAVA_UINT) a); }
+static inline JAVA_LONG bc_value_lneg(JAVA_LONG a) { return (JAVA_LONG) (0u - (JAVA_ULONG) a); }
+static inline JAVA_FLOAT bc_value_fneg(JAVA_FLOAT a) { return -a; }
+static inline JAVA_DOUBLE bc_value_dneg(JAVA_DOUBLE a) { return -a; }
+
+// The divisor is never zero here, since it's checked by the instruction before calling these.
+// The only overflow of integer division is MIN_VALUE / -1, which traps in C. Java wraps it back to MIN_VALUE.
+static inline JAVA_INT bc_value_idiv(JAVA_INT a, JAVA_INT b) {
+    assert(b != 0);
+    return b == -1 ? bc_value_ineg(a) : a / b;
+}
+static inline JAVA_LONG bc_value_ldiv(JAVA_LONG a, JAVA_LONG b) {
+    assert(b != 0);
+    return b == -1 ? bc_value_lneg(a) : a / b;
+}
+static inline JAVA_FLOAT bc_value_fdiv(JAVA_FLOAT a, JAVA_FLOAT b) { return a / b; }
+static inline JAVA_DOUBLE bc_value_ddiv(JAVA_DOUBLE a, JAVA_DOUBLE b) { return a / b; }
+
+static inline JAVA_INT bc_value_irem(JAVA_INT a, JAVA_INT b) {
+    assert(b != 0);
+    return b == -1 ? 0 : a % b;
+}
+static inline JAVA_LONG bc_value_lrem(JAVA_LONG a, JAVA_LONG b) {
+    assert(b != 0);
+    return b == -1 ? 0 : a % b;
+}
+// % does not work with float and double.
+// fmodf produce incorrect results for values close to zero. Converting the
+// operands to doubles and using fmod() returns the expected result. See
+// https://github.com/robovm/robovm/issues/89
+static inline JAVA_FLOAT bc_value_frem(JAVA_FLOAT a, JAVA_FLOAT b) { return (JAVA_FLOAT) fmod(a, b); }
+static inline JAVA_DOUBLE bc_value_drem(JAVA_DOUBLE a, JAVA_DOUBLE b) { return fmod(a, b); }
+
+// Shift distance only uses the low 5 / 6 bits
+static inline JAVA_INT bc_value_ishl(JAVA_INT x, JAVA_INT shift) { return (JAVA_INT) ((JAVA_UINT) x << ((JAVA_UINT) shift & 0x1Fu)); }
+static inline JAVA_LONG bc_value_lshl(JAVA_LONG x, JAVA_INT shift) { return (JAVA_LONG) ((JAVA_ULONG) x << ((JAVA_UINT) shift & 0x3Fu)); }
+static inline JAVA_INT bc_value_iushr(JAVA_INT x, JAVA_INT shift) { return (JAVA_INT) ((JAVA_UINT) x >> ((JAVA_UINT) shift & 0x1Fu)); }
+static inline JAVA_LONG bc_value_lushr(JAVA_LONG x, JAVA_INT shift) { return (JAVA_LONG) ((JAVA_ULONG) x >> ((JAVA_UINT) shift & 0x3Fu)); }
+
+/** Arithmetic right shift, since C dose not have a signed right shift operator */
+static inline JAVA_INT bc_value_ishr(JAVA_INT x, JAVA_INT shift) {
+    JAVA_UINT s = (JAVA_UINT) shift & 0x1Fu;
+    if (s > 0 && x < 0) {
+        return (JAVA_INT) ((JAVA_UINT) x >> s | ~(~((JAVA_UINT) 0u) >> s));
+    }
+
+    // Same as logical shift
+    return (JAVA_INT) ((JAVA_UINT) x >> s);
+}
+
+static inline JAVA_LONG bc_value_lshr(JAVA_LONG x, JAVA_INT shift) {
+    JAVA_ULONG s = (JAVA_ULONG) shift & 0x3Fu;
+    if (s > 0 && x < 0) {
+        return (JAVA_LONG) ((JAVA_ULONG) x >> s | ~(~((JAVA_ULONG) 0u) >> s));
+    }
+
+    // Same as logical shift
+    return (JAVA_LONG) ((JAVA_ULONG) x >> s);
+}
+
+static inline JAVA_INT bc_value_iand(JAVA_INT a, JAVA_INT b) { return a & b; }
+static inline JAVA_LONG bc_value_land(JAVA_LONG a, JAVA_LONG b) { return a & b; }
+static inline JAVA_INT bc_value_ior(JAVA_INT a, JAVA_INT b) { return a | b; }
+static inline JAVA_LONG bc_value_lor(JAVA_LONG a, JAVA_LONG b) { return a | b; }
+static inline JAVA_INT bc_value_ixor(JAVA_INT a, JAVA_INT b) { return a ^ b; }
+static inline JAVA_LONG bc_value_lxor(JAVA_LONG a, JAVA_LONG b) { return a ^ b; }
+
+// Type conversions
+static inline JAVA_LONG bc_value_i2l(JAVA_INT v) { return v; }
+static inline JAVA_FLOAT bc_value_i2f(JAVA_INT v) { return (JAVA_FLOAT) v; }
+static inline JAVA_DOUBLE bc_value_i2d(JAVA_INT v) { return v; }
+static inline JAVA_INT bc_value_l2i(JAVA_LONG v) { return (JAVA_INT) (JAVA_UINT) (JAVA_ULONG) v; }
+static inline JAVA_FLOAT bc_value_l2f(JAVA_LONG v) { return (JAVA_FLOAT) v; }
+static inline JAVA_DOUBLE bc_value_l2d(JAVA_LONG v) { return (JAVA_DOUBLE) v; }
+static inline JAVA_DOUBLE bc_value_f2d(JAVA_FLOAT v) { return v; }
+static inline JAVA_FLOAT bc_value_d2f(JAVA_DOUBLE v) { return (JAVA_FLOAT) v; }
+static inline JAVA_INT bc_value_i2b(JAVA_INT v) { return (JAVA_BYTE) v; }
+// For i2c the char value is zero-extended to an int value, so here we need a unsigned cast
+static inline JAVA_INT bc_value_i2c(JAVA_INT v) { return (JAVA_UCHAR) v; }
+static inline JAVA_INT bc_value_i2s(JAVA_INT v) { return (JAVA_SHORT) v; }
+
+// Casting NaN or a value out of range to an integer is undefined in C. Java converts NaN to 0 and
+// rounds the rest to the nearest representable value.
+static inline JAVA_INT bc_value_f2i(JAVA_FLOAT v) {
+    if (isnan(v)) {
+        return 0;
+    }
+    if (v >= (JAVA_FLOAT) JAVA_INT_MAX) {
+        return JAVA_INT_MAX;
+    }
+    if (v <= (JAVA_FLOAT) JAVA_INT_MIN) {
+        return JAVA_INT_MIN;
+    }
+    return (JAVA_INT) v;
+}
+static inline JAVA_LONG bc_value_f2l(JAVA_FLOAT v) {
+    if (isnan(v)) {
+        return 0;
+    }
+    if (v >= (JAVA_FLOAT) JAVA_LONG_MAX) {
+        return JAVA_LONG_MAX;
+    }
+    if (v <= (JAVA_FLOAT) JAVA_LONG_MIN) {
+        return JAVA_LONG_MIN;
+    }
+    return (JAVA_LONG) v;
+}
+static inline JAVA_INT bc_value_d2i(JAVA_DOUBLE v) {
+    if (isnan(v)) {
+        return 0;
+    }
+    if (v >= (JAVA_DOUBLE) JAVA_INT_MAX) {
+        return JAVA_INT_MAX;
+    }
+    if (v <= (JAVA_DOUBLE) JAVA_INT_MIN) {
+        return JAVA_INT_MIN;
+    }
+    return (JAVA_INT) v;
+}
+static inline JAVA_LONG bc_value_d2l(JAVA_DOUBLE v) {
+    if (isnan(v)) {
+        return 0;
+    }
+    if (v >= (JAVA_DOUBLE) JAVA_LONG_MAX) {
+        return JAVA_LONG_MAX;
+    }
+    if (v <= (JAVA_DOUBLE) JAVA_LONG_MIN) {
+        return JAVA_LONG_MIN;
+    }
+    return (JAVA_LONG) v;
+}
+
+// Comparisons. The l / g variants only differ in the result when either value is NaN.
+static inline JAVA_INT bc_value_lcmp(JAVA_LONG a, JAVA_LONG b) { return (a > b) - (a < b); }
+static inline JAVA_INT bc_value_fcmpl(JAVA_FLOAT a, JAVA_FLOAT b) { return a > b ? 1 : (a == b ? 0 : -1); }
+static inline JAVA_INT bc_value_fcmpg(JAVA_FLOAT a, JAVA_FLOAT b) { return a < b ? -1 : (a == b ? 0 : 1); }
+static inline JAVA_INT bc_value_dcmpl(JAVA_DOUBLE a, JAVA_DOUBLE b) { return a > b ? 1 : (a == b ? 0 : -1); }
+static inline JAVA_INT bc_value_dcmpg(JAVA_DOUBLE a, JAVA_DOUBLE b) { return a < b ? -1 : (a == b ? 0 : 1); }
+
+// ..., value1, value2 →
+// ..., result
+#define bc_do_binary(type1, field1, type2, field2, result_type, result_field, value)  \
+    VMStackSlot *__value2 = OP_STACK->top - 1;                                          \
+    VMStackSlot *__value1 = OP_STACK->top - 2;                                          \
+    assert(__value1 >= OP_STACK->slots);                                                \
+    assert(__value1->type == VM_SLOT_##type1);                                          \
+    assert(__value2->type == VM_SLOT_##type2);                                          \
+    JAVA_##result_type __result = value(__value1->data.field1, __value2->data.field2);  \
+    /* Pop value2 and replace value1 with the result */                                 \
+    OP_STACK->top = __value2;                                                           \
+    __value2->type = VM_SLOT_INVALID;                                                   \
+    __value1->type = VM_SLOT_##result_type;                                             \
+    __value1->data.result_field = __result
+#define bc_arithmetic(slot_type, slot_field, value) do {bc_do_binary(slot_type, slot_field, slot_type, slot_field, slot_type, slot_field, value);} while(0)
+#define bc_shift(slot_type, slot_field, value) do {bc_do_binary(slot_type, slot_field, INT, i, slot_type, slot_field, value);} while(0)
+#define bc_compare(slot_type, slot_field, value) do {bc_do_binary(slot_type, slot_field, slot_type, slot_field, INT, i, value);} while(0)
+
+// ..., value →
+// ..., result
+#define bc_unary(from_type, from_field, to_type, to_field, value) do {   \
+    VMStackSlot *__value = OP_STACK->top - 1;                           \
+    assert(__value >= OP_STACK->slots);                                 \
+    assert(__value->type == VM_SLOT_##from_type);                       \
+    JAVA_##to_type __result = value(__value->data.from_field);          \
+    __value->type = VM_SLOT_##to_type;                                  \
+    __value->data.to_field = __result;                                  \
+} while(0)
 
-// Type conversion instructions
-decl_arithmetic_func(i2l);
-decl_arithmetic_func(i2f);
-decl_arithmetic_func(i2d);
-decl_arithmetic_func(l2i);
-decl_arithmetic_func(l2f);
-decl_arithmetic_func(l2d);
-decl_arithmetic_func(f2i);
-decl_arithmetic_func(f2l);
-decl_arithmetic_func(f2d);
-decl_arithmetic_func(d2i);
-decl_arithmetic_func(d2l);
-decl_arithmetic_func(d2f);
-decl_arithmetic_func(i2b);
-decl_arithmetic_func(i2c);
-decl_arithmetic_func(i2s);
-
-#define bc_i2l() bc_arithmetic_i2l(OP_STACK)
-#define bc_i2f() bc_arithmetic_i2f(OP_STACK)
-#define bc_i2d() bc_arithmetic_i2d(OP_STACK)
-#define bc_l2i() bc_arithmetic_l2i(OP_STACK)
-#define bc_l2f() bc_arithmetic_l2f(OP_STACK)
-#define bc_l2d() bc_arithmetic_l2d(OP_STACK)
-#define bc_f2i() bc_arithmetic_f2i(OP_STACK)
-#define bc_f2l() bc_arithmetic_f2l(OP_STACK)
-#define bc_f2d() bc_arithmetic_f2d(OP_STACK)
-#define bc_d2i() bc_arithmetic_d2i(OP_STACK)
-#define bc_d2l() bc_arithmetic_d2l(OP_STACK)
-#define bc_d2f() bc_arithmetic_d2f(OP_STACK)
-#define bc_i2b() bc_arithmetic_i2b(OP_STACK)
-#define bc_i2c() bc_arithmetic_i2c(OP_STACK)
-#define bc_i2s() bc_arithmetic_i2s(OP_STACK)
+#define bc_iadd() bc_arithmetic(INT,    i, bc_value_iadd)
+#define bc_ladd() bc_arithmetic(LONG,   l, bc_value_ladd)
+#define bc_fadd() bc_arithmetic(FLOAT,  f, bc_value_fadd)
+#define bc_dadd() bc_arithmetic(DOUBLE, d, bc_value_dadd)
+
+#define bc_isub() bc_arithmetic(INT,    i, bc_value_isub)
+#define bc_lsub() bc_arithmetic(LONG,   l, bc_value_lsub)
+#define bc_fsub() bc_arithmetic(FLOAT,  f, bc_value_fsub)
+#define bc_dsub() bc_arithmetic(DOUBLE, d, bc_value_dsub)
+
+#define bc_imul() bc_arithmetic(INT,    i, bc_value_imul)
+#define bc_lmul() bc_arithmetic(LONG,   l, bc_value_lmul)
+#define bc_fmul() bc_arithmetic(FLOAT,  f, bc_value_fmul)
+#define bc_dmul() bc_arithmetic(DOUBLE, d, bc_value_dmul)
+
+// Integer division throws ArithmeticException if value2 is zero
+#define bc_integer_division(slot_type, slot_field, value) do {              \
+    assert((OP_STACK->top - 1)->type == VM_SLOT_##slot_type);               \
+    if ((OP_STACK->top - 1)->data.slot_field == 0) {                        \
+        exception_set_ArithmeticException_divideByZero(vmCurrentContext);   \
+        exception_raise();                                                  \
+    }                                                                       \
+    bc_arithmetic(slot_type, slot_field, value);                            \
+} while(0)
 
-// Comparison instructions
-decl_arithmetic_func(lcmp);
-decl_arithmetic_func(fcmpl);
-decl_arithmetic_func(fcmpg);
-decl_arithmetic_func(dcmpl);
-decl_arithmetic_func(dcmpg);
-
-#define bc_lcmp() bc_arithmetic_lcmp(OP_STACK)
-#define bc_fcmpl() bc_arithmetic_fcmpl(OP_STACK)
-#define bc_fcmpg() bc_arithmetic_fcmpg(OP_STACK)
-#define bc_dcmpl() bc_arithmetic_dcmpl(OP_STACK)
-#define bc_dcmpg() bc_arithmetic_dcmpg(OP_STACK)
+#define bc_idiv() bc_integer_division(INT,  i, bc_value_idiv)
+#define bc_ldiv() bc_integer_division(LONG, l, bc_value_ldiv)
+#define bc_fdiv() bc_arithmetic(FLOAT,  f, bc_value_fdiv)
+#define bc_ddiv() bc_arithmetic(DOUBLE, d, bc_value_ddiv)
 
-// Branch instructions
-#define decl_branch_func(name) JAVA_BOOLEAN bc_branch_##name(VMOperandStack *stack)
+#define bc_irem() bc_integer_division(INT,  i, bc_value_irem)
+#define bc_lrem() bc_integer_division(LONG, l, bc_value_lrem)
+#define bc_frem() bc_arithmetic(FLOAT,  f, bc_value_frem)
+#define bc_drem() bc_arithmetic(DOUBLE, d, bc_value_drem)
+
+#define bc_ineg() bc_unary(INT,    i, INT,    i, bc_value_ineg)
+#define bc_lneg() bc_unary(LONG,   l, LONG,   l, bc_value_lneg)
+#define bc_fneg() bc_unary(FLOAT,  f, FLOAT,  f, bc_value_fneg)
+#define bc_dneg() bc_unary(DOUBLE, d, DOUBLE, d, bc_value_dneg)
+
+// Bitwise instructions
+#define bc_ishl() bc_shift(INT,  i, bc_value_ishl)
+#define bc_lshl() bc_shift(LONG, l, bc_value_lshl)
+
+#define bc_ishr() bc_shift(INT,  i, bc_value_ishr)
+#define bc_lshr() bc_shift(LONG, l, bc_value_lshr)
 
-decl_branch_func(ifeq);
-decl_branch_func(ifne);
-decl_branch_func(iflt);
-decl_branch_func(ifle);
-decl_branch_func(ifgt);
-decl_branch_func(ifge);
+#define bc_iushr() bc_shift(INT,  i, bc_value_iushr)
+#define bc_lushr() bc_shift(LONG, l, bc_value_lushr)
 
-decl_branch_func(if_icmpeq);
-decl_branch_func(if_icmpne);
-decl_branch_func(if_icmplt);
-decl_branch_func(if_icmple);
-decl_branch_func(if_icmpgt);
-decl_branch_func(if_icmpge);
+#define bc_iand() bc_arithmetic(INT,  i, bc_value_iand)
+#define bc_land() bc_arithmetic(LONG, l, bc_value_land)
 
-decl_branch_func(if_acmpeq);
-decl_branch_func(if_acmpne);
+#define bc_ior() bc_arithmetic(INT,  i, bc_value_ior)
+#define bc_lor() bc_arithmetic(LONG, l, bc_value_lor)
 
-decl_branch_func(ifnull);
+#define bc_ixor() bc_arithmetic(INT,  i, bc_value_ixor)
+#define bc_lxor() bc_arithmetic(LONG, l, bc_value_lxor)
 
-#define BC_BRANCH_IMPL(name, label) if (bc_branch_##name(OP_STACK)) goto label
+// Type conversion instructions
+#define bc_i2l() bc_unary(INT,    i, LONG,   l, bc_value_i2l)
+#define bc_i2f() bc_unary(INT,    i, FLOAT,  f, bc_value_i2f)
+#define bc_i2d() bc_unary(INT,    i, DOUBLE, d, bc_value_i2d)
+#define bc_l2i() bc_unary(LONG,   l, INT,    i, bc_value_l2i)
+#define bc_l2f() bc_unary(LONG,   l, FLOAT,  f, bc_value_l2f)
+#define bc_l2d() bc_unary(LONG,   l, DOUBLE, d, bc_value_l2d)
+#define bc_f2i() bc_unary(FLOAT,  f, INT,    i, bc_value_f2i)
+#define bc_f2l() bc_unary(FLOAT,  f, LONG,   l, bc_value_f2l)
+#define bc_f2d() bc_unary(FLOAT,  f, DOUBLE, d, bc_value_f2d)
+#define bc_d2i() bc_unary(DOUBLE, d, INT,    i, bc_value_d2i)
+#define bc_d2l() bc_unary(DOUBLE, d, LONG,   l, bc_value_d2l)
+#define bc_d2f() bc_unary(DOUBLE, d, FLOAT,  f, bc_value_d2f)
+#define bc_i2b() bc_unary(INT,    i, INT,    i, bc_value_i2b)
+#define bc_i2c() bc_unary(INT,    i, INT,    i, bc_value_i2c)
+#define bc_i2s() bc_unary(INT,    i, INT,    i, bc_value_i2s)
+
+// Comparison instructions
+#define bc_lcmp()  bc_compare(LONG,   l, bc_value_lcmp)
+#define bc_fcmpl() bc_compare(FLOAT,  f, bc_value_fcmpl)
+#define bc_fcmpg() bc_compare(FLOAT,  f, bc_value_fcmpg)
+#define bc_dcmpl() bc_compare(DOUBLE, d, bc_value_dcmpl)
+#define bc_dcmpg() bc_compare(DOUBLE, d, bc_value_dcmpg)
+
+// Branch instructions
+#define bc_do_if(operation, label) do {                                 \
+    JAVA_INT __value = stack_pop_data(OP_STACK, VM_SLOT_INT).i;         \
+    if (__value operation 0) goto label;                                \
+} while(0)
+#define bc_do_if_cmp(slot_type, slot_field, operation, label) do {      \
+    VMStackSlotData __value2 = stack_pop_data(OP_STACK, slot_type);     \
+    VMStackSlotData __value1 = stack_pop_data(OP_STACK, slot_type);     \
+    if (__value1.slot_field operation __value2.slot_field) goto label;  \
+} while(0)
 
-#define bc_ifeq(label) BC_BRANCH_IMPL(ifeq, label)
-#define bc_ifne(label) BC_BRANCH_IMPL(ifne, label)
-#define bc_iflt(label) BC_BRANCH_IMPL(iflt, label)
-#define bc_ifle(label) BC_BRANCH_IMPL(ifle, label)
-#define bc_ifgt(label) BC_BRANCH_IMPL(ifgt, label)
-#define bc_ifge(label) BC_BRANCH_IMPL(ifge, label)
+#define bc_ifeq(label) bc_do_if(==, label)
+#define bc_ifne(label) bc_do_if(!=, label)
+#define bc_iflt(label) bc_do_if(<,  label)
+#define bc_ifle(label) bc_do_if(<=, label)
+#define bc_ifgt(label) bc_do_if(>,  label)
+#define bc_ifge(label) bc_do_if(>=, label)
 
-#define bc_if_icmpeq(label) BC_BRANCH_IMPL(if_icmpeq, label)
-#define bc_if_icmpne(label) BC_BRANCH_IMPL(if_icmpne, label)
-#define bc_if_icmplt(label) BC_BRANCH_IMPL(if_icmplt, label)
-#define bc_if_icmple(label) BC_BRANCH_IMPL(if_icmple, label)
-#define bc_if_icmpgt(label) BC_BRANCH_IMPL(if_icmpgt, label)
-#define bc_if_icmpge(label) BC_BRANCH_IMPL(if_icmpge, label)
+#define bc_if_icmpeq(label) bc_do_if_cmp(VM_SLOT_INT, i, ==, label)
+#define bc_if_icmpne(label) bc_do_if_cmp(VM_SLOT_INT, i, !=, label)
+#define bc_if_icmplt(label) bc_do_if_cmp(VM_SLOT_INT, i, <,  label)
+#define bc_if_icmple(label) bc_do_if_cmp(VM_SLOT_INT, i, <=, label)
+#define bc_if_icmpgt(label) bc_do_if_cmp(VM_SLOT_INT, i, >,  label)
+#define bc_if_icmpge(label) bc_do_if_cmp(VM_SLOT_INT, i, >=, label)
 
-#define bc_if_acmpeq(label) BC_BRANCH_IMPL(if_acmpeq, label)
-#define bc_if_acmpne(label) BC_BRANCH_IMPL(if_acmpne, label)
+#define bc_if_acmpeq(label) bc_do_if_cmp(VM_SLOT_OBJECT, o, ==, label)
+#define bc_if_acmpne(label) bc_do_if_cmp(VM_SLOT_OBJECT, o, !=, label)
 
-#define bc_ifnull(label)    if (bc_branch_ifnull(OP_STACK))  goto label
-#define bc_ifnonnull(label) if (!bc_branch_ifnull(OP_STACK)) goto label
+#define bc_ifnull(label)    do {if (stack_pop_data(OP_STACK, VM_SLOT_OBJECT).o == JAVA_NULL) goto label;} while(0)
+#define bc_ifnonnull(label) do {if (stack_pop_data(OP_STACK, VM_SLOT_OBJECT).o != JAVA_NULL) goto label;} while(0)
 
 #define bc_goto(label)  goto label
 
 // tableswitch and lookupswitch are both implemented by C switch-case statement
-JAVA_INT bc_switch_get_index(VMOperandStack *stack);
-#define bc_switch() switch(bc_switch_get_index(OP_STACK))
+#define bc_switch() switch(stack_pop_data(OP_STACK, VM_SLOT_INT).i)
 
 // ldc instructions
 #define bc_ldc_int(v)    stack_push_int(v)
@@ -309,70 +449,146 @@ JAVA_INT bc_switch_get_index(VMOperandStack *stack);
 #define bc_ldc_float(v)  stack_push_float(v)
 #define bc_ldc_double(v) stack_push_double(v)
 JAVA_OBJECT bc_ldc_class_obj(VM_PARAM_CURRENT_CONTEXT, JavaStackFrame *frame, C_CSTR class_name);
-#define bc_ldc_class(class_name) do {JAVA_OBJECT obj = bc_ldc_class_obj(vmCurrentContext, &STACK_FRAME, class_name); stack_push_object(obj);} while(0)
+#define bc_ldc_class(class_name) do {JAVA_OBJECT obj = bc_ldc_class_obj(vmCurrentContext, &STACK_FRAME, class_name); exception_raise_if_occurred(); stack_push_object(obj);} while(0)
 JAVA_OBJECT bc_ldc_string_const(VM_PARAM_CURRENT_CONTEXT, JAVA_INT constant_index);
-#define bc_ldc_string(constant_index) do { JAVA_OBJECT str = bc_ldc_string_const(vmCurrentContext, constant_index); stack_push_object(str);} while(0)
+#define bc_ldc_string(constant_index) do { JAVA_OBJECT str = bc_ldc_string_const(vmCurrentContext, constant_index); exception_raise_if_occurred(); stack_push_object(str);} while(0)
+
+JAVA_VOID bc_resolve_class(VM_PARAM_CURRENT_CONTEXT, JavaStackFrame *frame, JavaClassInfo *classInfo,
+                           JAVA_CLASS *classRefOut);
+JAVA_VOID bc_resolve_class_slow(VM_PARAM_CURRENT_CONTEXT, JavaStackFrame *frame, JavaClassInfo *classInfo,
+                                OPA_ptr_t *classCache, JAVA_CLASS *classRefOut);
+/**
+ * Resolve and initialize the class at the call site of new, getstatic, putstatic or invokestatic.
+ *
+ * Each call site has its own cache slot which is only filled once the class is fully initialized,
+ * so after the first use the class is loaded from the cache with an acquire load, without taking
+ * any class loader lock.
+ */
+#define bc_resolve_class_cached(class_info, class_ref) do {                                                 \
+    static OPA_ptr_t __classCache = OPA_PTR_T_INITIALIZER(NULL);                                          \
+    (class_ref) = (JAVA_CLASS) OPA_load_acquire_ptr(&__classCache);                                       \
+    if ((class_ref) == (JAVA_CLASS) JAVA_NULL) {                                                          \
+        bc_resolve_class_slow(vmCurrentContext, &STACK_FRAME, class_info, &__classCache, &(class_ref));   \
+        exception_raise_if_occurred();                                                                    \
+    }                                                                                                     \
+} while(0)
 
 // new instruction
-JAVA_OBJECT bc_create_instance(VM_PARAM_CURRENT_CONTEXT, JavaStackFrame *frame, JavaClassInfo *info);
-#define bc_new(class_info) do {JAVA_OBJECT obj = bc_create_instance(vmCurrentContext, &STACK_FRAME, class_info); stack_push_object(obj);} while(0)
+JAVA_OBJECT bc_create_instance(VM_PARAM_CURRENT_CONTEXT, JAVA_CLASS clazz);
+#define bc_new(class_info) do {                                     \
+    JAVA_CLASS classRef;                                            \
+    bc_resolve_class_cached(class_info, classRef);                  \
+    JAVA_OBJECT obj = bc_create_instance(vmCurrentContext, classRef); \
+    exception_raise_if_occurred();                                  \
+    stack_push_object(obj);                                         \
+} while(0)
 
 // invokeXXXX instructions
-#define bc_invoke_special(fp)                          ((JavaMethodRetVoid)    fp)(vmCurrentContext)
-#define bc_invoke_special_z(fp) do {JAVA_BOOLEAN ret = ((JavaMethodRetBoolean) fp)(vmCurrentContext); stack_push_int(ret);                } while(0)
-#define bc_invoke_special_c(fp) do {JAVA_CHAR    ret = ((JavaMethodRetChar)    fp)(vmCurrentContext); stack_push_int((JAVA_UCHAR)ret);    } while(0)
-#define bc_invoke_special_b(fp) do {JAVA_BYTE    ret = ((JavaMethodRetByte)    fp)(vmCurrentContext); stack_push_int(ret);                } while(0)
-#define bc_invoke_special_s(fp) do {JAVA_SHORT   ret = ((JavaMethodRetShort)   fp)(vmCurrentContext); stack_push_int(ret);                } while(0)
-#define bc_invoke_special_i(fp) do {JAVA_INT     ret = ((JavaMethodRetInt)     fp)(vmCurrentContext); stack_push_int(ret);                } while(0)
-#define bc_invoke_special_f(fp) do {JAVA_FLOAT   ret = ((JavaMethodRetFloat)   fp)(vmCurrentContext); stack_push_float(ret);              } while(0)
-#define bc_invoke_special_l(fp) do {JAVA_LONG    ret = ((JavaMethodRetLong)    fp)(vmCurrentContext); stack_push_long(ret);               } while(0)
-#define bc_invoke_special_d(fp) do {JAVA_DOUBLE  ret = ((JavaMethodRetDouble)  fp)(vmCurrentContext); stack_push_double(ret);             } while(0)
-#define bc_invoke_special_a(fp) do {JAVA_ARRAY   ret = ((JavaMethodRetArray)   fp)(vmCurrentContext); stack_push_object((JAVA_OBJECT)ret);} while(0)
-#define bc_invoke_special_o(fp) do {JAVA_OBJECT  ret = ((JavaMethodRetObject)  fp)(vmCurrentContext); stack_push_object(ret);             } while(0)
+#define bc_invoke_special(fp)   do {                   ((JavaMethodRetVoid)    fp)(vmCurrentContext); exception_raise_if_occurred();                                     } while(0)
+#define bc_invoke_special_z(fp) do {JAVA_BOOLEAN ret = ((JavaMethodRetBoolean) fp)(vmCurrentContext); exception_raise_if_occurred(); stack_push_int(ret);                } while(0)
+#define bc_invoke_special_c(fp) do {JAVA_CHAR    ret = ((JavaMethodRetChar)    fp)(vmCurrentContext); exception_raise_if_occurred(); stack_push_int((JAVA_UCHAR)ret);    } while(0)
+#define bc_invoke_special_b(fp) do {JAVA_BYTE    ret = ((JavaMethodRetByte)    fp)(vmCurrentContext); exception_raise_if_occurred(); stack_push_int(ret);                } while(0)
+#define bc_invoke_special_s(fp) do {JAVA_SHORT   ret = ((JavaMethodRetShort)   fp)(vmCurrentContext); exception_raise_if_occurred(); stack_push_int(ret);                } while(0)
+#define bc_invoke_special_i(fp) do {JAVA_INT     ret = ((JavaMethodRetInt)     fp)(vmCurrentContext); exception_raise_if_occurred(); stack_push_int(ret);                } while(0)
+#define bc_invoke_special_f(fp) do {JAVA_FLOAT   ret = ((JavaMethodRetFloat)   fp)(vmCurrentContext); exception_raise_if_occurred(); stack_push_float(ret);              } while(0)
+#define bc_invoke_special_l(fp) do {JAVA_LONG    ret = ((JavaMethodRetLong)    fp)(vmCurrentContext); exception_raise_if_occurred(); stack_push_long(ret);               } while(0)
+#define bc_invoke_special_d(fp) do {JAVA_DOUBLE  ret = ((JavaMethodRetDouble)  fp)(vmCurrentContext); exception_raise_if_occurred(); stack_push_double(ret);             } while(0)
+#define bc_invoke_special_a(fp) do {JAVA_ARRAY   ret = ((JavaMethodRetArray)   fp)(vmCurrentContext); exception_raise_if_occurred(); stack_push_object((JAVA_OBJECT)ret);} while(0)
+#define bc_invoke_special_o(fp) do {JAVA_OBJECT  ret = ((JavaMethodRetObject)  fp)(vmCurrentContext); exception_raise_if_occurred(); stack_push_object(ret);             } while(0)
 
-JAVA_VOID bc_resolve_class(VM_PARAM_CURRENT_CONTEXT, JavaStackFrame *frame, JavaClassInfo *classInfo,
-                           JAVA_CLASS *classRefOut);
 #define bc_invoke_static_prepare(class_info)                                    \
     JAVA_CLASS classRef;                                                        \
-    bc_resolve_class(vmCurrentContext, &STACK_FRAME, class_info, &classRef);    \
+    bc_resolve_class_cached(class_info, classRef);                              \
     vmCurrentContext->callingClass = classRef
-#define bc_invoke_static(class_info,   fp) do {bc_invoke_static_prepare(class_info);                    ((JavaMethodRetVoid)    fp)(vmCurrentContext);                                     } while(0)
-#define bc_invoke_static_z(class_info, fp) do {bc_invoke_static_prepare(class_info); JAVA_BOOLEAN ret = ((JavaMethodRetBoolean) fp)(vmCurrentContext); stack_push_int(ret);                } while(0)
-#define bc_invoke_static_c(class_info, fp) do {bc_invoke_static_prepare(class_info); JAVA_CHAR    ret = ((JavaMethodRetChar)    fp)(vmCurrentContext); stack_push_int((JAVA_UCHAR)ret);    } while(0)
-#define bc_invoke_static_b(class_info, fp) do {bc_invoke_static_prepare(class_info); JAVA_BYTE    ret = ((JavaMethodRetByte)    fp)(vmCurrentContext); stack_push_int(ret);                } while(0)
-#define bc_invoke_static_s(class_info, fp) do {bc_invoke_static_prepare(class_info); JAVA_SHORT   ret = ((JavaMethodRetShort)   fp)(vmCurrentContext); stack_push_int(ret);                } while(0)
-#define bc_invoke_static_i(class_info, fp) do {bc_invoke_static_prepare(class_info); JAVA_INT     ret = ((JavaMethodRetInt)     fp)(vmCurrentContext); stack_push_int(ret);                } while(0)
-#define bc_invoke_static_f(class_info, fp) do {bc_invoke_static_prepare(class_info); JAVA_FLOAT   ret = ((JavaMethodRetFloat)   fp)(vmCurrentContext); stack_push_float(ret);              } while(0)
-#define bc_invoke_static_l(class_info, fp) do {bc_invoke_static_prepare(class_info); JAVA_LONG    ret = ((JavaMethodRetLong)    fp)(vmCurrentContext); stack_push_long(ret);               } while(0)
-#define bc_invoke_static_d(class_info, fp) do {bc_invoke_static_prepare(class_info); JAVA_DOUBLE  ret = ((JavaMethodRetDouble)  fp)(vmCurrentContext); stack_push_double(ret);             } while(0)
-#define bc_invoke_static_a(class_info, fp) do {bc_invoke_static_prepare(class_info); JAVA_ARRAY   ret = ((JavaMethodRetArray)   fp)(vmCurrentContext); stack_push_object((JAVA_OBJECT)ret);} while(0)
-#define bc_invoke_static_o(class_info, fp) do {bc_invoke_static_prepare(class_info); JAVA_OBJECT  ret = ((JavaMethodRetObject)  fp)(vmCurrentContext); stack_push_object(ret);             } while(0)
+#define bc_invoke_static(class_info,   fp) do {bc_invoke_static_prepare(class_info);                    ((JavaMethodRetVoid)    fp)(vmCurrentContext); exception_raise_if_occurred();                                     } while(0)
+#define bc_invoke_static_z(class_info, fp) do {bc_invoke_static_prepare(class_info); JAVA_BOOLEAN ret = ((JavaMethodRetBoolean) fp)(vmCurrentContext); exception_raise_if_occurred(); stack_push_int(ret);                } while(0)
+#define bc_invoke_static_c(class_info, fp) do {bc_invoke_static_prepare(class_info); JAVA_CHAR    ret = ((JavaMethodRetChar)    fp)(vmCurrentContext); exception_raise_if_occurred(); stack_push_int((JAVA_UCHAR)ret);    } while(0)
+#define bc_invoke_static_b(class_info, fp) do {bc_invoke_static_prepare(class_info); JAVA_BYTE    ret = ((JavaMethodRetByte)    fp)(vmCurrentContext); exception_raise_if_occurred(); stack_push_int(ret);                } while(0)
+#define bc_invoke_static_s(class_info, fp) do {bc_invoke_static_prepare(class_info); JAVA_SHORT   ret = ((JavaMethodRetShort)   fp)(vmCurrentContext); exception_raise_if_occurred(); stack_push_int(ret);                } while(0)
+#define bc_invoke_static_i(class_info, fp) do {bc_invoke_static_prepare(class_info); JAVA_INT     ret = ((JavaMethodRetInt)     fp)(vmCurrentContext); exception_raise_if_occurred(); stack_push_int(ret);                } while(0)
+#define bc_invoke_static_f(class_info, fp) do {bc_invoke_static_prepare(class_info); JAVA_FLOAT   ret = ((JavaMethodRetFloat)   fp)(vmCurrentContext); exception_raise_if_occurred(); stack_push_float(ret);              } while(0)
+#define bc_invoke_static_l(class_info, fp) do {bc_invoke_static_prepare(class_info); JAVA_LONG    ret = ((JavaMethodRetLong)    fp)(vmCurrentContext); exception_raise_if_occurred(); stack_push_long(ret);               } while(0)
+#define bc_invoke_static_d(class_info, fp) do {bc_invoke_static_prepare(class_info); JAVA_DOUBLE  ret = ((JavaMethodRetDouble)  fp)(vmCurrentContext); exception_raise_if_occurred(); stack_push_double(ret);             } while(0)
+#define bc_invoke_static_a(class_info, fp) do {bc_invoke_static_prepare(class_info); JAVA_ARRAY   ret = ((JavaMethodRetArray)   fp)(vmCurrentContext); exception_raise_if_occurred(); stack_push_object((JAVA_OBJECT)ret);} while(0)
+#define bc_invoke_static_o(class_info, fp) do {bc_invoke_static_prepare(class_info); JAVA_OBJECT  ret = ((JavaMethodRetObject)  fp)(vmCurrentContext); exception_raise_if_occurred(); stack_push_object(ret);             } while(0)
 
 void *bc_vtable_lookup(VM_PARAM_CURRENT_CONTEXT, VMOperandStack *stack, JAVA_INT argument_count, JavaClassInfo* clazz, uint16_t vtable_index);
-#define bc_invoke_virtual(argument_count,   clazz, vtable_index) bc_invoke_special(  bc_vtable_lookup(vmCurrentContext, OP_STACK, argument_count, clazz, vtable_index))
-#define bc_invoke_virtual_z(argument_count, clazz, vtable_index) bc_invoke_special_z(bc_vtable_lookup(vmCurrentContext, OP_STACK, argument_count, clazz, vtable_index))
-#define bc_invoke_virtual_c(argument_count, clazz, vtable_index) bc_invoke_special_c(bc_vtable_lookup(vmCurrentContext, OP_STACK, argument_count, clazz, vtable_index))
-#define bc_invoke_virtual_b(argument_count, clazz, vtable_index) bc_invoke_special_b(bc_vtable_lookup(vmCurrentContext, OP_STACK, argument_count, clazz, vtable_index))
-#define bc_invoke_virtual_s(argument_count, clazz, vtable_index) bc_invoke_special_s(bc_vtable_lookup(vmCurrentContext, OP_STACK, argument_count, clazz, vtable_index))
-#define bc_invoke_virtual_i(argument_count, clazz, vtable_index) bc_invoke_special_i(bc_vtable_lookup(vmCurrentContext, OP_STACK, argument_count, clazz, vtable_index))
-#define bc_invoke_virtual_f(argument_count, clazz, vtable_index) bc_invoke_special_f(bc_vtable_lookup(vmCurrentContext, OP_STACK, argument_count, clazz, vtable_index))
-#define bc_invoke_virtual_l(argument_count, clazz, vtable_index) bc_invoke_special_l(bc_vtable_lookup(vmCurrentContext, OP_STACK, argument_count, clazz, vtable_index))
-#define bc_invoke_virtual_d(argument_count, clazz, vtable_index) bc_invoke_special_d(bc_vtable_lookup(vmCurrentContext, OP_STACK, argument_count, clazz, vtable_index))
-#define bc_invoke_virtual_a(argument_count, clazz, vtable_index) bc_invoke_special_a(bc_vtable_lookup(vmCurrentContext, OP_STACK, argument_count, clazz, vtable_index))
-#define bc_invoke_virtual_o(argument_count, clazz, vtable_index) bc_invoke_special_o(bc_vtable_lookup(vmCurrentContext, OP_STACK, argument_count, clazz, vtable_index))
+/**
+ * Inlined bc_vtable_lookup(). The objectref must already be checked by bc_check_receiver_virtual().
+ */
+static inline void *bc_vtable_code_of(VMOperandStack *stack, JAVA_INT argument_count, uint16_t vtable_index) {
+    JAVA_OBJECT object = (stack->top - argument_count)->data.o;
+    assert(object != JAVA_NULL);
+
+    return obj_get_class(object)->info->vtable[vtable_index].code;
+}
+/**
+ * Get the target of invokevirtual. Used by the polymorphic inline cache generated by the translator,
+ * which compares the target with each known implementation and calls the matched one directly, so
+ * the C compiler is able to inline it:
+ *
+ *   bc_check_receiver_virtual(...);
+ *   void *target = bc_vtable_code(...);
+ *   if (target == (void *) method_A) bc_invoke_special(method_A);
+ *   else bc_invoke_special(target);
+ */
+#define bc_vtable_code(argument_count, clazz, vtable_index) bc_vtable_code_of(OP_STACK, argument_count, vtable_index)
+/**
+ * Check the objectref of invokevirtual, which is also used alone by invokevirtual / invokeinterface
+ * that is devirtualized by the translator, which then calls the only possible implementation directly:
+ *
+ *   bc_check_receiver_virtual(...);
+ *   bc_invoke_special(method_A);
+ */
+#define bc_check_receiver_virtual(argument_count, clazz, vtable_index) do {                \
+    if ((OP_STACK->top - (argument_count))->data.o == JAVA_NULL) {                         \
+        /* Throws NullPointerException */                                                  \
+        bc_vtable_lookup(vmCurrentContext, OP_STACK, argument_count, clazz, vtable_index); \
+        exception_raise();                                                                 \
+    }                                                                                      \
+} while(0)
+#define bc_do_invoke_virtual(argument_count, clazz, vtable_index, invoke) do { \
+    bc_check_receiver_virtual(argument_count, clazz, vtable_index);            \
+    invoke(bc_vtable_code(argument_count, clazz, vtable_index));               \
+} while(0)
+#define bc_invoke_virtual(argument_count,   clazz, vtable_index) bc_do_invoke_virtual(argument_count, clazz, vtable_index, bc_invoke_special)
+#define bc_invoke_virtual_z(argument_count, clazz, vtable_index) bc_do_invoke_virtual(argument_count, clazz, vtable_index, bc_invoke_special_z)
+#define bc_invoke_virtual_c(argument_count, clazz, vtable_index) bc_do_invoke_virtual(argument_count, clazz, vtable_index, bc_invoke_special_c)
+#define bc_invoke_virtual_b(argument_count, clazz, vtable_index) bc_do_invoke_virtual(argument_count, clazz, vtable_index, bc_invoke_special_b)
+#define bc_invoke_virtual_s(argument_count, clazz, vtable_index) bc_do_invoke_virtual(argument_count, clazz, vtable_index, bc_invoke_special_s)
+#define bc_invoke_virtual_i(argument_count, clazz, vtable_index) bc_do_invoke_virtual(argument_count, clazz, vtable_index, bc_invoke_special_i)
+#define bc_invoke_virtual_f(argument_count, clazz, vtable_index) bc_do_invoke_virtual(argument_count, clazz, vtable_index, bc_invoke_special_f)
+#define bc_invoke_virtual_l(argument_count, clazz, vtable_index) bc_do_invoke_virtual(argument_count, clazz, vtable_index, bc_invoke_special_l)
+#define bc_invoke_virtual_d(argument_count, clazz, vtable_index) bc_do_invoke_virtual(argument_count, clazz, vtable_index, bc_invoke_special_d)
+#define bc_invoke_virtual_a(argument_count, clazz, vtable_index) bc_do_invoke_virtual(argument_count, clazz, vtable_index, bc_invoke_special_a)
+#define bc_invoke_virtual_o(argument_count, clazz, vtable_index) bc_do_invoke_virtual(argument_count, clazz, vtable_index, bc_invoke_special_o)
 
 void *bc_ivtable_lookup(VM_PARAM_CURRENT_CONTEXT, VMOperandStack *stack, JAVA_INT argument_count, JavaClassInfo* interface_type, uint16_t method_index);
-#define bc_invoke_interface(argument_count,   interface_type, method_index) bc_invoke_special(  bc_ivtable_lookup(vmCurrentContext, OP_STACK, argument_count, interface_type, method_index))
-#define bc_invoke_interface_z(argument_count, interface_type, method_index) bc_invoke_special_z(bc_ivtable_lookup(vmCurrentContext, OP_STACK, argument_count, interface_type, method_index))
-#define bc_invoke_interface_c(argument_count, interface_type, method_index) bc_invoke_special_c(bc_ivtable_lookup(vmCurrentContext, OP_STACK, argument_count, interface_type, method_index))
-#define bc_invoke_interface_b(argument_count, interface_type, method_index) bc_invoke_special_b(bc_ivtable_lookup(vmCurrentContext, OP_STACK, argument_count, interface_type, method_index))
-#define bc_invoke_interface_s(argument_count, interface_type, method_index) bc_invoke_special_s(bc_ivtable_lookup(vmCurrentContext, OP_STACK, argument_count, interface_type, method_index))
-#define bc_invoke_interface_i(argument_count, interface_type, method_index) bc_invoke_special_i(bc_ivtable_lookup(vmCurrentContext, OP_STACK, argument_count, interface_type, method_index))
-#define bc_invoke_interface_f(argument_count, interface_type, method_index) bc_invoke_special_f(bc_ivtable_lookup(vmCurrentContext, OP_STACK, argument_count, interface_type, method_index))
-#define bc_invoke_interface_l(argument_count, interface_type, method_index) bc_invoke_special_l(bc_ivtable_lookup(vmCurrentContext, OP_STACK, argument_count, interface_type, method_index))
-#define bc_invoke_interface_d(argument_count, interface_type, method_index) bc_invoke_special_d(bc_ivtable_lookup(vmCurrentContext, OP_STACK, argument_count, interface_type, method_index))
-#define bc_invoke_interface_a(argument_count, interface_type, method_index) bc_invoke_special_a(bc_ivtable_lookup(vmCurrentContext, OP_STACK, argument_count, interface_type, method_index))
-#define bc_invoke_interface_o(argument_count, interface_type, method_index) bc_invoke_special_o(bc_ivtable_lookup(vmCurrentContext, OP_STACK, argument_count, interface_type, method_index))
+#define bc_check_receiver_interface(argument_count, interface_type, method_index) do {               \
+    if ((OP_STACK->top - (argument_count))->data.o == JAVA_NULL) {                                   \
+        /* Throws NullPointerException */                                                            \
+        bc_ivtable_lookup(vmCurrentContext, OP_STACK, argument_count, interface_type, method_index); \
+        exception_raise();                                                                           \
+    }                                                                                                \
+} while(0)
+#define bc_do_invoke_interface(argument_count, interface_type, method_index, invoke) do {                         \
+    void *__target = bc_ivtable_lookup(vmCurrentContext, OP_STACK, argument_count, interface_type, method_index); \
+    if (__target == NULL) {                                                                                       \
+        exception_raise();                                                                                        \
+    }                                                                                                             \
+    invoke(__target);                                                                                             \
+} while(0)
+#define bc_invoke_interface(argument_count,   interface_type, method_index) bc_do_invoke_interface(argument_count, interface_type, method_index, bc_invoke_special)
+#define bc_invoke_interface_z(argument_count, interface_type, method_index) bc_do_invoke_interface(argument_count, interface_type, method_index, bc_invoke_special_z)
+#define bc_invoke_interface_c(argument_count, interface_type, method_index) bc_do_invoke_interface(argument_count, interface_type, method_index, bc_invoke_special_c)
+#define bc_invoke_interface_b(argument_count, interface_type, method_index) bc_do_invoke_interface(argument_count, interface_type, method_index, bc_invoke_special_b)
+#define bc_invoke_interface_s(argument_count, interface_type, method_index) bc_do_invoke_interface(argument_count, interface_type, method_index, bc_invoke_special_s)
+#define bc_invoke_interface_i(argument_count, interface_type, method_index) bc_do_invoke_interface(argument_count, interface_type, method_index, bc_invoke_special_i)
+#define bc_invoke_interface_f(argument_count, interface_type, method_index) bc_do_invoke_interface(argument_count, interface_type, method_index, bc_invoke_special_f)
+#define bc_invoke_interface_l(argument_count, interface_type, method_index) bc_do_invoke_interface(argument_count, interface_type, method_index, bc_invoke_special_l)
+#define bc_invoke_interface_d(argument_count, interface_type, method_index) bc_do_invoke_interface(argument_count, interface_type, method_index, bc_invoke_special_d)
+#define bc_invoke_interface_a(argument_count, interface_type, method_index) bc_do_invoke_interface(argument_count, interface_type, method_index, bc_invoke_special_a)
+#define bc_invoke_interface_o(argument_count, interface_type, method_index) bc_do_invoke_interface(argument_count, interface_type, method_index, bc_invoke_special_o)
 
 // field instructions
 JAVA_VOID bc_putfield(VM_PARAM_CURRENT_CONTEXT, VMOperandStack *stack, JavaClassInfo* clazz, uint16_t field_index, JAVA_OBJECT *objRefOut, void *valueOut, BasicType fieldType);
@@ -380,6 +596,9 @@ JAVA_VOID bc_putfield(VM_PARAM_CURRENT_CONTEXT, VMOperandStack *stack, JavaClass
     JAVA_OBJECT objectRef;                                                                                      \
     JAVA_##field_type value;                                                                                    \
     bc_putfield(vmCurrentContext, OP_STACK, clazz, field_index, &objectRef, &value, VM_TYPE_##field_type);      \
+    if (objectRef == JAVA_NULL) {                                                                               \
+        exception_raise();                                                                                      \
+    }                                                                                                           \
     ((object_type*)objectRef)->field_name = value
 #define bc_putfield_z(clazz, field_index, object_type, field_name) do {bc_do_putfield(clazz, field_index, object_type, field_name, BOOLEAN);} while(0)
 #define bc_putfield_c(clazz, field_index, object_type, field_name) do {bc_do_putfield(clazz, field_index, object_type, field_name, CHAR);   } while(0)
@@ -389,13 +608,16 @@ JAVA_VOID bc_putfield(VM_PARAM_CURRENT_CONTEXT, VMOperandStack *stack, JavaClass
 #define bc_putfield_f(clazz, field_index, object_type, field_name) do {bc_do_putfield(clazz, field_index, object_type, field_name, FLOAT);  } while(0)
 #define bc_putfield_l(clazz, field_index, object_type, field_name) do {bc_do_putfield(clazz, field_index, object_type, field_name, LONG);   } while(0)
 #define bc_putfield_d(clazz, field_index, object_type, field_name) do {bc_do_putfield(clazz, field_index, object_type, field_name, DOUBLE); } while(0)
-// TODO: update card table for cross-gen reference
-#define bc_putfield_a(clazz, field_index, object_type, field_name) do {bc_do_putfield(clazz, field_index, object_type, field_name, ARRAY);  } while(0)
-#define bc_putfield_o(clazz, field_index, object_type, field_name) do {bc_do_putfield(clazz, field_index, object_type, field_name, OBJECT); } while(0)
+// Reference stores need to update card table for cross-gen reference
+#define bc_putfield_a(clazz, field_index, object_type, field_name) do {bc_do_putfield(clazz, field_index, object_type, field_name, ARRAY);  heap_write_barrier(&((object_type*)objectRef)->field_name, (JAVA_OBJECT)value);} while(0)
+#define bc_putfield_o(clazz, field_index, object_type, field_name) do {bc_do_putfield(clazz, field_index, object_type, field_name, OBJECT); heap_write_barrier(&((object_type*)objectRef)->field_name, value);              } while(0)
 
 JAVA_OBJECT bc_getfield(VM_PARAM_CURRENT_CONTEXT, VMOperandStack *stack, JavaClassInfo* clazz, uint16_t field_index);
 #define bc_do_getfield(clazz, field_index, object_type, field_name, field_type)                                 \
     JAVA_OBJECT objectRef = bc_getfield(vmCurrentContext, OP_STACK, clazz, field_index);                        \
+    if (objectRef == JAVA_NULL) {                                                                               \
+        exception_raise();                                                                                      \
+    }                                                                                                           \
     JAVA_##field_type value = ((object_type*)objectRef)->field_name
 #define bc_getfield_z(clazz, field_index, object_type, field_name) do {bc_do_getfield(clazz, field_index, object_type, field_name, BOOLEAN); stack_push_int(value);                } while(0)
 #define bc_getfield_c(clazz, field_index, object_type, field_name) do {bc_do_getfield(clazz, field_index, object_type, field_name, CHAR);    stack_push_int((JAVA_UCHAR)value);    } while(0)
@@ -408,12 +630,44 @@ JAVA_OBJECT bc_getfield(VM_PARAM_CURRENT_CONTEXT, VMOperandStack *stack, JavaCla
 #define bc_getfield_a(clazz, field_index, object_type, field_name) do {bc_do_getfield(clazz, field_index, object_type, field_name, ARRAY);   stack_push_object((JAVA_OBJECT)value);} while(0)
 #define bc_getfield_o(clazz, field_index, object_type, field_name) do {bc_do_getfield(clazz, field_index, object_type, field_name, OBJECT);  stack_push_object(value);             } while(0)
 
-JAVA_VOID bc_putstatic(VM_PARAM_CURRENT_CONTEXT, JavaStackFrame *frame, JavaClassInfo *classInfo,
-                       JAVA_CLASS *classRefOut, void *valueOut, BasicType fieldType);
-#define bc_do_putstatic(class_info, class_type, field_name, field_type)                                 \
-    JAVA_CLASS classRef;                                                                                \
-    JAVA_##field_type value;                                                                            \
-    bc_putstatic(vmCurrentContext, &STACK_FRAME, class_info, &classRef, &value, VM_TYPE_##field_type);  \
+// Field access on receivers that the translator proved not null, which skips the null check
+// and reads / writes the field inline.
+#define bc_do_putfield_unchecked(object_type, field_name, field_type, slot_type, slot_field)              \
+    JAVA_##field_type value = (JAVA_##field_type) stack_pop_data(OP_STACK, VM_SLOT_##slot_type).slot_field;   \
+    JAVA_OBJECT objectRef = stack_pop_data(OP_STACK, VM_SLOT_OBJECT).o;                                    \
+    assert(objectRef != JAVA_NULL);                                                                        \
+    ((object_type*)objectRef)->field_name = value
+#define bc_putfield_unchecked_z(clazz, field_index, object_type, field_name) do {bc_do_putfield_unchecked(object_type, field_name, BOOLEAN, INT,    i);} while(0)
+#define bc_putfield_unchecked_c(clazz, field_index, object_type, field_name) do {bc_do_putfield_unchecked(object_type, field_name, CHAR,    INT,    i);} while(0)
+#define bc_putfield_unchecked_b(clazz, field_index, object_type, field_name) do {bc_do_putfield_unchecked(object_type, field_name, BYTE,    INT,    i);} while(0)
+#define bc_putfield_unchecked_s(clazz, field_index, object_type, field_name) do {bc_do_putfield_unchecked(object_type, field_name, SHORT,   INT,    i);} while(0)
+#define bc_putfield_unchecked_i(clazz, field_index, object_type, field_name) do {bc_do_putfield_unchecked(object_type, field_name, INT,     INT,    i);} while(0)
+#define bc_putfield_unchecked_f(clazz, field_index, object_type, field_name) do {bc_do_putfield_unchecked(object_type, field_name, FLOAT,   FLOAT,  f);} while(0)
+#define bc_putfield_unchecked_l(clazz, field_index, object_type, field_name) do {bc_do_putfield_unchecked(object_type, field_name, LONG,    LONG,   l);} while(0)
+#define bc_putfield_unchecked_d(clazz, field_index, object_type, field_name) do {bc_do_putfield_unchecked(object_type, field_name, DOUBLE,  DOUBLE, d);} while(0)
+#define bc_putfield_unchecked_a(clazz, field_index, object_type, field_name) do {bc_do_putfield_unchecked(object_type, field_name, ARRAY,   OBJECT, o); heap_write_barrier(&((object_type*)objectRef)->field_name, (JAVA_OBJECT)value);} while(0)
+#define bc_putfield_unchecked_o(clazz, field_index, object_type, field_name) do {bc_do_putfield_unchecked(object_type, field_name, OBJECT,  OBJECT, o); heap_write_barrier(&((object_type*)objectRef)->field_name, value);              } while(0)
+
+#define bc_do_getfield_unchecked(object_type, field_name, field_type)                                     \
+    JAVA_OBJECT objectRef = stack_pop_data(OP_STACK, VM_SLOT_OBJECT).o;                                    \
+    assert(objectRef != JAVA_NULL);                                                                        \
+    JAVA_##field_type value = ((object_type*)objectRef)->field_name
+#define bc_getfield_unchecked_z(clazz, field_index, object_type, field_name) do {bc_do_getfield_unchecked(object_type, field_name, BOOLEAN); stack_push_int(value);                } while(0)
+#define bc_getfield_unchecked_c(clazz, field_index, object_type, field_name) do {bc_do_getfield_unchecked(object_type, field_name, CHAR);    stack_push_int((JAVA_UCHAR)value);    } while(0)
+#define bc_getfield_unchecked_b(clazz, field_index, object_type, field_name) do {bc_do_getfield_unchecked(object_type, field_name, BYTE);    stack_push_int(value);                } while(0)
+#define bc_getfield_unchecked_s(clazz, field_index, object_type, field_name) do {bc_do_getfield_unchecked(object_type, field_name, SHORT);   stack_push_int(value);                } while(0)
+#define bc_getfield_unchecked_i(clazz, field_index, object_type, field_name) do {bc_do_getfield_unchecked(object_type, field_name, INT);     stack_push_int(value);                } while(0)
+#define bc_getfield_unchecked_f(clazz, field_index, object_type, field_name) do {bc_do_getfield_unchecked(object_type, field_name, FLOAT);   stack_push_float(value);              } while(0)
+#define bc_getfield_unchecked_l(clazz, field_index, object_type, field_name) do {bc_do_getfield_unchecked(object_type, field_name, LONG);    stack_push_long(value);               } while(0)
+#define bc_getfield_unchecked_d(clazz, field_index, object_type, field_name) do {bc_do_getfield_unchecked(object_type, field_name, DOUBLE);  stack_push_double(value);             } while(0)
+#define bc_getfield_unchecked_a(clazz, field_index, object_type, field_name) do {bc_do_getfield_unchecked(object_type, field_name, ARRAY);   stack_push_object((JAVA_OBJECT)value);} while(0)
+#define bc_getfield_unchecked_o(clazz, field_index, object_type, field_name) do {bc_do_getfield_unchecked(object_type, field_name, OBJECT);  stack_push_object(value);             } while(0)
+
+#define bc_do_putstatic(class_info, class_type, field_name, field_type)     \
+    JAVA_CLASS classRef;                                                    \
+    JAVA_##field_type value;                                                \
+    bc_resolve_class_cached(class_info, classRef);                          \
+    bc_read_stack_top(OP_STACK, &value, VM_TYPE_##field_type);              \
     ((class_type*)classRef)->field_name = value
 #define bc_putstatic_z(class_info, class_type, field_name) do {bc_do_putstatic(class_info, class_type, field_name, BOOLEAN);} while(0)
 #define bc_putstatic_c(class_info, class_type, field_name) do {bc_do_putstatic(class_info, class_type, field_name, CHAR);   } while(0)
@@ -423,13 +677,13 @@ JAVA_VOID bc_putstatic(VM_PARAM_CURRENT_CONTEXT, JavaStackFrame *frame, JavaClas
 #define bc_putstatic_f(class_info, class_type, field_name) do {bc_do_putstatic(class_info, class_type, field_name, FLOAT);  } while(0)
 #define bc_putstatic_l(class_info, class_type, field_name) do {bc_do_putstatic(class_info, class_type, field_name, LONG);   } while(0)
 #define bc_putstatic_d(class_info, class_type, field_name) do {bc_do_putstatic(class_info, class_type, field_name, DOUBLE); } while(0)
-// TODO: update card table for cross-gen reference
-#define bc_putstatic_a(class_info, class_type, field_name) do {bc_do_putstatic(class_info, class_type, field_name, ARRAY);  } while(0)
-#define bc_putstatic_o(class_info, class_type, field_name) do {bc_do_putstatic(class_info, class_type, field_name, OBJECT); } while(0)
+// Reference stores need to update card table for cross-gen reference
+#define bc_putstatic_a(class_info, class_type, field_name) do {bc_do_putstatic(class_info, class_type, field_name, ARRAY);  heap_write_barrier(&((class_type*)classRef)->field_name, (JAVA_OBJECT)value);} while(0)
+#define bc_putstatic_o(class_info, class_type, field_name) do {bc_do_putstatic(class_info, class_type, field_name, OBJECT); heap_write_barrier(&((class_type*)classRef)->field_name, value);              } while(0)
 
 #define bc_do_getstatic(class_info, class_type, field_name, field_type)         \
     JAVA_CLASS classRef;                                                        \
-    bc_resolve_class(vmCurrentContext, &STACK_FRAME, class_info, &classRef);    \
+    bc_resolve_class_cached(class_info, classRef);                              \
     JAVA_##field_type value = ((class_type*)classRef)->field_name
 #define bc_getstatic_z(class_info, class_type, field_name) do {bc_do_getstatic(class_info, class_type, field_name, BOOLEAN); stack_push_int(value);                } while(0)
 #define bc_getstatic_c(class_info, class_type, field_name) do {bc_do_getstatic(class_info, class_type, field_name, CHAR);    stack_push_int((JAVA_UCHAR)value);    } while(0)
@@ -443,49 +697,168 @@ JAVA_VOID bc_putstatic(VM_PARAM_CURRENT_CONTEXT, JavaStackFrame *frame, JavaClas
 #define bc_getstatic_o(class_info, class_type, field_name) do {bc_do_getstatic(class_info, class_type, field_name, OBJECT);  stack_push_object(value);             } while(0)
 
 // array related instructions
-JAVA_ARRAY bc_new_array(VM_PARAM_CURRENT_CONTEXT, JavaStackFrame *frame, C_CSTR desc);
-#define bc_newarray(desc) do {JAVA_ARRAY array = bc_new_array(vmCurrentContext, &STACK_FRAME, desc); stack_push_object((JAVA_OBJECT)array);} while(0)
+JAVA_VOID bc_resolve_array_class_slow(VM_PARAM_CURRENT_CONTEXT, JavaStackFrame *frame, C_CSTR desc,
+                                      OPA_ptr_t *classCache, JAVA_CLASS *classRefOut);
+/**
+ * Resolve the array class at the call site of newarray or anewarray.
+ *
+ * Same as bc_resolve_class_cached(), each call site has its own cache slot so the array class
+ * is only looked up by its descriptor once.
+ */
+#define bc_resolve_array_class_cached(desc, class_ref) do {                                                 \
+    static OPA_ptr_t __arrayClassCache = OPA_PTR_T_INITIALIZER(NULL);                                     \
+    (class_ref) = (JAVA_CLASS) OPA_load_acquire_ptr(&__arrayClassCache);                                  \
+    if ((class_ref) == (JAVA_CLASS) JAVA_NULL) {                                                          \
+        bc_resolve_array_class_slow(vmCurrentContext, &STACK_FRAME, desc, &__arrayClassCache, &(class_ref)); \
+        exception_raise_if_occurred();                                                                    \
+    }                                                                                                     \
+} while(0)
+JAVA_ARRAY bc_new_array(VM_PARAM_CURRENT_CONTEXT, JavaStackFrame *frame, JAVA_CLASS arrayClass);
+#define bc_newarray(desc) do {                                                      \
+    JAVA_CLASS arrayClass;                                                          \
+    bc_resolve_array_class_cached(desc, arrayClass);                                \
+    JAVA_ARRAY array = bc_new_array(vmCurrentContext, &STACK_FRAME, arrayClass);    \
+    exception_raise_if_occurred();                                                  \
+    stack_push_object((JAVA_OBJECT)array);                                          \
+} while(0)
 
 JAVA_INT bc_array_length(VM_PARAM_CURRENT_CONTEXT, VMOperandStack *stack);
-#define bc_arraylength() do {JAVA_INT len = bc_array_length(vmCurrentContext, OP_STACK); stack_push_int(len);} while(0)
+#define bc_arraylength() do {JAVA_INT len = bc_array_length(vmCurrentContext, OP_STACK); exception_raise_if_occurred(); stack_push_int(len);} while(0)
+
+/**
+ * Check the arrayref and index of the array load / store instructions, and return the array,
+ * or NULL with the exception set if the check fails.
+ *
+ * @param get true if it's a load instruction
+ */
+static inline JAVA_ARRAY bc_array_check(VM_PARAM_CURRENT_CONTEXT, VMStackSlot *arrayRef, VMStackSlot *index, JAVA_BOOLEAN get) {
+    assert(arrayRef->type == VM_SLOT_OBJECT);
+    JAVA_ARRAY array = (JAVA_ARRAY) arrayRef->data.o;
+    if (array == (JAVA_ARRAY) JAVA_NULL) {
+        exception_set_NullPointerException_array(vmCurrentContext, get);
+        return (JAVA_ARRAY) JAVA_NULL;
+    }
+    assert(index->type == VM_SLOT_INT);
+    // A negative index becomes a huge unsigned value, so both bounds are checked by one compare
+    if ((uint32_t) index->data.i >= (uint32_t) array->length) {
+        exception_set_ArrayIndexOutOfBoundsException(vmCurrentContext, index->data.i);
+        return (JAVA_ARRAY) JAVA_NULL;
+    }
+
+    return array;
+}
 
-JAVA_VOID bc_array_load(VM_PARAM_CURRENT_CONTEXT, VMOperandStack *stack, void *valueOut, BasicType fieldType);
-#define bc_do_array_load(field_type)                        \
-    JAVA_##field_type value;                                \
-    bc_array_load(vmCurrentContext, OP_STACK, &value, VM_TYPE_##field_type)
+/**
+ * Same as bc_array_check() but for instructions that the translator has already proved
+ * the arrayref is not null and the index is in range, so nothing is checked in release build.
+ */
+static inline JAVA_ARRAY bc_array_check_unchecked(VM_PARAM_CURRENT_CONTEXT, VMStackSlot *arrayRef, VMStackSlot *index, JAVA_BOOLEAN get) {
+    assert(arrayRef->type == VM_SLOT_OBJECT);
+    JAVA_ARRAY array = (JAVA_ARRAY) arrayRef->data.o;
+    assert(array != (JAVA_ARRAY) JAVA_NULL);
+    assert(index->type == VM_SLOT_INT);
+    assert(index->data.i >= 0 && index->data.i < array->length);
+
+    return array;
+}
+
+// Get the array of a load / store instruction, or jump to the exception dispatcher if the check fails
+#define bc_array_access(array, arrayRef, index, get) do {                \
+    (array) = bc_array_check(vmCurrentContext, arrayRef, index, get);   \
+    if ((array) == (JAVA_ARRAY) JAVA_NULL) {                            \
+        exception_raise();                                              \
+    }                                                                   \
+} while(0)
+#define bc_array_access_unchecked(array, arrayRef, index, get) (array) = bc_array_check_unchecked(vmCurrentContext, arrayRef, index, get)
+
+// Element type of the array is known at each load / store instruction, so the element address
+// is computed inline with constant header size and element size.
+// baload / bastore are also used by boolean arrays, which have the same element size.
+#define bc_do_array_load(field_type, check)                                                             \
+    VMStackSlot *__index = OP_STACK->top - 1;                                                           \
+    VMStackSlot *__arrayRef = OP_STACK->top - 2;                                                        \
+    assert(__arrayRef >= OP_STACK->slots);                                                              \
+    JAVA_ARRAY __array;                                                                                 \
+    check(__array, __arrayRef, __index, JAVA_TRUE);                                                     \
+    assert(array_element_type_matches(__array, VM_TYPE_##field_type));                                 \
+    JAVA_##field_type value = ((JAVA_##field_type *) array_base(__array, VM_TYPE_##field_type))[__index->data.i]; \
+    /* Pop */                                                                                           \
+    OP_STACK->top = __arrayRef;                                                                         \
+    __index->type = VM_SLOT_INVALID;                                                                    \
+    __arrayRef->type = VM_SLOT_INVALID
 // For caload the char value is zero-extended to an int value, so here we need a unsigned cast,
 // otherwise it will be sign-extended.
-#define bc_caload() do {bc_do_array_load(CHAR);   stack_push_int((JAVA_UCHAR)value);   } while(0)
-#define bc_baload() do {bc_do_array_load(BYTE);   stack_push_int(value);   } while(0)
-#define bc_saload() do {bc_do_array_load(SHORT);  stack_push_int(value);   } while(0)
-#define bc_iaload() do {bc_do_array_load(INT);    stack_push_int(value);   } while(0)
-#define bc_faload() do {bc_do_array_load(FLOAT);  stack_push_float(value); } while(0)
-#define bc_laload() do {bc_do_array_load(LONG);   stack_push_long(value);  } while(0)
-#define bc_daload() do {bc_do_array_load(DOUBLE); stack_push_double(value);} while(0)
-#define bc_aaload() do {bc_do_array_load(OBJECT); stack_push_object(value);} while(0)
-
-JAVA_VOID bc_array_store(VM_PARAM_CURRENT_CONTEXT, VMOperandStack *stack, BasicType fieldType);
-#define bc_castore() bc_array_store(vmCurrentContext, OP_STACK, VM_TYPE_CHAR)
-#define bc_bastore() bc_array_store(vmCurrentContext, OP_STACK, VM_TYPE_BYTE)
-#define bc_sastore() bc_array_store(vmCurrentContext, OP_STACK, VM_TYPE_SHORT)
-#define bc_iastore() bc_array_store(vmCurrentContext, OP_STACK, VM_TYPE_INT)
-#define bc_fastore() bc_array_store(vmCurrentContext, OP_STACK, VM_TYPE_FLOAT)
-#define bc_lastore() bc_array_store(vmCurrentContext, OP_STACK, VM_TYPE_LONG)
-#define bc_dastore() bc_array_store(vmCurrentContext, OP_STACK, VM_TYPE_DOUBLE)
-#define bc_aastore() bc_array_store(vmCurrentContext, OP_STACK, VM_TYPE_OBJECT)
+#define bc_caload() do {bc_do_array_load(CHAR,   bc_array_access); stack_push_int((JAVA_UCHAR)value);   } while(0)
+#define bc_baload() do {bc_do_array_load(BYTE,   bc_array_access); stack_push_int(value);   } while(0)
+#define bc_saload() do {bc_do_array_load(SHORT,  bc_array_access); stack_push_int(value);   } while(0)
+#define bc_iaload() do {bc_do_array_load(INT,    bc_array_access); stack_push_int(value);   } while(0)
+#define bc_faload() do {bc_do_array_load(FLOAT,  bc_array_access); stack_push_float(value); } while(0)
+#define bc_laload() do {bc_do_array_load(LONG,   bc_array_access); stack_push_long(value);  } while(0)
+#define bc_daload() do {bc_do_array_load(DOUBLE, bc_array_access); stack_push_double(value);} while(0)
+#define bc_aaload() do {bc_do_array_load(OBJECT, bc_array_access); stack_push_object(value);} while(0)
+// Loads that the translator proved never throw
+#define bc_caload_unchecked() do {bc_do_array_load(CHAR,   bc_array_access_unchecked); stack_push_int((JAVA_UCHAR)value);   } while(0)
+#define bc_baload_unchecked() do {bc_do_array_load(BYTE,   bc_array_access_unchecked); stack_push_int(value);   } while(0)
+#define bc_saload_unchecked() do {bc_do_array_load(SHORT,  bc_array_access_unchecked); stack_push_int(value);   } while(0)
+#define bc_iaload_unchecked() do {bc_do_array_load(INT,    bc_array_access_unchecked); stack_push_int(value);   } while(0)
+#define bc_faload_unchecked() do {bc_do_array_load(FLOAT,  bc_array_access_unchecked); stack_push_float(value); } while(0)
+#define bc_laload_unchecked() do {bc_do_array_load(LONG,   bc_array_access_unchecked); stack_push_long(value);  } while(0)
+#define bc_daload_unchecked() do {bc_do_array_load(DOUBLE, bc_array_access_unchecked); stack_push_double(value);} while(0)
+#define bc_aaload_unchecked() do {bc_do_array_load(OBJECT, bc_array_access_unchecked); stack_push_object(value);} while(0)
+
+#define bc_do_array_store(field_type, slot_type, slot_field, check) do {                                \
+    VMStackSlot *__value = OP_STACK->top - 1;                                                           \
+    VMStackSlot *__index = OP_STACK->top - 2;                                                           \
+    VMStackSlot *__arrayRef = OP_STACK->top - 3;                                                        \
+    assert(__arrayRef >= OP_STACK->slots);                                                              \
+    JAVA_ARRAY __array;                                                                                 \
+    check(__array, __arrayRef, __index, JAVA_FALSE);                                                    \
+    assert(array_element_type_matches(__array, VM_TYPE_##field_type));                                  \
+    assert(__value->type == VM_SLOT_##slot_type);                                                       \
+    ((JAVA_##field_type *) array_base(__array, VM_TYPE_##field_type))[__index->data.i] = (JAVA_##field_type) __value->data.slot_field; \
+    /* Pop */                                                                                           \
+    OP_STACK->top = __arrayRef;                                                                         \
+    __value->type = VM_SLOT_INVALID;                                                                    \
+    __index->type = VM_SLOT_INVALID;                                                                    \
+    __arrayRef->type = VM_SLOT_INVALID;                                                                 \
+} while(0)
+#define bc_castore() bc_do_array_store(CHAR,   INT,    i, bc_array_access)
+#define bc_bastore() bc_do_array_store(BYTE,   INT,    i, bc_array_access)
+#define bc_sastore() bc_do_array_store(SHORT,  INT,    i, bc_array_access)
+#define bc_iastore() bc_do_array_store(INT,    INT,    i, bc_array_access)
+#define bc_fastore() bc_do_array_store(FLOAT,  FLOAT,  f, bc_array_access)
+#define bc_lastore() bc_do_array_store(LONG,   LONG,   l, bc_array_access)
+#define bc_dastore() bc_do_array_store(DOUBLE, DOUBLE, d, bc_array_access)
+// Stores that the translator proved never throw
+#define bc_castore_unchecked() bc_do_array_store(CHAR,   INT,    i, bc_array_access_unchecked)
+#define bc_bastore_unchecked() bc_do_array_store(BYTE,   INT,    i, bc_array_access_unchecked)
+#define bc_sastore_unchecked() bc_do_array_store(SHORT,  INT,    i, bc_array_access_unchecked)
+#define bc_iastore_unchecked() bc_do_array_store(INT,    INT,    i, bc_array_access_unchecked)
+#define bc_fastore_unchecked() bc_do_array_store(FLOAT,  FLOAT,  f, bc_array_access_unchecked)
+#define bc_lastore_unchecked() bc_do_array_store(LONG,   LONG,   l, bc_array_access_unchecked)
+#define bc_dastore_unchecked() bc_do_array_store(DOUBLE, DOUBLE, d, bc_array_access_unchecked)
+
+// aastore needs to check the type of the value
+JAVA_VOID bc_array_store_object(VM_PARAM_CURRENT_CONTEXT, VMOperandStack *stack);
+#define bc_aastore() do {bc_array_store_object(vmCurrentContext, OP_STACK); exception_raise_if_occurred();} while(0)
 
 // Monitor instructions
 JAVA_VOID bc_monitor_enter(VM_PARAM_CURRENT_CONTEXT, VMOperandStack *stack);
-#define bc_monitorenter() bc_monitor_enter(vmCurrentContext, OP_STACK)
+#define bc_monitorenter() do {bc_monitor_enter(vmCurrentContext, OP_STACK); exception_raise_if_occurred();} while(0)
 JAVA_VOID bc_monitor_exit(VM_PARAM_CURRENT_CONTEXT, VMOperandStack *stack);
-#define bc_monitorexit() bc_monitor_exit(vmCurrentContext, OP_STACK)
+#define bc_monitorexit()  do {bc_monitor_exit(vmCurrentContext, OP_STACK);  exception_raise_if_occurred();} while(0)
+
+// Lock the receiver or the class of a synchronized method, released by the return instructions and the exception dispatcher
+#define bc_synchronized_enter()         stack_frame_monitor_enter(vmCurrentContext, &STACK_FRAME, local_of(0).data.o)
+#define bc_synchronized_enter_static()  stack_frame_monitor_enter(vmCurrentContext, &STACK_FRAME, THIS_CLASS->classInstance)
 
 // Return instructions
 JAVA_VOID bc_read_stack_top(VMOperandStack *stack, void *valueOut, BasicType requiredType);
-#define bc_return() stack_frame_end(); return
+#define bc_return() stack_frame_unlock(); stack_frame_end(); return
 #define bc_do_return(field_type) do {                           \
     JAVA_##field_type value;                                    \
     bc_read_stack_top(OP_STACK, &value, VM_TYPE_##field_type);  \
+    stack_frame_unlock();                                       \
     stack_frame_end();                                          \
     return value;                                               \
 } while(0)
@@ -517,7 +890,35 @@ JAVA_VOID bc_cast_a(VM_PARAM_CURRENT_CONTEXT, VMOperandStack *stack, C_CSTR desc
     JAVA_OBJECT _ex;                                    \
     bc_read_stack_top(OP_STACK, &_ex, VM_TYPE_OBJECT);  \
     exception_set(vmCurrentContext, _ex);               \
-    exception_raise(vmCurrentContext);                  \
+    exception_raise();                                  \
+} while(0)
+
+// Register promoted locals and operand stack values.
+// When translated with local promotion, primitive locals and intermediate primitive values are kept
+// in plain C variables. They are only moved from / to the operand stack when required, e.g. before a
+// method call or at a branch target. References always live in the stack slots so GC can see them.
+#define bc_push_i(value) stack_push_int(value)
+#define bc_push_l(value) stack_push_long(value)
+#define bc_push_f(value) stack_push_float(value)
+#define bc_push_d(value) stack_push_double(value)
+
+#define bc_pop_i(var) (var) = stack_pop_data(OP_STACK, VM_SLOT_INT).i
+#define bc_pop_l(var) (var) = stack_pop_data(OP_STACK, VM_SLOT_LONG).l
+#define bc_pop_f(var) (var) = stack_pop_data(OP_STACK, VM_SLOT_FLOAT).f
+#define bc_pop_d(var) (var) = stack_pop_data(OP_STACK, VM_SLOT_DOUBLE).d
+
+/** Read the initial value of a promoted argument from its local slot. */
+#define bc_arg_i(local) local_of(local).data.i
+#define bc_arg_l(local) local_of(local).data.l
+#define bc_arg_f(local) local_of(local).data.f
+#define bc_arg_d(local) local_of(local).data.d
+
+#define bc_if_r(condition, label) if (condition) goto label
+
+#define bc_return_r(value) do { \
+    stack_frame_unlock();       \
+    stack_frame_end();          \
+    return (value);             \
 } while(0)
 
 // FoxVM specific instructions
@@ -529,6 +930,13 @@ JAVA_VOID bc_cast_a(VM_PARAM_CURRENT_CONTEXT, VMOperandStack *stack, C_CSTR desc
 /** Record current label. */
 #define bc_label(label_number) STACK_FRAME.currentLabel = (label_number)
 
+/**
+ * Record the index of the next instruction that might trigger a GC, so the GC could find
+ * the stack map of current frame. Since the index is in the same order as labels, exception
+ * handler lookup still works.
+ */
+#define bc_gc_point(instruction_index) STACK_FRAME.currentLabel = (instruction_index)
+
 // JNI stack frame helpers
 // Setup the native stack frame for the jni call
 // Before it enters a native method, the VM automatically ensures that at least 16 local references can be created.
@@ -538,19 +946,21 @@ JAVA_VOID bc_cast_a(VM_PARAM_CURRENT_CONTEXT, VMOperandStack *stack, C_CSTR desc
 // the object can be moved by the GC at any time.
 // This affectively makes current thread entering the safe region until the call returns.
 #define bc_native_start() native_enter_jni(vmCurrentContext);
-// End the native stack frame then push the result to the java stack.
+// End the native stack frame then push the result to the java stack, or jump to the exception dispatcher
+// if the native method throws.
 // This also switch the state of current thread back to normal.
-#define bc_native_end_z(result) do {native_exit_jni(vmCurrentContext); stack_push_int(result);    native_stack_frame_end();} while(0)
-#define bc_native_end_c(result) do {native_exit_jni(vmCurrentContext); stack_push_int((JAVA_UCHAR)result);    native_stack_frame_end();} while(0)
-#define bc_native_end_b(result) do {native_exit_jni(vmCurrentContext); stack_push_int(result);    native_stack_frame_end();} while(0)
-#define bc_native_end_s(result) do {native_exit_jni(vmCurrentContext); stack_push_int(result);    native_stack_frame_end();} while(0)
-#define bc_native_end_i(result) do {native_exit_jni(vmCurrentContext); stack_push_int(result);    native_stack_frame_end();} while(0)
-#define bc_native_end_f(result) do {native_exit_jni(vmCurrentContext); stack_push_float(result);  native_stack_frame_end();} while(0)
-#define bc_native_end_l(result) do {native_exit_jni(vmCurrentContext); stack_push_long(result);   native_stack_frame_end();} while(0)
-#define bc_native_end_d(result) do {native_exit_jni(vmCurrentContext); stack_push_double(result); native_stack_frame_end();} while(0)
+#define bc_do_native_end(result, push) do {native_exit_jni(vmCurrentContext); native_stack_frame_end(); exception_raise_if_occurred(); push(result);} while(0)
+#define bc_native_end_z(result) bc_do_native_end(result, stack_push_int)
+#define bc_native_end_c(result) bc_do_native_end((JAVA_UCHAR)result, stack_push_int)
+#define bc_native_end_b(result) bc_do_native_end(result, stack_push_int)
+#define bc_native_end_s(result) bc_do_native_end(result, stack_push_int)
+#define bc_native_end_i(result) bc_do_native_end(result, stack_push_int)
+#define bc_native_end_f(result) bc_do_native_end(result, stack_push_float)
+#define bc_native_end_l(result) bc_do_native_end(result, stack_push_long)
+#define bc_native_end_d(result) bc_do_native_end(result, stack_push_double)
 // For reference return types, we need to convert the native handler to object reference
 #define bc_native_end_a(result) bc_native_end_o(result)
-#define bc_native_end_o(result) do {native_exit_jni(vmCurrentContext); JAVA_OBJECT obj = native_dereference(vmCurrentContext, result); stack_push_object(obj); native_stack_frame_end();} while(0)
+#define bc_native_end_o(result) do {native_exit_jni(vmCurrentContext); JAVA_OBJECT obj = native_dereference(vmCurrentContext, result); native_stack_frame_end(); exception_raise_if_occurred(); stack_push_object(obj);} while(0)
 
 // JNI argument passing helpers
 #define bc_jni_arg_jboolean(local)       (local_of(local).data.i == 0 ? JNI_FALSE : JNI_TRUE)
@@ -567,8 +977,14 @@ JAVA_VOID bc_cast_a(VM_PARAM_CURRENT_CONTEXT, VMOperandStack *stack, C_CSTR desc
 // Called at the beginning of each instance method to check the validity of the objectref
 // and also populate the STACK_FRAME.thisClass
 JAVA_VOID bc_check_objref(VM_PARAM_CURRENT_CONTEXT, JavaStackFrame* frame);
-#define bc_check_objectref()  bc_check_objref(vmCurrentContext, &STACK_FRAME)
-
-void *bc_resolve_native(VM_PARAM_CURRENT_CONTEXT, MethodInfoNative *method);
+#define bc_check_objectref() do {bc_check_objref(vmCurrentContext, &STACK_FRAME); exception_raise_if_occurred();} while(0)
+
+void *bc_resolve_native_ptr(VM_PARAM_CURRENT_CONTEXT, MethodInfoNative *method);
+#define bc_resolve_native(method, ptr) do {                  \
+    (ptr) = bc_resolve_native_ptr(vmCurrentContext, method); \
+    if ((ptr) == NULL) {                                     \
+        exception_raise();                                   \
+    }                                                        \
+} while(0)
 
 #endif //FOXVM_VM_BYTECODE_H
@@ -19,6 +19,8 @@ JAVA_CLASS classloader_get_class_by_name_init(VM_PARAM_CURRENT_CONTEXT, JAVA_OBJ
 
 JAVA_BOOLEAN classloader_prepare_fields(VM_PARAM_CURRENT_CONTEXT, JAVA_CLASS thisClass);
 
+JAVA_BOOLEAN classloader_prepare_itable(VM_PARAM_CURRENT_CONTEXT, JAVA_CLASS thisClass);
+
 JAVA_BOOLEAN classloader_init_class(VM_PARAM_CURRENT_CONTEXT, JAVA_CLASS clazz);
 
 JAVA_CLASS classloader_get_class_by_desc(VM_PARAM_CURRENT_CONTEXT, JAVA_OBJECT classloader, C_CSTR desc);
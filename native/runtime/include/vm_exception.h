@@ -5,25 +5,9 @@
 #ifndef FOXVM_VM_EXCEPTION_H
 #define FOXVM_VM_EXCEPTION_H
 
-#include <setjmp.h>
 #include "vm_stack.h"
 #include "vm_thread.h"
 
-typedef struct _ExceptionFrame {
-    struct _ExceptionFrame *previous;
-
-    jmp_buf jmpTarget;
-} ExceptionFrame;
-
-static inline JAVA_VOID exception_frame_push(VMStackFrame *frame, ExceptionFrame* exceptionFrame) {
-    exceptionFrame->previous = frame->exceptionHandler;
-    frame->exceptionHandler = exceptionFrame;
-}
-
-static inline JAVA_VOID exception_frame_pop(VMStackFrame *frame) {
-    frame->exceptionHandler = frame->exceptionHandler->previous;
-}
-
 static inline JAVA_BOOLEAN exception_occurred(VM_PARAM_CURRENT_CONTEXT) {
     return vmCurrentContext->exception != JAVA_NULL;
 }
@@ -37,13 +21,6 @@ static inline JAVA_OBJECT exception_clear(VM_PARAM_CURRENT_CONTEXT) {
 JAVA_BOOLEAN exception_matches(JAVA_OBJECT ex, int32_t current_sp, int32_t start, int32_t end, JavaClassInfo* type);
 
 JAVA_VOID exception_set(VM_PARAM_CURRENT_CONTEXT, JAVA_OBJECT ex);
-NORETURN JAVA_VOID exception_raise(VM_PARAM_CURRENT_CONTEXT);
-
-static inline JAVA_VOID exception_raise_if_occurred(VM_PARAM_CURRENT_CONTEXT) {
-    if (exception_occurred(vmCurrentContext)) {
-        exception_raise(vmCurrentContext);
-    }
-}
 
 JAVA_OBJECT exception_new(VM_PARAM_CURRENT_CONTEXT, JavaClassInfo *exClass, C_CSTR message);
 JAVA_OBJECT exception_newf(VM_PARAM_CURRENT_CONTEXT, JavaClassInfo *exClass, C_CSTR format, ...);
@@ -62,57 +39,72 @@ JAVA_VOID exception_set_NullPointerException_monitor(VM_PARAM_CURRENT_CONTEXT, J
 JAVA_VOID exception_set_NullPointerException_invoke(VM_PARAM_CURRENT_CONTEXT, C_CSTR methodName);
 JAVA_VOID exception_set_NullPointerException_arraylen(VM_PARAM_CURRENT_CONTEXT);
 JAVA_VOID exception_set_NullPointerException_array(VM_PARAM_CURRENT_CONTEXT, JAVA_BOOLEAN get);
+JAVA_VOID exception_set_ArithmeticException_divideByZero(VM_PARAM_CURRENT_CONTEXT);
+JAVA_VOID exception_set_ArrayIndexOutOfBoundsException(VM_PARAM_CURRENT_CONTEXT, JAVA_INT index);
 JAVA_VOID exception_set_ArrayStoreException(VM_PARAM_CURRENT_CONTEXT, JavaClassInfo *arrayType, JavaClassInfo *elementType);
 JAVA_VOID exception_set_NegativeArraySizeException(VM_PARAM_CURRENT_CONTEXT, JAVA_INT length);
 JAVA_VOID exception_set_IllegalArgumentException(VM_PARAM_CURRENT_CONTEXT, C_CSTR message);
 JAVA_VOID exception_set_ClassCastException(VM_PARAM_CURRENT_CONTEXT, JavaClassInfo *expectedType, JavaClassInfo *actualType);
 
-#define EX_VAL 1
-
-#define exception_frame_start()                                             \
-    ExceptionFrame __exceptionFrame;                                        \
-    exception_frame_push(&STACK_FRAME.baseFrame, &__exceptionFrame);        \
-    if (setjmp(__exceptionFrame.jmpTarget) == EX_VAL) {                     \
-        stack_frame_pop_deeper(vmCurrentContext, &STACK_FRAME.baseFrame);   \
-        JAVA_OBJECT ex = exception_clear(vmCurrentContext);                 \
-        assert(ex);                                                         \
-        stack_clear(OP_STACK);                                              \
-        stack_push_object(ex)
-
-#define exception_new_block(start, end, handler, type) \
-        if(exception_matches(ex, STACK_FRAME.currentLabel, start, end, type)) goto handler
-
-#define exception_not_handled()                             \
-        /* Exception not handled */                         \
-        exception_frame_pop(&STACK_FRAME.baseFrame);        \
-        /* TODO: Release lock for synchronized method */    \
-
-#define exception_block_end()                               \
-        /* Rethrow the same exception again */              \
-        bc_athrow();                                        \
+/** Replace the pending exception with an ExceptionInInitializerError if it is not an Error. */
+JAVA_VOID exception_wrap_ExceptionInInitializerError(VM_PARAM_CURRENT_CONTEXT);
+
+// Exceptions are never thrown by unwinding the C stack. Instead a thrown exception is left pending
+// in vmCurrentContext->exception, and each method checks for it right after anything that could
+// throw, which costs a single compare on the path that doesn't throw.
+//
+// Every translated method ends with an exception dispatcher, which is jumped to when an exception
+// is pending. It either transfers the control to the matching handler, or ends the current frame and
+// returns with the exception still pending, so the caller will find it by the same check:
+//
+//     exception_dispatch_start();
+//     exception_new_block(start, end, handler, type);
+//     ...
+//     exception_not_handled();
+
+/** Jump to the exception dispatcher of current method. The exception must already be pending. */
+#define exception_raise() goto __exceptionDispatch
+
+#define exception_raise_if_occurred() do {              \
+    if (exception_occurred(vmCurrentContext)) {         \
+        exception_raise();                              \
+    }                                                   \
+} while(0)
+
+#define exception_dispatch_start()                      \
+    __exceptionDispatch:                                \
+    assert(exception_occurred(vmCurrentContext))
+
+#define exception_new_block(start, end, handler, type)                                                  \
+    if (exception_matches(vmCurrentContext->exception, STACK_FRAME.currentLabel, start, end, type)) {  \
+        JAVA_OBJECT __ex = exception_clear(vmCurrentContext);                                          \
+        stack_clear(OP_STACK);                                                                          \
+        stack_push_object(__ex);                                                                        \
+        goto handler;                                                                                   \
     }
 
+#define exception_not_handled()                         \
+    stack_frame_unlock();                               \
+    stack_frame_end();                                  \
+    return
+
+#define exception_not_handled_r(default_value)          \
+    stack_frame_unlock();                               \
+    stack_frame_end();                                  \
+    return (default_value)
+
 /**
- * Capture all exception, then re-set the exception and return current
- * function with given result.
+ * The exception dispatcher of a native function that calls some Java method, which
+ * leaves the exception pending, then returns current function with given result.
  *
- * This is used when a native method calls some Java method and want to
- * handle the exception in a different fashion.
+ * It must be placed after the normal return of the function.
  */
-#define exception_suppressed(result) do {       \
-    exception_not_handled() {                   \
-        exception_set(vmCurrentContext, ex);    \
-        stack_frame_end();                      \
-        return result;                          \
-    }                                           \
-} while(0)
+#define exception_suppressed(result)    \
+    exception_dispatch_start();         \
+    exception_not_handled_r(result)
 
-#define exception_suppressedv() do {            \
-    exception_not_handled() {                   \
-        exception_set(vmCurrentContext, ex);    \
-        stack_frame_end();                      \
-        return;                                 \
-    }                                           \
-} while(0)
+#define exception_suppressedv()         \
+    exception_dispatch_start();         \
+    exception_not_handled()
 
 #endif //FOXVM_VM_EXCEPTION_H
@@ -7,10 +7,63 @@
 
 #include "vm_base.h"
 
+/** Heap options given by the launcher, each size is in bytes and 0 means the default value. */
 typedef struct {
-
+    size_t maxSize; // Total reserved size of SOH and LOH
+    size_t initialSize; // Size of the SOH that is committed at startup
+    size_t gen0Size; // Allocation budget of gen0
+    size_t largeObjectSize; // Objects of at least this size are allocated in LOH
+    size_t tlabSizeMin; // Lower bound of the TLAB size
+    size_t tlabSizeMax; // Upper bound of the TLAB size
+    uint32_t gcThreadCount; // Number of threads used for marking, 0 to decide by the number of processors
+    uint32_t trimDelay; // Number of GCs that free memory must stay unused for before it's returned to the OS
+    uint32_t trimHysteresis; // Percentage of free memory above the allocation budget that is kept committed
+    JAVA_BOOLEAN concurrentMark; // Mark the old generation in background before a full GC
+    JAVA_BOOLEAN keepCommitted; // Never return free memory to the OS
 } HeapConfig;
 
+/** Function for visiting a reference slot, used by GC to find and update references */
+typedef void (*scan_func)(JAVA_OBJECT *obj_p, void *scan_context);
+
+// Card table, see vm_gc.c for details
+#ifdef TARGET_64BIT
+// 1 byte in card table -> 1<<11 bytes (2KB) of memory
+#define CARD_BYTE_SHIFT 11
+#else
+// 1 byte in card table -> 1<<10 bytes (1KB) of memory
+#define CARD_BYTE_SHIFT 10
+#endif // TARGET_64BIT
+
+#define CARD_MARKED ((uint8_t)0xFF)
+
+extern uint8_t *g_cardTableTranslated; // The translated card table, indexed by `addr >> CARD_BYTE_SHIFT`
+extern uint8_t *g_ephemeralLow; // Lowest address of the ephemeral generations
+extern uint8_t *g_ephemeralHigh; // Highest address of the ephemeral generations
+extern uint8_t *g_modUnionTableTranslated; // Same as the card table, but only set during concurrent marking
+
+/**
+ * Post-write barrier, must be called after the reference `ref` is stored into `slot` which
+ * is inside a heap object (including the static fields of a class).
+ */
+static inline void heap_write_barrier(void *slot, JAVA_OBJECT ref) {
+    if ((uint8_t *) ref >= g_ephemeralLow && (uint8_t *) ref < g_ephemeralHigh) {
+        uint8_t *card = &g_cardTableTranslated[((size_t) slot) >> CARD_BYTE_SHIFT];
+        // Don't dirty the cache line if the card is already marked
+        if (*card != CARD_MARKED) {
+            *card = CARD_MARKED;
+        }
+    }
+
+    // Tell the concurrent marker that the slot is changed
+    uint8_t *mod_union = g_modUnionTableTranslated;
+    if (mod_union != NULL) {
+        mod_union[((size_t) slot) >> CARD_BYTE_SHIFT] = CARD_MARKED;
+    }
+}
+
+/** Mark all cards that cover [start, start + size[, used after copying references in bulk. */
+void heap_write_barrier_range(void *start, size_t size);
+
 /**
  * Initialize global application heap.
  * @return 0 if success, 1 otherwise.
@@ -17,6 +17,14 @@ void heap_fill_with_object(void *start, size_t size);
 /** Get the free memory size of gen0. */
 size_t heap_gen0_free();
 
+/** Get the allocation budget of gen0, which is how much can be allocated between two gen0 GCs. */
+size_t heap_gen0_budget();
+
+/** Get the TLAB size bounds given by HeapConfig, 0 if not specified. */
+size_t heap_tlab_size_min();
+
+size_t heap_tlab_size_max();
+
 /** Make sure the end of the tlab can fit a fill array. */
 size_t tlab_reserve_size();
 
@@ -112,6 +112,12 @@ JAVA_BOOLEAN mem_commit(void *addr, size_t size);
 
 JAVA_BOOLEAN mem_uncommit(void *addr, size_t size);
 
+/**
+ * Give the physical pages of the committed range back to the OS while keeping it committed,
+ * so it can be accessed again without calling mem_commit(). The content of the range is lost.
+ */
+JAVA_BOOLEAN mem_discard(void *addr, size_t size);
+
 JAVA_BOOLEAN mem_release(void *addr, size_t size);
 
 
@@ -33,6 +33,35 @@ MethodInfo *method_find(JavaClassInfo *clazz, C_CSTR name, C_CSTR desc);
 JAVA_INT method_vtable_find(JavaClassInfo *clazz, C_CSTR name, C_CSTR desc);
 MethodInfo *method_vtable_get(JavaClassInfo *clazz, JAVA_INT vtable_index);
 
+/**
+ * Find the vtable index of the method that implements the method at `method_index` of the given interface,
+ * by searching the ivtable of the class and its superclasses.
+ *
+ * @return the vtable index, or -1 if not found.
+ */
+int32_t method_ivtable_find(JavaClassInfo *clazz, JavaClassInfo *interface_type, uint16_t method_index);
+
+/** Get the slot of the given interface in the itable of the class, or NULL if not found. */
+static inline ITableEntry *method_itable_find(JAVA_CLASS clazz, JavaClassInfo *interface_type) {
+    ITableEntry *itable = clazz->itable;
+    if (!itable) {
+        return NULL;
+    }
+
+    uint32_t mask = clazz->itableMask;
+    uint32_t i = ((uint32_t) (((uintptr_t) interface_type) >> 3u)) & mask;
+    while (1) {
+        ITableEntry *entry = &itable[i];
+        if (entry->interface == interface_type) {
+            return entry;
+        }
+        if (entry->interface == NULL) {
+            return NULL;
+        }
+        i = (i + 1) & mask;
+    }
+}
+
 C_CSTR method_get_return_type(C_CSTR desc);
 C_CSTR method_get_next_parameter_type(C_CSTR* desc_cursor);
 JAVA_INT method_get_parameter_count(C_CSTR desc);
@@ -34,13 +34,10 @@ typedef struct _NativeStackFrame {
     native_reftable_init(&__refTable, __nativeRefs, ref_capacity);      \
     native_frame_init(&__nativeFrame, &__refTable);                     \
     __nativeFrame.baseFrame.thisClass = vmCurrentContext->callingClass; \
-    stack_frame_push(vmCurrentContext, &__nativeFrame.baseFrame);       \
-    /* Native frame don't inherit exception handler from java world */  \
-    __nativeFrame.baseFrame.exceptionHandler = NULL
+    stack_frame_push(vmCurrentContext, &__nativeFrame.baseFrame)
 
 #define native_stack_frame_end() \
-    native_frame_pop(vmCurrentContext); \
-    exception_raise_if_occurred(vmCurrentContext)
+    native_frame_pop(vmCurrentContext)
 
 // Helper macros for using native handler in a non-jni native function
 
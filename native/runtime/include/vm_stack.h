@@ -9,8 +9,6 @@
 #include <assert.h>
 #include <stdlib.h>
 
-struct _ExceptionFrame;
-
 static inline VMTypeCategory slot_type_category(VMStackSlotType type) {
     switch (type) {
         case VM_SLOT_OBJECT:
@@ -49,8 +47,6 @@ typedef struct _VMStackFrame {
     struct _VMStackFrame *next;
     StackFrameType type;
 
-    struct _ExceptionFrame *exceptionHandler;
-
     JAVA_CLASS thisClass; // Reference to current class
 } VMStackFrame;
 
@@ -63,8 +59,19 @@ typedef struct _JavaStackFrame {
 
     uint16_t currentLine; // Current line number in the source file
     int32_t currentLabel; // Current label in the instruction stream
+
+    VMStackSlot lockedObject; // The object locked by a synchronized method, NULL otherwise
 } JavaStackFrame;
 
+/**
+ * Find the stack map of the given frame at its current label,
+ * or NULL if the slot types should be checked instead.
+ */
+StackMapEntry *stack_frame_stack_map(JavaStackFrame *frame);
+
+#define stack_map_is_reference(map, slot_index) \
+    ((((map)->refs[(slot_index) >> 3]) >> ((slot_index) & 7)) & 1)
+
 /** Current top of the call stack */
 VMStackFrame *stack_frame_top(VM_PARAM_CURRENT_CONTEXT);
 
@@ -74,13 +81,6 @@ void stack_frame_push(VM_PARAM_CURRENT_CONTEXT, VMStackFrame *frame);
 /** Pop the top of the call stack frame */
 void stack_frame_pop(VM_PARAM_CURRENT_CONTEXT);
 
-/**
- * Pop all stack frames that are deeper than current one,
- * make current one the top frame. This is used at exception handler to
- * fix the stack frame.
- */
-void stack_frame_pop_deeper(VM_PARAM_CURRENT_CONTEXT, VMStackFrame *frame);
-
 /** Init the stack frame of current method */
 void stack_frame_init_java(JavaStackFrame *frame, VMStackSlot *slot_base, uint16_t max_stack, uint16_t max_locals);
 
@@ -106,6 +106,19 @@ void stack_frame_init_java(JavaStackFrame *frame, VMStackSlot *slot_base, uint16
 #define stack_frame_end() \
     stack_frame_pop(vmCurrentContext)
 
+/** Lock the given object for the synchronized method of the frame. */
+JAVA_VOID stack_frame_monitor_enter(VM_PARAM_CURRENT_CONTEXT, JavaStackFrame *frame, JAVA_OBJECT obj);
+
+/** Release the object locked by stack_frame_monitor_enter(). */
+JAVA_VOID stack_frame_monitor_exit(VM_PARAM_CURRENT_CONTEXT, JavaStackFrame *frame);
+
+/** Release the monitor of a synchronized method if any, must be called before the method returns. */
+#define stack_frame_unlock() do {                                   \
+    if (STACK_FRAME.lockedObject.data.o != JAVA_NULL) {             \
+        stack_frame_monitor_exit(vmCurrentContext, &STACK_FRAME);   \
+    }                                                               \
+} while(0)
+
 #define THIS_CLASS STACK_FRAME.baseFrame.thisClass
 
 #define local_of(local) STACK_SLOTS[local]
@@ -220,6 +233,21 @@ static inline void stack_pop_to(VMOperandStack *stack, VMStackSlot *to, VMStackS
     to->data = value1->data;
 }
 
+/**
+ * Pop the top of the given stack and return the data.
+ * This also checks if the data type matches the [required_type].
+ */
+static inline VMStackSlotData stack_pop_data(VMOperandStack *stack, VMStackSlotType required_type) {
+    stack_peek_value(1);
+    assert(value1->type == required_type); // Check the type
+
+    // Pop the data
+    stack->top = value1;
+    value1->type = VM_SLOT_INVALID;
+
+    return value1->data;
+}
+
 /**
  * Pop a category 1 computational type value from the top of the operand stack
  */
@@ -6,6 +6,7 @@
 #define FOXVM_VM_STRING_H
 
 #include "vm_base.h"
+#include "vm_gc.h"
 
 // Index of pre-defined string constants in the generated constant pool
 // Must be sync with [io.noisyfox.foxvm.translator.cgen.StringConstantPool]
@@ -19,6 +20,9 @@ extern FieldInfo *g_field_java_lang_String_value;
 
 C_CSTR string_get_constant_utf8(JAVA_INT constant_index);
 
+/** Scan all string constant instances that have been created. Must be called when the world is stopped. */
+void string_scan_constants(scan_func fn, void *scan_context);
+
 JAVA_OBJECT string_get_constant(VM_PARAM_CURRENT_CONTEXT, JAVA_INT constant_index);
 
 JAVA_OBJECT string_create_utf8(VM_PARAM_CURRENT_CONTEXT, C_CSTR utf8);
@@ -10,6 +10,7 @@
 #include "vm_stack.h"
 #include "opa_primitives.h"
 #include "vm_native.h"
+#include "vm_gc.h"
 
 typedef struct {
     uint32_t numberOfProcessors;
@@ -175,12 +176,64 @@ JAVA_BOOLEAN thread_checkpoint(VM_PARAM_CURRENT_CONTEXT);
 
 JAVA_BOOLEAN thread_in_saferegion(VM_PARAM_CURRENT_CONTEXT);
 
+typedef struct _VMThreadGang VMThreadGang;
+
+/** Task that runs on each worker of a thread gang, `worker_id` is in [0, worker_count[. */
+typedef JAVA_VOID (*VMGangTask)(uint32_t worker_id, void *param);
+
+/**
+ * Create a gang of worker threads for running GC tasks in parallel. The thread that calls
+ * thread_gang_run() is always used as the worker 0, so only `worker_count - 1` native threads
+ * are started. Those threads are not managed by the VM, so they never run any java code and
+ * are not suspended by thread_stop_the_world().
+ *
+ * @return NULL if failed.
+ */
+VMThreadGang *thread_gang_create(uint32_t worker_count);
+
+/** Number of workers in the gang, which could be less than requested if some threads can't be started. */
+uint32_t thread_gang_size(VMThreadGang *gang);
+
+/** Run the task on all workers of the gang, and wait until all of them finish. */
+JAVA_VOID thread_gang_run(VMThreadGang *gang, VMGangTask task, void *param);
+
+typedef struct _VMBackgroundWorker VMBackgroundWorker;
+
+typedef JAVA_VOID (*VMBackgroundTask)(void *param);
+
+/**
+ * Create a native thread for GC background work, which runs the task once each time it's woken up
+ * by thread_background_wake(). Same as the thread gang, it's not managed by the VM.
+ *
+ * @return NULL if failed.
+ */
+VMBackgroundWorker *thread_background_create(VMBackgroundTask task, void *param);
+
+/** Wake up the worker to run its task. If the task is running, it will run again once it's finished. */
+JAVA_VOID thread_background_wake(VMBackgroundWorker *worker);
+
 // For object lock
 
 int monitor_create(VM_PARAM_CURRENT_CONTEXT, VMStackSlot *obj);
 
 JAVA_VOID monitor_free(VM_PARAM_CURRENT_CONTEXT, VMStackSlot *obj);
 
+/** Get the identity hash code of the object, which is stable even if the object is moved. */
+JAVA_INT monitor_identity_hash(VM_PARAM_CURRENT_CONTEXT, VMStackSlot *obj);
+
+/** Function for checking whether an object is unreachable, used by GC when deflating monitors */
+typedef JAVA_BOOLEAN (*object_filter_func)(JAVA_OBJECT obj);
+
+/**
+ * Detach the monitors that are not owned, waited on, or used as identity hash from their objects,
+ * and put them back to the free pool. Monitors of dead objects are always recycled.
+ * Must be called when the world is stopped.
+ */
+JAVA_VOID monitor_deflate_idle(object_filter_func is_dead);
+
+/** Scan the objects that inflated monitors are attached to, so they can be updated after objects are moved. */
+JAVA_VOID monitor_scan_objects(scan_func fn, void *scan_context);
+
 int monitor_enter(VM_PARAM_CURRENT_CONTEXT, VMStackSlot *obj);
 
 int monitor_exit(VM_PARAM_CURRENT_CONTEXT, VMStackSlot *obj);
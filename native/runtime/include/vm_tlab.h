@@ -6,6 +6,11 @@
 // from all threads, then if a thread need to allocate small object afterwards, a new tlab will
 // be allocated to that thread.
 //
+// The size of TLABs is adjusted per thread at each GC, similar to HotSpot: each thread keeps a
+// weighted average of its share of gen0 allocations, and its TLAB size is chosen so that it would
+// refill about TLAB_TARGET_REFILLS times before gen0 runs out of budget. So threads that allocate
+// a lot get larger TLABs and rarely need to take the heap lock.
+//
 
 #ifndef FOXVM_VM_TLAB_H
 #define FOXVM_VM_TLAB_H
@@ -19,6 +24,24 @@
 // By default the waste limit is 1/64 of the size
 #define TLAB_WASTE_FRACTION 64
 
+// Waste limit is increased by this much each time an object is allocated outside the TLAB
+// because the TLAB can't be discarded, so a thread won't keep doing that forever.
+// The limit is in bytes, so this is 4 words as in HotSpot's TLABWasteIncrement.
+#define TLAB_WASTE_INCREMENT (4 * sizeof(void *))
+
+// Expected number of refills of each thread between two GCs, which keeps the wasted space at the
+// end of TLABs at about 1% of gen0.
+#define TLAB_TARGET_REFILLS 50
+
+// Weight in percentage of the latest sample in the weighted averages
+#define TLAB_ALLOCATION_WEIGHT 35
+
+/** Exponentially decaying average, the first few samples are weighted higher so it warms up fast. */
+typedef struct {
+    float average;
+    uint32_t sampleCount;
+} WeightedAverage;
+
 typedef struct _AllocContext ThreadAllocContext;
 
 struct _AllocContext {
@@ -28,6 +51,7 @@ struct _AllocContext {
     size_t wasteLimit; // Don't discard TLAB if remaining space is larger than this.
 
     size_t desiredSize; // Desired TLAB size of this thread.
+    WeightedAverage allocationFraction; // The share of gen0 allocations that this thread made in each GC cycle.
     size_t refillCount; // Refill count since last GC.
     size_t refillSize; // Total refilled size since last GC.
     size_t wastedSize; // Total wasted size since last GC.
@@ -41,7 +65,6 @@ static inline void tlab_reset(ThreadAllocContext *tlab) {
     tlab->tlabHead = 0;
     tlab->tlabCurrent = 0;
     tlab->tlabLimit = 0;
-    tlab->wasteLimit = 0;
 }
 
 /** Fill the tlab with given memory and size */
@@ -84,4 +107,25 @@ size_t tlab_calculate_new_size(ThreadAllocContext *tlab, size_t obj_size);
  */
 void tlab_retire(ThreadAllocContext *tlab, JAVA_BOOLEAN for_gc);
 
+/** Called when an object is allocated outside of the tlab because it can't be discarded yet. */
+static inline void tlab_record_slow_allocation(ThreadAllocContext *tlab) {
+    tlab->wasteLimit += TLAB_WASTE_INCREMENT;
+}
+
+/** Size of gen0 used by the given tlab since last GC. Must be called before it's retired by GC. */
+size_t tlab_used(ThreadAllocContext *tlab);
+
+/**
+ * Update the statistic data of the tlab before it's retired by GC.
+ *
+ * @param total_used total size of gen0 used by all tlabs since last GC.
+ */
+void tlab_accumulate_statistics(ThreadAllocContext *tlab, size_t total_used);
+
+/** Update the global statistic data once all tlabs are accumulated. */
+void tlab_publish_statistics(size_t allocating_thread_count);
+
+/** Compute the desired size of the tlab for the next GC cycle. */
+void tlab_resize(ThreadAllocContext *tlab);
+
 #endif //FOXVM_VM_TLAB_H
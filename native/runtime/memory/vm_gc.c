@@ -7,6 +7,10 @@
 #include "vm_memory.h"
 #include "vm_thread.h"
 #include "vm_array.h"
+#include "vm_class.h"
+#include "vm_native.h"
+#include "vm_string.h"
+#include "classloader/vm_boot_classloader.h"
 #include <assert.h>
 #include <string.h>
 #include <stdio.h>
@@ -29,13 +33,7 @@
  * `card_byte()` function, and 0xFF is masked into it.
  */
 
-#ifdef TARGET_64BIT
-// 1 byte in card table -> 1<<11 bytes (2KB) of memory
-#define CARD_BYTE_SHIFT 11
-#else
-// 1 byte in card table -> 1<<10 bytes (1KB) of memory
-#define CARD_BYTE_SHIFT 10
-#endif // TARGET_64BIT
+// CARD_BYTE_SHIFT is defined in vm_gc.h, since it's used by the write barrier
 
 #define card_byte(addr) (((size_t)(addr)) >> CARD_BYTE_SHIFT)
 
@@ -78,8 +76,9 @@ typedef struct _CardTable {
     uint8_t *highestAddr;
 
     int16_t *brickTable;
+    uint8_t *modUnionTable; // Cards changed during concurrent marking, see concurrent_mark_try_start()
 
-    size_t size; // Size of the entire card table, include the header and brick table
+    size_t size; // Size of the entire card table, include the header, brick table and mod union table
     struct _CardTable *next;  // Pointer to next chained card table
 } CardTable;
 
@@ -107,15 +106,34 @@ static inline uint8_t *card_table_translate(CardTable *ct) {
     return ptr_dec(base_addr, card_byte(ct->lowestAddr));
 }
 
+/** Same as card_table_translate() but for the mod union table. */
+static inline uint8_t *mod_union_table_translate(CardTable *ct) {
+    return ptr_dec(ct->modUnionTable, card_byte(ct->lowestAddr));
+}
+
 // Heap segment default size
 #ifdef TARGET_64BIT
 #define SOH_SEGMENT_ALLOC ((size_t)(1024*1024*256))
-#define LOH_SEGMENT_ALLOC ((size_t)(1024*1024*128))
+#define LOH_SEGMENT_ALLOC ((size_t)(1024*1024*256))
 #else
 #define SOH_SEGMENT_ALLOC ((size_t)(1024*1024*16))
 #define LOH_SEGMENT_ALLOC ((size_t)(1024*1024*16))
 #endif //TARGET_64BIT
 
+// The smallest segment size that can be configured by HeapConfig
+#define SOH_SEGMENT_SIZE_MIN ((size_t)(1024*1024*16))
+#define LOH_SEGMENT_SIZE_MIN ((size_t)(1024*1024*4))
+
+// Large objects go directly to LOH
+#define LARGE_OBJECT_SIZE_MIN ((size_t)(85000))
+
+// Default number of GCs that free memory must stay unused for before it's returned to the OS
+#define TRIM_DELAY_DEFAULT 3
+// Default percentage of free memory above the allocation budget that is kept committed
+#define TRIM_HYSTERESIS_DEFAULT 25
+// Free items that can give back less than this are left alone, to save system calls
+#define TRIM_FREE_ITEM_MIN ((size_t)(64*1024))
+
 // The initial commit size when creating a new segment
 #define SEGMENT_INITIAL_COMMIT (mem_page_size())
 // Make sure the start memory is aligned
@@ -137,18 +155,20 @@ typedef struct _HeapSegment {
  * Allocate a new heap segment with the given size.
  *
  * @param size the size of the segment, include the header size. Can't be smaller than `SEGMENT_INITIAL_COMMIT`.
+ * @param commit_size the size that is committed up front, at least `SEGMENT_INITIAL_COMMIT` is committed.
  * @return NULL if can't allocate new memory. Otherwise a new HeapSegment* will be returned,
  * the address is aligned with `SEGMENT_ALIGNMENT`.
  */
-static HeapSegment *heap_segment_alloc(size_t size) {
+static HeapSegment *heap_segment_alloc(size_t size, size_t commit_size) {
     // Reserve memory
     void *mem = mem_reserve(NULL, size, SEGMENT_ALIGNMENT);
     if (!mem) {
         return NULL;
     }
 
-    // Commit the first page
-    if (mem_commit(mem, SEGMENT_INITIAL_COMMIT) != JAVA_TRUE) {
+    // Commit the first page, or more if required
+    commit_size = size_min(align_size_up(size_max(commit_size, SEGMENT_INITIAL_COMMIT), mem_page_size()), size);
+    if (mem_commit(mem, commit_size) != JAVA_TRUE) {
         mem_release(mem, size);
         return NULL;
     }
@@ -158,7 +178,7 @@ static HeapSegment *heap_segment_alloc(size_t size) {
     // Init each field
     segment->start = ptr_inc(mem, SEGMENT_START_OFFSET);
     segment->allocated = segment->start;
-    segment->committed = ptr_inc(mem, SEGMENT_INITIAL_COMMIT);
+    segment->committed = ptr_inc(mem, commit_size);
     segment->end = ptr_inc(mem, size);
     segment->flags = 0;
     segment->next = NULL;
@@ -193,6 +213,28 @@ static size_t heap_segment_grow(HeapSegment *segment, size_t required_size) {
     return required_size;
 }
 
+/**
+ * Uncommit the end of the given segment, so only `keep_size` after the allocated space stays committed.
+ *
+ * @return the size that is uncommitted.
+ */
+static size_t heap_segment_shrink(HeapSegment *segment, size_t keep_size) {
+    uint8_t *committed = align_ptr(ptr_inc(segment->allocated, size_min(keep_size, (size_t) ptr_offset(segment->allocated, segment->end))),
+                                   mem_page_size());
+    if (committed >= segment->committed) {
+        return 0;
+    }
+
+    size_t uncommit_size = ptr_offset(committed, segment->committed);
+    if (mem_uncommit(committed, uncommit_size) != JAVA_TRUE) {
+        return 0;
+    }
+
+    segment->committed = committed;
+
+    return uncommit_size;
+}
+
 typedef enum {
     // small object heap includes generations [0-2], which are "generations" in the general sense.
     soh_gen0 = 0,
@@ -223,22 +265,149 @@ typedef struct {
     size_t collectionCount; // GC count of this generation
 } DynamicData;
 
+/**
+ * Free space of a generation that is found by the sweeper.
+ *
+ * Each free item is formatted as a filler int array so the heap is always walkable, and the
+ * pointer to the next item is stored as the first element of the array. Items are kept in
+ * address order.
+ */
+typedef struct {
+    uint8_t *head;
+    uint8_t *tail;
+    size_t freeSize; // Total size of all items in this list
+} FreeList;
+
+// Items smaller than 1 << LOH_BUCKET_SHIFT_MIN go to the first bucket
+#define LOH_BUCKET_SHIFT_MIN 10
+#define LOH_BUCKET_COUNT 20
+
+/**
+ * Free space of the large object heap. Items are formatted the same as FreeList, but segregated by size:
+ * bucket b holds the items in [1 << (b + LOH_BUCKET_SHIFT_MIN), 1 << (b + LOH_BUCKET_SHIFT_MIN + 1)[,
+ * and the last bucket holds everything larger. Items in a bucket are not ordered.
+ */
+typedef struct {
+    uint8_t *buckets[LOH_BUCKET_COUNT];
+    size_t freeSize; // Total size of all items in this list
+} LohFreeList;
+
 // Memory info of each generation
 typedef struct {
     GCGeneration gen;
     HeapSegment *startSegment; // The head of the chained segments that used by this generation
     HeapSegment *allocationSegment; // The segment currently used to allocate
     uint8_t *allocationStart; // The start address of this generation
+    FreeList freeList; // Free items in this generation
 
     StaticData staticData;
     DynamicData dynamicData;
 } Generation;
 
+// Objects that are marked but not traced yet
+typedef struct {
+    JAVA_OBJECT *objects;
+    size_t top;
+    size_t capacity;
+} MarkStack;
+
+// Capacity of the mark deque of each worker, must be power of 2
+#define MARK_DEQUE_SIZE ((size_t)(1 << 14))
+
+/**
+ * Chase-Lev work stealing deque with a fixed capacity. Only the owner pushes & pops at the bottom,
+ * while other workers steal from the top. Objects that don't fit go to the overflow stack of the owner.
+ */
+typedef struct {
+    JAVA_OBJECT *objects;
+    OPA_int_t top;
+    OPA_int_t bottom;
+} MarkDeque;
+
+typedef struct {
+    uint32_t id;
+    uint32_t stealSeed; // State of the random generator for picking the victim to steal from
+    MarkDeque deque;
+    MarkStack overflow; // Objects that don't fit in the deque, which can't be stolen
+} MarkWorker;
+
+// The number of cards that are scanned by a single root scanning task
+#define MARK_CARD_TASK_SIZE ((size_t)256)
+
+// A range of the heap whose marked cards are scanned as roots
+typedef struct {
+    uint8_t *cards; // The translated card table
+    uint8_t *low;
+    uint8_t *high;
+    JAVA_BOOLEAN markedOnly; // Only scan the objects that are already marked
+    int firstTask; // The root scanning task of the first chunk of cards
+} MarkCardRange;
+
+#define MARK_CARD_RANGE_MAX 3
+
+typedef enum {
+    cm_idle = 0, // Not started
+    cm_marking, // The background marker is running
+    cm_marked, // Marking is finished, waiting for the final remark
+} ConcurrentMarkState;
+
+typedef struct {
+    JAVA_BOOLEAN enabled;
+    OPA_int_t state;
+    OPA_int_t abortRequested; // Ask the marker to stop as soon as possible
+    OPA_int_t markerRunning; // Whether the marker is still using the mark stack
+    VMBackgroundWorker *marker;
+    MarkStack markStack;
+
+    // Objects in [ephemeralLow, ephemeralHigh[ are skipped by the marker, since they could be moved
+    // by ephemeral GCs. They are marked by the final remark instead.
+    uint8_t *ephemeralLow;
+    uint8_t *ephemeralHigh;
+} ConcurrentMarkContext;
+
+// A run of adjacent living objects that are moved together by the compactor
+typedef struct {
+    uint8_t *start;
+    uint8_t *end;
+    uint8_t *newStart; // Where the plug is moved to
+} Plug;
+
+typedef struct {
+    Plug *plugs; // Plugs in address order
+    size_t count;
+    size_t capacity;
+
+    size_t *brickPlugs; // Index of the first plug that ends after the start of each brick
+    size_t brickStart; // The brick of brickPlugs[0]
+} PlugTable;
+
 typedef struct {
     void *addressLow; // Lowest address being condemned
     void *addressHigh; // Highest address being condemned
+
+    PlugTable plugTable;
+
+    // Parallel marking
+    uint32_t markWorkerCount;
+    MarkWorker *markWorkers;
+    VMThreadGang *markGang; // NULL if marking is done by the GC thread only
+    // Root scanning tasks: one for each thread, then loaded classes, string constants, and each chunk of cards
+    MarkCardRange markCardRanges[MARK_CARD_RANGE_MAX];
+    int markCardRangeCount;
+    int markThreadCount;
+    int markRootTaskCount;
+    OPA_int_t markRootTaskNext;
+    OPA_int_t markTerminationOffered; // Number of workers that run out of work
 } GCContext;
 
+// Free memory that is given back to the OS after GCs
+typedef struct {
+    JAVA_BOOLEAN enabled;
+    uint32_t delay; // Number of consecutive GCs with surplus memory before trimming
+    uint32_t hysteresis; // Percentage of memory above the budget that is not counted as surplus
+    uint32_t surplusCount; // Number of consecutive GCs that found surplus memory so far
+} TrimContext;
+
 typedef struct {
     // The size of each SOH segment
     size_t sohSegmentSize;
@@ -246,27 +415,42 @@ typedef struct {
     // Minimum LOH segment size
     size_t minLohSegmentSize;
 
+    // Objects of at least this size are allocated in LOH
+    size_t largeObjectSize;
+
+    // TLAB size bounds from HeapConfig, 0 if not specified
+    size_t tlabSizeMin;
+    size_t tlabSizeMax;
+
     // The current max possible memory range of the heap, which is covered by card table.
     uint8_t *lowestAddr;
     uint8_t *highestAddr;
 
     CardTable *cardTable;
-    uint8_t *cardTableTranslated;
 
     // The generation table
     Generation generations[total_generation_count];
+    LohFreeList lohFreeList; // Free items of the LOH
 
     // Lock when alloc directly from heap
     VMSpinLock moreSpaceLockSoh;
     VMSpinLock moreSpaceLockLoh;
 
     // Fields used by GC
+    uint32_t gcThreadCount; // Requested number of GC threads, 0 if not specified
     VMSpinLock gcLock;
     GCContext gcContext;
+    ConcurrentMarkContext concurrentMark;
+    TrimContext trim;
 } JavaHeap;
 
 static JavaHeap g_heap = {0};
 
+uint8_t *g_cardTableTranslated = NULL;
+uint8_t *g_ephemeralLow = NULL;
+uint8_t *g_ephemeralHigh = NULL;
+uint8_t *g_modUnionTableTranslated = NULL;
+
 /**
  * Create the initial card table & brick table that covers the current heap address range.
  */
@@ -277,7 +461,7 @@ static int card_table_init() {
     size_t bs = brick_size_of(g_heap.lowestAddr, g_heap.highestAddr);
 
     // Allocate memory
-    size_t alloc_size = sizeof(CardTable) + cs + bs;
+    size_t alloc_size = sizeof(CardTable) + cs + bs + cs;
     void *mem = mem_reserve(NULL, alloc_size, ANY_ALIGNMENT);
     if (!mem) {
         return -1;
@@ -295,13 +479,14 @@ static int card_table_init() {
     card_table->lowestAddr = g_heap.lowestAddr;
     card_table->highestAddr = g_heap.highestAddr;
     card_table->brickTable = ptr_inc(mem, sizeof(CardTable) + cs);
+    card_table->modUnionTable = ptr_inc(mem, sizeof(CardTable) + cs + bs);
     card_table->size = alloc_size;
     card_table->next = NULL;
 
     g_heap.cardTable = card_table;
 
     // Translate card table
-    g_heap.cardTableTranslated = card_table_translate(card_table);
+    g_cardTableTranslated = card_table_translate(card_table);
 
     return 0;
 }
@@ -323,6 +508,32 @@ static inline void brick_set(Brick b, int16_t val) {
     g_heap.cardTable->brickTable[b] = val;
 }
 
+/** Record an object that starts at `start` with given size in the brick table */
+static void brick_mark_object(void *start, size_t size) {
+    Brick b = brick_of(start);
+    // Mark first brick
+    brick_set(b, ptr_offset(brick_start_addr_of(b), start) + 1);
+    // Fill the rest bricks that are covered by this object
+    Brick end_brick = brick_of(ptr_inc(start, size - 1));
+    for (b++; b <= end_brick; b++) {
+        brick_set(b, BRICK_VAL_PREVIOUS);
+    }
+}
+
+void heap_write_barrier_range(void *start, size_t size) {
+    if (size == 0) {
+        return;
+    }
+    size_t first = card_byte(start);
+    size_t last = card_byte(ptr_inc(start, size - 1));
+    memset(&g_cardTableTranslated[first], CARD_MARKED, last - first + 1);
+
+    uint8_t *mod_union = g_modUnionTableTranslated;
+    if (mod_union != NULL) {
+        memset(&mod_union[first], CARD_MARKED, last - first + 1);
+    }
+}
+
 static inline Generation *generation_of(GCGeneration n) {
     assert (((n < total_generation_count) && (n >= soh_gen0)));
 
@@ -332,6 +543,236 @@ static inline Generation *generation_of(GCGeneration n) {
 #define youngest_generation (generation_of (soh_gen0))
 #define large_object_generation (generation_of (loh_generation))
 
+/** Get the SOH generation that the given address belongs to */
+static GCGeneration generation_of_address(void *addr) {
+    for (int i = soh_gen0; i < max_generation; i++) {
+        if ((uint8_t *) addr >= generation_of(i)->allocationStart) {
+            return i;
+        }
+    }
+    return max_generation;
+}
+
+/** Get the size of the given object. A class is allocated together with its class instance. */
+static size_t heap_object_size(JAVA_OBJECT obj) {
+    JAVA_CLASS clazz = obj_get_class(obj);
+    if (clazz == (JAVA_CLASS) JAVA_NULL) {
+        // This is a class
+        JavaClassInfo *info = ((JAVA_CLASS) obj)->info;
+        assert(info != NULL);
+        return align_size_up(info->classSize, SIZE_ALIGNMENT) +
+               align_size_up(g_classInfo_java_lang_Class->instanceSize, SIZE_ALIGNMENT);
+    }
+
+    JavaClassInfo *info = clazz->info;
+    if (class_is_array(info)) {
+        return array_class_size_of((JavaArrayClass *) clazz, (size_t) ((JAVA_ARRAY) obj)->length);
+    }
+
+    return align_size_up(info->instanceSize, SIZE_ALIGNMENT);
+}
+
+/**
+ * Find the object that covers the given address. The brick table is used to find an object
+ * before addr, then the heap is walked from there. `low` must be the start of an object.
+ */
+static uint8_t *heap_find_object(uint8_t *addr, uint8_t *low) {
+    uint8_t *current = low;
+
+    Brick low_brick = brick_of(low);
+    Brick b = brick_of(addr);
+    while (b > low_brick) {
+        int16_t entry = g_heap.cardTable->brickTable[b];
+        if (entry > 0) {
+            uint8_t *start = ptr_inc(brick_start_addr_of(b), entry - 1);
+            if (start <= addr && start >= low) {
+                current = start;
+                break;
+            }
+            b--;
+        } else if (entry < 0) {
+            // Jump back
+            b -= (Brick) (-entry);
+        } else {
+            b--;
+        }
+    }
+
+    while (1) {
+        uint8_t *next = ptr_inc(current, heap_object_size((JAVA_OBJECT) current));
+        if (next > addr) {
+            return current;
+        }
+        current = next;
+    }
+}
+
+/** The smallest free item that can hold the pointer to the next item */
+static inline size_t free_item_size_min() {
+    return align_size_up(g_fillerArraySizeMin + sizeof(uint8_t *), SIZE_ALIGNMENT);
+}
+
+static inline uint8_t **free_item_next(uint8_t *item) {
+    return array_base((JAVA_ARRAY) item, VM_TYPE_INT);
+}
+
+static inline size_t free_item_size(uint8_t *item) {
+    return array_size_of_type(VM_TYPE_INT, ((JAVA_ARRAY) item)->length);
+}
+
+/** Turn the given memory into a free item, which is linked to the given next item */
+static uint8_t *free_item_make(void *start, size_t size, uint8_t *next) {
+    assert(size >= free_item_size_min());
+
+    heap_fill_with_object(start, size);
+    *free_item_next(start) = next;
+
+    return start;
+}
+
+static inline void free_list_clear(FreeList *list) {
+    list->head = NULL;
+    list->tail = NULL;
+    list->freeSize = 0;
+}
+
+/** Move all items of `src` to the end of `dst`. Items in `src` must be after the items in `dst`. */
+static void free_list_concat(FreeList *dst, FreeList *src) {
+    if (!src->head) {
+        return;
+    }
+    assert(dst->tail == NULL || dst->tail < src->head);
+
+    if (dst->tail) {
+        *free_item_next(dst->tail) = src->head;
+    } else {
+        dst->head = src->head;
+    }
+    dst->tail = src->tail;
+    dst->freeSize += src->freeSize;
+
+    free_list_clear(src);
+}
+
+/** Append the given memory to the end of the free list. */
+static void free_list_append(FreeList *list, void *start, size_t size) {
+    uint8_t *item = free_item_make(start, size, NULL);
+    if (list->tail) {
+        *free_item_next(list->tail) = item;
+    } else {
+        list->head = item;
+    }
+    list->tail = item;
+    list->freeSize += size;
+}
+
+/**
+ * Take given size of memory from the first item that can fit. The rest of the item is put back
+ * to the list if it is large enough, otherwise it is filled with a filler object and wasted
+ * until next GC.
+ */
+static JAVA_BOOLEAN free_list_try_fit(FreeList *list, size_t size, void **out) {
+    uint8_t *prev = NULL;
+    for (uint8_t *item = list->head; item != NULL; prev = item, item = *free_item_next(item)) {
+        size_t item_size = free_item_size(item);
+        if (item_size < size) {
+            continue;
+        }
+        size_t remaining = item_size - size;
+        if (remaining != 0 && remaining < g_fillerSizeMin) {
+            // The rest can't be filled
+            continue;
+        }
+
+        uint8_t *next = *free_item_next(item);
+        if (remaining >= free_item_size_min()) {
+            // Replace the item with the rest of it
+            next = free_item_make(ptr_inc(item, size), remaining, next);
+            list->freeSize -= size;
+        } else {
+            heap_fill_with_object(ptr_inc(item, size), remaining);
+            list->freeSize -= item_size;
+        }
+
+        // Unlink the item
+        if (prev) {
+            *free_item_next(prev) = next;
+        } else {
+            list->head = next;
+        }
+        if (list->tail == item) {
+            list->tail = next != NULL ? next : prev;
+        }
+
+        *out = item;
+        return JAVA_TRUE;
+    }
+
+    return JAVA_FALSE;
+}
+
+static inline int loh_bucket_of(size_t size) {
+    int b = 0;
+    size >>= LOH_BUCKET_SHIFT_MIN;
+    while (size > 1 && b < LOH_BUCKET_COUNT - 1) {
+        size >>= 1;
+        b++;
+    }
+    return b;
+}
+
+static inline void loh_free_list_clear(LohFreeList *list) {
+    memset(list->buckets, 0, sizeof(list->buckets));
+    list->freeSize = 0;
+}
+
+/** Add the given memory to the bucket of its size. */
+static void loh_free_list_add(LohFreeList *list, void *start, size_t size) {
+    int b = loh_bucket_of(size);
+    list->buckets[b] = free_item_make(start, size, list->buckets[b]);
+    list->freeSize += size;
+}
+
+/**
+ * Take given size of memory from the free list. The bucket of the size is searched first fit, then any item
+ * in larger buckets can fit. The rest of the item is put back to the list, same as free_list_try_fit().
+ */
+static JAVA_BOOLEAN loh_free_list_try_fit(LohFreeList *list, size_t size, void **out) {
+    for (int b = loh_bucket_of(size); b < LOH_BUCKET_COUNT; b++) {
+        uint8_t *prev = NULL;
+        for (uint8_t *item = list->buckets[b]; item != NULL; prev = item, item = *free_item_next(item)) {
+            size_t item_size = free_item_size(item);
+            if (item_size < size) {
+                continue;
+            }
+            size_t remaining = item_size - size;
+            if (remaining != 0 && remaining < g_fillerSizeMin) {
+                // The rest can't be filled
+                continue;
+            }
+
+            // Unlink the item
+            if (prev) {
+                *free_item_next(prev) = *free_item_next(item);
+            } else {
+                list->buckets[b] = *free_item_next(item);
+            }
+            list->freeSize -= item_size;
+
+            if (remaining >= free_item_size_min()) {
+                loh_free_list_add(list, ptr_inc(item, size), remaining);
+            } else if (remaining != 0) {
+                heap_fill_with_object(ptr_inc(item, size), remaining);
+            }
+
+            *out = item;
+            return JAVA_TRUE;
+        }
+    }
+
+    return JAVA_FALSE;
+}
+
 static void generation_make(GCGeneration gen, HeapSegment *seg) {
     Generation *generation = generation_of(gen);
 
@@ -339,11 +780,29 @@ static void generation_make(GCGeneration gen, HeapSegment *seg) {
     generation->startSegment = seg;
     generation->allocationSegment = seg;
     generation->allocationStart = seg->start;
+    free_list_clear(&generation->freeList);
 }
 
 size_t heap_gen0_free() {
     Generation *gen0 = youngest_generation;
-    return ptr_offset(gen0->allocationSegment->allocated, gen0->allocationSegment->end);
+    size_t free = ptr_offset(gen0->allocationSegment->allocated, gen0->allocationSegment->end);
+    // Gen0 allocations can also use the free space of older generations
+    for (int i = soh_gen0; i <= max_generation; i++) {
+        free += generation_of(i)->freeList.freeSize;
+    }
+    return free;
+}
+
+size_t heap_gen0_budget() {
+    return youngest_generation->dynamicData.allocBudget;
+}
+
+size_t heap_tlab_size_min() {
+    return g_heap.tlabSizeMin;
+}
+
+size_t heap_tlab_size_max() {
+    return g_heap.tlabSizeMax;
 }
 
 int heap_init(HeapConfig *config) {
@@ -353,12 +812,24 @@ int heap_init(HeapConfig *config) {
     g_fillerSizeMin = MIN_OBJECT_SIZE;
 
     // Determine the size of each heap segment
-    g_heap.sohSegmentSize = align_size_up(SOH_SEGMENT_ALLOC, SIZE_ALIGNMENT);
-    g_heap.minLohSegmentSize = align_size_up(LOH_SEGMENT_ALLOC, SIZE_ALIGNMENT);
+    if (config->maxSize != 0) {
+        // 1/3 of the heap is left for LOH
+        size_t loh_size = config->maxSize / 3;
+        g_heap.sohSegmentSize = align_size_up(size_max(config->maxSize - loh_size, SOH_SEGMENT_SIZE_MIN), SEGMENT_ALIGNMENT);
+        // LOH is the only segment that large objects can't move out of, so it's reserved for the whole heap
+        // in case the live set is mostly large objects. Pages are only committed when used.
+        g_heap.minLohSegmentSize = align_size_up(size_max(config->maxSize, LOH_SEGMENT_SIZE_MIN), SEGMENT_ALIGNMENT);
+    } else {
+        g_heap.sohSegmentSize = align_size_up(SOH_SEGMENT_ALLOC, SIZE_ALIGNMENT);
+        g_heap.minLohSegmentSize = align_size_up(LOH_SEGMENT_ALLOC, SIZE_ALIGNMENT);
+    }
+    g_heap.largeObjectSize = config->largeObjectSize != 0 ? config->largeObjectSize : LARGE_OBJECT_SIZE_MIN;
+    g_heap.tlabSizeMin = config->tlabSizeMin;
+    g_heap.tlabSizeMax = config->tlabSizeMax;
 
     // Create first SOH and LOH segment
-    HeapSegment *soh_seg = heap_segment_alloc(g_heap.sohSegmentSize);
-    HeapSegment *loh_seg = heap_segment_alloc(g_heap.minLohSegmentSize);
+    HeapSegment *soh_seg = heap_segment_alloc(g_heap.sohSegmentSize, config->initialSize);
+    HeapSegment *loh_seg = heap_segment_alloc(g_heap.minLohSegmentSize, SEGMENT_INITIAL_COMMIT);
     if (!soh_seg || !loh_seg) {
         // Something went wrong
         return -1;
@@ -378,9 +849,12 @@ int heap_init(HeapConfig *config) {
     for (int i = max_generation; i >= soh_gen0; i--) {
         generation_make(i, soh_seg);
     }
+    g_ephemeralLow = soh_seg->start;
+    g_ephemeralHigh = soh_seg->end;
 
     // Init loh generation
     generation_make(loh_generation, loh_seg);
+    loh_free_list_clear(&g_heap.lohFreeList);
 
     // Init generation static & dynamic data
     {
@@ -401,6 +875,14 @@ int heap_init(HeapConfig *config) {
                 .minSize = 256 * 1024,
                 .maxSize = gen0_max_size,
         };
+        if (config->gen0Size != 0) {
+            // Use the given budget, as long as gen0 can still fit in the SOH segment
+            size_t gen0_size = align_size_up(size_min(config->gen0Size, gen0_max_size), SIZE_ALIGNMENT);
+            generation_of(soh_gen0)->staticData = (StaticData) {
+                    .minSize = gen0_size,
+                    .maxSize = gen0_size,
+            };
+        }
         generation_of(soh_gen1)->staticData = (StaticData) {
                 .minSize = 160 * 1024,
                 .maxSize = gen1_max_size,
@@ -431,6 +913,15 @@ int heap_init(HeapConfig *config) {
     spin_lock_init(&g_heap.moreSpaceLockLoh);
 
     // Init GC data
+    g_heap.gcThreadCount = config->gcThreadCount;
+    g_heap.concurrentMark.enabled = config->concurrentMark;
+    OPA_store_int(&g_heap.concurrentMark.state, cm_idle);
+    g_heap.trim = (TrimContext) {
+            .enabled = config->keepCommitted ? JAVA_FALSE : JAVA_TRUE,
+            .delay = config->trimDelay != 0 ? config->trimDelay : TRIM_DELAY_DEFAULT,
+            .hysteresis = config->trimHysteresis != 0 ? config->trimHysteresis : TRIM_HYSTERESIS_DEFAULT,
+            .surplusCount = 0,
+    };
     spin_lock_init(&g_heap.gcLock);
 
     return 0;
@@ -440,122 +931,1355 @@ int heap_init(HeapConfig *config) {
 // GC related functions
 //*********************************************************************************************************
 
-/** Retire all tlabs. */
+/** Retire all tlabs, and collect their allocation statistics. */
 static void gc_reclaim_tlabs() {
-    HeapSegment *ephemeral_seg = youngest_generation->allocationSegment;
+    size_t total_used = 0;
+    size_t allocating_thread_count = 0;
+    {
+        thread_iterate(thread) {
+            ThreadAllocContext *tlab = &thread->tlab;
+            if (tlab->refillCount > 0) {
+                total_used += tlab_used(tlab);
+                allocating_thread_count++;
+            }
+        }
+    }
 
     thread_iterate(thread) {
         ThreadAllocContext *tlab = &thread->tlab;
+        tlab_accumulate_statistics(tlab, total_used);
+
         if (!tlab_allocated(tlab)) {
             continue;
         }
 
         tlab_retire(tlab, JAVA_TRUE);
     }
-}
-
-typedef void (*scan_func)(JAVA_OBJECT *, void *);
 
-/** Scan GC roots */
-static void scan_roots(scan_func fn, void *scan_context) {
-    assert(fn != NULL);
+    tlab_publish_statistics(allocating_thread_count);
+}
 
-    // Scan thread stacks
+/** Adjust the tlab size of each thread for the next GC cycle. */
+static void gc_resize_tlabs() {
     thread_iterate(thread) {
-        // Scan each frame
-        stack_frame_iterate(thread, frame) {
-            if(frame->type == VM_STACK_FRAME_JAVA) {
-                JavaStackFrame *javaFrame = (JavaStackFrame *) frame;
-                // Scan operand stack
-                stack_frame_operand_stack_iterate(javaFrame, slot) {
-                    if (slot->type == VM_SLOT_OBJECT) {
-                        fn(&slot->data.o, scan_context);
+        tlab_resize(&thread->tlab);
+    }
+}
+
+/** Scan the stack and other roots of the given thread */
+static void scan_thread_roots(VMThreadContext *thread, scan_func fn, void *scan_context) {
+    // Scan each frame
+    stack_frame_iterate(thread, frame) {
+        if(frame->type == VM_STACK_FRAME_JAVA) {
+            JavaStackFrame *javaFrame = (JavaStackFrame *) frame;
+            if (javaFrame->lockedObject.data.o != JAVA_NULL) {
+                fn(&javaFrame->lockedObject.data.o, scan_context);
+            }
+            StackMapEntry *map = stack_frame_stack_map(javaFrame);
+            if (map != NULL) {
+                // Scan slots precisely using the stack map generated by the translator
+                int localCount = javaFrame->locals.maxLocals;
+                int stackCount = (int) (javaFrame->operandStack.top - javaFrame->operandStack.slots);
+                int mappedCount = localCount + (stackCount < map->stackDepth ? stackCount : map->stackDepth);
+                for (int i = 0; i < mappedCount; i++) {
+                    if (stack_map_is_reference(map, i)) {
+                        fn(&javaFrame->locals.slots[i].data.o, scan_context);
                     }
                 }
-                // Scan local slots
-                stack_frame_local_iterate(javaFrame, slot) {
+                // Values pushed by current instruction are not covered by the map
+                for (int i = mappedCount; i < localCount + stackCount; i++) {
+                    VMStackSlot *slot = &javaFrame->locals.slots[i];
                     if (slot->type == VM_SLOT_OBJECT) {
                         fn(&slot->data.o, scan_context);
                     }
                 }
+                continue;
+            }
+            // Scan operand stack
+            stack_frame_operand_stack_iterate(javaFrame, slot) {
+                if (slot->type == VM_SLOT_OBJECT) {
+                    fn(&slot->data.o, scan_context);
+                }
+            }
+            // Scan local slots
+            stack_frame_local_iterate(javaFrame, slot) {
+                if (slot->type == VM_SLOT_OBJECT) {
+                    fn(&slot->data.o, scan_context);
+                }
+            }
+        }
+        if (frame->type == VM_STACK_FRAME_NATIVE) {
+            // Scan native references
+            NativeStackFrame *nativeFrame = (NativeStackFrame *) frame;
+            for (RefTable *table = nativeFrame->refTable; table != NULL; table = table->next) {
+                for (jint i = 0; i < table->top; i++) {
+                    fn(&table->objects[i], scan_context);
+                }
             }
-            // TODO: scan native stack frame
         }
     }
+
+    // Scan thread objects
+    fn(&thread->currentThread, scan_context);
+    fn(&thread->exception, scan_context);
 }
 
-/** Promote an object */
-static void object_promote(JAVA_OBJECT *obj_p, void *scan_context) {
-    JAVA_OBJECT obj = *obj_p;
+/** Scan GC roots */
+static void scan_roots(scan_func fn, void *scan_context) {
+    assert(fn != NULL);
 
-    // Check if obj is in our gc range
-    if ((void *) obj < g_heap.gcContext.addressLow || (void *) obj >= g_heap.gcContext.addressHigh) {
-        return;
+    // Scan thread stacks
+    thread_iterate(thread) {
+        scan_thread_roots(thread, fn, scan_context);
     }
 
-    // Mark object
-    if(obj_is_marked(obj) == JAVA_FALSE) {
-        obj_set_marked(obj);
+    // Scan loaded classes
+    cl_bootstrap_scan_classes(fn, scan_context);
 
-        // TODO: mark object fields
+    // Scan string constants
+    string_scan_constants(fn, scan_context);
+}
+
+static void mark_stack_push(MarkStack *stack, JAVA_OBJECT obj) {
+    if (stack->top == stack->capacity) {
+        // Grow the stack
+        size_t new_capacity = stack->capacity == 0 ? 1024 : stack->capacity * 2;
+        JAVA_OBJECT *new_objects = heap_alloc_uncollectable(new_capacity * sizeof(JAVA_OBJECT));
+        if (!new_objects) {
+            fprintf(stderr, "GC: unable to grow the mark stack\n");
+            abort();
+        }
+        if (stack->objects) {
+            memcpy(new_objects, stack->objects, stack->top * sizeof(JAVA_OBJECT));
+            heap_free_uncollectable(stack->objects);
+        }
+        stack->objects = new_objects;
+        stack->capacity = new_capacity;
     }
+
+    stack->objects[stack->top++] = obj;
 }
 
-/** Mark living objects */
-static void heap_mark(GCGeneration gen) {
-    printf("Marking roots\n");
-    scan_roots(object_promote, NULL);
+static inline JAVA_OBJECT mark_stack_pop(MarkStack *stack) {
+    return stack->top == 0 ? JAVA_NULL : stack->objects[--stack->top];
 }
 
-/** Real GC work once the world is stopped */
-static void heap_gc(GCGeneration gen) {
-    // Retire all TLABs
-    gc_reclaim_tlabs();
+static inline JAVA_BOOLEAN mark_deque_is_empty(MarkDeque *deque) {
+    return OPA_load_int(&deque->top) >= OPA_load_int(&deque->bottom) ? JAVA_TRUE : JAVA_FALSE;
+}
 
-    // Check alloc budget to see if any older gen needs GC as well
-    for (int i = total_generation_count - 1; i > (int) gen; i--) {
-        if (generation_of(i)->dynamicData.runningBudget < 0) {
-            gen = i;
-            if (gen == loh_generation) {
-                gen = max_generation;
-            }
-            printf("Gen %d run out of budget, trigger gen %dd GC instead.\n", i, gen);
-            break;
+/** Push an object to the bottom of the deque. Owner only. */
+static JAVA_BOOLEAN mark_deque_push(MarkDeque *deque, JAVA_OBJECT obj) {
+    int b = OPA_load_int(&deque->bottom);
+    int t = OPA_load_acquire_int(&deque->top);
+    if ((size_t) (b - t) >= MARK_DEQUE_SIZE) {
+        // Full
+        return JAVA_FALSE;
+    }
+
+    deque->objects[b & (MARK_DEQUE_SIZE - 1)] = obj;
+    // Make sure the object is visible before the thieves could see it
+    OPA_store_release_int(&deque->bottom, b + 1);
+    return JAVA_TRUE;
+}
+
+/** Pop an object from the bottom of the deque. Owner only. */
+static JAVA_OBJECT mark_deque_pop(MarkDeque *deque) {
+    int b = OPA_load_int(&deque->bottom) - 1;
+    OPA_store_int(&deque->bottom, b);
+    // The store to bottom must be visible before reading top, otherwise both
+    // the owner and a thief could take the last object.
+    OPA_read_write_barrier();
+    int t = OPA_load_int(&deque->top);
+
+    if (t > b) {
+        // Empty
+        OPA_store_int(&deque->bottom, b + 1);
+        return JAVA_NULL;
+    }
+
+    JAVA_OBJECT obj = deque->objects[b & (MARK_DEQUE_SIZE - 1)];
+    if (t == b) {
+        // The last one, race with the thieves
+        if (OPA_cas_int(&deque->top, t, t + 1) != t) {
+            obj = JAVA_NULL;
         }
+        OPA_store_int(&deque->bottom, b + 1);
     }
+    return obj;
+}
 
-    // Set GC address range
-    if (gen == max_generation) {
-        // Process the whole heap
-        g_heap.gcContext.addressLow = g_heap.lowestAddr;
-        g_heap.gcContext.addressHigh = g_heap.highestAddr;
-    } else {
-        // Process ephemeral segment only
-        g_heap.gcContext.addressLow = youngest_generation->allocationSegment->start;
-        g_heap.gcContext.addressHigh = youngest_generation->allocationSegment->allocated;
+/** Steal an object from the top of the deque. Returns JAVA_NULL if empty or lost the race. */
+static JAVA_OBJECT mark_deque_steal(MarkDeque *deque) {
+    int t = OPA_load_acquire_int(&deque->top);
+    OPA_read_write_barrier();
+    int b = OPA_load_acquire_int(&deque->bottom);
+
+    if (t >= b) {
+        return JAVA_NULL;
     }
 
-    // TODO: merge card table
+    JAVA_OBJECT obj = deque->objects[t & (MARK_DEQUE_SIZE - 1)];
+    if (OPA_cas_int(&deque->top, t, t + 1) != t) {
+        return JAVA_NULL;
+    }
+    return obj;
+}
 
-    // Mark phase
-    heap_mark(gen);
+static inline void mark_worker_push(MarkWorker *worker, JAVA_OBJECT obj) {
+    if (mark_deque_push(&worker->deque, obj) != JAVA_TRUE) {
+        mark_stack_push(&worker->overflow, obj);
+    }
+}
 
-    // Update collect counts
-    for (int i = soh_gen0; i <= (int) gen; i++) {
-        generation_of(i)->dynamicData.collectionCount++;
-        if (i == max_generation) {
-            // Also collect LOH
-            generation_of(loh_generation)->dynamicData.collectionCount++;
-        }
+static inline JAVA_OBJECT mark_worker_pop(MarkWorker *worker) {
+    JAVA_OBJECT obj = mark_deque_pop(&worker->deque);
+    if (obj == JAVA_NULL) {
+        obj = mark_stack_pop(&worker->overflow);
     }
+    return obj;
 }
 
-/** Trigger a GC of given generation. */
-static size_t gc(VM_PARAM_CURRENT_CONTEXT, GCGeneration gen) {
-    DynamicData *dd = &generation_of(gen)->dynamicData;
-    size_t count_before_lock = dd->collectionCount;
+/** Try stealing an object from other workers, starting from a random one. */
+static JAVA_OBJECT mark_worker_steal(MarkWorker *worker) {
+    GCContext *ctx = &g_heap.gcContext;
+    uint32_t count = ctx->markWorkerCount;
+    if (count == 1) {
+        return JAVA_NULL;
+    }
 
-    spin_lock_enter(vmCurrentContext, &g_heap.gcLock);
+    // xorshift
+    uint32_t seed = worker->stealSeed;
+    seed ^= seed << 13;
+    seed ^= seed >> 17;
+    seed ^= seed << 5;
+    worker->stealSeed = seed;
+
+    for (uint32_t i = 0; i < count; i++) {
+        uint32_t victim = (seed + i) % count;
+        if (victim == worker->id) {
+            continue;
+        }
+        JAVA_OBJECT obj = mark_deque_steal(&ctx->markWorkers[victim].deque);
+        if (obj != JAVA_NULL) {
+            return obj;
+        }
+    }
+    return JAVA_NULL;
+}
+
+/**
+ * Called when the worker runs out of work. Returns JAVA_TRUE if all workers run out of work so the
+ * marking is done, or JAVA_FALSE if there are still objects that can be stolen.
+ *
+ * A worker only offers termination when its own deque and overflow stack are empty, and no one
+ * pushes to the deque of others, so there is nothing left once all workers offered.
+ */
+static JAVA_BOOLEAN mark_worker_offer_termination(MarkWorker *worker) {
+    GCContext *ctx = &g_heap.gcContext;
+    int count = (int) ctx->markWorkerCount;
+    if (count == 1) {
+        return JAVA_TRUE;
+    }
+
+    OPA_incr_int(&ctx->markTerminationOffered);
+    while (1) {
+        if (OPA_load_int(&ctx->markTerminationOffered) == count) {
+            return JAVA_TRUE;
+        }
+
+        for (int i = 0; i < count; i++) {
+            if (mark_deque_is_empty(&ctx->markWorkers[i].deque) != JAVA_TRUE) {
+                OPA_decr_int(&ctx->markTerminationOffered);
+                return JAVA_FALSE;
+            }
+        }
+
+        OPA_busy_wait();
+    }
+}
+
+/** Set the mark of the object, returns JAVA_TRUE if it's marked by this call. */
+static inline JAVA_BOOLEAN object_try_mark(JAVA_OBJECT obj) {
+    if (obj_is_marked(obj) == JAVA_TRUE) {
+        return JAVA_FALSE;
+    }
+
+    if (g_heap.gcContext.markWorkerCount == 1) {
+        obj_set_marked(obj);
+        return JAVA_TRUE;
+    }
+
+    // Other workers could be marking the same object
+    OPA_ptr_t *word = (OPA_ptr_t *) &obj->clazz;
+    void *c = OPA_load_ptr(word);
+    while ((((uintptr_t) c) & OBJECT_FLAG_GC_MARKED) == 0) {
+        void *prev = OPA_cas_ptr(word, c, (void *) (((uintptr_t) c) | OBJECT_FLAG_GC_MARKED));
+        if (prev == c) {
+            return JAVA_TRUE;
+        }
+        c = prev;
+    }
+    return JAVA_FALSE;
+}
+
+/** Promote an object, the scan_context is the current MarkWorker */
+static void object_promote(JAVA_OBJECT *obj_p, void *scan_context) {
+    JAVA_OBJECT obj = *obj_p;
+
+    // Check if obj is in our gc range
+    if ((void *) obj < g_heap.gcContext.addressLow || (void *) obj >= g_heap.gcContext.addressHigh) {
+        return;
+    }
+
+    // Mark object, and trace it later
+    if (object_try_mark(obj) == JAVA_TRUE) {
+        mark_worker_push(scan_context, obj);
+    }
+}
+
+/** Scan static reference fields and other objects referenced by the given class. */
+static void class_scan_references(JAVA_CLASS clazz, scan_func fn, void *scan_context) {
+    if (clazz->hasStaticReference) {
+        for (uint16_t i = 0; i < clazz->staticFieldCount; i++) {
+            ResolvedField *f = &clazz->staticFields[i];
+            if (f->isReference) {
+                fn(ptr_inc(clazz, f->info.offset), scan_context);
+            }
+        }
+    }
+
+    fn(&clazz->classLoader, scan_context);
+    // The class instance is allocated together with the class, however the class of it
+    // is not set until java/lang/Class is loaded.
+    if (clazz->classInstance != JAVA_NULL && obj_get_class(clazz->classInstance) != (JAVA_CLASS) JAVA_NULL) {
+        fn(&clazz->classInstance, scan_context);
+    }
+}
+
+/** Scan all references of the given object. */
+static void object_scan_references(JAVA_OBJECT obj, scan_func fn, void *scan_context) {
+    JAVA_CLASS clazz = obj_get_class(obj);
+    if (clazz == (JAVA_CLASS) JAVA_NULL) {
+        // This is a class
+        class_scan_references((JAVA_CLASS) obj, fn, scan_context);
+        return;
+    }
+
+    JavaClassInfo *info = clazz->info;
+    if (class_is_array(info)) {
+        BasicType t = ((JavaArrayClass *) clazz)->elementType;
+        if (t == VM_TYPE_OBJECT || t == VM_TYPE_ARRAY) {
+            JAVA_ARRAY array = (JAVA_ARRAY) obj;
+            JAVA_OBJECT *elements = array_base(array, t);
+            for (JAVA_INT i = 0; i < array->length; i++) {
+                fn(&elements[i], scan_context);
+            }
+        }
+        return;
+    }
+
+    // Reference fields are grouped into blocks by the translator
+    for (uint16_t i = 0; i < info->referenceBlockCount; i++) {
+        ReferenceFieldBlock *block = &info->referenceBlocks[i];
+        JAVA_OBJECT *fields = ptr_inc(obj, block->offset);
+        for (uint32_t j = 0; j < block->count; j++) {
+            fn(&fields[j], scan_context);
+        }
+    }
+}
+
+typedef struct {
+    scan_func fn;
+    void *scanContext;
+    // Only slots in [low, high[ are scanned
+    uint8_t *low;
+    uint8_t *high;
+    JAVA_BOOLEAN crossGen; // If any slot is referencing ephemeral generations
+} CardScanContext;
+
+static void card_scan_slot(JAVA_OBJECT *obj_p, void *scan_context) {
+    CardScanContext *ctx = scan_context;
+    if ((uint8_t *) obj_p < ctx->low || (uint8_t *) obj_p >= ctx->high) {
+        return;
+    }
+
+    if (ctx->fn) {
+        ctx->fn(obj_p, ctx->scanContext);
+    }
+    if ((uint8_t *) *obj_p >= g_ephemeralLow && (uint8_t *) *obj_p < g_ephemeralHigh) {
+        ctx->crossGen = JAVA_TRUE;
+    }
+}
+
+/** Scan the reference slots of given object that are covered by the card */
+static void card_scan_object(JAVA_OBJECT obj, CardScanContext *ctx) {
+    JAVA_CLASS clazz = obj_get_class(obj);
+    if (clazz != (JAVA_CLASS) JAVA_NULL && class_is_array(clazz->info)) {
+        // Only visit the elements inside the card, since a large array could cover a lot of cards
+        BasicType t = ((JavaArrayClass *) clazz)->elementType;
+        if (t == VM_TYPE_OBJECT || t == VM_TYPE_ARRAY) {
+            JAVA_ARRAY array = (JAVA_ARRAY) obj;
+            JAVA_OBJECT *elements = array_base(array, t);
+            JAVA_OBJECT *from = (uint8_t *) elements < ctx->low ? (JAVA_OBJECT *) ctx->low : elements;
+            JAVA_OBJECT *to = &elements[array->length];
+            if ((uint8_t *) to > ctx->high) {
+                to = (JAVA_OBJECT *) ctx->high;
+            }
+            for (JAVA_OBJECT *slot = from; slot < to; slot++) {
+                card_scan_slot(slot, ctx);
+            }
+        }
+        return;
+    }
+
+    object_scan_references(obj, card_scan_slot, ctx);
+}
+
+/**
+ * Visit the reference slots in [low, high[ that are covered by marked cards in [first_card, last_card].
+ * `low` must be the start of an object.
+ *
+ * @param cards the translated card table to look at
+ * @param marked_only if JAVA_TRUE, only the slots of marked objects are visited
+ */
+static void card_table_scan_cards(uint8_t *cards, uint8_t *low, uint8_t *high, size_t first_card, size_t last_card,
+                                  scan_func fn, void *scan_context, JAVA_BOOLEAN clear_clean_cards, JAVA_BOOLEAN marked_only) {
+    for (size_t c = first_card; c <= last_card; c++) {
+        if (cards[c] == 0) {
+            continue;
+        }
+
+        CardScanContext ctx = {
+                .fn = fn,
+                .scanContext = scan_context,
+                .low = ptr_max(low, (void *) (c << CARD_BYTE_SHIFT)),
+                .high = ptr_min(high, (void *) ((c + 1) << CARD_BYTE_SHIFT)),
+                .crossGen = JAVA_FALSE,
+        };
+        for (uint8_t *current = heap_find_object(ctx.low, low); current < ctx.high;) {
+            JAVA_OBJECT obj = (JAVA_OBJECT) current;
+            size_t size = heap_object_size(obj);
+            if (!marked_only || obj_is_marked(obj)) {
+                card_scan_object(obj, &ctx);
+            }
+            current = ptr_inc(current, size);
+        }
+
+        if (clear_clean_cards && !ctx.crossGen) {
+            cards[c] = 0;
+        }
+    }
+}
+
+/**
+ * Visit the reference slots in [low, high[ that are covered by marked cards.
+ *
+ * @param clear_clean_cards if JAVA_TRUE, cards that no longer contain any reference to the
+ * ephemeral generations are cleared.
+ */
+static void card_table_scan(uint8_t *low, uint8_t *high, scan_func fn, void *scan_context, JAVA_BOOLEAN clear_clean_cards) {
+    if (low >= high) {
+        return;
+    }
+
+    card_table_scan_cards(g_cardTableTranslated, low, high, card_byte(low), card_byte(ptr_dec(high, 1)),
+                          fn, scan_context, clear_clean_cards, JAVA_FALSE);
+}
+
+/** Add a range of cards to be scanned by root scanning tasks. */
+static void mark_add_card_range(uint8_t *cards, uint8_t *low, uint8_t *high, JAVA_BOOLEAN marked_only) {
+    GCContext *ctx = &g_heap.gcContext;
+    if (low >= high) {
+        return;
+    }
+    assert(ctx->markCardRangeCount < MARK_CARD_RANGE_MAX);
+
+    MarkCardRange *range = &ctx->markCardRanges[ctx->markCardRangeCount++];
+    range->cards = cards;
+    range->low = low;
+    range->high = high;
+    range->markedOnly = marked_only;
+    range->firstTask = ctx->markRootTaskCount;
+
+    size_t card_count = card_count_of(low, high);
+    ctx->markRootTaskCount += (int) ((card_count + MARK_CARD_TASK_SIZE - 1) / MARK_CARD_TASK_SIZE);
+}
+
+static inline int mark_claim_root_task() {
+    return OPA_fetch_and_incr_int(&g_heap.gcContext.markRootTaskNext);
+}
+
+/** Claim & run root scanning tasks until there is no one left. */
+static void mark_scan_roots(MarkWorker *worker) {
+    GCContext *ctx = &g_heap.gcContext;
+    int task = mark_claim_root_task();
+
+    // Thread stacks. Tasks are claimed in order, so the thread list is only walked once by each worker.
+    {
+        int i = 0;
+        thread_iterate(thread) {
+            if (i++ == task) {
+                scan_thread_roots(thread, object_promote, worker);
+                task = mark_claim_root_task();
+            }
+        }
+    }
+
+    for (; task < ctx->markRootTaskCount; task = mark_claim_root_task()) {
+        int t = task - ctx->markThreadCount;
+        if (t == 0) {
+            // Scan loaded classes
+            cl_bootstrap_scan_classes(object_promote, worker);
+        } else if (t == 1) {
+            // Scan string constants
+            string_scan_constants(object_promote, worker);
+        } else {
+            // Scan a chunk of cards
+            int r = ctx->markCardRangeCount - 1;
+            while (task < ctx->markCardRanges[r].firstTask) {
+                r--;
+            }
+            MarkCardRange *range = &ctx->markCardRanges[r];
+            size_t first = card_byte(range->low) + (size_t) (task - range->firstTask) * MARK_CARD_TASK_SIZE;
+            size_t last = size_min(first + MARK_CARD_TASK_SIZE - 1, card_byte(ptr_dec(range->high, 1)));
+            card_table_scan_cards(range->cards, range->low, range->high, first, last,
+                                  object_promote, worker, JAVA_FALSE, range->markedOnly);
+        }
+    }
+}
+
+/** Mark task that runs on each worker */
+static JAVA_VOID mark_worker_run(uint32_t worker_id, void *param) {
+    GCContext *ctx = param;
+    MarkWorker *worker = &ctx->markWorkers[worker_id];
+
+    mark_scan_roots(worker);
+
+    // Trace all objects that are reachable from roots
+    while (1) {
+        JAVA_OBJECT obj = mark_worker_pop(worker);
+        if (obj == JAVA_NULL) {
+            obj = mark_worker_steal(worker);
+        }
+        if (obj != JAVA_NULL) {
+            object_scan_references(obj, object_promote, worker);
+        } else if (mark_worker_offer_termination(worker) == JAVA_TRUE) {
+            break;
+        }
+    }
+}
+
+/** Decide the number of mark workers and create them at the first GC. */
+static void mark_workers_init() {
+    GCContext *ctx = &g_heap.gcContext;
+    if (ctx->markWorkers != NULL) {
+        return;
+    }
+
+    uint32_t count = g_heap.gcThreadCount;
+    if (count == 0) {
+        // Same as HotSpot: one per processor up to 8, then 5/8 of the rest
+        uint32_t np = g_systemProcessorInfo.numberOfProcessors > 0 ? g_systemProcessorInfo.numberOfProcessors : 1;
+        count = np <= 8 ? np : 8 + (np - 8) * 5 / 8;
+    }
+    if (count > 1) {
+        ctx->markGang = thread_gang_create(count);
+        count = ctx->markGang ? thread_gang_size(ctx->markGang) : 1;
+    }
+
+    MarkWorker *workers = heap_alloc_uncollectable(count * sizeof(MarkWorker));
+    if (!workers) {
+        fprintf(stderr, "GC: unable to create mark workers\n");
+        abort();
+    }
+    for (uint32_t i = 0; i < count; i++) {
+        MarkWorker *w = &workers[i];
+        w->id = i;
+        w->stealSeed = 2463534242u + i * 0x9E3779B9u;
+        w->deque.objects = heap_alloc_uncollectable(MARK_DEQUE_SIZE * sizeof(JAVA_OBJECT));
+        if (!w->deque.objects) {
+            fprintf(stderr, "GC: unable to create mark workers\n");
+            abort();
+        }
+        OPA_store_int(&w->deque.top, 0);
+        OPA_store_int(&w->deque.bottom, 0);
+    }
+
+    ctx->markWorkerCount = count;
+    ctx->markWorkers = workers;
+}
+
+/** Mark living objects */
+//*********************************************************************************************************
+// Concurrent marking
+//*********************************************************************************************************
+
+/*
+ * The old generation can be marked in background before a full GC, so the full GC itself only needs to
+ * mark the objects that are changed since then. This is an incremental update marking:
+ *
+ * 1. Initial mark: at the end of an ephemeral GC, old objects that are directly referenced by roots are
+ *    marked and pushed to the mark stack of the concurrent marker. Then the mod union table is cleared
+ *    and enabled, so the write barrier records every slot that mutators store into.
+ * 2. Concurrent mark: the background marker traces the old objects while mutators and ephemeral GCs keep
+ *    running. Objects in the ephemeral range are never marked by the marker since ephemeral GCs could
+ *    move them, instead the card of the slot is marked in the mod union table so it's revisited later.
+ *    Ephemeral GCs don't touch the marks of the old objects nor move them, so both can run at the same time.
+ * 3. Remark: the next full GC stops the marker, and marks the heap as usual with every object marked
+ *    concurrently treated as traced. Slots of marked objects that are covered by the mod union table are
+ *    scanned as extra roots, as well as the objects left in the mark stack of the marker.
+ *
+ * Sweeping still happens when the world is stopped.
+ */
+
+// Start concurrent marking once old generation occupies this percentage of the SOH segment
+#define CONCURRENT_MARK_OCCUPANCY_PERCENT 70
+
+// The number of objects that the marker traces before checking if it should stop
+#define CONCURRENT_MARK_ABORT_CHECK_INTERVAL 256
+
+/** Check if the object lives in the old generation that is being marked concurrently. */
+static inline JAVA_BOOLEAN concurrent_mark_is_old(JAVA_OBJECT obj) {
+    ConcurrentMarkContext *cm = &g_heap.concurrentMark;
+
+    if ((uint8_t *) obj < g_heap.lowestAddr || (uint8_t *) obj >= g_heap.highestAddr) {
+        return JAVA_FALSE;
+    }
+
+    if ((uint8_t *) obj >= cm->ephemeralLow && (uint8_t *) obj < cm->ephemeralHigh) {
+        return JAVA_FALSE;
+    }
+
+    return JAVA_TRUE;
+}
+
+/** Mark the referenced old object during initial mark, the scan_context is the mark stack */
+static void concurrent_mark_root(JAVA_OBJECT *obj_p, void *scan_context) {
+    JAVA_OBJECT obj = *obj_p;
+
+    if (obj != JAVA_NULL && concurrent_mark_is_old(obj) && !obj_is_marked(obj)) {
+        obj_set_marked(obj);
+        mark_stack_push(scan_context, obj);
+    }
+}
+
+/** Mark the old object referenced by the slot, the scan_context is the mark stack */
+static void concurrent_mark_slot(JAVA_OBJECT *obj_p, void *scan_context) {
+    JAVA_OBJECT obj = *obj_p;
+
+    if (obj == JAVA_NULL) {
+        return;
+    }
+
+    if (concurrent_mark_is_old(obj)) {
+        // Mutators never touch the mark, but an ephemeral GC could be scanning the cards at the same time
+        // which reads the same word, so keep it atomic.
+        OPA_ptr_t *word = (OPA_ptr_t *) &obj->clazz;
+        void *c = OPA_load_ptr(word);
+        if ((((uintptr_t) c) & OBJECT_FLAG_GC_MARKED) == 0 &&
+            OPA_cas_ptr(word, c, (void *) (((uintptr_t) c) | OBJECT_FLAG_GC_MARKED)) == c) {
+            mark_stack_push(scan_context, obj);
+        }
+    } else {
+        // The referenced object could be moved, let the remark scan the slot again
+        mod_union_table_translate(g_heap.cardTable)[card_byte(obj_p)] = CARD_MARKED;
+    }
+}
+
+/** Task of the background marker */
+static JAVA_VOID concurrent_mark_run(void *param) {
+    ConcurrentMarkContext *cm = param;
+
+    if (OPA_load_int(&cm->state) != cm_marking) {
+        return;
+    }
+
+    printf("Concurrent marking started\n");
+    size_t count = 0;
+    while (1) {
+        if (count++ % CONCURRENT_MARK_ABORT_CHECK_INTERVAL == 0 && OPA_load_int(&cm->abortRequested)) {
+            printf("Concurrent marking aborted\n");
+            break;
+        }
+
+        JAVA_OBJECT obj = mark_stack_pop(&cm->markStack);
+        if (obj == JAVA_NULL) {
+            printf("Concurrent marking finished\n");
+            OPA_store_int(&cm->state, cm_marked);
+            break;
+        }
+
+        object_scan_references(obj, concurrent_mark_slot, &cm->markStack);
+    }
+
+    // Hand the mark stack back to the GC
+    OPA_store_release_int(&cm->markerRunning, 0);
+}
+
+/** Start concurrent marking if the old generation is full enough. Must be called when the world is stopped. */
+static void concurrent_mark_try_start() {
+    ConcurrentMarkContext *cm = &g_heap.concurrentMark;
+    HeapSegment *segment = youngest_generation->allocationSegment;
+
+    if (!cm->enabled || OPA_load_int(&cm->state) != cm_idle) {
+        return;
+    }
+
+    size_t old_size = ptr_offset(segment->start, generation_of(soh_gen1)->allocationStart);
+    size_t old_free = generation_of(max_generation)->freeList.freeSize;
+    if ((old_size - old_free) * 100 < g_heap.sohSegmentSize * CONCURRENT_MARK_OCCUPANCY_PERCENT) {
+        return;
+    }
+
+    if (!cm->marker) {
+        cm->marker = thread_background_create(concurrent_mark_run, cm);
+        if (!cm->marker) {
+            fprintf(stderr, "GC: unable to create the concurrent marker, disable concurrent marking\n");
+            cm->enabled = JAVA_FALSE;
+            return;
+        }
+    }
+
+    printf("Concurrent marking initial mark\n");
+
+    // Everything allocated from now on are traced by the remark
+    cm->ephemeralLow = generation_of(soh_gen1)->allocationStart;
+    cm->ephemeralHigh = segment->end;
+
+    CardTable *card_table = g_heap.cardTable;
+    memset(card_table->modUnionTable, 0, card_size_of(card_table->lowestAddr, card_table->highestAddr));
+
+    scan_roots(concurrent_mark_root, &cm->markStack);
+
+    OPA_store_int(&cm->abortRequested, 0);
+    OPA_store_int(&cm->state, cm_marking);
+    OPA_store_int(&cm->markerRunning, 1);
+    g_modUnionTableTranslated = mod_union_table_translate(card_table);
+
+    thread_background_wake(cm->marker);
+}
+
+/**
+ * Stop concurrent marking and take over its work as part of a full GC: the objects left in the mark stack
+ * are given to the first mark worker, and marked objects in changed cards are scanned again.
+ */
+static void concurrent_mark_remark() {
+    ConcurrentMarkContext *cm = &g_heap.concurrentMark;
+    GCContext *ctx = &g_heap.gcContext;
+
+    if (OPA_load_int(&cm->state) == cm_idle) {
+        return;
+    }
+
+    // Wait for the marker to release the mark stack
+    OPA_store_int(&cm->abortRequested, 1);
+    while (OPA_load_acquire_int(&cm->markerRunning)) {
+        OPA_busy_wait();
+    }
+    g_modUnionTableTranslated = NULL;
+
+    printf("Concurrent marking remark, %zu objects left\n", cm->markStack.top);
+
+    MarkStack stack = ctx->markWorkers[0].overflow;
+    ctx->markWorkers[0].overflow = cm->markStack;
+    cm->markStack = stack;
+
+    CardTable *card_table = g_heap.cardTable;
+    HeapSegment *segment = youngest_generation->allocationSegment;
+    HeapSegment *loh_segment = large_object_generation->allocationSegment;
+    mark_add_card_range(mod_union_table_translate(card_table),
+                        segment->start, ptr_min(cm->ephemeralLow, segment->allocated), JAVA_TRUE);
+    mark_add_card_range(mod_union_table_translate(card_table), loh_segment->start, loh_segment->allocated, JAVA_TRUE);
+
+    OPA_store_int(&cm->state, cm_idle);
+}
+
+/** Check if a concurrent marking is finished and waiting for a full GC */
+static inline JAVA_BOOLEAN concurrent_mark_is_done() {
+    return OPA_load_int(&g_heap.concurrentMark.state) == cm_marked ? JAVA_TRUE : JAVA_FALSE;
+}
+
+static void heap_mark(GCGeneration gen) {
+    GCContext *ctx = &g_heap.gcContext;
+    mark_workers_init();
+
+    // Prepare root scanning tasks
+    ctx->markThreadCount = 0;
+    {
+        thread_iterate(thread) {
+            ctx->markThreadCount++;
+        }
+    }
+    ctx->markRootTaskCount = ctx->markThreadCount + 2;
+    ctx->markCardRangeCount = 0;
+    if (gen < max_generation) {
+        // Objects in older generations are not traced, so references from them are found by cards
+        HeapSegment *loh_segment = large_object_generation->allocationSegment;
+        mark_add_card_range(g_cardTableTranslated, youngest_generation->allocationSegment->start,
+                            generation_of(gen)->allocationStart, JAVA_FALSE);
+        mark_add_card_range(g_cardTableTranslated, loh_segment->start, loh_segment->allocated, JAVA_FALSE);
+    }
+    OPA_store_int(&ctx->markRootTaskNext, 0);
+    OPA_store_int(&ctx->markTerminationOffered, 0);
+
+    for (uint32_t i = 0; i < ctx->markWorkerCount; i++) {
+        MarkWorker *w = &ctx->markWorkers[i];
+        assert(mark_deque_is_empty(&w->deque) && w->overflow.top == 0);
+        // Restart the deque indexes, so they never overflow
+        OPA_store_int(&w->deque.top, 0);
+        OPA_store_int(&w->deque.bottom, 0);
+    }
+
+    if (gen == max_generation) {
+        // Take over the work of concurrent marking if any
+        concurrent_mark_remark();
+    }
+
+    printf("Marking with %u workers\n", ctx->markWorkerCount);
+    if (ctx->markGang) {
+        thread_gang_run(ctx->markGang, mark_worker_run, ctx);
+    } else {
+        mark_worker_run(0, ctx);
+    }
+}
+
+/** Check if the object is condemned by current GC and not marked */
+static JAVA_BOOLEAN object_is_dead(JAVA_OBJECT obj) {
+    if ((void *) obj < g_heap.gcContext.addressLow || (void *) obj >= g_heap.gcContext.addressHigh) {
+        return JAVA_FALSE;
+    }
+
+    return obj_is_marked(obj) ? JAVA_FALSE : JAVA_TRUE;
+}
+
+/** Clear the mark of a living object, and record it in the brick table */
+static void heap_object_survive(JAVA_OBJECT obj, size_t size) {
+    obj_clear_marked(obj);
+    if (obj_get_class(obj) == (JAVA_CLASS) JAVA_NULL && ((JAVA_CLASS) obj)->classInstance != JAVA_NULL) {
+        // Class instance is allocated right after the class
+        obj_clear_marked(((JAVA_CLASS) obj)->classInstance);
+    }
+    brick_mark_object(obj, size);
+}
+
+/** Give the dead objects in [start, end[ back to the free list of the generation */
+static void heap_sweep_free_run(uint8_t *start, uint8_t *end) {
+    size_t size = ptr_offset(start, end);
+
+    if (size >= free_item_size_min()) {
+        free_list_append(&generation_of(generation_of_address(start))->freeList, start, size);
+    } else {
+        // Too small to be reused
+        heap_fill_with_object(start, size);
+    }
+    brick_mark_object(start, size);
+}
+
+/**
+ * Sweep the condemned SOH generations: the mark of living objects is cleared, and each run of
+ * dead objects is merged into a single free item. The brick table is rebuilt during the walk.
+ */
+static void heap_sweep(GCGeneration gen) {
+    HeapSegment *segment = youngest_generation->allocationSegment;
+    uint8_t *start = generation_of(gen)->allocationStart;
+    uint8_t *end = segment->allocated;
+
+    printf("Sweeping gen %d\n", gen);
+
+    // Free lists of all condemned generations are rebuilt from scratch
+    for (int i = soh_gen0; i <= (int) gen; i++) {
+        free_list_clear(&generation_of(i)->freeList);
+    }
+
+    uint8_t *free_start = NULL; // The start of current run of dead objects
+    uint8_t *current = start;
+    while (current < end) {
+        JAVA_OBJECT obj = (JAVA_OBJECT) current;
+        size_t size = heap_object_size(obj);
+        assert(size >= MIN_OBJECT_SIZE && is_size_aligned(size, SIZE_ALIGNMENT));
+
+        if (obj_is_marked(obj) == JAVA_TRUE) {
+            if (free_start) {
+                heap_sweep_free_run(free_start, current);
+                free_start = NULL;
+            }
+
+            heap_object_survive(obj, size);
+        } else if (!free_start) {
+            free_start = current;
+        }
+
+        current = ptr_inc(current, size);
+    }
+    assert(current == end);
+
+    if (free_start) {
+        // The dead objects at the end of the segment are given back to the segment directly
+        segment->allocated = free_start;
+    }
+}
+
+/** Sweep the LOH, which is only collected together with gen2. Adjacent dead objects and free items are merged. */
+static void heap_sweep_loh() {
+    HeapSegment *segment = large_object_generation->allocationSegment;
+    LohFreeList *list = &g_heap.lohFreeList;
+
+    printf("Sweeping LOH\n");
+
+    loh_free_list_clear(list);
+
+    uint8_t *free_start = NULL; // The start of current run of dead objects
+    uint8_t *current = segment->start;
+    while (current < segment->allocated) {
+        JAVA_OBJECT obj = (JAVA_OBJECT) current;
+        size_t size = heap_object_size(obj);
+
+        if (obj_is_marked(obj) == JAVA_TRUE) {
+            if (free_start) {
+                size_t free_size = ptr_offset(free_start, current);
+                if (free_size >= free_item_size_min()) {
+                    loh_free_list_add(list, free_start, free_size);
+                } else {
+                    heap_fill_with_object(free_start, free_size);
+                }
+                brick_mark_object(free_start, free_size);
+                free_start = NULL;
+            }
+
+            heap_object_survive(obj, size);
+        } else if (!free_start) {
+            free_start = current;
+        }
+
+        current = ptr_inc(current, size);
+    }
+    assert(current == segment->allocated);
+
+    if (free_start) {
+        segment->allocated = free_start;
+    }
+}
+
+/**
+ * Compact the ephemeral generations when at least 1/COMPACT_FRAGMENTATION_RATIO of the space
+ * before the last living object is dead.
+ */
+#define COMPACT_FRAGMENTATION_RATIO 8
+
+static void plug_table_add(PlugTable *table, uint8_t *start, uint8_t *end, uint8_t *new_start) {
+    if (table->count == table->capacity) {
+        // Grow the table
+        size_t new_capacity = table->capacity == 0 ? 1024 : table->capacity * 2;
+        Plug *new_plugs = heap_alloc_uncollectable(new_capacity * sizeof(Plug));
+        if (!new_plugs) {
+            fprintf(stderr, "GC: unable to grow the plug table\n");
+            abort();
+        }
+        if (table->plugs) {
+            memcpy(new_plugs, table->plugs, table->count * sizeof(Plug));
+            heap_free_uncollectable(table->plugs);
+        }
+        table->plugs = new_plugs;
+        table->capacity = new_capacity;
+    }
+
+    table->plugs[table->count++] = (Plug) {
+            .start = start,
+            .end = end,
+            .newStart = new_start,
+    };
+}
+
+/** Index the plugs by brick, so the plug of any address can be found quickly */
+static void plug_table_build_brick_index(PlugTable *table, uint8_t *start, uint8_t *end) {
+    Brick first = brick_of(start);
+    Brick last = brick_of(ptr_dec(end, 1));
+    size_t *brick_plugs = heap_alloc_uncollectable((last - first + 1) * sizeof(size_t));
+    if (!brick_plugs) {
+        fprintf(stderr, "GC: unable to alloc the brick index of plugs\n");
+        abort();
+    }
+
+    size_t i = 0;
+    for (Brick b = first; b <= last; b++) {
+        uint8_t *brick_start = brick_start_addr_of(b);
+        while (i < table->count && table->plugs[i].end <= brick_start) {
+            i++;
+        }
+        brick_plugs[b - first] = i;
+    }
+
+    table->brickPlugs = brick_plugs;
+    table->brickStart = first;
+}
+
+static void plug_table_reset(PlugTable *table) {
+    table->count = 0;
+    heap_free_uncollectable(table->brickPlugs);
+    table->brickPlugs = NULL;
+}
+
+/** Get the plug that contains the given living object */
+static Plug *plug_table_find(PlugTable *table, void *obj) {
+    size_t i = table->brickPlugs[brick_of(obj) - table->brickStart];
+    while (table->plugs[i].end <= (uint8_t *) obj) {
+        i++;
+    }
+    assert(i < table->count && table->plugs[i].start <= (uint8_t *) obj);
+
+    return &table->plugs[i];
+}
+
+/**
+ * Plan phase of the compaction: calculate the new address of each living object in
+ * [start, end[ by sliding them towards `start`. Pinned objects and classes are never moved.
+ *
+ * @return JAVA_TRUE if the compaction is worth doing.
+ */
+static JAVA_BOOLEAN heap_plan(uint8_t *start, uint8_t *end) {
+    PlugTable *table = &g_heap.gcContext.plugTable;
+    assert(table->count == 0);
+
+    uint8_t *dest = start; // Where next living object goes
+    uint8_t *live_end = start; // The end of the last living object
+    size_t fragmentation = 0;
+
+    uint8_t *current = start;
+    while (current < end) {
+        JAVA_OBJECT obj = (JAVA_OBJECT) current;
+        size_t size = heap_object_size(obj);
+        uint8_t *next = ptr_inc(current, size);
+
+        if (obj_is_marked(obj) == JAVA_TRUE) {
+            fragmentation += ptr_offset(live_end, current);
+            live_end = next;
+
+            uint8_t *new_start = dest;
+            if (obj_is_pinned(obj) == JAVA_TRUE || obj_get_class(obj) == (JAVA_CLASS) JAVA_NULL) {
+                // Stay where it is
+                new_start = current;
+            }
+
+            Plug *last = table->count > 0 ? &table->plugs[table->count - 1] : NULL;
+            if (last && last->end == current &&
+                ptr_offset(last->start, current) == ptr_offset(last->newStart, new_start)) {
+                // Move together with the previous objects
+                last->end = next;
+            } else {
+                plug_table_add(table, current, next, new_start);
+            }
+            dest = ptr_inc(new_start, size);
+        }
+
+        current = next;
+    }
+    assert(current == end);
+
+    size_t used = ptr_offset(start, live_end);
+    if (fragmentation == 0 || fragmentation < used / COMPACT_FRAGMENTATION_RATIO) {
+        plug_table_reset(table);
+        return JAVA_FALSE;
+    }
+
+    plug_table_build_brick_index(table, start, end);
+    return JAVA_TRUE;
+}
+
+/** Update the reference to the new address of the object */
+static void object_relocate(JAVA_OBJECT *obj_p, void *scan_context) {
+    JAVA_OBJECT obj = *obj_p;
+
+    // Check if obj is in our gc range
+    if ((void *) obj < g_heap.gcContext.addressLow || (void *) obj >= g_heap.gcContext.addressHigh) {
+        return;
+    }
+
+    Plug *plug = plug_table_find(&g_heap.gcContext.plugTable, obj);
+    *obj_p = ptr_inc(plug->newStart, ptr_offset(plug->start, obj));
+}
+
+/** Relocate phase of the compaction: update all references to the living objects */
+static void heap_relocate(GCGeneration gen) {
+    PlugTable *table = &g_heap.gcContext.plugTable;
+
+    printf("Relocating references\n");
+    scan_roots(object_relocate, NULL);
+    card_table_scan(youngest_generation->allocationSegment->start, generation_of(gen)->allocationStart,
+                    object_relocate, NULL, JAVA_FALSE);
+    card_table_scan(large_object_generation->allocationSegment->start, large_object_generation->allocationSegment->allocated,
+                    object_relocate, NULL, JAVA_FALSE);
+    monitor_scan_objects(object_relocate, NULL);
+
+    for (size_t i = 0; i < table->count; i++) {
+        Plug *plug = &table->plugs[i];
+        for (uint8_t *current = plug->start; current < plug->end;) {
+            JAVA_OBJECT obj = (JAVA_OBJECT) current;
+            size_t size = heap_object_size(obj);
+            object_scan_references(obj, object_relocate, NULL);
+            current = ptr_inc(current, size);
+        }
+    }
+}
+
+/**
+ * Compact phase: move each plug to its new address, and rebuild the brick table and free lists.
+ * The gaps in front of pinned plugs become free items.
+ */
+static void heap_compact(GCGeneration gen, uint8_t *start) {
+    PlugTable *table = &g_heap.gcContext.plugTable;
+    HeapSegment *segment = youngest_generation->allocationSegment;
+
+    printf("Compacting gen %d\n", gen);
+
+    for (int i = soh_gen0; i <= (int) gen; i++) {
+        free_list_clear(&generation_of(i)->freeList);
+    }
+
+    uint8_t *dest = start;
+    for (size_t i = 0; i < table->count; i++) {
+        Plug *plug = &table->plugs[i];
+        assert(dest <= plug->newStart && plug->newStart <= plug->start);
+
+        if (dest != plug->newStart) {
+            heap_sweep_free_run(dest, plug->newStart);
+        }
+
+        size_t plug_size = ptr_offset(plug->start, plug->end);
+        if (plug->newStart != plug->start) {
+            memmove(plug->newStart, plug->start, plug_size);
+        }
+
+        dest = ptr_inc(plug->newStart, plug_size);
+        for (uint8_t *current = plug->newStart; current < dest;) {
+            JAVA_OBJECT obj = (JAVA_OBJECT) current;
+            size_t size = heap_object_size(obj);
+            heap_object_survive(obj, size);
+            current = ptr_inc(current, size);
+        }
+    }
+
+    // Everything after the last plug can be used for bump allocation again
+    segment->allocated = dest;
+
+    plug_table_reset(table);
+}
+
+/**
+ * Survivors of the condemned generations are promoted to the next generation, by moving the
+ * generation boundaries to the end of allocated space. Then the card table is updated to
+ * the new ephemeral range.
+ */
+static void heap_promote(GCGeneration gen) {
+    HeapSegment *segment = youngest_generation->allocationSegment;
+    GCGeneration target = gen < max_generation ? gen + 1 : max_generation;
+
+    for (int i = (int) target - 1; i >= soh_gen0; i--) {
+        Generation *generation = generation_of(i);
+        free_list_concat(&generation_of(target)->freeList, &generation->freeList);
+        generation->allocationStart = segment->allocated;
+    }
+
+    g_ephemeralLow = generation_of(soh_gen1)->allocationStart;
+
+    if (g_ephemeralLow >= segment->allocated) {
+        // Nothing left in ephemeral generations
+        size_t first = card_byte(segment->start);
+        size_t last = card_byte(ptr_dec(segment->allocated, 1));
+        memset(&g_cardTableTranslated[first], 0, last - first + 1);
+    } else {
+        card_table_scan(segment->start, segment->allocated, NULL, NULL, JAVA_TRUE);
+    }
+
+    HeapSegment *loh_segment = large_object_generation->allocationSegment;
+    card_table_scan(loh_segment->start, loh_segment->allocated, NULL, NULL, JAVA_TRUE);
+}
+
+//*********************************************************************************************************
+// Heap trimming
+//*********************************************************************************************************
+
+/*
+ * After each GC, free memory that is not going to be used soon is given back to the OS. Allocations take
+ * the free items from the head of the free lists first, then the end of the segment. So the first part of
+ * the free space, as large as the allocation budget plus the hysteresis, is kept as is since it will be
+ * touched again before the next GC. Whatever is beyond that is trimmed:
+ *
+ * - The end of a segment is uncommitted, and committed again by heap_segment_grow() once needed.
+ * - The pages inside free items are discarded, the item header is kept so the heap is still walkable.
+ *
+ * Trimming only happens once the surplus has been seen by `delay` GCs in a row, so a short drop in
+ * allocation rate doesn't make the same pages fault in again right after.
+ */
+
+/** Discard the whole pages inside a free item. */
+static size_t free_item_discard(uint8_t *item) {
+    uint8_t *start = align_ptr(ptr_inc(item, free_item_size_min()), mem_page_size());
+    uint8_t *end = (uint8_t *) align_size_down((size_t) ptr_inc(item, free_item_size(item)), mem_page_size());
+    if (end <= start || (size_t) ptr_offset(start, end) < TRIM_FREE_ITEM_MIN) {
+        return 0;
+    }
+
+    size_t size = ptr_offset(start, end);
+    return mem_discard(start, size) == JAVA_TRUE ? size : 0;
+}
+
+/** Discard the free items after the first `keep_size` bytes of the list. */
+static size_t free_items_trim(uint8_t *head, size_t *keep_size) {
+    size_t trimmed = 0;
+    for (uint8_t *item = head; item != NULL; item = *free_item_next(item)) {
+        size_t item_size = free_item_size(item);
+        if (*keep_size >= item_size) {
+            *keep_size -= item_size;
+        } else {
+            *keep_size = 0;
+            trimmed += free_item_discard(item);
+        }
+    }
+    return trimmed;
+}
+
+/** Memory that is kept committed for the given allocation budget */
+static inline size_t heap_trim_keep_size(size_t budget) {
+    return budget + budget / 100 * g_heap.trim.hysteresis;
+}
+
+/** Check if there is more free memory than what the next GC cycle could use */
+static JAVA_BOOLEAN heap_trim_has_surplus() {
+    HeapSegment *soh_segment = youngest_generation->allocationSegment;
+    HeapSegment *loh_segment = large_object_generation->allocationSegment;
+
+    size_t soh_free = ptr_offset(soh_segment->allocated, soh_segment->committed);
+    for (int i = soh_gen0; i <= max_generation; i++) {
+        soh_free += generation_of(i)->freeList.freeSize;
+    }
+    if (soh_free > heap_trim_keep_size(youngest_generation->dynamicData.allocBudget)) {
+        return JAVA_TRUE;
+    }
+
+    size_t loh_free = ptr_offset(loh_segment->allocated, loh_segment->committed) + g_heap.lohFreeList.freeSize;
+    if (loh_free > heap_trim_keep_size(large_object_generation->dynamicData.allocBudget)) {
+        return JAVA_TRUE;
+    }
+
+    return JAVA_FALSE;
+}
+
+/** Give the surplus free memory back to the OS if it stays unused for long enough. */
+static void heap_trim() {
+    TrimContext *trim = &g_heap.trim;
+    if (!trim->enabled) {
+        return;
+    }
+
+    if (heap_trim_has_surplus() != JAVA_TRUE) {
+        trim->surplusCount = 0;
+        return;
+    }
+    if (++trim->surplusCount < trim->delay) {
+        return;
+    }
+    trim->surplusCount = 0;
+
+    size_t trimmed = 0;
+
+    // SOH, the free lists of younger generations are used first
+    size_t keep_size = heap_trim_keep_size(youngest_generation->dynamicData.allocBudget);
+    for (int i = soh_gen0; i <= max_generation; i++) {
+        trimmed += free_items_trim(generation_of(i)->freeList.head, &keep_size);
+    }
+    trimmed += heap_segment_shrink(youngest_generation->allocationSegment, keep_size);
+
+    // LOH, smaller buckets are searched first
+    keep_size = heap_trim_keep_size(large_object_generation->dynamicData.allocBudget);
+    for (int b = 0; b < LOH_BUCKET_COUNT; b++) {
+        trimmed += free_items_trim(g_heap.lohFreeList.buckets[b], &keep_size);
+    }
+    trimmed += heap_segment_shrink(large_object_generation->allocationSegment, keep_size);
+
+    printf("Returned %zu bytes to the OS\n", trimmed);
+}
+
+/** Real GC work once the world is stopped */
+static void heap_gc(GCGeneration gen) {
+    // Retire all TLABs
+    gc_reclaim_tlabs();
+
+    // Check alloc budget to see if any older gen needs GC as well
+    for (int i = total_generation_count - 1; i > (int) gen; i--) {
+        if (generation_of(i)->dynamicData.runningBudget < 0) {
+            gen = i;
+            if (gen == loh_generation) {
+                gen = max_generation;
+            }
+            printf("Gen %d run out of budget, trigger gen %dd GC instead.\n", i, gen);
+            break;
+        }
+    }
+    if (gen < max_generation && concurrent_mark_is_done()) {
+        // Finish the concurrent marking
+        gen = max_generation;
+    }
+
+    // Set GC address range
+    if (gen == max_generation) {
+        // Process the whole heap
+        g_heap.gcContext.addressLow = g_heap.lowestAddr;
+        g_heap.gcContext.addressHigh = g_heap.highestAddr;
+    } else {
+        // Process condemned generations only
+        g_heap.gcContext.addressLow = generation_of(gen)->allocationStart;
+        g_heap.gcContext.addressHigh = youngest_generation->allocationSegment->allocated;
+    }
+
+    // Mark phase
+    heap_mark(gen);
+
+    // Recycle idle monitors while we know which objects are dead
+    monitor_deflate_idle(object_is_dead);
+
+    if (gen < max_generation &&
+        heap_plan(generation_of(gen)->allocationStart, youngest_generation->allocationSegment->allocated) == JAVA_TRUE) {
+        // Relocate & compact phase
+        heap_relocate(gen);
+        heap_compact(gen, generation_of(gen)->allocationStart);
+    } else {
+        // Sweep phase
+        heap_sweep(gen);
+        if (gen == max_generation) {
+            heap_sweep_loh();
+        }
+    }
+
+    heap_promote(gen);
+
+    // Update collect counts and reset budgets
+    for (int i = soh_gen0; i <= (int) gen; i++) {
+        generation_of(i)->dynamicData.collectionCount++;
+        generation_of(i)->dynamicData.runningBudget = generation_of(i)->dynamicData.allocBudget;
+        if (i == max_generation) {
+            // Also collect LOH
+            generation_of(loh_generation)->dynamicData.collectionCount++;
+            generation_of(loh_generation)->dynamicData.runningBudget = generation_of(loh_generation)->dynamicData.allocBudget;
+        }
+    }
+
+    // Resize TLABs based on the new budget
+    gc_resize_tlabs();
+
+    heap_trim();
+
+    if (gen < max_generation) {
+        concurrent_mark_try_start();
+    }
+}
+
+/** Trigger a GC of given generation. */
+static size_t gc(VM_PARAM_CURRENT_CONTEXT, GCGeneration gen) {
+    DynamicData *dd = &generation_of(gen)->dynamicData;
+    size_t count_before_lock = dd->collectionCount;
+
+    spin_lock_enter(vmCurrentContext, &g_heap.gcLock);
 
     // don't trigger another GC if one was already in progress
     // while waiting for the lock
@@ -652,14 +2376,23 @@ static FitResult heap_segment_try_fit_end(HeapSegment *segment, size_t size, voi
 }
 
 static FitResult heap_soh_try_fit(size_t size, void **out) {
+    // Reuse the space freed by last GC first. Objects allocated in the free space of older
+    // generations are treated as part of that generation, which is fine since all reference
+    // stores go through the write barrier.
+    for (int i = soh_gen0; i <= max_generation; i++) {
+        if (free_list_try_fit(&generation_of(i)->freeList, size, out) == JAVA_TRUE) {
+            return f_can_fit;
+        }
+    }
+
     return heap_segment_try_fit_end(youngest_generation->allocationSegment, size, out);
 }
 
 static JAVA_BOOLEAN heap_alloc_soh(VM_PARAM_CURRENT_CONTEXT, size_t size, void **out) {
     assert(out != NULL);
 
-    Generation *gen0 = youngest_generation;
     AllocationState alloc_state = a_state_start;
+    int last_gc = -1; // The generation of the last GC triggered by this allocation
 
     while (1) {
         printf("SOH alloc state: %s\n", g_allocationStateStr[alloc_state]);
@@ -700,20 +2433,34 @@ static JAVA_BOOLEAN heap_alloc_soh(VM_PARAM_CURRENT_CONTEXT, size_t size, void *
             }
             case a_state_trigger_gen0_gc: {
                 gc(vmCurrentContext, soh_gen0);
+                last_gc = soh_gen0;
                 alloc_state = a_state_try_fit;
                 break;
             }
             case a_state_trigger_ephemeral_gc: {
-                alloc_state = a_state_cant_allocate;
+                if (last_gc >= soh_gen1) {
+                    // Still can't fit after an ephemeral gc
+                    alloc_state = a_state_trigger_full_gc;
+                    break;
+                }
+                gc(vmCurrentContext, soh_gen1);
+                last_gc = soh_gen1;
+                alloc_state = a_state_try_fit;
                 break;
             }
             case a_state_trigger_full_gc: {
-                alloc_state = a_state_cant_allocate;
+                if (last_gc == max_generation) {
+                    alloc_state = a_state_cant_allocate;
+                    break;
+                }
+                gc(vmCurrentContext, max_generation);
+                last_gc = max_generation;
+                alloc_state = a_state_try_fit;
                 break;
             }
             case a_state_can_allocate: {
-                // Consume alloc budget
-                gen0->dynamicData.runningBudget -= size;
+                // Consume alloc budget of the generation where the memory comes from
+                generation_of(generation_of_address(*out))->dynamicData.runningBudget -= size;
 
                 // Release the lock
                 spin_lock_exit(&g_heap.moreSpaceLockSoh);
@@ -725,15 +2472,7 @@ static JAVA_BOOLEAN heap_alloc_soh(VM_PARAM_CURRENT_CONTEXT, size_t size, void *
                 memset(result, 0, size);
 
                 // Mark brick table
-                Brick b = brick_of(result);
-                // Mark first brick
-                brick_set(b, ptr_offset(brick_start_addr_of(b), result) + 1);
-                // Fill the rest bricks
-                void *end = align_ptr(ptr_inc(result, size), BRICK_SIZE);
-                Brick end_brick = brick_of(end);
-                for (b++; b <= end_brick; b++) {
-                    brick_set(b, BRICK_VAL_PREVIOUS);
-                }
+                brick_mark_object(result, size);
                 goto exit;
             }
             case a_state_cant_allocate: {
@@ -747,6 +2486,88 @@ static JAVA_BOOLEAN heap_alloc_soh(VM_PARAM_CURRENT_CONTEXT, size_t size, void *
     return alloc_state == a_state_can_allocate ? JAVA_TRUE : JAVA_FALSE;
 }
 
+static FitResult heap_loh_try_fit(size_t size, void **out) {
+    if (loh_free_list_try_fit(&g_heap.lohFreeList, size, out) == JAVA_TRUE) {
+        return f_can_fit;
+    }
+
+    return heap_segment_try_fit_end(large_object_generation->allocationSegment, size, out);
+}
+
+/**
+ * Allocate from the LOH. Objects in LOH are never moved, and only collected by a full GC, so the only
+ * chance to get more space is a full GC.
+ */
+static JAVA_BOOLEAN heap_alloc_large(VM_PARAM_CURRENT_CONTEXT, size_t size, void **out) {
+    assert(out != NULL);
+
+    AllocationState alloc_state = a_state_start;
+    int last_gc = -1; // The generation of the last GC triggered by this allocation
+
+    while (1) {
+        printf("LOH alloc state: %s\n", g_allocationStateStr[alloc_state]);
+
+        switch (alloc_state) {
+            case a_state_start: {
+                // Lock the generation
+                spin_lock_enter(vmCurrentContext, &g_heap.moreSpaceLockLoh);
+
+                alloc_state = a_state_try_fit;
+                break;
+            }
+            case a_state_try_fit: {
+                if (heap_loh_try_fit(size, out) == f_can_fit) {
+                    alloc_state = a_state_can_allocate;
+                } else {
+                    alloc_state = a_state_trigger_full_gc;
+                }
+                break;
+            }
+            case a_state_trigger_full_gc: {
+                if (last_gc == max_generation) {
+                    alloc_state = a_state_cant_allocate;
+                    break;
+                }
+                gc(vmCurrentContext, max_generation);
+                last_gc = max_generation;
+                alloc_state = a_state_try_fit;
+                break;
+            }
+            case a_state_can_allocate: {
+                // Consume alloc budget, a full GC is triggered by the next GC once it runs out
+                large_object_generation->dynamicData.runningBudget -= size;
+
+                // Release the lock
+                spin_lock_exit(&g_heap.moreSpaceLockLoh);
+
+                void *result = *out;
+                assert(result != NULL);
+
+                // Zero out memory
+                memset(result, 0, size);
+
+                // Mark brick table
+                brick_mark_object(result, size);
+                goto exit;
+            }
+            case a_state_cant_allocate: {
+                spin_lock_exit(&g_heap.moreSpaceLockLoh);
+                goto exit;
+            }
+            case a_state_check_budget:
+            case a_state_trigger_gen0_gc:
+            case a_state_trigger_ephemeral_gc: {
+                // LOH has no budget check and is only collected by a full GC
+                assert(!"Unreachable LOH alloc state");
+                abort();
+            }
+        }
+    }
+
+    exit:
+    return alloc_state == a_state_can_allocate ? JAVA_TRUE : JAVA_FALSE;
+}
+
 /** Allocate given size of memory from given gen. */
 static void *heap_alloc_more_space(VM_PARAM_CURRENT_CONTEXT, size_t size, GCGeneration gen) {
     assert(is_size_aligned(size, SIZE_ALIGNMENT));
@@ -755,13 +2576,17 @@ static void *heap_alloc_more_space(VM_PARAM_CURRENT_CONTEXT, size_t size, GCGene
     // Give GC a chance to run before we try alloc more space
     thread_checkpoint(vmCurrentContext);
 
+    if (concurrent_mark_is_done()) {
+        // Old generation is marked, do the full GC now so the result is not out of date
+        gc(vmCurrentContext, max_generation);
+    }
+
     void *result = NULL;
 
     if (gen == soh_gen0) {
         heap_alloc_soh(vmCurrentContext, size, &result);
     } else {
-        // TODO: Fix me
-        heap_alloc_soh(vmCurrentContext, size, &result);
+        heap_alloc_large(vmCurrentContext, size, &result);
     }
 
     return result;
@@ -774,16 +2599,19 @@ void *heap_alloc_loh(VM_PARAM_CURRENT_CONTEXT, size_t size) {
     return heap_alloc_more_space(vmCurrentContext, size, loh_generation);
 }
 
-// Large objects go directly to old gen
-#define LARGE_OBJECT_SIZE_MIN ((size_t)(85000))
-
 void *heap_alloc(VM_PARAM_CURRENT_CONTEXT, size_t size) {
     size = align_size_up(size, SIZE_ALIGNMENT);
     assert(size >= MIN_OBJECT_SIZE);
 
-    if (size >= LARGE_OBJECT_SIZE_MIN) {
+    if (size >= g_heap.largeObjectSize) {
         // Alloc on LOH
-        return heap_alloc_more_space(vmCurrentContext, size, loh_generation);
+        void *result = heap_alloc_more_space(vmCurrentContext, size, loh_generation);
+        if (result == NULL) {
+            // LOH can't grow since the card table only covers the segments created by heap_init(),
+            // try SOH before giving up, where the object is handled like any other small object
+            result = heap_alloc_more_space(vmCurrentContext, size, soh_gen0);
+        }
+        return result;
     } else {
         // Alloc on SOH
         ThreadAllocContext *tlab = &vmCurrentContext->tlab;
@@ -808,6 +2636,7 @@ void *heap_alloc(VM_PARAM_CURRENT_CONTEXT, size_t size) {
                 // the amount free in the tlab is too large to discard.
                 if (tlab_free(tlab) > tlab->wasteLimit) {
                     // Alloc on SOH directly
+                    tlab_record_slow_allocation(tlab);
                     return heap_alloc_more_space(vmCurrentContext, size, soh_gen0);
                 } else {
                     // Discard current tlab
@@ -5,6 +5,7 @@
 #include "vm_gc_priv.h"
 #include "vm_memory.h"
 #include "vm_array.h"
+#include "classloader/vm_boot_classloader.h"
 #include <assert.h>
 
 size_t g_fillerArraySizeMax = 0;
@@ -33,6 +34,9 @@ void heap_fill_with_object(void *start, size_t size) {
         assert(size == g_fillerSizeMin);
         // Fill the memory with a plain object
         JAVA_OBJECT object = start;
-        // TODO: set class
+        // Set class, so the heap can still be walked through
+        assert(g_class_java_lang_Object != NULL);
+        object->clazz = g_class_java_lang_Object;
+        object->monitor = NULL;
     }
 }
@@ -6,6 +6,7 @@
 #include <sys/mman.h>
 #include <unistd.h>
 #include <string.h>
+#include <assert.h>
 
 
 JAVA_BOOLEAN mem_init() {
@@ -97,6 +98,20 @@ JAVA_BOOLEAN mem_uncommit(void *addr, size_t size) {
     return res == MAP_FAILED ? JAVA_FALSE : JAVA_TRUE;
 }
 
+JAVA_BOOLEAN mem_discard(void *addr, size_t size) {
+    if (size == 0) {
+        return JAVA_TRUE;
+    }
+
+    // Callers only discard whole pages
+    assert(((uintptr_t) addr) % mem_page_size() == 0);
+    assert(size % mem_page_size() == 0);
+
+    // MADV_FREE is cheaper, but the pages are still counted as used until there is memory pressure,
+    // which defeats the purpose of trimming the heap.
+    return madvise(addr, size, MADV_DONTNEED) == 0 ? JAVA_TRUE : JAVA_FALSE;
+}
+
 JAVA_BOOLEAN mem_release(void *addr, size_t size) {
     if (!addr) {
         return JAVA_TRUE;
@@ -3,6 +3,7 @@
 //
 
 #include "vm_memory.h"
+#include <assert.h>
 
 #define WIN32_LEAN_AND_MEAN
 
@@ -93,6 +94,20 @@ JAVA_BOOLEAN mem_uncommit(void *addr, size_t size) {
     return VirtualFree(addr, size, MEM_DECOMMIT) ? JAVA_TRUE : JAVA_FALSE;
 }
 
+JAVA_BOOLEAN mem_discard(void *addr, size_t size) {
+    if (size == 0) {
+        return JAVA_TRUE;
+    }
+
+    // Callers only discard whole pages
+    assert(((uintptr_t) addr) % mem_page_size() == 0);
+    assert(size % mem_page_size() == 0);
+
+    void *res = VirtualAlloc(addr, size, MEM_RESET, PAGE_READWRITE);
+
+    return res == NULL ? JAVA_FALSE : JAVA_TRUE;
+}
+
 JAVA_BOOLEAN mem_release(void *addr, size_t size) {
     if (!addr) {
         return JAVA_TRUE;
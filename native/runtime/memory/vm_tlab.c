@@ -12,27 +12,58 @@ size_t tlab_reserve_size() {
 
 /** Minimum size of a TLAB, reserved size included. */
 static inline size_t tlab_size_min() {
-    return align_size_up(TLAB_SIZE_MIN, SIZE_ALIGNMENT) + tlab_reserve_size();
+    size_t size = heap_tlab_size_min();
+    if (size == 0) {
+        size = TLAB_SIZE_MIN;
+    }
+    return align_size_up(size, SIZE_ALIGNMENT) + tlab_reserve_size();
 }
 
 /** Maximum size of a TLAB, reserved size included. */
 static inline size_t tlab_size_max() {
     // TLABs can't be bigger than we can fill with the filler array.
-    return align_size_down(g_fillerArraySizeMax, SIZE_ALIGNMENT);
+    size_t size = align_size_down(g_fillerArraySizeMax, SIZE_ALIGNMENT);
+
+    size_t configured = heap_tlab_size_max();
+    if (configured != 0) {
+        size = size_min(size, align_size_up(configured, SIZE_ALIGNMENT) + tlab_reserve_size());
+    }
+    return size;
 }
 
-void tlab_init(ThreadAllocContext *tlab) {
-    tlab_reset(tlab);
+// Average number of threads that allocate in each GC cycle
+static WeightedAverage g_allocatingThreadCount = {.average = 1.0f, .sampleCount = 0};
 
-    // Calculate desired size
-    size_t init_size = 0;
-    // TODO: calculate desired size using statistic data
-    tlab->desiredSize = size_min(size_max(init_size, tlab_size_min()), tlab_size_max());
+static void weighted_average_sample(WeightedAverage *avg, float value) {
+    avg->sampleCount++;
+
+    // Until there are enough samples, use the arithmetic mean instead so the
+    // initial value doesn't stick around for too long.
+    uint32_t weight = 100 / avg->sampleCount;
+    if (weight < TLAB_ALLOCATION_WEIGHT) {
+        weight = TLAB_ALLOCATION_WEIGHT;
+    }
+    avg->average = ((100 - weight) * avg->average + weight * value) / 100;
+}
+
+static inline void tlab_reset_statistics(ThreadAllocContext *tlab) {
     tlab->refillCount = 0;
     tlab->refillSize = 0;
     tlab->wastedSize = 0;
 }
 
+void tlab_init(ThreadAllocContext *tlab) {
+    tlab_reset(tlab);
+    tlab_reset_statistics(tlab);
+
+    // Assume the new thread allocates as much as any other allocating thread
+    tlab->allocationFraction = (WeightedAverage) {.average = 0.0f, .sampleCount = 0};
+    weighted_average_sample(&tlab->allocationFraction, 1.0f / g_allocatingThreadCount.average);
+
+    // Calculate desired size
+    tlab_resize(tlab);
+}
+
 static inline uint8_t *tlab_limit_hard(ThreadAllocContext *tlab) {
     return ptr_inc(tlab_limit(tlab), tlab_reserve_size());
 }
@@ -69,7 +100,38 @@ void tlab_fill(ThreadAllocContext *tlab, void *start, size_t size) {
     tlab->tlabHead = start;
     tlab->tlabCurrent = start;
     tlab->tlabLimit = ptr_inc(start, size - tlab_reserve_size());
-    tlab->wasteLimit = tlab->desiredSize / TLAB_WASTE_FRACTION;
     tlab->refillCount++;
     tlab->refillSize += size;
 }
+
+size_t tlab_used(ThreadAllocContext *tlab) {
+    if (!tlab_allocated(tlab)) {
+        return tlab->refillSize;
+    }
+
+    // The remaining space of current tlab is given back to gen0 by GC
+    return tlab->refillSize - ptr_offset(tlab->tlabCurrent, tlab_limit_hard(tlab));
+}
+
+void tlab_accumulate_statistics(ThreadAllocContext *tlab, size_t total_used) {
+    // Threads that didn't allocate keep their previous allocation fraction,
+    // so they get the same tlab size once they start allocating again.
+    if (tlab->refillCount > 0 && total_used > 0) {
+        weighted_average_sample(&tlab->allocationFraction, (float) tlab_used(tlab) / (float) total_used);
+    }
+
+    tlab_reset_statistics(tlab);
+}
+
+void tlab_publish_statistics(size_t allocating_thread_count) {
+    weighted_average_sample(&g_allocatingThreadCount, (float) size_max(allocating_thread_count, 1));
+}
+
+void tlab_resize(ThreadAllocContext *tlab) {
+    // Expected allocation of this thread before the next GC
+    size_t alloc = (size_t) ((float) heap_gen0_budget() * tlab->allocationFraction.average);
+    size_t new_size = align_size_up(alloc / TLAB_TARGET_REFILLS, SIZE_ALIGNMENT);
+
+    tlab->desiredSize = size_min(size_max(new_size, tlab_size_min()), tlab_size_max());
+    tlab->wasteLimit = tlab->desiredSize / TLAB_WASTE_FRACTION;
+}
@@ -375,7 +375,9 @@ static void JNICALL SetStaticObjectField(JNIEnv* env, jclass cls, jfieldID field
     JAVA_OBJECT obj = native_dereference(vmCurrentContext, value);
     native_check_exception();
 
-    *((JAVA_OBJECT *) ptr_inc(clazz, field->info.offset)) = obj;
+    JAVA_OBJECT *fieldPtr = ptr_inc(clazz, field->info.offset);
+    *fieldPtr = obj;
+    heap_write_barrier(fieldPtr, obj);
 
 native_end:
     native_enter_jni(vmCurrentContext);
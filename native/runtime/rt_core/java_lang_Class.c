@@ -141,6 +141,8 @@ JAVA_OBJECT method_fastNative_9Pjava_lang5CClass_15MgetClassLoader0_R9Pjava_lang
     stack_frame_end();
 
     return clazz->classLoader;
+
+    exception_suppressed(JAVA_NULL);
 }
 
 JNIEXPORT jboolean JNICALL Java_java_lang_Class_isInterface(VM_PARAM_CURRENT_CONTEXT, jobject thiz) {
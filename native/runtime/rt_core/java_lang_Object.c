@@ -17,6 +17,8 @@ JAVA_OBJECT method_fastNative_9Pjava_lang6CObject_8MgetClass_R9Pjava_lang5CClass
     stack_frame_end();
 
     return clazz->classInstance;
+
+    exception_suppressed(JAVA_NULL);
 }
 
 JAVA_VOID method_fastNative_9Pjava_lang6CObject_9MnotifyAll(VM_PARAM_CURRENT_CONTEXT, MethodInfoNative *methodInfo) {
@@ -27,4 +29,7 @@ JAVA_VOID method_fastNative_9Pjava_lang6CObject_9MnotifyAll(VM_PARAM_CURRENT_CON
     monitor_notify_all(vmCurrentContext, &local_of(0));
 
     stack_frame_end();
+    return;
+
+    exception_suppressedv();
 }
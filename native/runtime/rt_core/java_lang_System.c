@@ -15,11 +15,11 @@ JNIEXPORT void JNICALL Java_java_lang_System_arraycopyPrimitive(VM_PARAM_CURRENT
     JAVA_ARRAY srcObj = (JAVA_ARRAY) native_dereference(vmCurrentContext, src);
     JAVA_ARRAY destObj = (JAVA_ARRAY) native_dereference(vmCurrentContext, dest);
 
-    BasicType componentType = array_type_of(obj_get_class(&srcObj->baseObject)->info->thisClass);
-    assert(is_java_primitive(componentType));
-    void *srcPtr = array_element_at(srcObj, componentType, srcPos);
-    void *destPtr = array_element_at(destObj, componentType, destPos);
-    memmove(destPtr, srcPtr, length * type_size(componentType));
+    JavaArrayClass *arrayClass = array_class_of(srcObj);
+    assert(is_java_primitive(arrayClass->elementType));
+    void *srcPtr = ptr_inc(srcObj, arrayClass->headerSize + arrayClass->elementSize * srcPos);
+    void *destPtr = ptr_inc(destObj, arrayClass->headerSize + arrayClass->elementSize * destPos);
+    memmove(destPtr, srcPtr, length * arrayClass->elementSize);
 
     native_enter_jni(vmCurrentContext);
 }
@@ -35,14 +35,7 @@ JAVA_INT method_fastNative_9Pjava_lang6CSystem_16MidentityHashCode_9Pjava_lang6C
         // The hash code for the null reference is zero.
         result = 0;
     } else {
-        if (!obj->monitor) {
-            // TODO: check exception
-            monitor_enter(vmCurrentContext, &local_of(0));
-            monitor_exit(vmCurrentContext, &local_of(0));
-            obj = local_of(0).data.o;
-        }
-
-        result = (uintptr_t) obj->monitor;
+        result = monitor_identity_hash(vmCurrentContext, &local_of(0));
     }
 
     stack_frame_end();
@@ -19,9 +19,6 @@ static void invoke_constructor(VM_PARAM_CURRENT_CONTEXT, MethodInfo* method, JAV
 
     // Creating a stack frame, C99 has dynamic size array! Yeah!
     stack_frame_start(NULL, argLength, 0);
-    exception_frame_start();
-        exception_suppressedv();
-    exception_block_end();
 
     // Push $this
     stack_push_object(obj);
@@ -36,49 +33,49 @@ static void invoke_constructor(VM_PARAM_CURRENT_CONTEXT, MethodInfo* method, JAV
         switch (currentParam[0]) {
             case TYPE_DESC_BYTE: {
                 JAVA_BYTE v = primitive_unbox_b(vmCurrentContext, paramObj);
-                exception_raise_if_occurred(vmCurrentContext);
+                exception_raise_if_occurred();
                 stack_push_int(v);
                 break;
             }
             case TYPE_DESC_CHAR: {
                 JAVA_CHAR v = primitive_unbox_c(vmCurrentContext, paramObj);
-                exception_raise_if_occurred(vmCurrentContext);
+                exception_raise_if_occurred();
                 stack_push_int((JAVA_UCHAR)v);
                 break;
             }
             case TYPE_DESC_DOUBLE: {
                 JAVA_DOUBLE v = primitive_unbox_d(vmCurrentContext, paramObj);
-                exception_raise_if_occurred(vmCurrentContext);
+                exception_raise_if_occurred();
                 stack_push_double(v);
                 break;
             }
             case TYPE_DESC_FLOAT: {
                 JAVA_FLOAT v = primitive_unbox_f(vmCurrentContext, paramObj);
-                exception_raise_if_occurred(vmCurrentContext);
+                exception_raise_if_occurred();
                 stack_push_float(v);
                 break;
             }
             case TYPE_DESC_INT: {
                 JAVA_INT v = primitive_unbox_i(vmCurrentContext, paramObj);
-                exception_raise_if_occurred(vmCurrentContext);
+                exception_raise_if_occurred();
                 stack_push_int(v);
                 break;
             }
             case TYPE_DESC_LONG: {
                 JAVA_LONG v = primitive_unbox_j(vmCurrentContext, paramObj);
-                exception_raise_if_occurred(vmCurrentContext);
+                exception_raise_if_occurred();
                 stack_push_long(v);
                 break;
             }
             case TYPE_DESC_SHORT: {
                 JAVA_SHORT v = primitive_unbox_s(vmCurrentContext, paramObj);
-                exception_raise_if_occurred(vmCurrentContext);
+                exception_raise_if_occurred();
                 stack_push_int(v);
                 break;
             }
             case TYPE_DESC_BOOLEAN: {
                 JAVA_BOOLEAN v = primitive_unbox_z(vmCurrentContext, paramObj);
-                exception_raise_if_occurred(vmCurrentContext);
+                exception_raise_if_occurred();
                 stack_push_int(v);
                 break;
             }
@@ -96,6 +93,9 @@ static void invoke_constructor(VM_PARAM_CURRENT_CONTEXT, MethodInfo* method, JAV
     bc_invoke_special(method->code);
 
     stack_frame_end();
+    return;
+
+    exception_suppressedv();
 }
 
 JNIEXPORT jobject JNICALL Java_java_lang_reflect_Constructor_newInstance0(VM_PARAM_CURRENT_CONTEXT, jobject cst, jobjectArray args) {
@@ -156,6 +156,8 @@ JAVA_BOOLEAN thread_init_main(VM_PARAM_CURRENT_CONTEXT) {
     stack_frame_end();
 
     return JAVA_TRUE;
+
+    exception_suppressed(JAVA_FALSE);
 }
 
 static inline JAVA_BOOLEAN thread_add(VMThreadContext *target) {
@@ -7,6 +7,7 @@
 #include <stdlib.h>
 #include <time.h>
 #include <errno.h>
+#include <assert.h>
 
 typedef struct _ObjectMonitor ObjectMonitor;
 typedef struct _NativeThreadContext NativeThreadContext;
@@ -63,10 +64,61 @@ struct _ObjectMonitor {
     pthread_mutex_t masterMutex;
     pthread_cond_t blockingCondition;
     BlockingListNode blockingListHeader;
-    volatile JAVA_LONG ownerThreadId;
+    volatile uintptr_t ownerLockId; // The `lockOwnerId` of the owner thread, 0 if not owned
     int reentranceCounter;
+    OPA_int_t users; // Number of threads that are blocked on or waiting for this monitor
+
+    JAVA_OBJECT object; // The object this monitor is attached to, NULL if it's detached
+    JAVA_BOOLEAN hashed; // The address of this monitor is used as the identity hash of the object
+    ObjectMonitor *next; // Next monitor in the in-use list or the free pool
 };
 
+/*
+ * Object lock word, stored in the `monitor` field of the object header:
+ *
+ * NULL                                     -> unlocked
+ * | owner lock id | recursion count | 1 |  -> thin locked
+ * ObjectMonitor*                           -> inflated. The monitor is allocated by calloc() so the lowest bit is always 0
+ *
+ * A thin lock is acquired & released by a single CAS on the lock word. It's inflated to a full ObjectMonitor
+ * when another thread contends the lock, the recursion count overflows, or wait()/notify() is called.
+ * An inflated monitor is deflated at the next GC once it becomes idle, see monitor_deflate_idle().
+ */
+#define THIN_LOCK_TAG ((uintptr_t) 1)
+#define THIN_LOCK_COUNT_SHIFT 1
+#define THIN_LOCK_COUNT_BITS 8
+#define THIN_LOCK_COUNT_MAX ((((uintptr_t) 1) << THIN_LOCK_COUNT_BITS) - 1)
+#define THIN_LOCK_OWNER_SHIFT (THIN_LOCK_COUNT_SHIFT + THIN_LOCK_COUNT_BITS)
+#define THIN_LOCK_OWNER_MAX (UINTPTR_MAX >> THIN_LOCK_OWNER_SHIFT)
+// How many times a thread spins on a thin lock held by others before inflating it
+#define THIN_LOCK_SPIN_COUNT 1024
+
+#define thin_lock_is_thin(w) ((((uintptr_t) (w)) & THIN_LOCK_TAG) != 0)
+#define thin_lock_owner(w) (((uintptr_t) (w)) >> THIN_LOCK_OWNER_SHIFT)
+#define thin_lock_count(w) ((((uintptr_t) (w)) >> THIN_LOCK_COUNT_SHIFT) & THIN_LOCK_COUNT_MAX)
+#define thin_lock_make(owner, count) \
+    ((void *) (((uintptr_t) (owner) << THIN_LOCK_OWNER_SHIFT) | ((uintptr_t) (count) << THIN_LOCK_COUNT_SHIFT) | THIN_LOCK_TAG))
+
+#define monitor_word_of(obj) ((OPA_ptr_t *) &(obj)->monitor)
+
+// Next lock owner id to be assigned
+static OPA_int_t g_lockOwnerIdNext = OPA_INT_T_INITIALIZER(1);
+
+/*
+ * Monitor recycling: every inflated monitor is linked in the in-use list. Idle ones are detached from
+ * their objects by GC and put back to the global free pool, where threads take monitors from in batches
+ * to their own pools, so most inflations don't need to allocate & init a new mutex.
+ */
+// Max number of monitors kept by a single thread
+#define MONITOR_POOL_THREAD_MAX 32
+// Max number of monitors kept in the global free pool, the rest are destroyed
+#define MONITOR_POOL_GLOBAL_MAX 1024
+
+static pthread_mutex_t g_monitorListLock = PTHREAD_MUTEX_INITIALIZER;
+static ObjectMonitor *g_monitorInUse = NULL;
+static ObjectMonitor *g_monitorFree = NULL;
+static size_t g_monitorFreeCount = 0;
+
 struct _NativeThreadContext {
     BlockingListNode waitingListNode;
 
@@ -77,6 +129,12 @@ struct _NativeThreadContext {
     pthread_t nativeThreadId;
     volatile VMThreadState threadState;
 
+    /** A small id that identifies this thread as the owner of object locks, which fits in the thin lock word. */
+    uintptr_t lockOwnerId;
+    /** Free monitors that can be used by this thread without locking. */
+    ObjectMonitor *monitorPool;
+    size_t monitorPoolSize;
+
     // GC specific flags
     /** Main lock for accessing & updating current thread gc state. */
     pthread_mutex_t gcMutex;
@@ -105,6 +163,9 @@ int thread_native_init(VM_PARAM_CURRENT_CONTEXT) {
     nativeContext->inSafeRegion = JAVA_FALSE;
     nativeContext->waitingForResume = JAVA_FALSE;
     nativeContext->safeRegionReentranceCounter = 0;
+    nativeContext->lockOwnerId = (uintptr_t) OPA_fetch_and_incr_int(&g_lockOwnerIdNext);
+    nativeContext->monitorPool = NULL;
+    nativeContext->monitorPoolSize = 0;
     // TODO: check return value
     pthread_mutex_init(&nativeContext->masterMutex, NULL);
     pthread_cond_init(&nativeContext->blockingCondition, NULL);
@@ -116,6 +177,8 @@ int thread_native_init(VM_PARAM_CURRENT_CONTEXT) {
     return thrd_success;
 }
 
+static void monitor_pool_release(NativeThreadContext *nativeContext);
+
 JAVA_VOID thread_native_free(VM_PARAM_CURRENT_CONTEXT) {
     NativeThreadContext *nativeThreadContext = vmCurrentContext->nativeContext;
     if (nativeThreadContext != NULL) {
@@ -123,6 +186,8 @@ JAVA_VOID thread_native_free(VM_PARAM_CURRENT_CONTEXT) {
 
         // TODO: make sure it's not blocked
 
+        monitor_pool_release(nativeThreadContext);
+
         pthread_cond_destroy(&nativeThreadContext->blockingCondition);
         pthread_mutex_destroy(&nativeThreadContext->masterMutex);
 
@@ -437,14 +502,181 @@ JAVA_BOOLEAN thread_in_saferegion(VM_PARAM_CURRENT_CONTEXT) {
     return nativeContext->inSafeRegion;
 }
 
+struct _VMThreadGang {
+    uint32_t workerCount;
 
-int monitor_create(VM_PARAM_CURRENT_CONTEXT, VMStackSlot *obj) {
-    // TODO: check stack slot type
+    pthread_mutex_t mutex;
+    /** Signaled when a new task is posted. */
+    pthread_cond_t taskCondition;
+    /** Signaled when the last worker finishes the task. */
+    pthread_cond_t doneCondition;
+
+    VMGangTask task;
+    void *param;
+    uint64_t taskSequence; // Increased each time a task is posted
+    uint32_t pendingWorkers; // Number of workers that haven't finished current task, worker 0 excluded
+};
+
+typedef struct {
+    VMThreadGang *gang;
+    uint32_t workerId;
+} GangWorker;
+
+static void *thread_gang_worker_enter(void *param) {
+    GangWorker *worker = param;
+    VMThreadGang *gang = worker->gang;
+    uint32_t worker_id = worker->workerId;
+    free(worker);
+
+    uint64_t last_sequence = 0;
+    pthread_mutex_lock(&gang->mutex);
+    while (1) {
+        // Wait for the next task
+        while (gang->taskSequence == last_sequence) {
+            pthread_cond_wait(&gang->taskCondition, &gang->mutex);
+        }
+        last_sequence = gang->taskSequence;
+        VMGangTask task = gang->task;
+        void *task_param = gang->param;
+        pthread_mutex_unlock(&gang->mutex);
+
+        task(worker_id, task_param);
+
+        pthread_mutex_lock(&gang->mutex);
+        if (--gang->pendingWorkers == 0) {
+            pthread_cond_signal(&gang->doneCondition);
+        }
+    }
+
+    return NULL;
+}
+
+VMThreadGang *thread_gang_create(uint32_t worker_count) {
+    assert(worker_count > 0);
+
+    VMThreadGang *gang = calloc(1, sizeof(VMThreadGang));
+    if (!gang) {
+        return NULL;
+    }
+    pthread_mutex_init(&gang->mutex, NULL);
+    pthread_cond_init(&gang->taskCondition, NULL);
+    pthread_cond_init(&gang->doneCondition, NULL);
+    gang->workerCount = 1;
+
+    // Worker threads live as long as the VM, so they are detached
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+    for (uint32_t i = 1; i < worker_count; i++) {
+        GangWorker *worker = malloc(sizeof(GangWorker));
+        if (!worker) {
+            break;
+        }
+        worker->gang = gang;
+        worker->workerId = i;
+
+        pthread_t tid;
+        if (pthread_create(&tid, &attr, thread_gang_worker_enter, worker) != 0) {
+            // Run with the workers we already have
+            free(worker);
+            break;
+        }
+        gang->workerCount++;
+    }
+    pthread_attr_destroy(&attr);
+
+    return gang;
+}
+
+uint32_t thread_gang_size(VMThreadGang *gang) {
+    return gang->workerCount;
+}
+
+JAVA_VOID thread_gang_run(VMThreadGang *gang, VMGangTask task, void *param) {
+    // Post the task
+    pthread_mutex_lock(&gang->mutex);
+    gang->task = task;
+    gang->param = param;
+    gang->pendingWorkers = gang->workerCount - 1;
+    gang->taskSequence++;
+    pthread_cond_broadcast(&gang->taskCondition);
+    pthread_mutex_unlock(&gang->mutex);
+
+    // Current thread is the worker 0
+    task(0, param);
+
+    // Wait for other workers
+    pthread_mutex_lock(&gang->mutex);
+    while (gang->pendingWorkers > 0) {
+        pthread_cond_wait(&gang->doneCondition, &gang->mutex);
+    }
+    pthread_mutex_unlock(&gang->mutex);
+}
+
+struct _VMBackgroundWorker {
+    VMBackgroundTask task;
+    void *param;
+
+    pthread_mutex_t mutex;
+    pthread_cond_t wakeCondition;
+    JAVA_BOOLEAN pending; // Whether the task needs to be run
+};
+
+static void *thread_background_enter(void *param) {
+    VMBackgroundWorker *worker = param;
+
+    pthread_mutex_lock(&worker->mutex);
+    while (1) {
+        while (!worker->pending) {
+            pthread_cond_wait(&worker->wakeCondition, &worker->mutex);
+        }
+        worker->pending = JAVA_FALSE;
+        pthread_mutex_unlock(&worker->mutex);
 
-    if (obj->data.o->monitor != NULL) {
-        return thrd_success;
+        worker->task(worker->param);
+
+        pthread_mutex_lock(&worker->mutex);
+    }
+
+    return NULL;
+}
+
+VMBackgroundWorker *thread_background_create(VMBackgroundTask task, void *param) {
+    VMBackgroundWorker *worker = calloc(1, sizeof(VMBackgroundWorker));
+    if (!worker) {
+        return NULL;
+    }
+    worker->task = task;
+    worker->param = param;
+    worker->pending = JAVA_FALSE;
+    pthread_mutex_init(&worker->mutex, NULL);
+    pthread_cond_init(&worker->wakeCondition, NULL);
+
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+    pthread_t tid;
+    int ret = pthread_create(&tid, &attr, thread_background_enter, worker);
+    pthread_attr_destroy(&attr);
+    if (ret != 0) {
+        pthread_cond_destroy(&worker->wakeCondition);
+        pthread_mutex_destroy(&worker->mutex);
+        free(worker);
+        return NULL;
     }
 
+    return worker;
+}
+
+JAVA_VOID thread_background_wake(VMBackgroundWorker *worker) {
+    pthread_mutex_lock(&worker->mutex);
+    worker->pending = JAVA_TRUE;
+    pthread_cond_signal(&worker->wakeCondition);
+    pthread_mutex_unlock(&worker->mutex);
+}
+
+
+static ObjectMonitor *monitor_create_new() {
     ObjectMonitor *m = calloc(1, sizeof(ObjectMonitor));
     // TODO: assert m != NULL
     m->blockingListHeader.thread = NULL; // NULL indicates it's header node
@@ -454,7 +686,156 @@ int monitor_create(VM_PARAM_CURRENT_CONTEXT, VMStackSlot *obj) {
     pthread_mutex_init(&m->masterMutex, NULL);
     pthread_cond_init(&m->blockingCondition, NULL);
 
-    obj->data.o->monitor = m;
+    return m;
+}
+
+static void monitor_destroy(ObjectMonitor *m) {
+    // TODO: make sure the blocking list is empty
+
+    pthread_cond_destroy(&m->blockingCondition);
+    pthread_mutex_destroy(&m->masterMutex);
+
+    free(m);
+}
+
+/** Get a free monitor from the pool of current thread, or create a new one if no monitor can be reused. */
+static ObjectMonitor *monitor_alloc(NativeThreadContext *nativeContext) {
+    if (nativeContext->monitorPool == NULL) {
+        // Refill the thread pool from the global pool
+        pthread_mutex_lock(&g_monitorListLock);
+        {
+            while (g_monitorFree != NULL && nativeContext->monitorPoolSize < MONITOR_POOL_THREAD_MAX) {
+                ObjectMonitor *m = g_monitorFree;
+                g_monitorFree = m->next;
+                g_monitorFreeCount--;
+
+                m->next = nativeContext->monitorPool;
+                nativeContext->monitorPool = m;
+                nativeContext->monitorPoolSize++;
+            }
+
+            pthread_mutex_unlock(&g_monitorListLock);
+        }
+    }
+
+    ObjectMonitor *m = nativeContext->monitorPool;
+    if (m == NULL) {
+        return monitor_create_new();
+    }
+
+    nativeContext->monitorPool = m->next;
+    nativeContext->monitorPoolSize--;
+    m->next = NULL;
+
+    return m;
+}
+
+/** Give an unused monitor back to the pool of current thread. */
+static void monitor_recycle(NativeThreadContext *nativeContext, ObjectMonitor *m) {
+    if (nativeContext->monitorPoolSize >= MONITOR_POOL_THREAD_MAX) {
+        monitor_destroy(m);
+        return;
+    }
+
+    m->next = nativeContext->monitorPool;
+    nativeContext->monitorPool = m;
+    nativeContext->monitorPoolSize++;
+}
+
+/** Move all monitors in the pool of the given thread to the global pool. */
+static void monitor_pool_release(NativeThreadContext *nativeContext) {
+    pthread_mutex_lock(&g_monitorListLock);
+    {
+        ObjectMonitor *m;
+        while ((m = nativeContext->monitorPool) != NULL) {
+            nativeContext->monitorPool = m->next;
+
+            if (g_monitorFreeCount >= MONITOR_POOL_GLOBAL_MAX) {
+                monitor_destroy(m);
+            } else {
+                m->next = g_monitorFree;
+                g_monitorFree = m;
+                g_monitorFreeCount++;
+            }
+        }
+        nativeContext->monitorPoolSize = 0;
+
+        pthread_mutex_unlock(&g_monitorListLock);
+    }
+}
+
+/**
+ * Inflate the lock of the given object to a full monitor. If the object is thin locked, the
+ * ownership is transferred to the monitor.
+ */
+static ObjectMonitor *monitor_inflate(NativeThreadContext *nativeContext, JAVA_OBJECT o) {
+    OPA_ptr_t *word = monitor_word_of(o);
+    ObjectMonitor *m = NULL;
+
+    while (1) {
+        void *w = OPA_load_ptr(word);
+        if (w != NULL && !thin_lock_is_thin(w)) {
+            // Already inflated
+            if (m) {
+                monitor_recycle(nativeContext, m);
+            }
+            return w;
+        }
+
+        if (!m) {
+            m = monitor_alloc(nativeContext);
+        }
+        if (w != NULL) {
+            m->ownerLockId = thin_lock_owner(w);
+            m->reentranceCounter = (int) thin_lock_count(w) + 1;
+        } else {
+            m->ownerLockId = 0;
+            m->reentranceCounter = 0;
+        }
+        m->object = o;
+        m->hashed = JAVA_FALSE;
+
+        // If this fails, the lock word is changed by the owner or other inflating thread
+        if (OPA_cas_ptr(word, w, m) == w) {
+            break;
+        }
+    }
+
+    pthread_mutex_lock(&g_monitorListLock);
+    {
+        m->next = g_monitorInUse;
+        g_monitorInUse = m;
+
+        pthread_mutex_unlock(&g_monitorListLock);
+    }
+
+    return m;
+}
+
+/** Get the inflated monitor if current thread owns the lock of the given object, NULL otherwise. */
+static ObjectMonitor *monitor_of_owned(VM_PARAM_CURRENT_CONTEXT, JAVA_OBJECT o) {
+    NativeThreadContext *nativeContext = vmCurrentContext->nativeContext;
+
+    void *w = OPA_load_ptr(monitor_word_of(o));
+    if (w == NULL) {
+        return NULL;
+    }
+    if (thin_lock_is_thin(w)) {
+        if (thin_lock_owner(w) != nativeContext->lockOwnerId) {
+            return NULL;
+        }
+        // Only the owner could make the lock thin again, so it's safe to inflate here
+        return monitor_inflate(nativeContext, o);
+    }
+
+    ObjectMonitor *m = w;
+    return m->ownerLockId == nativeContext->lockOwnerId ? m : NULL;
+}
+
+int monitor_create(VM_PARAM_CURRENT_CONTEXT, VMStackSlot *obj) {
+    // TODO: check stack slot type
+
+    monitor_inflate(vmCurrentContext->nativeContext, obj->data.o);
 
     return thrd_success;
 }
@@ -462,69 +843,138 @@ int monitor_create(VM_PARAM_CURRENT_CONTEXT, VMStackSlot *obj) {
 JAVA_VOID monitor_free(VM_PARAM_CURRENT_CONTEXT, VMStackSlot *obj) {
     // TODO: check stack slot type
 
-    ObjectMonitor *m = obj->data.o->monitor;
-    if (m != NULL) {
+    void *w = obj->data.o->monitor;
+    if (w != NULL && !thin_lock_is_thin(w)) {
         obj->data.o->monitor = NULL;
 
-        // TODO: make sure the blocking list is empty
-
-        pthread_cond_destroy(&m->blockingCondition);
-        pthread_mutex_destroy(&m->masterMutex);
-
-        free(m);
+        // The monitor is still in the in-use list, it will be recycled by the next GC
+        ((ObjectMonitor *) w)->object = JAVA_NULL;
     }
 }
 
-int monitor_enter(VM_PARAM_CURRENT_CONTEXT, VMStackSlot *obj) {
+JAVA_INT monitor_identity_hash(VM_PARAM_CURRENT_CONTEXT, VMStackSlot *obj) {
     // TODO: check stack slot type
 
-    if (obj->data.o->monitor == NULL) {
-        JAVA_CLASS clazz = obj_get_class(obj->data.o);
-        if (clazz == (JAVA_CLASS) JAVA_NULL) {
-            // Class monitor should be created by class loader
-            return thrd_error;
+    // The address of the monitor is used as the hash, since the object itself could be moved by GC
+    ObjectMonitor *m = monitor_inflate(vmCurrentContext->nativeContext, obj->data.o);
+    // Hashed monitor will never be deflated, otherwise the hash code changes
+    m->hashed = JAVA_TRUE;
+
+    return (JAVA_INT) (uintptr_t) m;
+}
+
+JAVA_VOID monitor_deflate_idle(object_filter_func is_dead) {
+    pthread_mutex_lock(&g_monitorListLock);
+    {
+        ObjectMonitor **p = &g_monitorInUse;
+        ObjectMonitor *m;
+        while ((m = *p) != NULL) {
+            JAVA_OBJECT o = m->object;
+            JAVA_BOOLEAN recycle;
+            if (o == JAVA_NULL) {
+                // Detached by monitor_free()
+                recycle = JAVA_TRUE;
+            } else if (is_dead(o)) {
+                // Nobody could be using the monitor of an unreachable object
+                recycle = JAVA_TRUE;
+            } else {
+                recycle = m->ownerLockId == 0 && OPA_load_int(&m->users) == 0 && m->hashed == JAVA_FALSE;
+                if (recycle) {
+                    o->monitor = NULL;
+                }
+            }
+
+            if (recycle) {
+                *p = m->next;
+
+                m->object = JAVA_NULL;
+                m->reentranceCounter = 0;
+                if (g_monitorFreeCount >= MONITOR_POOL_GLOBAL_MAX) {
+                    monitor_destroy(m);
+                } else {
+                    m->next = g_monitorFree;
+                    g_monitorFree = m;
+                    g_monitorFreeCount++;
+                }
+            } else {
+                p = &m->next;
+            }
         }
 
-        // Push the class object to stack
-        VMStackSlot clazz_slot;
-        clazz_slot.type = VM_SLOT_OBJECT;
-        clazz_slot.data.o = (JAVA_OBJECT) clazz;
+        pthread_mutex_unlock(&g_monitorListLock);
+    }
+}
 
-        // Lock the class. Class monitor is guaranteed to be inited when class is load.
-        int ret = monitor_enter(vmCurrentContext, &clazz_slot);
-        if (ret != thrd_success) {
-            return ret;
+JAVA_VOID monitor_scan_objects(scan_func fn, void *scan_context) {
+    for (ObjectMonitor *m = g_monitorInUse; m != NULL; m = m->next) {
+        if (m->object != JAVA_NULL) {
+            fn(&m->object, scan_context);
         }
+    }
+}
+
+int monitor_enter(VM_PARAM_CURRENT_CONTEXT, VMStackSlot *obj) {
+    // TODO: check stack slot type
+
+    NativeThreadContext *nativeContext = vmCurrentContext->nativeContext;
+    uintptr_t self = nativeContext->lockOwnerId;
 
-        // Create object monitor
-        ret = monitor_create(vmCurrentContext, obj);
+    // Fast path: thin lock
+    if (self <= THIN_LOCK_OWNER_MAX) {
+        OPA_ptr_t *word = monitor_word_of(obj->data.o);
+        // Spinning only makes sense when the owner could be running on another processor
+        int spin = g_systemProcessorInfo.numberOfProcessors > 1 ? THIN_LOCK_SPIN_COUNT : 0;
 
-        // The monitor_enter() call enters check point, so we need to update the reference
-        clazz_slot.data.o = (JAVA_OBJECT) obj_get_class(obj->data.o);
-        // Unlock the clazz
-        monitor_exit(vmCurrentContext, &clazz_slot);
+        while (1) {
+            void *w = OPA_load_ptr(word);
+            if (w == NULL) {
+                if (OPA_cas_ptr(word, NULL, thin_lock_make(self, 0)) == NULL) {
+                    return thrd_success;
+                }
+                continue;
+            }
+            if (!thin_lock_is_thin(w)) {
+                // Already inflated
+                break;
+            }
+            if (thin_lock_owner(w) == self) {
+                // Reentrance
+                uintptr_t count = thin_lock_count(w);
+                if (count == THIN_LOCK_COUNT_MAX) {
+                    // Count overflow, inflate it
+                    break;
+                }
+                // The CAS could fail if another thread is inflating the lock
+                if (OPA_cas_ptr(word, w, thin_lock_make(self, count + 1)) == w) {
+                    return thrd_success;
+                }
+                continue;
+            }
 
-        if (ret != thrd_success) {
-            return ret;
+            // Held by another thread
+            if (spin-- <= 0) {
+                break;
+            }
+            OPA_busy_wait();
         }
     }
 
-    ObjectMonitor *m = obj->data.o->monitor; // Obtain the monitor before enter checkpoint
+    ObjectMonitor *m = monitor_inflate(nativeContext, obj->data.o); // Obtain the monitor before enter checkpoint
+    // Keep the monitor from being deflated by GC while we are blocked
+    OPA_incr_int(&m->users);
 
     // Do lock
     thread_enter_saferegion(vmCurrentContext);
-    JAVA_LONG current_thread_id = vmCurrentContext->threadId;
     pthread_mutex_lock(&m->masterMutex);
     {
         while (1) {
-            JAVA_LONG currentOwner = m->ownerThreadId;
+            uintptr_t currentOwner = m->ownerLockId;
             if (currentOwner == 0 // free to lock
-                || currentOwner == current_thread_id) { // Reentrance
-                m->ownerThreadId = current_thread_id;
+                || currentOwner == self) { // Reentrance
+                m->ownerLockId = self;
                 m->reentranceCounter++;
                 break;
             } else {
-                NativeThreadContext *nativeContext = vmCurrentContext->nativeContext;
                 nativeContext->threadState = thrd_stat_blocked;
                 pthread_cond_wait(&m->blockingCondition, &m->masterMutex); // Waiting for ownership to be released
                 nativeContext->threadState = thrd_stat_runnable;
@@ -533,6 +983,7 @@ int monitor_enter(VM_PARAM_CURRENT_CONTEXT, VMStackSlot *obj) {
 
         pthread_mutex_unlock(&m->masterMutex);
     }
+    OPA_decr_int(&m->users);
 
     thread_leave_saferegion(vmCurrentContext);
 
@@ -542,13 +993,33 @@ int monitor_enter(VM_PARAM_CURRENT_CONTEXT, VMStackSlot *obj) {
 int monitor_exit(VM_PARAM_CURRENT_CONTEXT, VMStackSlot *obj) {
     // TODO: check stack slot type
 
-    ObjectMonitor *m = obj->data.o->monitor;
-    if (m == NULL) {
-        return thrd_error;
+    NativeThreadContext *nativeContext = vmCurrentContext->nativeContext;
+    uintptr_t self = nativeContext->lockOwnerId;
+    OPA_ptr_t *word = monitor_word_of(obj->data.o);
+
+    void *w;
+    while (1) {
+        w = OPA_load_ptr(word);
+        if (w == NULL) {
+            return thrd_lock;
+        }
+        if (!thin_lock_is_thin(w)) {
+            break;
+        }
+        if (thin_lock_owner(w) != self) {
+            return thrd_lock;
+        }
+
+        uintptr_t count = thin_lock_count(w);
+        void *released = count == 0 ? NULL : thin_lock_make(self, count - 1);
+        // The CAS could fail if another thread has inflated the lock
+        if (OPA_cas_ptr(word, w, released) == w) {
+            return thrd_success;
+        }
     }
 
-    JAVA_LONG current_thread_id = vmCurrentContext->threadId;
-    if (current_thread_id != m->ownerThreadId) {
+    ObjectMonitor *m = w;
+    if (self != m->ownerLockId) {
         return thrd_lock;
     }
 
@@ -558,7 +1029,7 @@ int monitor_exit(VM_PARAM_CURRENT_CONTEXT, VMStackSlot *obj) {
 
         if (m->reentranceCounter <= 0) {
             m->reentranceCounter = 0;
-            m->ownerThreadId = 0; // Release ownership
+            m->ownerLockId = 0; // Release ownership
             pthread_cond_signal(&m->blockingCondition); // Notify next blocking thread
         }
 
@@ -571,21 +1042,18 @@ int monitor_exit(VM_PARAM_CURRENT_CONTEXT, VMStackSlot *obj) {
 int monitor_wait(VM_PARAM_CURRENT_CONTEXT, VMStackSlot *obj, JAVA_LONG timeout, JAVA_INT nanos) {
     // TODO: check stack slot type
 
-    ObjectMonitor *m = obj->data.o->monitor;
+    // Make sure the obj lock is held by current thread. Waiting always requires a full monitor.
+    ObjectMonitor *m = monitor_of_owned(vmCurrentContext, obj->data.o);
     if (m == NULL) {
-        return thrd_error;
+        return thrd_lock;
     }
+    // Keep the monitor from being deflated by GC while we are waiting
+    OPA_incr_int(&m->users);
 
     thread_enter_saferegion(vmCurrentContext);
 
-    // Make sure the obj lock is held by current thread
-    JAVA_LONG current_thread_id = vmCurrentContext->threadId;
-    if (current_thread_id != m->ownerThreadId) {
-        thread_leave_saferegion(vmCurrentContext);
-        return thrd_lock;
-    }
-
     NativeThreadContext *nativeContext = vmCurrentContext->nativeContext;
+    uintptr_t current_thread_id = nativeContext->lockOwnerId;
     int prev_count;
 
     pthread_mutex_lock(&m->masterMutex);
@@ -595,7 +1063,7 @@ int monitor_wait(VM_PARAM_CURRENT_CONTEXT, VMStackSlot *obj, JAVA_LONG timeout,
         prev_count = m->reentranceCounter; // First save the status first
         // Release ownership
         m->reentranceCounter = 0;
-        m->ownerThreadId = 0;
+        m->ownerLockId = 0;
         pthread_cond_signal(&m->blockingCondition); // Notify next blocking thread
 
         pthread_mutex_unlock(&m->masterMutex);
@@ -630,10 +1098,10 @@ int monitor_wait(VM_PARAM_CURRENT_CONTEXT, VMStackSlot *obj, JAVA_LONG timeout,
 
         // Get the lock
         while (1) {
-            JAVA_LONG currentOwner = m->ownerThreadId;
+            uintptr_t currentOwner = m->ownerLockId;
             if (currentOwner == 0 // free to lock
                 || currentOwner == current_thread_id) { // Reentrance, shouldn't happen, but anyway
-                m->ownerThreadId = current_thread_id;
+                m->ownerLockId = current_thread_id;
                 m->reentranceCounter = prev_count; // Restore the reentrance count
                 break;
             } else {
@@ -645,6 +1113,7 @@ int monitor_wait(VM_PARAM_CURRENT_CONTEXT, VMStackSlot *obj, JAVA_LONG timeout,
 
         pthread_mutex_unlock(&m->masterMutex);
     }
+    OPA_decr_int(&m->users);
 
     // Now we are locked, check interrupt flag
     JAVA_BOOLEAN interrupt;
@@ -675,14 +1144,9 @@ int monitor_wait(VM_PARAM_CURRENT_CONTEXT, VMStackSlot *obj, JAVA_LONG timeout,
 static inline int _monitor_notify(VM_PARAM_CURRENT_CONTEXT, VMStackSlot *obj, JAVA_BOOLEAN all) {
     // TODO: check stack slot type
 
-    ObjectMonitor *m = obj->data.o->monitor;
-    if (m == NULL) {
-        return thrd_error;
-    }
-
     // Make sure the obj lock is held by current thread
-    JAVA_LONG current_thread_id = vmCurrentContext->threadId;
-    if (current_thread_id != m->ownerThreadId) {
+    ObjectMonitor *m = monitor_of_owned(vmCurrentContext, obj->data.o);
+    if (m == NULL) {
         return thrd_lock;
     }
 
@@ -22,24 +22,6 @@ JavaClass* g_class_array_J = NULL;
 JavaClass* g_class_array_F = NULL;
 JavaClass* g_class_array_D = NULL;
 
-// Check whether an element of am array with the given type must be
-// aligned 0 mod 8.
-static inline JAVA_BOOLEAN array_element_alignment(BasicType t) {
-    return (t == VM_TYPE_DOUBLE || t == VM_TYPE_LONG) ? 8 : ANY_ALIGNMENT;
-}
-
-size_t array_header_size(BasicType t) {
-    return align_size_up(sizeof(JavaArrayBase), array_element_alignment(t));
-}
-
-void *array_base(JAVA_ARRAY a, BasicType t) {
-    return ptr_inc(a, array_header_size(t));
-}
-
-void *array_element_at(JAVA_ARRAY a, BasicType t, size_t index) {
-    return ptr_inc(array_base(a, t), type_size(t) * index);
-}
-
 size_t array_max_length(BasicType t) {
     size_t header_size = array_header_size(t);
     // Available size of element space in bytes
@@ -60,19 +42,21 @@ size_t array_size_of_type(BasicType t, size_t length) {
 static JAVA_ARRAY array_clone(VM_PARAM_CURRENT_CONTEXT, JAVA_ARRAY array) {
     JAVA_CLASS c = obj_get_class((JAVA_OBJECT) array);
     JAVA_INT length = array->length;
-    C_CSTR desc = c->info->thisClass;
-    BasicType elementType = array_type_of(desc);
+    BasicType elementType = ((JavaArrayClass *) c)->elementType;
 
     native_scoped {
         // Store the original
         native_handler_new(h_orig, array);
         // Create new one
-        native_handler_new(h_cloned, array_new(vmCurrentContext, desc, length));
+        native_handler_new(h_cloned, array_new_of_class(vmCurrentContext, c, length));
         // Copy the array
         JAVA_ARRAY orig = (JAVA_ARRAY) native_dereference(vmCurrentContext, h_orig);
         JAVA_ARRAY cloned = (JAVA_ARRAY) native_dereference(vmCurrentContext, h_cloned);
         size_t size = type_size(elementType) * length;
         memcpy(array_base(cloned, elementType), array_base(orig, elementType), size);
+        if (elementType == VM_TYPE_OBJECT || elementType == VM_TYPE_ARRAY) {
+            heap_write_barrier_range(array_base(cloned, elementType), size);
+        }
 
         result = h_cloned;
     } native_scope_end();
@@ -89,11 +73,13 @@ JAVA_OBJECT g_array_5Mclone_R9Pjava_lang6CObject(VM_PARAM_CURRENT_CONTEXT) {
     bc_check_objectref();
 
     JAVA_ARRAY cloned = array_clone(vmCurrentContext, (JAVA_ARRAY) local_of(0).data.o);
-    exception_raise_if_occurred(vmCurrentContext);
+    exception_raise_if_occurred();
 
     stack_frame_end();
 
     return (JAVA_OBJECT) cloned;
+
+    exception_suppressed(JAVA_NULL);
 }
 
 JAVA_ARRAY array_new(VM_PARAM_CURRENT_CONTEXT, C_CSTR desc, JAVA_INT length) {
@@ -108,32 +94,39 @@ JAVA_ARRAY array_new(VM_PARAM_CURRENT_CONTEXT, C_CSTR desc, JAVA_INT length) {
     }
     assert(clazz); // TODO: remove this once I figure out how to safely throw exception in classloader
 
+    return array_new_of_class(vmCurrentContext, clazz, length);
+}
+
+JAVA_ARRAY array_new_of_class(VM_PARAM_CURRENT_CONTEXT, JAVA_CLASS arrayClass, JAVA_INT length) {
+    assert(arrayClass->info->thisClass[0] == TYPE_DESC_ARRAY);
+
     if (length < 0) {
         exception_set_NegativeArraySizeException(vmCurrentContext, length);
         return (JAVA_ARRAY) JAVA_NULL;
     }
 
-    BasicType elementType = array_type_of(desc);
-    size_t objectSize = array_size_of_type(elementType, length);
+    size_t objectSize = array_class_size_of((JavaArrayClass *) arrayClass, (size_t) length);
 
     JAVA_ARRAY array = heap_alloc(vmCurrentContext, objectSize);
     if (!array) {
-        fprintf(stderr, "Unable to alloc array %s with length %d\n", desc, length);
+        fprintf(stderr, "Unable to alloc array %s with length %d\n", arrayClass->info->thisClass, length);
         // TODO: throw OOM exception
         abort();
     }
 
-    array->baseObject.clazz = clazz;
+    array->baseObject.clazz = arrayClass;
     array->length = length;
 
     return array;
 }
 
 JAVA_VOID array_set_object(VM_PARAM_CURRENT_CONTEXT, JAVA_ARRAY array, JAVA_INT index, JAVA_OBJECT obj) {
-    assert(index >= 0); // TODO: throw ArrayIndexOutOfBoundsException instead
-    assert(index < array->length); // TODO: throw ArrayIndexOutOfBoundsException instead
+    if ((uint32_t) index >= (uint32_t) array->length) {
+        exception_set_ArrayIndexOutOfBoundsException(vmCurrentContext, index);
+        return;
+    }
 
-    BasicType arrayType = array_type_of(obj_get_class(&array->baseObject)->info->thisClass);
+    BasicType arrayType = array_class_of(array)->elementType;
 
     if (arrayType != VM_TYPE_OBJECT && arrayType != VM_TYPE_ARRAY) {
         fprintf(stderr, "Cannot store object in an array of primitive type\n");
@@ -155,4 +148,5 @@ JAVA_VOID array_set_object(VM_PARAM_CURRENT_CONTEXT, JAVA_ARRAY array, JAVA_INT
 
     JAVA_OBJECT *element = array_element_at(array, arrayType, index);
     *element = obj;
+    heap_write_barrier(element, obj);
 }
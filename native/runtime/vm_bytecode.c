@@ -15,369 +15,8 @@
 #include "vm_method.h"
 #include "classloader/vm_boot_classloader.h"
 
-#define RETURNV() exception_raise_if_occurred(vmCurrentContext); return
-#define RETURN(result) exception_raise_if_occurred(vmCurrentContext); return result
-
-#define JAVA_TYPE_a JAVA_ARRAY
-#define JAVA_TYPE_o JAVA_OBJECT
-#define JAVA_TYPE_z JAVA_BOOLEAN
-#define JAVA_TYPE_i JAVA_INT
-#define JAVA_TYPE_l JAVA_LONG
-#define JAVA_TYPE_f JAVA_FLOAT
-#define JAVA_TYPE_d JAVA_DOUBLE
-#define JAVA_TYPE_b JAVA_BYTE
-#define JAVA_TYPE_c JAVA_CHAR
-#define JAVA_TYPE_s JAVA_SHORT
-#define java_type_of(prefix) JAVA_TYPE_##prefix
-
-#define SLOT_TYPE_a VM_SLOT_OBJECT
-#define SLOT_TYPE_o VM_SLOT_OBJECT
-#define SLOT_TYPE_z VM_SLOT_INT
-#define SLOT_TYPE_i VM_SLOT_INT
-#define SLOT_TYPE_l VM_SLOT_LONG
-#define SLOT_TYPE_f VM_SLOT_FLOAT
-#define SLOT_TYPE_d VM_SLOT_DOUBLE
-#define SLOT_TYPE_b VM_SLOT_INT
-#define SLOT_TYPE_c VM_SLOT_INT
-#define SLOT_TYPE_s VM_SLOT_INT
-#define slot_type_of(prefix) SLOT_TYPE_##prefix
-
-#define SLOT_VALUE_a o
-#define SLOT_VALUE_o o
-#define SLOT_VALUE_z i
-#define SLOT_VALUE_i i
-#define SLOT_VALUE_l l
-#define SLOT_VALUE_f f
-#define SLOT_VALUE_d d
-#define SLOT_VALUE_b i
-#define SLOT_VALUE_c i
-#define SLOT_VALUE_s i
-#define slot_value_of(prefix) SLOT_VALUE_##prefix
-
-// ..., value1, value2 →
-// ..., result
-#define arithmetic_bi_operand(required_type)    \
-    VMStackSlot *value2 = stack->top - 1;       \
-    VMStackSlot *value1 = stack->top - 2;       \
-                                                \
-    assert(value1 >= stack->slots);             \
-                                                \
-    assert(value1->type == required_type);      \
-    assert(value2->type == required_type);      \
-                                                \
-    /* Pop value2 */                            \
-    stack->top = value2;                        \
-    value2->type = VM_SLOT_INVALID
-    // Store the result in the place of value1
-
-// ..., value1, value2 →
-// ...
-#define arithmetic_bi_operand_nr(required_type) \
-    VMStackSlot *value2 = stack->top - 1;       \
-    VMStackSlot *value1 = stack->top - 2;       \
-                                                \
-    assert(value1 >= stack->slots);             \
-                                                \
-    assert(value1->type == required_type);      \
-    assert(value2->type == required_type);      \
-                                                \
-    /* Pop value1 and value2 */                 \
-    stack->top = value1;                        \
-    value1->type = VM_SLOT_INVALID;             \
-    value2->type = VM_SLOT_INVALID
-
-// ..., value →
-// ..., result
-#define arithmetic_un_operand(required_type)    \
-    VMStackSlot *value = stack->top - 1;        \
-                                                \
-    assert(value >= stack->slots);              \
-                                                \
-    assert(value->type == required_type)
-// Store the result in the place of value
-
-// ..., value →
-// ...
-#define arithmetic_un_operand_nr(required_type) \
-    VMStackSlot *value = stack->top - 1;        \
-                                                \
-    assert(value >= stack->slots);              \
-                                                \
-    assert(value->type == required_type);       \
-                                                \
-    /* Pop value */                             \
-    stack->top = value;                         \
-    value->type = VM_SLOT_INVALID
-
-#define def_arithmetic_bi_func(prefix, name, operation)                                     \
-decl_arithmetic_func(prefix##name) {                                                        \
-    arithmetic_bi_operand(slot_type_of(prefix));                                            \
-                                                                                            \
-    value1->data.slot_value_of(prefix)                                                      \
-        = value1->data.slot_value_of(prefix) operation value2->data.slot_value_of(prefix);  \
-}
-
-#define def_arithmetic_un_func(prefix, name, operation)                                 \
-decl_arithmetic_func(prefix##name) {                                                    \
-    arithmetic_un_operand(slot_type_of(prefix));                                        \
-                                                                                        \
-    value->data.slot_value_of(prefix) = operation value->data.slot_value_of(prefix);    \
-}
-
-def_arithmetic_bi_func(i, add, +);
-def_arithmetic_bi_func(l, add, +);
-def_arithmetic_bi_func(f, add, +);
-def_arithmetic_bi_func(d, add, +);
-
-def_arithmetic_bi_func(i, sub, -);
-def_arithmetic_bi_func(l, sub, -);
-def_arithmetic_bi_func(f, sub, -);
-def_arithmetic_bi_func(d, sub, -);
-
-def_arithmetic_bi_func(i, mul, *);
-def_arithmetic_bi_func(l, mul, *);
-def_arithmetic_bi_func(f, mul, *);
-def_arithmetic_bi_func(d, mul, *);
-
-def_arithmetic_bi_func(i, div, /);
-def_arithmetic_bi_func(l, div, /);
-def_arithmetic_bi_func(f, div, /);
-def_arithmetic_bi_func(d, div, /);
-
-def_arithmetic_bi_func(i, rem, %);
-def_arithmetic_bi_func(l, rem, %);
-// % does not work with float and double
-decl_arithmetic_func(frem) {
-    arithmetic_bi_operand(VM_SLOT_FLOAT);
-
-    // fmodf produce incorrect results for values close to zero.Converting the
-    // operands to doubles and using fmod() returns the expected result. See
-    // https://github.com/robovm/robovm/issues/89
-    value1->data.f = fmod(value1->data.f, value2->data.f);
-}
-decl_arithmetic_func(drem) {
-    arithmetic_bi_operand(VM_SLOT_DOUBLE);
-
-    value1->data.d = fmod(value1->data.d, value2->data.d);
-}
-
-def_arithmetic_un_func(i, neg, -);
-def_arithmetic_un_func(l, neg, -);
-def_arithmetic_un_func(f, neg, -);
-def_arithmetic_un_func(d, neg, -);
-
-#define def_ishift_func(name, operation)                                                        \
-decl_arithmetic_func(i##name) {                                                                 \
-    arithmetic_bi_operand(VM_SLOT_INT);                                                         \
-                                                                                                \
-    value1->data.i = (JAVA_UINT)value1->data.i operation ((JAVA_UINT)value2->data.i & 0x1Fu);   \
-}
-
-#define def_lshift_func(name, operation)                                                        \
-decl_arithmetic_func(l##name) {                                                                 \
-    VMStackSlot *value2 = stack->top - 1;                                                       \
-    VMStackSlot *value1 = stack->top - 2;                                                       \
-                                                                                                \
-    assert(value1 >= stack->slots);                                                             \
-                                                                                                \
-    assert(value1->type == VM_SLOT_LONG);                                                       \
-    assert(value2->type == VM_SLOT_INT);                                                        \
-                                                                                                \
-    /* Pop value2 */                                                                            \
-    stack->top = value2;                                                                        \
-    value2->type = VM_SLOT_INVALID;                                                             \
-                                                                                                \
-    value1->data.l = (JAVA_ULONG)value1->data.l operation ((JAVA_ULONG)value2->data.l & 0x3Fu); \
-}
-
-// Left shift
-def_ishift_func(shl, <<);
-def_lshift_func(shl, <<);
-// Logical right shift
-def_ishift_func(ushr, >>);
-def_lshift_func(ushr, >>);
-// C dose not have a signed right shift (arithmetic right shift) operator
-decl_arithmetic_func(ishr) {
-    arithmetic_bi_operand(VM_SLOT_INT);
-
-    JAVA_UINT s = (JAVA_UINT)value2->data.i & 0x1Fu;
-    if(s > 0) {
-        JAVA_INT x = value1->data.i;
-        if(x < 0) {
-            value1->data.i = (JAVA_UINT)x >> s | ~(~((JAVA_UINT)0u) >> s);
-        } else {
-            // Same as logical shift
-            value1->data.i = (JAVA_UINT)x >> s;
-        }
-    }
-}
-decl_arithmetic_func(lshr) {
-    VMStackSlot *value2 = stack->top - 1;
-    VMStackSlot *value1 = stack->top - 2;
-
-    assert(value1 >= stack->slots);
-
-    assert(value1->type == VM_SLOT_LONG);
-    assert(value2->type == VM_SLOT_INT);
-
-    /* Pop value2 */
-    stack->top = value2;
-    value2->type = VM_SLOT_INVALID;
-
-    JAVA_ULONG s = (JAVA_ULONG)value2->data.l & 0x3Fu;
-    if(s > 0) {
-        JAVA_LONG x = value1->data.l;
-        if(x < 0) {
-            value1->data.l = (JAVA_ULONG)x >> s | ~(~((JAVA_ULONG)0u) >> s);
-        } else {
-            // Same as logical shift
-            value1->data.l = (JAVA_ULONG)x >> s;
-        }
-    }
-}
-
-def_arithmetic_bi_func(i, and, &);
-def_arithmetic_bi_func(l, and, &);
-
-def_arithmetic_bi_func(i, or, |);
-def_arithmetic_bi_func(l, or, |);
-
-def_arithmetic_bi_func(i, xor, ^);
-def_arithmetic_bi_func(l, xor, ^);
-
-// Type conversion operations
-#define def_conv_func(from_prefix, to_prefix)                                   \
-decl_arithmetic_func(from_prefix##2##to_prefix) {                               \
-    arithmetic_un_operand(slot_type_of(from_prefix));                           \
-                                                                                \
-    java_type_of(to_prefix) converted = value->data.slot_value_of(from_prefix); \
-    value->type = slot_type_of(to_prefix);                                      \
-    value->data.slot_value_of(to_prefix) = converted;                           \
-}
-
-def_conv_func(i, l);
-def_conv_func(i, f);
-def_conv_func(i, d);
-
-def_conv_func(l, i);
-def_conv_func(l, f);
-def_conv_func(l, d);
-
-def_conv_func(f, i);
-def_conv_func(f, l);
-def_conv_func(f, d);
-
-def_conv_func(d, i);
-def_conv_func(d, l);
-def_conv_func(d, f);
-
-def_conv_func(i, b);
-def_conv_func(i, s);
-
-decl_arithmetic_func(i2c) {
-    arithmetic_un_operand(slot_type_of(i));
-
-    java_type_of(c) converted = (JAVA_UCHAR) value->data.slot_value_of(i);
-    value->type = slot_type_of(c);
-    value->data.slot_value_of(c) = converted;
-}
-
-// Comparison operations
-#define CMP_RESULT_g 1
-#define CMP_RESULT_l -1
-#define cmp_result_of(r) CMP_RESULT_##r
-
-#define IS_NAN_f isnanf
-#define IS_NAN_d isnan
-#define is_nan(prefix, v)  IS_NAN_##prefix(v)
-
-decl_arithmetic_func(lcmp) {
-    arithmetic_bi_operand(VM_SLOT_LONG);
-
-    if (value1->data.l == value2->data.l) {
-        value1->data.i = 0;
-    } else if (value1->data.l > value2->data.l) {
-        value1->data.i = cmp_result_of(g);
-    } else {
-        value1->data.i = cmp_result_of(l);
-    }
-    value1->type = VM_SLOT_INT;
-}
-
-#define def_cmp_func(prefix, suffix)                                \
-decl_arithmetic_func(prefix##cmp##suffix) {                         \
-    arithmetic_bi_operand(slot_type_of(prefix));                    \
-                                                                    \
-    java_type_of(prefix) v1 = value1->data.slot_value_of(prefix);   \
-    java_type_of(prefix) v2 = value2->data.slot_value_of(prefix);   \
-                                                                    \
-    if(is_nan(prefix, v1) || is_nan(prefix, v2)) {                  \
-        value1->data.i = cmp_result_of(suffix);                     \
-    } else if(v1 == v2){                                            \
-        value1->data.i = 0;                                         \
-    } else if(v1 > v2){                                             \
-        value1->data.i = cmp_result_of(g);                          \
-    } else {                                                        \
-        value1->data.i = cmp_result_of(l);                          \
-    }                                                               \
-    value1->type = VM_SLOT_INT;                                     \
-}
-
-def_cmp_func(f, l);
-def_cmp_func(f, g);
-def_cmp_func(d, l);
-def_cmp_func(d, g);
-
-// Branch operations
-#define CMP_eq ==
-#define CMP_ne !=
-#define CMP_lt <
-#define CMP_le <=
-#define CMP_gt >
-#define CMP_ge >=
-#define comparator_of(c) CMP_##c
-
-#define def_branch_if(suffix)                                               \
-JAVA_BOOLEAN bc_branch_if##suffix(VMOperandStack *stack) {                  \
-    arithmetic_un_operand_nr(VM_SLOT_INT);                                  \
-                                                                            \
-    return value->data.i comparator_of(suffix) 0 ? JAVA_TRUE : JAVA_FALSE;  \
-}
-def_branch_if(eq);
-def_branch_if(ne);
-def_branch_if(lt);
-def_branch_if(le);
-def_branch_if(gt);
-def_branch_if(ge);
-
-#define def_branch_ifcmp(prefix, suffix)                                    \
-JAVA_BOOLEAN bc_branch_if_##prefix##cmp##suffix(VMOperandStack *stack) {    \
-    arithmetic_bi_operand_nr(slot_type_of(prefix));                         \
-                                                                            \
-    return value1->data.slot_value_of(prefix)                               \
-        comparator_of(suffix) value2->data.slot_value_of(prefix)            \
-        ? JAVA_TRUE : JAVA_FALSE;                                           \
-}
-def_branch_ifcmp(i, eq);
-def_branch_ifcmp(i, ne);
-def_branch_ifcmp(i, lt);
-def_branch_ifcmp(i, le);
-def_branch_ifcmp(i, gt);
-def_branch_ifcmp(i, ge);
-def_branch_ifcmp(a, eq);
-def_branch_ifcmp(a, ne);
-
-JAVA_BOOLEAN bc_branch_ifnull(VMOperandStack *stack) {
-    arithmetic_un_operand_nr(VM_SLOT_OBJECT);
-
-    return value->data.o == JAVA_NULL ? JAVA_TRUE : JAVA_FALSE;
-}
-
-JAVA_INT bc_switch_get_index(VMOperandStack *stack) {
-    arithmetic_un_operand_nr(VM_SLOT_INT);
-
-    return value->data.i;
-}
+// All functions here never throw by themselves. If an exception occurs, it's left pending
+// in vmCurrentContext and the caller jumps to the exception dispatcher of the translated method.
 
 JAVA_VOID bc_check_objref(VM_PARAM_CURRENT_CONTEXT, JavaStackFrame *frame) {
     // objectref is always in the local0
@@ -390,7 +29,7 @@ JAVA_VOID bc_check_objref(VM_PARAM_CURRENT_CONTEXT, JavaStackFrame *frame) {
         // Get current method info
         MethodInfo *m = frame->currentMethod;
         exception_set_NullPointerException_invoke(vmCurrentContext, string_get_constant_utf8(m->name));
-        exception_raise(vmCurrentContext);
+        return;
     }
 
     frame->baseFrame.thisClass = obj_get_class(obj);
@@ -474,15 +113,14 @@ JAVA_VOID bc_putfield(VM_PARAM_CURRENT_CONTEXT, VMOperandStack *stack, JavaClass
 
     assert(objectRef->type == VM_SLOT_OBJECT);
 
+    *objRefOut = objectRef->data.o;
     if (objectRef->data.o == JAVA_NULL) {
         exception_set_NullPointerException_property(vmCurrentContext,
                                                     string_get_constant_utf8(clazz->fields[field_index].name),
                                                     JAVA_FALSE);
-        exception_raise(vmCurrentContext);
+        return;
     }
 
-    *objRefOut = objectRef->data.o;
-
     bc_stack_value_out(value, valueOut, fieldType);
 
     // Pop
@@ -500,19 +138,11 @@ JAVA_OBJECT bc_getfield(VM_PARAM_CURRENT_CONTEXT, VMOperandStack *stack, JavaCla
         exception_set_NullPointerException_property(vmCurrentContext,
                                                     string_get_constant_utf8(clazz->fields[field_index].name),
                                                     JAVA_TRUE);
-        exception_raise(vmCurrentContext);
     }
 
     return obj;
 }
 
-JAVA_VOID bc_putstatic(VM_PARAM_CURRENT_CONTEXT, JavaStackFrame *frame, JavaClassInfo *classInfo,
-                       JAVA_CLASS *classRefOut, void *valueOut, BasicType fieldType) {
-    bc_resolve_class(vmCurrentContext, frame, classInfo, classRefOut);
-
-    bc_read_stack_top(&frame->operandStack, valueOut, fieldType);
-}
-
 JAVA_VOID bc_resolve_class(VM_PARAM_CURRENT_CONTEXT, JavaStackFrame *frame, JavaClassInfo *classInfo,
                            JAVA_CLASS *classRefOut) {
     // jvms8 §5.5 Initialization
@@ -527,11 +157,43 @@ JAVA_VOID bc_resolve_class(VM_PARAM_CURRENT_CONTEXT, JavaStackFrame *frame, Java
     //   initialized already.
 
     JAVA_CLASS clazz = classloader_get_class_init(vmCurrentContext, frame->baseFrame.thisClass->classLoader, classInfo);
+    *classRefOut = clazz;
+}
+
+JAVA_VOID bc_resolve_class_slow(VM_PARAM_CURRENT_CONTEXT, JavaStackFrame *frame, JavaClassInfo *classInfo,
+                                OPA_ptr_t *classCache, JAVA_CLASS *classRefOut) {
+    bc_resolve_class(vmCurrentContext, frame, classInfo, classRefOut);
+    if (exception_occurred(vmCurrentContext)) {
+        return;
+    }
+
+    JAVA_CLASS clazz = *classRefOut;
     assert(clazz != (JAVA_CLASS) JAVA_NULL);
+    // Only cache the class if it's fully initialized, so other threads won't skip waiting for the
+    // initialization, or a recursive initialization done by current thread.
+    // The cache belongs to the generated code so it can only be shared by classes from the bootstrap
+    // class loader.
+    if (clazz->state == CLASS_STATE_INITIALIZED && frame->baseFrame.thisClass->classLoader == JAVA_NULL) {
+        OPA_store_release_ptr(classCache, clazz);
+    }
+}
+
+JAVA_VOID bc_resolve_array_class_slow(VM_PARAM_CURRENT_CONTEXT, JavaStackFrame *frame, C_CSTR desc,
+                                      OPA_ptr_t *classCache, JAVA_CLASS *classRefOut) {
+    JAVA_CLASS clazz = classloader_get_class_by_name_init(vmCurrentContext, frame->baseFrame.thisClass->classLoader, desc);
     *classRefOut = clazz;
+    if (exception_occurred(vmCurrentContext)) {
+        return;
+    }
+    assert(clazz != (JAVA_CLASS) JAVA_NULL);
+
+    // Same as bc_resolve_class_slow(), only classes from the bootstrap class loader can be cached
+    if (clazz->state >= CLASS_STATE_RESOLVED && frame->baseFrame.thisClass->classLoader == JAVA_NULL) {
+        OPA_store_release_ptr(classCache, clazz);
+    }
 }
 
-JAVA_ARRAY bc_new_array(VM_PARAM_CURRENT_CONTEXT, JavaStackFrame *frame, C_CSTR desc) {
+JAVA_ARRAY bc_new_array(VM_PARAM_CURRENT_CONTEXT, JavaStackFrame *frame, JAVA_CLASS arrayClass) {
     VMOperandStack *stack = &frame->operandStack;
     VMStackSlot *value = stack->top - 1;
 
@@ -542,10 +204,7 @@ JAVA_ARRAY bc_new_array(VM_PARAM_CURRENT_CONTEXT, JavaStackFrame *frame, C_CSTR
     stack->top = value;
     value->type = VM_SLOT_INVALID;
 
-    JAVA_ARRAY array = array_new(vmCurrentContext, desc, value->data.i);
-    exception_raise_if_occurred(vmCurrentContext);
-
-    return array;
+    return array_new_of_class(vmCurrentContext, arrayClass, value->data.i);
 }
 
 JAVA_INT bc_array_length(VM_PARAM_CURRENT_CONTEXT, VMOperandStack *stack) {
@@ -556,7 +215,7 @@ JAVA_INT bc_array_length(VM_PARAM_CURRENT_CONTEXT, VMOperandStack *stack) {
     assert(arrayRef->type == VM_SLOT_OBJECT);
     if (arrayRef->data.o == JAVA_NULL) {
         exception_set_NullPointerException_arraylen(vmCurrentContext);
-        exception_raise(vmCurrentContext);
+        return 0;
     }
 
     JAVA_ARRAY array = (JAVA_ARRAY) arrayRef->data.o;
@@ -572,143 +231,22 @@ JAVA_INT bc_array_length(VM_PARAM_CURRENT_CONTEXT, VMOperandStack *stack) {
     return length;
 }
 
-JAVA_VOID bc_array_load(VM_PARAM_CURRENT_CONTEXT, VMOperandStack *stack, void *valueOut, BasicType fieldType) {
-    VMStackSlot *index = stack->top - 1;
-    VMStackSlot *arrayRef = stack->top - 2;
-
-    assert(arrayRef >= stack->slots);
-
-    assert(arrayRef->type == VM_SLOT_OBJECT);
-    if (arrayRef->data.o == JAVA_NULL) {
-        exception_set_NullPointerException_array(vmCurrentContext, JAVA_TRUE);
-        exception_raise(vmCurrentContext);
-    }
-    assert(index->type == VM_SLOT_INT);
-    JAVA_INT i = index->data.i;
-    assert(i >= 0); // TODO: throw ArrayIndexOutOfBoundsException instead
-    JAVA_ARRAY array = (JAVA_ARRAY) arrayRef->data.o;
-    assert(i < array->length); // TODO: throw ArrayIndexOutOfBoundsException instead
-
-    void* element = array_element_at(array, fieldType, i);
-    BasicType arrayType = array_type_of(obj_get_class(&array->baseObject)->info->thisClass);
-
-    // Read the value
-    switch (fieldType) {
-        case VM_TYPE_CHAR:
-            assert(arrayType == VM_TYPE_CHAR);
-            *((JAVA_CHAR *) valueOut) = *((JAVA_CHAR *) element);
-            break;
-        case VM_TYPE_FLOAT:
-            assert(arrayType == VM_TYPE_FLOAT);
-            *((JAVA_FLOAT *) valueOut) = *((JAVA_FLOAT *) element);
-            break;
-        case VM_TYPE_DOUBLE:
-            assert(arrayType == VM_TYPE_DOUBLE);
-            *((JAVA_DOUBLE *) valueOut) = *((JAVA_DOUBLE *) element);
-            break;
-        case VM_TYPE_BYTE:
-            assert(arrayType == VM_TYPE_BYTE || arrayType == VM_TYPE_BOOLEAN);
-            *((JAVA_BYTE *) valueOut) = *((JAVA_BYTE *) element);
-            break;
-        case VM_TYPE_SHORT:
-            assert(arrayType == VM_TYPE_SHORT);
-            *((JAVA_SHORT *) valueOut) = *((JAVA_SHORT *) element);
-            break;
-        case VM_TYPE_INT:
-            assert(arrayType == VM_TYPE_INT);
-            *((JAVA_INT *) valueOut) = *((JAVA_INT *) element);
-            break;
-        case VM_TYPE_LONG:
-            assert(arrayType == VM_TYPE_LONG);
-            *((JAVA_LONG *) valueOut) = *((JAVA_LONG *) element);
-            break;
-        case VM_TYPE_OBJECT:
-            assert(arrayType == VM_TYPE_OBJECT || arrayType == VM_TYPE_ARRAY);
-            *((JAVA_OBJECT *) valueOut) = *((JAVA_OBJECT *) element);
-            break;
-        case VM_TYPE_BOOLEAN:
-        case VM_TYPE_ARRAY:
-        case VM_TYPE_VOID:
-        case VM_TYPE_ILLEGAL:
-            assert(!"Unexpected value type");
-    }
-
-    // Pop
-    stack->top = arrayRef;
-    index->type = VM_SLOT_INVALID;
-    arrayRef->type = VM_SLOT_INVALID;
-}
-
-JAVA_VOID bc_array_store(VM_PARAM_CURRENT_CONTEXT, VMOperandStack *stack, BasicType fieldType) {
+JAVA_VOID bc_array_store_object(VM_PARAM_CURRENT_CONTEXT, VMOperandStack *stack) {
     VMStackSlot *value = stack->top - 1;
     VMStackSlot *index = stack->top - 2;
     VMStackSlot *arrayRef = stack->top - 3;
 
     assert(arrayRef >= stack->slots);
 
-    assert(arrayRef->type == VM_SLOT_OBJECT);
-    if (arrayRef->data.o == JAVA_NULL) {
-        exception_set_NullPointerException_array(vmCurrentContext, JAVA_FALSE);
-        exception_raise(vmCurrentContext);
+    JAVA_ARRAY array = bc_array_check(vmCurrentContext, arrayRef, index, JAVA_FALSE);
+    if (array == (JAVA_ARRAY) JAVA_NULL) {
+        return;
     }
-    assert(index->type == VM_SLOT_INT);
-    JAVA_INT i = index->data.i;
-    assert(i >= 0); // TODO: throw ArrayIndexOutOfBoundsException instead
-    JAVA_ARRAY array = (JAVA_ARRAY) arrayRef->data.o;
-    assert(i < array->length); // TODO: throw ArrayIndexOutOfBoundsException instead
-
-    void* element = array_element_at(array, fieldType, i);
-    BasicType arrayType = array_type_of(obj_get_class(&array->baseObject)->info->thisClass);
+    assert(value->type == VM_SLOT_OBJECT);
 
-    // Store the value
-    switch (fieldType) {
-        case VM_TYPE_CHAR:
-            assert(arrayType == VM_TYPE_CHAR);
-            assert(value->type == VM_SLOT_INT);
-            *((JAVA_CHAR *) element) = value->data.i;
-            break;
-        case VM_TYPE_FLOAT:
-            assert(arrayType == VM_TYPE_FLOAT);
-            assert(value->type == VM_SLOT_FLOAT);
-            *((JAVA_FLOAT *) element) = value->data.f;
-            break;
-        case VM_TYPE_DOUBLE:
-            assert(arrayType == VM_TYPE_DOUBLE);
-            assert(value->type == VM_SLOT_DOUBLE);
-            *((JAVA_DOUBLE *) element) = value->data.d;
-            break;
-        case VM_TYPE_BYTE:
-            assert(arrayType == VM_TYPE_BYTE || arrayType == VM_TYPE_BOOLEAN);
-            assert(value->type == VM_SLOT_INT);
-            *((JAVA_BYTE *) element) = value->data.i;
-            break;
-        case VM_TYPE_SHORT:
-            assert(arrayType == VM_TYPE_SHORT);
-            assert(value->type == VM_SLOT_INT);
-            *((JAVA_SHORT *) element) = value->data.i;
-            break;
-        case VM_TYPE_INT:
-            assert(arrayType == VM_TYPE_INT);
-            assert(value->type == VM_SLOT_INT);
-            *((JAVA_INT *) element) = value->data.i;
-            break;
-        case VM_TYPE_LONG:
-            assert(arrayType == VM_TYPE_LONG);
-            assert(value->type == VM_SLOT_LONG);
-            *((JAVA_LONG *) element) = value->data.l;
-            break;
-        case VM_TYPE_OBJECT:
-            assert(arrayType == VM_TYPE_OBJECT || arrayType == VM_TYPE_ARRAY);
-            assert(value->type == VM_SLOT_OBJECT);
-
-            array_set_object(vmCurrentContext, array, i, value->data.o);
-            exception_raise_if_occurred(vmCurrentContext);
-            break;
-        case VM_TYPE_BOOLEAN:
-        case VM_TYPE_ARRAY:
-        case VM_TYPE_VOID:
-        case VM_TYPE_ILLEGAL:
-            assert(!"Unexpected value type");
+    array_set_object(vmCurrentContext, array, index->data.i, value->data.o);
+    if (exception_occurred(vmCurrentContext)) {
+        return;
     }
 
     // Pop
@@ -718,15 +256,10 @@ JAVA_VOID bc_array_store(VM_PARAM_CURRENT_CONTEXT, VMOperandStack *stack, BasicT
     arrayRef->type = VM_SLOT_INVALID;
 }
 
-JAVA_OBJECT bc_create_instance(VM_PARAM_CURRENT_CONTEXT, JavaStackFrame *frame, JavaClassInfo *info) {
-    JAVA_CLASS clazz;
-    bc_resolve_class(vmCurrentContext, frame, info, &clazz);
-
+JAVA_OBJECT bc_create_instance(VM_PARAM_CURRENT_CONTEXT, JAVA_CLASS clazz) {
     assert(!clazz->isPrimitive);
 
-    JAVA_OBJECT obj = class_alloc_instance(vmCurrentContext, clazz);
-
-    RETURN(obj);
+    return class_alloc_instance(vmCurrentContext, clazz);
 }
 
 JAVA_VOID bc_monitor_enter(VM_PARAM_CURRENT_CONTEXT, VMOperandStack *stack) {
@@ -738,7 +271,7 @@ JAVA_VOID bc_monitor_enter(VM_PARAM_CURRENT_CONTEXT, VMOperandStack *stack) {
 
     if (objectRef->data.o == JAVA_NULL) {
         exception_set_NullPointerException_monitor(vmCurrentContext, JAVA_TRUE);
-        exception_raise(vmCurrentContext);
+        return;
     }
 
     int ret = monitor_enter(vmCurrentContext, objectRef);
@@ -762,7 +295,7 @@ JAVA_VOID bc_monitor_exit(VM_PARAM_CURRENT_CONTEXT, VMOperandStack *stack) {
 
     if (objectRef->data.o == JAVA_NULL) {
         exception_set_NullPointerException_monitor(vmCurrentContext, JAVA_FALSE);
-        exception_raise(vmCurrentContext);
+        return;
     }
 
     int ret = monitor_exit(vmCurrentContext, objectRef);
@@ -787,7 +320,8 @@ JAVA_VOID bc_monitor_exit(VM_PARAM_CURRENT_CONTEXT, VMOperandStack *stack) {
 }
 
 /**
- * Get the function ptr at the given index in the vtable of the objectref in stack.
+ * Get the function ptr at the given index in the vtable of the objectref in stack,
+ * or NULL with the exception set if the objectref is null.
   *
   * @param argument_count argument count, including the implicitly passed `objectref`
   */
@@ -802,7 +336,7 @@ void *bc_vtable_lookup(VM_PARAM_CURRENT_CONTEXT, VMOperandStack *stack, JAVA_INT
     if (object == JAVA_NULL) {
         MethodInfo *m = method_vtable_get(clazz, vtable_index);
         exception_set_NullPointerException_invoke(vmCurrentContext, string_get_constant_utf8(m->name));
-        exception_raise(vmCurrentContext);
+        return NULL;
     }
 
     JavaClassInfo *info = obj_get_class(object)->info;
@@ -811,36 +345,9 @@ void *bc_vtable_lookup(VM_PARAM_CURRENT_CONTEXT, VMOperandStack *stack, JAVA_INT
     return info->vtable[vtable_index].code;
 }
 
-static int32_t bc_ivtable_do_lookup(JavaClassInfo* clazz, JavaClassInfo* interface_type, uint16_t method_index) {
-    for (uint16_t i = 0; i < clazz->ivtableCount; i++) {
-        IVTableItem *ivti = &clazz->ivtable[i];
-
-        if (ivti->declaringInterface != interface_type) {
-            continue;
-        }
-
-        // Look at the method index
-        for (uint16_t j = 0; j < ivti->indexCount; j++) {
-            IVTableMethodIndex *mi = &ivti->methodIndexes[j];
-            if (mi->methodIndex == method_index) {
-                return mi->vtableIndex;
-            }
-        }
-
-        break;
-    }
-
-    // Try superclass
-    if (clazz->superClass) {
-        return bc_ivtable_do_lookup(clazz->superClass, interface_type, method_index);
-    }
-
-    // Not found
-    return -1;
-}
-
 /**
- * Get the function ptr from the given interface at the given index in the ivtable of the objectref in stack.
+ * Get the function ptr from the given interface at the given index in the ivtable of the objectref in stack,
+ * or NULL with the exception set if the method can't be invoked.
   *
   * @param argument_count argument count, including the implicitly passed `objectref`
   */
@@ -854,17 +361,28 @@ void *bc_ivtable_lookup(VM_PARAM_CURRENT_CONTEXT, VMOperandStack *stack, JAVA_IN
     JAVA_OBJECT object = objectRef->data.o;
     if (object == JAVA_NULL) {
         exception_set_NullPointerException_invoke(vmCurrentContext, string_get_constant_utf8(interface_type->methods[method_index]->name));
-        exception_raise(vmCurrentContext);
+        return NULL;
     }
 
-    JavaClassInfo *info = obj_get_class(object)->info;
-    int32_t vtableIndex = bc_ivtable_do_lookup(info, interface_type, method_index);
+    JAVA_CLASS clazz = obj_get_class(object);
+    // Fast path: the itable built by class loader
+    ITableEntry *entry = method_itable_find(clazz, interface_type);
+    if (entry) {
+        void *code = entry->codes[method_index];
+        if (code) {
+            return code;
+        }
+    }
+
+    // Slow path: find the method and throw the proper error
+    JavaClassInfo *info = clazz->info;
+    int32_t vtableIndex = method_ivtable_find(info, interface_type, method_index);
     if (vtableIndex >= 0) {
         MethodInfo *m = method_vtable_get(info, vtableIndex);
         if(!method_is_public(m)) {
             exception_set_newf(vmCurrentContext, g_classInfo_java_lang_IllegalAccessError, "%s.%s%s",
                                info->thisClass, string_get_constant_utf8(m->name), string_get_constant_utf8(m->descriptor));
-            exception_raise(vmCurrentContext);
+            return NULL;
         }
         return info->vtable[vtableIndex].code;
     }
@@ -877,7 +395,7 @@ void *bc_ivtable_lookup(VM_PARAM_CURRENT_CONTEXT, VMOperandStack *stack, JAVA_IN
 
     fprintf(stderr, "bc_ivtable_lookup failed: AbstractMethodError\n");
     exception_set_AbstractMethodError(vmCurrentContext, im);
-    exception_raise(vmCurrentContext);
+    return NULL;
 }
 
 JAVA_OBJECT bc_ldc_class_obj(VM_PARAM_CURRENT_CONTEXT, JavaStackFrame *frame, C_CSTR class_name) {
@@ -892,12 +410,10 @@ JAVA_OBJECT bc_ldc_class_obj(VM_PARAM_CURRENT_CONTEXT, JavaStackFrame *frame, C_
 }
 
 JAVA_OBJECT bc_ldc_string_const(VM_PARAM_CURRENT_CONTEXT, JAVA_INT constant_index) {
-    JAVA_OBJECT result = string_get_constant(vmCurrentContext, constant_index);
-
-    RETURN(result);
+    return string_get_constant(vmCurrentContext, constant_index);
 }
 
-void *bc_resolve_native(VM_PARAM_CURRENT_CONTEXT, MethodInfoNative *method) {
+void *bc_resolve_native_ptr(VM_PARAM_CURRENT_CONTEXT, MethodInfoNative *method) {
     assert((method->method.accessFlags & METHOD_ACC_NATIVE) == METHOD_ACC_NATIVE);
 
     void *nativePtr = method->nativePtr;
@@ -905,9 +421,7 @@ void *bc_resolve_native(VM_PARAM_CURRENT_CONTEXT, MethodInfoNative *method) {
         return nativePtr;
     }
 
-    nativePtr = native_bind_method(vmCurrentContext, method);
-
-    RETURN(nativePtr);
+    return native_bind_method(vmCurrentContext, method);
 }
 
 JAVA_BOOLEAN bc_instance_of(VMOperandStack *stack, JavaClassInfo *info) {
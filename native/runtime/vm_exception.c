@@ -11,7 +11,6 @@
 #include "vm_method.h"
 #include "vm_string.h"
 #include "vm_gc.h"
-#include <setjmp.h>
 #include <stdio.h>
 
 #define MAX_FORMAT_MESSAGE_SIZE 512
@@ -28,22 +27,6 @@ JAVA_BOOLEAN exception_matches(JAVA_OBJECT ex, int32_t current_sp, int32_t start
     return class_assignable(obj_get_class(ex)->info, type);
 }
 
-JAVA_VOID exception_raise(VM_PARAM_CURRENT_CONTEXT) {
-    if (vmCurrentContext->exception == JAVA_NULL) {
-        fprintf(stderr, "exception_raise() called with vmCurrentContext->exception not set");
-        abort();
-    }
-
-    VMStackFrame *frame = stack_frame_top(vmCurrentContext);
-    ExceptionFrame *exFrame = frame->exceptionHandler;
-    if (exFrame == NULL) {
-        fprintf(stderr, "exception_raise() called with no available exceptionHandler");
-        abort();
-    }
-
-    longjmp(exFrame->jmpTarget, EX_VAL);
-}
-
 JAVA_VOID exception_set(VM_PARAM_CURRENT_CONTEXT, JAVA_OBJECT ex) {
     assert(ex);
 
@@ -95,9 +78,6 @@ JAVA_OBJECT exception_new(VM_PARAM_CURRENT_CONTEXT, JavaClassInfo *exClass, C_CS
     }
 
     stack_frame_start(NULL, 3, 1);
-    exception_frame_start();
-        exception_suppressed(JAVA_NULL);
-    exception_block_end();
 
     local_of(0).type = VM_SLOT_OBJECT;
     local_of(0).data.o = messageStr;
@@ -117,6 +97,8 @@ JAVA_OBJECT exception_new(VM_PARAM_CURRENT_CONTEXT, JavaClassInfo *exClass, C_CS
     stack_frame_end();
 
     return ex;
+
+    exception_suppressed(JAVA_NULL);
 }
 
 JAVA_OBJECT exception_newf(VM_PARAM_CURRENT_CONTEXT, JavaClassInfo *exClass, C_CSTR format, ...) {
@@ -190,6 +172,14 @@ JAVA_VOID exception_set_NullPointerException_array(VM_PARAM_CURRENT_CONTEXT, JAV
     }
 }
 
+JAVA_VOID exception_set_ArithmeticException_divideByZero(VM_PARAM_CURRENT_CONTEXT) {
+    exception_set_new(vmCurrentContext, g_classInfo_java_lang_ArithmeticException, "/ by zero");
+}
+
+JAVA_VOID exception_set_ArrayIndexOutOfBoundsException(VM_PARAM_CURRENT_CONTEXT, JAVA_INT index) {
+    exception_set_newf(vmCurrentContext, g_classInfo_java_lang_ArrayIndexOutOfBoundsException, "Array index out of range: %d", index);
+}
+
 JAVA_VOID exception_set_NegativeArraySizeException(VM_PARAM_CURRENT_CONTEXT, JAVA_INT length) {
     exception_set_newf(vmCurrentContext, g_classInfo_java_lang_NegativeArraySizeException, "%d is not a valid array size", length);
 }
@@ -231,3 +221,46 @@ JAVA_VOID exception_set_ClassCastException(VM_PARAM_CURRENT_CONTEXT, JavaClassIn
     heap_free_uncollectable((void *) expectedTypeName);
     heap_free_uncollectable((void *) actualTypeName);
 }
+
+JAVA_VOID exception_wrap_ExceptionInInitializerError(VM_PARAM_CURRENT_CONTEXT) {
+    assert(exception_occurred(vmCurrentContext));
+
+    JAVA_OBJECT cause = vmCurrentContext->exception;
+    if (class_assignable(obj_get_class(cause)->info, g_classInfo_java_lang_Error)) {
+        // Errors are thrown as is
+        return;
+    }
+
+    MethodInfo *constructor = method_find(g_classInfo_java_lang_ExceptionInInitializerError, "<init>", "(Ljava/lang/Throwable;)V");
+    if (constructor == NULL) {
+        // Keep the original exception pending
+        fprintf(stderr, "Unable to find method ExceptionInInitializerError.<init>(Ljava/lang/Throwable;)V\n");
+        return;
+    }
+
+    stack_frame_start(NULL, 3, 1);
+
+    // Keep the cause in a local so it's visible to GC
+    local_of(0).type = VM_SLOT_OBJECT;
+    local_of(0).data.o = exception_clear(vmCurrentContext);
+
+    // Create the error instance
+    bc_new(g_classInfo_java_lang_ExceptionInInitializerError);
+    bc_dup();
+    // Push the cause to stack
+    bc_aload(0);
+    // Call the init method
+    bc_invoke_special(constructor->code);
+    // Put the error instance to local 0
+    bc_astore(0);
+
+    JAVA_OBJECT ex = local_of(0).data.o;
+
+    stack_frame_end();
+
+    exception_set(vmCurrentContext, ex);
+    return;
+
+    // If the error can't be created, then the exception thrown while creating it is pending instead
+    exception_suppressedv();
+}
@@ -10,7 +10,11 @@
 #include "vm_reflection.h"
 #include "vm_primitive.h"
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
+#include <stddef.h>
+#include <ctype.h>
+#include <errno.h>
 
 static void main_call_initializeSystemClass(VM_PARAM_CURRENT_CONTEXT) {
     JAVA_CLASS java_lang_System = classloader_get_class_by_name_init(vmCurrentContext, JAVA_NULL, "java/lang/System");
@@ -25,12 +29,10 @@ static void main_call_initializeSystemClass(VM_PARAM_CURRENT_CONTEXT) {
 static void start_main(VM_PARAM_CURRENT_CONTEXT, int argc, char *argv[], C_STR mainClass) {
     // Since we are calling into java function, we need a java stack frame
     stack_frame_start(NULL, 1, 0);
-    exception_frame_start();
-        exception_suppressedv();
-    exception_block_end();
 
     // Call `java.lang.System#initializeSystemClass`
     main_call_initializeSystemClass(vmCurrentContext);
+    exception_raise_if_occurred();
 
     JAVA_CLASS c;
     {
@@ -48,7 +50,7 @@ static void start_main(VM_PARAM_CURRENT_CONTEXT, int argc, char *argv[], C_STR m
 
         c = classloader_get_class_by_name_init(vmCurrentContext, JAVA_NULL, mainClass2);
     }
-    exception_raise_if_occurred(vmCurrentContext);
+    exception_raise_if_occurred();
     if (!c) {
         fprintf(stderr,
                 "Error: Could not find or load main class %s\n", mainClass);
@@ -66,6 +68,9 @@ static void start_main(VM_PARAM_CURRENT_CONTEXT, int argc, char *argv[], C_STR m
     bc_invoke_static(c->info, mainFunc->code);
 
     stack_frame_end();
+    return;
+
+    exception_suppressedv();
 }
 
 static void try_print_exception(VM_PARAM_CURRENT_CONTEXT, JAVA_OBJECT ex) {
@@ -80,21 +85,222 @@ static void try_print_exception(VM_PARAM_CURRENT_CONTEXT, JAVA_OBJECT ex) {
     bc_invoke_virtual(1, clazz, i);
 
     stack_frame_end();
+    return;
+
+    exception_suppressedv();
+}
+
+// Environment variable that holds the VM options separated by whitespaces
+#define VM_OPTIONS_ENV "FOXVM_OPTS"
+
+typedef struct {
+    const char *prefix;
+    size_t offset; // Offset of the size field in HeapConfig
+} SizeOption;
+
+static const SizeOption g_sizeOptions[] = {
+        {"-Xmx",                     offsetof(HeapConfig, maxSize)},
+        {"-Xms",                     offsetof(HeapConfig, initialSize)},
+        {"-Xmn",                     offsetof(HeapConfig, gen0Size)},
+        {"-XX:LargeObjectThreshold=", offsetof(HeapConfig, largeObjectSize)},
+        {"-XX:MinTLABSize=",         offsetof(HeapConfig, tlabSizeMin)},
+        {"-XX:MaxTLABSize=",         offsetof(HeapConfig, tlabSizeMax)},
+};
+
+typedef struct {
+    const char *prefix;
+    size_t offset; // Offset of the uint32_t field in HeapConfig
+} CountOption;
+
+static const CountOption g_countOptions[] = {
+        {"-XX:ParallelGCThreads=", offsetof(HeapConfig, gcThreadCount)},
+        {"-XX:TrimDelay=",         offsetof(HeapConfig, trimDelay)},
+        {"-XX:TrimHysteresis=",    offsetof(HeapConfig, trimHysteresis)},
+};
+
+static inline JAVA_BOOLEAN option_has_prefix(const char *option, const char *prefix) {
+    return strncmp(option, prefix, strlen(prefix)) == 0 ? JAVA_TRUE : JAVA_FALSE;
+}
+
+/** Parse a number with an optional k/m/g suffix, such as `512m`. */
+static JAVA_BOOLEAN parse_size(const char *str, size_t *out) {
+    if (!isdigit((unsigned char) *str)) {
+        return JAVA_FALSE;
+    }
+
+    char *end;
+    errno = 0;
+    unsigned long long value = strtoull(str, &end, 10);
+    if (errno == ERANGE) {
+        return JAVA_FALSE;
+    }
+    unsigned long long unit = 1;
+    switch (*end) {
+        case 'k':
+        case 'K':
+            unit = 1024;
+            end++;
+            break;
+        case 'm':
+        case 'M':
+            unit = 1024 * 1024;
+            end++;
+            break;
+        case 'g':
+        case 'G':
+            unit = 1024 * 1024 * 1024;
+            end++;
+            break;
+        default:
+            break;
+    }
+    if (*end != '\0' || value > SIZE_MAX / unit) {
+        return JAVA_FALSE;
+    }
+
+    *out = (size_t) (value * unit);
+    return JAVA_TRUE;
+}
+
+/**
+ * Parse a single VM option into the heap config.
+ *
+ * @return JAVA_FALSE if the option is unknown or invalid, an error message is printed as well.
+ */
+static JAVA_BOOLEAN parse_vm_option(HeapConfig *config, const char *option) {
+    for (size_t i = 0; i < sizeof(g_sizeOptions) / sizeof(g_sizeOptions[0]); i++) {
+        const SizeOption *o = &g_sizeOptions[i];
+        if (option_has_prefix(option, o->prefix)) {
+            size_t *field = (size_t *) ((uint8_t *) config + o->offset);
+            if (parse_size(option + strlen(o->prefix), field) != JAVA_TRUE) {
+                fprintf(stderr, "Error: Invalid size in option: %s\n", option);
+                return JAVA_FALSE;
+            }
+            return JAVA_TRUE;
+        }
+    }
+
+    for (size_t i = 0; i < sizeof(g_countOptions) / sizeof(g_countOptions[0]); i++) {
+        const CountOption *o = &g_countOptions[i];
+        if (option_has_prefix(option, o->prefix)) {
+            size_t count;
+            if (parse_size(option + strlen(o->prefix), &count) != JAVA_TRUE || count > UINT32_MAX) {
+                fprintf(stderr, "Error: Invalid number in option: %s\n", option);
+                return JAVA_FALSE;
+            }
+            *(uint32_t *) ((uint8_t *) config + o->offset) = (uint32_t) count;
+            return JAVA_TRUE;
+        }
+    }
+
+    if (strcmp(option, "-XX:+ConcurrentMark") == 0) {
+        config->concurrentMark = JAVA_TRUE;
+        return JAVA_TRUE;
+    }
+    if (strcmp(option, "-XX:-ConcurrentMark") == 0) {
+        config->concurrentMark = JAVA_FALSE;
+        return JAVA_TRUE;
+    }
+    if (strcmp(option, "-XX:+TrimHeap") == 0) {
+        config->keepCommitted = JAVA_FALSE;
+        return JAVA_TRUE;
+    }
+    if (strcmp(option, "-XX:-TrimHeap") == 0) {
+        config->keepCommitted = JAVA_TRUE;
+        return JAVA_TRUE;
+    }
+
+    fprintf(stderr, "Error: Unrecognized option: %s\n", option);
+    return JAVA_FALSE;
+}
+
+/** Parse the VM options in the environment variable. */
+static JAVA_BOOLEAN parse_vm_options_env(HeapConfig *config) {
+    const char *env = getenv(VM_OPTIONS_ENV);
+    if (!env) {
+        return JAVA_TRUE;
+    }
+
+    char *options = malloc(strlen(env) + 1);
+    if (!options) {
+        return JAVA_FALSE;
+    }
+    strcpy(options, env);
+
+    JAVA_BOOLEAN result = JAVA_TRUE;
+    char *p = options;
+    while (result == JAVA_TRUE) {
+        while (isspace((unsigned char) *p)) {
+            p++;
+        }
+        if (*p == '\0') {
+            break;
+        }
+
+        char *option = p;
+        while (*p != '\0' && !isspace((unsigned char) *p)) {
+            p++;
+        }
+        if (*p != '\0') {
+            *(p++) = '\0';
+        }
+
+        result = parse_vm_option(config, option);
+    }
+
+    free(options);
+    return result;
+}
+
+/**
+ * Parse VM options from the environment variable first, then the leading `-X` arguments of the command line,
+ * so the command line takes precedence.
+ *
+ * @return the number of arguments that are consumed, or -1 if any option is invalid.
+ */
+static int parse_vm_options(HeapConfig *config, int argc, char *argv[]) {
+    if (parse_vm_options_env(config) != JAVA_TRUE) {
+        return -1;
+    }
+
+    int i = 0;
+    for (; i < argc && option_has_prefix(argv[i], "-X"); i++) {
+        if (parse_vm_option(config, argv[i]) != JAVA_TRUE) {
+            return -1;
+        }
+    }
+
+    if (config->tlabSizeMax != 0 && config->tlabSizeMin > config->tlabSizeMax) {
+        fprintf(stderr, "Error: MinTLABSize can't be larger than MaxTLABSize\n");
+        return -1;
+    }
+    if (config->maxSize != 0 && config->initialSize > config->maxSize) {
+        fprintf(stderr, "Error: Initial heap size can't be larger than the maximum heap size\n");
+        return -1;
+    }
+
+    return i;
 }
 
 int vm_main(int argc, char *argv[], C_STR mainClass) {
+    // Parse VM options, the rest of the arguments are passed to the main class
+    HeapConfig heapConfig = {0};
+    int option_count = parse_vm_options(&heapConfig, argc - 1, argv + 1);
+    if (option_count < 0) {
+        return -1;
+    }
+    int arg_start = 1 + option_count;
+
     // Init low level memory system first
     if (!mem_init()) {
         return -1;
     }
 
     // Init heap first because we need it for allocating thread context
-    HeapConfig heapConfig = {
-//            .maxSize=0,
-//            .newRatio=2,
-//            .survivorRatio=8
-    };
-    heap_init(&heapConfig);
+    if (heap_init(&heapConfig)) {
+        fprintf(stderr, "Error: Could not reserve enough space for the heap\n");
+        return -1;
+    }
 
     // Then we init native thread system
     thread_init();
@@ -133,7 +339,7 @@ int vm_main(int argc, char *argv[], C_STR mainClass) {
     reflection_init(vmCurrentContext);
     primitive_init(vmCurrentContext);
 
-    start_main(vmCurrentContext, argc, argv, mainClass);
+    start_main(vmCurrentContext, argc - arg_start, argv + arg_start, mainClass);
     if (exception_occurred(vmCurrentContext)) {
         fprintf(stderr, "Unhandled exception");
         try_print_exception(vmCurrentContext, exception_clear(vmCurrentContext));
@@ -67,6 +67,34 @@ MethodInfo *method_vtable_get(JavaClassInfo *clazz, JAVA_INT vtable_index) {
     return m;
 }
 
+int32_t method_ivtable_find(JavaClassInfo *clazz, JavaClassInfo *interface_type, uint16_t method_index) {
+    for (uint16_t i = 0; i < clazz->ivtableCount; i++) {
+        IVTableItem *ivti = &clazz->ivtable[i];
+
+        if (ivti->declaringInterface != interface_type) {
+            continue;
+        }
+
+        // Look at the method index
+        for (uint16_t j = 0; j < ivti->indexCount; j++) {
+            IVTableMethodIndex *mi = &ivti->methodIndexes[j];
+            if (mi->methodIndex == method_index) {
+                return mi->vtableIndex;
+            }
+        }
+
+        break;
+    }
+
+    // Try superclass
+    if (clazz->superClass) {
+        return method_ivtable_find(clazz->superClass, interface_type, method_index);
+    }
+
+    // Not found
+    return -1;
+}
+
 C_CSTR method_get_return_type(C_CSTR desc) {
     // Find the end of the parameter desc
     while (*desc != ')') {
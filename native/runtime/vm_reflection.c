@@ -107,6 +107,8 @@ JAVA_OBJECT reflection_method_new_constructor(VM_PARAM_CURRENT_CONTEXT, JAVA_CLA
         *((JAVA_OBJECT*)ptr_inc(constructor, g_field_java_lang_reflect_Constructor_exceptionTypes->info.offset)) = native_dereference(vmCurrentContext, h_exTypes);
         *((JAVA_INT*)ptr_inc(constructor, g_field_java_lang_reflect_Constructor_modifiers->info.offset)) = clazz->accessFlags;
         *((JAVA_OBJECT*)ptr_inc(constructor, g_field_java_lang_reflect_Constructor_signature->info.offset)) = native_dereference(vmCurrentContext, h_sig);
+        // The constructor could be allocated in older generation
+        heap_write_barrier_range(constructor, g_class_java_lang_reflect_Constructor->info->instanceSize);
 
         native_handler_of(result, constructor);
     } native_scope_end();
@@ -5,6 +5,7 @@
 #include "vm_stack.h"
 #include "vm_thread.h"
 #include <assert.h>
+#include <stdio.h>
 
 inline VMStackFrame *stack_frame_top(VM_PARAM_CURRENT_CONTEXT) {
     return vmCurrentContext->frameRoot.baseFrame.prev;
@@ -18,6 +19,9 @@ void stack_frame_init_java(JavaStackFrame *frame, VMStackSlot *slot_base, uint16
     base->type = VM_STACK_FRAME_JAVA;
 
     frame->currentLine = 0;
+    frame->currentLabel = -1;
+    frame->lockedObject.type = VM_SLOT_INVALID;
+    frame->lockedObject.data.o = JAVA_NULL;
 
     /**
      * Locals are stored at the beginning of the slot_base,
@@ -40,6 +44,59 @@ void stack_frame_init_java(JavaStackFrame *frame, VMStackSlot *slot_base, uint16
     }
 }
 
+JAVA_VOID stack_frame_monitor_enter(VM_PARAM_CURRENT_CONTEXT, JavaStackFrame *frame, JAVA_OBJECT obj) {
+    assert(obj != JAVA_NULL);
+    assert(frame->lockedObject.data.o == JAVA_NULL);
+
+    // The slot is scanned by GC, so the object is kept updated while waiting for the monitor
+    frame->lockedObject.type = VM_SLOT_OBJECT;
+    frame->lockedObject.data.o = obj;
+
+    int ret = monitor_enter(vmCurrentContext, &frame->lockedObject);
+    if (ret != thrd_success) {
+        fprintf(stderr, "Failed to enter monitor: %d\n", ret);
+        assert(!"Failed to enter monitor");
+    }
+}
+
+JAVA_VOID stack_frame_monitor_exit(VM_PARAM_CURRENT_CONTEXT, JavaStackFrame *frame) {
+    assert(frame->lockedObject.data.o != JAVA_NULL);
+
+    int ret = monitor_exit(vmCurrentContext, &frame->lockedObject);
+    if (ret != thrd_success) {
+        fprintf(stderr, "Failed to exit monitor: %d\n", ret);
+        assert(!"Failed to exit monitor");
+    }
+
+    frame->lockedObject.type = VM_SLOT_INVALID;
+    frame->lockedObject.data.o = JAVA_NULL;
+}
+
+StackMapEntry *stack_frame_stack_map(JavaStackFrame *frame) {
+    MethodInfo *method = frame->currentMethod;
+    if (method == NULL || method->stackMaps == NULL) {
+        return NULL;
+    }
+
+    // Binary search the map of current label
+    int32_t label = frame->currentLabel;
+    int low = 0;
+    int high = (int) method->stackMapCount - 1;
+    while (low <= high) {
+        int mid = (low + high) >> 1;
+        StackMapEntry *entry = &method->stackMaps[mid];
+        if (entry->label < label) {
+            low = mid + 1;
+        } else if (entry->label > label) {
+            high = mid - 1;
+        } else {
+            return entry;
+        }
+    }
+
+    return NULL;
+}
+
 void stack_frame_push(VM_PARAM_CURRENT_CONTEXT, VMStackFrame *frame) {
     assert(frame->next == NULL);
     assert(frame->prev == NULL);
@@ -51,9 +108,6 @@ void stack_frame_push(VM_PARAM_CURRENT_CONTEXT, VMStackFrame *frame) {
 
     frame->prev->next = frame;
     frame->next->prev = frame;
-
-    // Inherit the exception handler from caller
-    frame->exceptionHandler = curr->exceptionHandler;
 }
 
 void stack_frame_pop(VM_PARAM_CURRENT_CONTEXT) {
@@ -64,8 +118,3 @@ void stack_frame_pop(VM_PARAM_CURRENT_CONTEXT) {
     curr->prev = NULL;
     curr->next = NULL;
 }
-
-void stack_frame_pop_deeper(VM_PARAM_CURRENT_CONTEXT, VMStackFrame *frame) {
-    frame->next = &vmCurrentContext->frameRoot.baseFrame;
-    vmCurrentContext->frameRoot.baseFrame.prev = frame;
-}
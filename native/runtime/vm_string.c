@@ -121,9 +121,6 @@ static JAVA_VOID string_utf8_to_unicode(C_CSTR utf8_str, JAVA_ARRAY char_array)
 
 JAVA_OBJECT string_create_utf8(VM_PARAM_CURRENT_CONTEXT, C_CSTR utf8) {
     stack_frame_start(NULL, 4, 2);
-    exception_frame_start();
-        exception_suppressed(JAVA_NULL);
-    exception_block_end();
 
     JAVA_INT requiredCharCount = string_unicode_length_of(utf8);
     // Allocate a char[] that can contains the unicode string
@@ -151,6 +148,8 @@ JAVA_OBJECT string_create_utf8(VM_PARAM_CURRENT_CONTEXT, C_CSTR utf8) {
     stack_frame_end();
 
     return objRef;
+
+    exception_suppressed(JAVA_NULL);
 }
 
 C_CSTR string_get_constant_utf8(JAVA_INT constant_index) {
@@ -164,6 +163,14 @@ C_CSTR string_get_constant_utf8(JAVA_INT constant_index) {
     return foxvm_constant_pool_rt[constant_index];
 }
 
+void string_scan_constants(scan_func fn, void *scan_context) {
+    for (JAVA_INT i = 0; i < foxvm_constant_pool_rt_count; i++) {
+        if (foxvm_constant_pool_rt_obj[i] != JAVA_NULL) {
+            fn(&foxvm_constant_pool_rt_obj[i], scan_context);
+        }
+    }
+}
+
 JAVA_OBJECT string_get_constant(VM_PARAM_CURRENT_CONTEXT, JAVA_INT constant_index) {
     assert(constant_index >= STRING_CONSTANT_NULL);
     assert(constant_index < foxvm_constant_pool_rt_count);